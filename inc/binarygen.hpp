@@ -50,7 +50,6 @@ public:
 protected:
     typedef std::vector<std::vector<double>> Data;
     std::vector<genfile::bgen::Context> m_context_map;
-    std::vector<genfile::byte_t> m_buffer1, m_buffer2;
     bool m_target_plink = false;
     bool m_ref_plink = false;
     bool m_has_external_sample = false;
@@ -60,6 +59,14 @@ protected:
      * \return Vector containing the sample information
      */
     std::vector<Sample_ID> gen_sample_vector() override;
+    std::vector<std::string> genotype_files() const override
+    {
+        std::vector<std::string> files;
+        for (auto&& prefix : m_genotype_file_names)
+        { files.push_back(prefix + ".bgen"); }
+        if (!m_sample_file.empty()) files.push_back(m_sample_file);
+        return files;
+    }
     void handle_pheno_header(std::unique_ptr<std::istream>& sample);
     void
     gen_snp_vector(const std::vector<IITree<size_t, size_t>>& exclusion_regions,
@@ -69,6 +76,19 @@ protected:
                              const std::string& prefix,
                              Genotype* genotype = nullptr) override;
 
+    /*!
+     * \brief Buffers used for decompressing the genotype blocks. Genotypes
+     *        can be read by multiple threads (e.g. during clumping), so each
+     *        thread has its own pair of buffers instead of sharing a member
+     * \return the buffers of the calling thread
+     */
+    static std::pair<std::vector<genfile::byte_t>*,
+                     std::vector<genfile::byte_t>*>
+    decompress_buffer()
+    {
+        static thread_local std::vector<genfile::byte_t> buffer1, buffer2;
+        return {&buffer1, &buffer2};
+    }
     genfile::bgen::Context get_context(const size_t& idx);
     size_t get_sex_col(const std::string& header,
                        const std::string& format_line);
@@ -118,14 +138,14 @@ protected:
                                 uintptr_t* __restrict subset_mask)
     {
         assert(m_unfiltered_sample_ct);
+        auto [buffer1, buffer2] = decompress_buffer();
         try
         {
             PLINK_generator setter(subset_mask, mainbuf, m_hard_threshold,
                                    m_dose_threshold);
             genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
                 genotype_file, m_genotype_file_names[file_idx] + ".bgen",
-                m_context_map[file_idx], setter, &m_buffer1, &m_buffer2,
-                byte_pos);
+                m_context_map[file_idx], setter, buffer1, buffer2, byte_pos);
         }
         catch (...)
         {
@@ -134,16 +154,37 @@ protected:
         return true;
     }
 
+    void read_dosage(const SNP& snp, FileRead& genotype_file,
+                     uintptr_t* storage, bool is_ref) override
+    {
+        auto [file_idx, byte_pos] = snp.get_file_info(is_ref);
+        auto [buffer1, buffer2] = decompress_buffer();
+        Dosage_generator setter(m_sample_for_ld.data(),
+                                reinterpret_cast<float*>(storage + 1));
+        try
+        {
+            genfile::bgen::read_and_parse_genotype_data_block<
+                Dosage_generator>(
+                genotype_file, m_genotype_file_names[file_idx] + ".bgen",
+                m_context_map[file_idx], setter, buffer1, buffer2, byte_pos);
+        }
+        catch (...)
+        {
+            throw std::runtime_error("Error: Cannot read the bgen file!");
+        }
+        const double sum_sq = setter.sum_sq();
+        std::memcpy(storage, &sum_sq, sizeof(double));
+    }
     void count_and_read_genotype(SNP&) override;
-    void read_score(std::vector<PRS>& prs_list,
+    void read_score(PRS& prs_list,
                     const std::vector<size_t>::const_iterator& start_idx,
                     const std::vector<size_t>::const_iterator& end_idx,
                     bool reset_zero) override;
-    void hard_code_score(std::vector<PRS>& prs_list,
+    void hard_code_score(PRS& prs_list,
                          const std::vector<size_t>::const_iterator& start_idx,
                          const std::vector<size_t>::const_iterator& end_idx,
                          bool reset_zero);
-    void dosage_score(std::vector<PRS>& prs_list,
+    void dosage_score(PRS& prs_list,
                       const std::vector<size_t>::const_iterator& start_idx,
                       const std::vector<size_t>::const_iterator& end_idx,
                       bool reset_zero);
@@ -13,7 +13,7 @@ class PRS_Interpreter
 {
 public:
     virtual ~PRS_Interpreter() {}
-    PRS_Interpreter(std::vector<PRS>* sample_prs,
+    PRS_Interpreter(PRS* sample_prs,
                     std::vector<uintptr_t>* sample_inclusion,
                     MISSING_SCORE missing)
         : m_sample_prs(sample_prs), m_sample_inclusion(sample_inclusion)
@@ -123,7 +123,7 @@ public:
     virtual void process_centre_missing() {}
 
 protected:
-    std::vector<PRS>* m_sample_prs;
+    PRS* m_sample_prs;
     std::vector<uintptr_t>* m_sample_inclusion;
     std::vector<size_t> m_missing;
     std::vector<double> m_probs;
@@ -148,7 +148,7 @@ protected:
 class First_PRS : public PRS_Interpreter
 {
 public:
-    First_PRS(std::vector<PRS>* sample_prs,
+    First_PRS(PRS* sample_prs,
               std::vector<uintptr_t>* sample_inclusion, MISSING_SCORE missing)
         : PRS_Interpreter(sample_prs, sample_inclusion, missing)
     {
@@ -161,8 +161,8 @@ public:
         // assign the PRS
         else
         {
-            (*m_sample_prs)[idx].num_snp = m_ploidy;
-            (*m_sample_prs)[idx].prs = m_sum * m_stat;
+            m_sample_prs->assign(idx, m_sum * m_stat,
+                                 static_cast<uint32_t>(m_ploidy));
             dose_statistic.push(m_sum);
         }
     }
@@ -173,8 +173,8 @@ public:
         {
             if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
             {
-                (*m_sample_prs)[i].prs = m_miss_score;
-                (*m_sample_prs)[i].num_snp = m_miss_count;
+                m_sample_prs->assign(i, m_miss_score,
+                                     static_cast<uint32_t>(m_miss_count));
                 ++cur_idx;
             }
             else if (m_centre)
@@ -182,7 +182,7 @@ public:
                 // if it is not missing and we want the centre the
                 // score we will need to minus the adjusted score
                 // which was 0 before this run
-                (*m_sample_prs)[i].prs -= m_adj_score;
+                m_sample_prs->add(i, -m_adj_score, 0);
             }
         }
     }
@@ -192,15 +192,15 @@ public:
         // information
         for (auto&& idx : m_missing)
         {
-            (*m_sample_prs)[idx].prs = m_miss_score;
-            (*m_sample_prs)[idx].num_snp = m_miss_count;
+            m_sample_prs->assign(idx, m_miss_score,
+                                 static_cast<uint32_t>(m_miss_count));
         }
     }
 };
 class Add_PRS : public PRS_Interpreter
 {
 public:
-    Add_PRS(std::vector<PRS>* sample_prs,
+    Add_PRS(PRS* sample_prs,
             std::vector<uintptr_t>* sample_inclusion, MISSING_SCORE missing)
         : PRS_Interpreter(sample_prs, sample_inclusion, missing)
     {
@@ -214,8 +214,8 @@ public:
         else
         {
 
-            (*m_sample_prs)[idx].num_snp += m_ploidy;
-            (*m_sample_prs)[idx].prs += m_sum * m_stat;
+            m_sample_prs->add(idx, m_sum * m_stat,
+                              static_cast<uint32_t>(m_ploidy));
             dose_statistic.push(m_sum);
         }
     }
@@ -226,8 +226,8 @@ public:
         {
             if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
             {
-                (*m_sample_prs)[i].prs += m_miss_score;
-                (*m_sample_prs)[i].num_snp += m_miss_count;
+                m_sample_prs->add(i, m_miss_score,
+                                  static_cast<uint32_t>(m_miss_count));
                 ++cur_idx;
             }
             else if (m_centre)
@@ -235,7 +235,7 @@ public:
                 // if it is not missing and we want the centre the
                 // score we will need to minus the adjusted score
                 // which was 0 before this run
-                (*m_sample_prs)[i].prs -= m_adj_score;
+                m_sample_prs->add(i, -m_adj_score, 0);
             }
         }
     }
@@ -245,8 +245,8 @@ public:
         // information
         for (auto&& idx : m_missing)
         {
-            (*m_sample_prs)[idx].prs += m_miss_score;
-            (*m_sample_prs)[idx].num_snp += m_miss_count;
+            m_sample_prs->add(idx, m_miss_score,
+                              static_cast<uint32_t>(m_miss_count));
         }
     }
 };
@@ -460,4 +460,90 @@ private:
     bool m_phased = false;
     bool m_missing = false;
 };
+/*!
+ * \brief Setter that decodes the expected dosage of the included samples into
+ * a mean centred float vector, used for dosage based LD calculation. Missing
+ * dosages are mean imputed, i.e. set to 0 after centring
+ */
+struct Dosage_generator
+{
+    Dosage_generator(const uintptr_t* sample, float* dosage)
+        : m_sample(sample), m_dosage(dosage)
+    {
+        m_prob.resize(4, 0.0);
+    }
+    void initialise(std::size_t, std::size_t)
+    {
+        m_index = 0;
+        m_total = 0.0;
+        m_missing_index.clear();
+    }
+    void set_min_max_ploidy(uint32_t, uint32_t, uint32_t, uint32_t) {}
+    bool set_sample(std::size_t i)
+    {
+        m_missing = false;
+        return IS_SET(m_sample, i);
+    }
+    void set_number_of_entries(std::size_t, std::size_t,
+                               genfile::OrderType phased, genfile::ValueType)
+    {
+        m_phased = (phased == genfile::OrderType::ePerPhasedHaplotypePerAllele);
+    }
+    void set_value(uint32_t idx, double value) { m_prob[idx] = value; }
+    void set_value(uint32_t, genfile::MissingValue) { m_missing = true; }
+    void sample_completed()
+    {
+        double het = m_prob[1], homrar = m_prob[2];
+        if (m_phased)
+        {
+            het = m_prob[0] * m_prob[3] + m_prob[1] * m_prob[2];
+            homrar = m_prob[1] * m_prob[3];
+        }
+        if (!m_missing)
+        {
+            const double total = m_prob[0] + m_prob[1] + m_prob[2]
+                                 + (m_phased ? m_prob[3] : 0.0);
+            m_missing = misc::logically_equal(total, 0.0);
+        }
+        if (m_missing)
+        {
+            m_missing_index.push_back(m_index);
+            m_dosage[m_index] = 0;
+        }
+        else
+        {
+            const double dosage = het + 2.0 * homrar;
+            m_dosage[m_index] = static_cast<float>(dosage);
+            m_total += dosage;
+        }
+        ++m_index;
+    }
+    void finalise()
+    {
+        const size_t observed = m_index - m_missing_index.size();
+        const float mean =
+            (observed == 0) ? 0.0f : static_cast<float>(m_total / observed);
+        for (uint32_t i = 0; i < m_index; ++i) { m_dosage[i] -= mean; }
+        // missing samples take the mean dosage
+        for (auto&& idx : m_missing_index) { m_dosage[idx] = 0; }
+        m_sum_sq = 0.0;
+        for (uint32_t i = 0; i < m_index; ++i)
+        { m_sum_sq += static_cast<double>(m_dosage[i]) * m_dosage[i]; }
+    }
+    /*!
+     * \brief Return the sum of squares of the centred dosages
+     */
+    double sum_sq() const { return m_sum_sq; }
+
+private:
+    std::vector<double> m_prob;
+    std::vector<uint32_t> m_missing_index;
+    const uintptr_t* m_sample;
+    float* m_dosage;
+    double m_total = 0.0;
+    double m_sum_sq = 0.0;
+    uint32_t m_index = 0;
+    bool m_phased = false;
+    bool m_missing = false;
+};
 #endif // BINARYGEN_SETTERS_HPP
@@ -49,6 +49,17 @@ protected:
     std::vector<uintptr_t> m_sample_mask;
     std::streampos m_prev_loc = 0;
     std::vector<Sample_ID> gen_sample_vector() override;
+    std::vector<std::string> genotype_files() const override
+    {
+        std::vector<std::string> files;
+        for (auto&& prefix : m_genotype_file_names)
+        {
+            files.push_back(prefix + ".bed");
+            files.push_back(prefix + ".bim");
+        }
+        files.push_back(m_sample_file);
+        return files;
+    }
     void
     gen_snp_vector(const std::vector<IITree<size_t, size_t>>& exclusion_regions,
                    const std::string& out_prefix,
@@ -152,7 +163,7 @@ protected:
         }
     }
     virtual void
-    read_score(std::vector<PRS>& prs_list,
+    read_score(PRS& prs_list,
                const std::vector<size_t>::const_iterator& start_idx,
                const std::vector<size_t>::const_iterator& end_idx,
                bool reset_zero) override;
@@ -80,6 +80,7 @@ public:
     std::string delim() const { return m_id_delim; }
     std::string out() const { return m_out_prefix; }
     std::string exclusion_range() const { return m_exclusion_range; }
+    std::string weight_matrix() const { return m_weight_matrix; }
     bool all_scores() const { return m_print_all_scores; }
     bool print_snp() const { return m_print_snp; }
     unsigned long long max_memory(const unsigned long long detected) const
@@ -97,11 +98,15 @@ public:
 
 protected:
     const std::vector<std::string> supported_types = {"bed", "ped", "bgen"};
+    // LD panels can only be used as LD reference
+    const std::vector<std::string> supported_ld_types = {"bed", "ped", "bgen",
+                                                         "ldp"};
     std::string m_id_delim = " ";
     std::string m_out_prefix = "PRSice";
     std::string m_exclusion_range = "";
     std::string m_exclude_file = "";
     std::string m_extract_file = "";
+    std::string m_weight_matrix = "";
     std::string m_help_message;
     std::string m_chr_id_formula;
     size_t m_memory = 1e10;
@@ -418,6 +423,14 @@ protected:
         std::string in = input;
         misc::to_lower(in);
         m_parameter_log[c] = in;
+        return convert_unit_value(in, default_power, target, memory);
+    }
+    inline bool convert_unit_value(const std::string& input,
+                                   const size_t default_power, size_t& target,
+                                   bool memory = false)
+    {
+        std::string in = input;
+        misc::to_lower(in);
         const size_t weight = memory ? 1024 : 1000;
         double value;
         std::string unit;
@@ -538,7 +551,60 @@ protected:
 
     inline bool set_memory(const std::string& input)
     {
-        return parse_unit_value(input, "memory", 2, m_memory, true);
+        m_provided_memory =
+            parse_unit_value(input, "memory", 2, m_memory, true);
+        return m_provided_memory;
+    }
+    /*!
+     * \brief Parse the settings of the clumping sweep, in the form of
+     * r2:distance separated by comma. Distance is in kb unless a unit is
+     * provided
+     */
+    inline bool parse_clump_sweep(const std::string& input,
+                                  const std::string& c)
+    {
+        check_duplicate(c);
+        m_parameter_log[c] = input;
+        bool valid = true;
+        for (auto&& token : misc::split(input, ","))
+        {
+            std::vector<std::string> detail = misc::split(token, ":");
+            ClumpSetting setting;
+            if (detail.size() != 2)
+            {
+                m_error_message.append("Error: Invalid clumping setting: "
+                                       + token
+                                       + ". Should be in the form of "
+                                         "r2:distance\n");
+                valid = false;
+                continue;
+            }
+            try
+            {
+                setting.r2 = misc::convert<double>(detail[0]);
+            }
+            catch (const std::runtime_error&)
+            {
+                m_error_message.append("Error: Non numeric r2 in clumping "
+                                       "setting: "
+                                       + token + "\n");
+                valid = false;
+                continue;
+            }
+            if (!convert_unit_value(detail[1], 1, setting.distance))
+            {
+                valid = false;
+                continue;
+            }
+            // keep the unit so that the setting is reported as provided
+            std::string distance = detail[1], unit;
+            misc::to_lower(distance);
+            double value;
+            extract_unit(distance, value, unit);
+            setting.unit_power = unit.empty() ? 1 : unit_power(unit);
+            m_clump_info.sweep.push_back(setting);
+        }
+        return valid;
     }
     inline bool set_info(const std::string& in)
     {
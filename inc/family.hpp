@@ -38,6 +38,23 @@ public:
     virtual double var_res() { return 1; }
     virtual bool valideta(const Eigen::VectorXd& /*eta*/) const { return true; }
     virtual bool validmu(const Eigen::VectorXd& /*mu*/) const { return true; }
+    // versions writing into an existing vector, used by the IRLS iterations
+    // so that no memory is allocated once the vectors are sized
+    virtual void variance_into(const Eigen::VectorXd& mu,
+                               Eigen::VectorXd& out) const
+    {
+        out = variance(mu);
+    }
+    virtual void mu_eta_into(const Eigen::VectorXd& eta,
+                             Eigen::VectorXd& out) const
+    {
+        out = mu_eta(eta);
+    }
+    virtual void linkinv_into(const Eigen::VectorXd& eta,
+                              Eigen::VectorXd& out) const
+    {
+        out = linkinv(eta);
+    }
 
 protected:
     double y_log_y(const double y, const double mu) const
@@ -55,10 +72,20 @@ public:
     {
         return mu.array() * (1 - mu.array());
     }
+    void variance_into(const Eigen::VectorXd& mu, Eigen::VectorXd& out) const
+    {
+        out = mu.array() * (1 - mu.array());
+    }
     Eigen::VectorXd mu_eta(const Eigen::VectorXd& eta) const
     {
-        Eigen::VectorXd ans = eta;
+        Eigen::VectorXd ans(eta.rows());
+        mu_eta_into(eta, ans);
+        return ans;
+    }
+    void mu_eta_into(const Eigen::VectorXd& eta, Eigen::VectorXd& ans) const
+    {
         long n = eta.rows();
+        ans.resize(n);
         double etai, opexp;
         const double limit = std::numeric_limits<double>::epsilon();
         for (long i = 0; i < n; ++i)
@@ -68,12 +95,17 @@ public:
             ans(i) =
                 (etai > 30 || etai < -30) ? limit : exp(etai) / (opexp * opexp);
         }
-        return ans;
     }
     Eigen::VectorXd linkinv(const Eigen::VectorXd& eta) const
     {
-        Eigen::VectorXd ans = eta;
+        Eigen::VectorXd ans(eta.rows());
+        linkinv_into(eta, ans);
+        return ans;
+    }
+    void linkinv_into(const Eigen::VectorXd& eta, Eigen::VectorXd& ans) const
+    {
         long n = eta.rows();
+        ans.resize(n);
         double etai, temp;
         for (long i = 0; i < n; ++i)
         {
@@ -85,7 +117,6 @@ public:
                                    : exp(etai));
             ans(i) = temp / (1.0 + temp);
         }
-        return ans;
     }
     Eigen::VectorXd initialize(const Eigen::VectorXd& y,
                                const Eigen::VectorXd weights) const
@@ -21,14 +21,17 @@
 #include "IITree.h"
 #include "commander.hpp"
 #include "genotype_pool.hpp"
+#include "ld_cache.hpp"
 #include "misc.hpp"
 #include "plink_common.hpp"
 #include "reporter.hpp"
 #include "snp.hpp"
 #include "storage.hpp"
+#include "thread_pool.hpp"
 #include "thread_queue.hpp"
 #include <Eigen/Dense>
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cctype>
 #include <cstdio>
@@ -39,6 +42,7 @@
 #include <memory>
 #include <memoryread.hpp>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <set>
 #include <string>
@@ -53,6 +57,12 @@
 
 #define MULTIPLEX_LD 1920
 #define MULTIPLEX_2LD (MULTIPLEX_LD * 2)
+// size of the genotype tiles used by matrix_score
+#define MATRIX_SCORE_SNP_BLOCK 256
+#define MATRIX_SCORE_SAMPLE_BLOCK (BITCT2 * 64)
+// a SNP is scored with the sparse path when fewer than 1 / SPARSE_SCORE_RATIO
+// of the samples carry a non-homozygous common or missing genotype
+#define SPARSE_SCORE_RATIO 16
 class Genotype
 {
 public:
@@ -127,6 +137,15 @@ public:
      * \return the number of sample
      */
     size_t num_sample() const { return m_sample_id.size(); }
+    /*!
+     * \brief Return an empty PRS storage for all samples, using the same
+     * accumulator as the one used by this genotype object
+     * \return the PRS storage
+     */
+    PRS new_prs_storage() const
+    {
+        return PRS(num_sample(), m_prs_calculation.kahan_sum);
+    }
 
     /*!
      * \brief Function to prepare clumping. Should sort all the SNPs by their
@@ -291,7 +310,8 @@ public:
             BITCT_TO_WORDCT(m_unfiltered_sample_ct);
         const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
         m_tmp_genotype.resize(unfiltered_sample_ctv2, 0);
-        m_prs_info.resize(m_sample_ct, PRS());
+        m_prs_info.set_compensated(m_prs_calculation.kahan_sum);
+        m_prs_info.resize(m_sample_ct);
         m_sample_include2.resize(unfiltered_sample_ctv2, 0);
         m_founder_include2.resize(unfiltered_sample_ctv2, 0);
         // fill it with the required mask (copy from PLINK2)
@@ -305,6 +325,66 @@ public:
     }
     void clumping(const Clumping& clump_info, Genotype& reference,
                   size_t threads);
+    /*!
+     * \brief Restrict clumping to the LD blocks. Clumping windows built
+     * afterwards never extend beyond the block (or the gap between two
+     * blocks) containing the SNP, so that each block can be clumped
+     * independently
+     * \param ld_blocks contains the boundaries of the LD blocks of each
+     * chromosome
+     */
+    void set_ld_blocks(std::vector<IITree<size_t, size_t>>&& ld_blocks)
+    {
+        m_ld_blocks = std::move(ld_blocks);
+    }
+    /*!
+     * \brief Open the LD cache specified in clump_info, building it from the
+     * reference if it doesn't exist yet. Must be called after
+     * build_clump_windows
+     * \param clump_info contains the cache name and the r2 floor
+     * \param reference is the LD reference
+     */
+    void prepare_ld_cache(const Clumping& clump_info, Genotype& reference);
+    /*!
+     * \brief Fingerprint of this genotype when used as the LD reference, see
+     * LDCache::Fingerprint
+     * \param clump_info contains the LD calculation settings
+     */
+    LDCache::Fingerprint ld_fingerprint(const Clumping& clump_info) const;
+    /*!
+     * \brief Write the founder genotypes of all SNPs in m_existed_snps to an
+     * LD panel (see LDPanel). Only used on a reference that was loaded with
+     * read_all_snps, so the panel is independent of the base and target
+     * \param file is the name of the panel
+     */
+    void write_ld_panel(const std::string& file);
+    /*!
+     * \brief Calculate the r2 of all pairs of SNPs within the clumping
+     * window and store those with r2 >= clump_info.ld_cache_r2 into the LD
+     * cache file
+     * \param clump_info contains the cache name, the clumping distance used
+     * for the windows and the memory budget
+     * \param reference is the LD reference
+     */
+    void build_ld_cache(const Clumping& clump_info, Genotype& reference);
+    /*!
+     * \brief Prepare for the clumping sweep. The r2 of all pairs of SNPs
+     * within the widest window of the sweep and with r2 above the loosest
+     * threshold are calculated once and kept in memory, together with a copy
+     * of m_existed_snps so that each setting can start from the same state
+     * \param clump_info contains the settings of the sweep
+     * \param reference is the LD reference
+     */
+    void prepare_clump_sweep(const Clumping& clump_info, Genotype& reference);
+    /*!
+     * \brief Perform clumping with one setting of the sweep using the r2
+     * calculated by prepare_clump_sweep. The result is identical to
+     * clumping with that r2 threshold and distance
+     * \param clump_info contains the p-value and proxy threshold
+     * \param setting is the r2 threshold and distance to use
+     */
+    void sweep_clumping(const Clumping& clump_info,
+                        const ClumpSetting& setting);
     std::vector<std::pair<size_t, size_t>> get_chrom_boundary();
     template <typename T>
     void
@@ -312,6 +392,175 @@ public:
                       const Clumping& clump_info, T& progress_observer,
                       std::vector<std::atomic<bool>>& remained_snps,
                       std::atomic<size_t>& num_core, Genotype& reference);
+    /*!
+     * \brief Per-thread buffers required for clumping an index SNP
+     */
+    struct ClumpWorkspace
+    {
+        ClumpWorkspace(const Clumping& clump_info, uintptr_t founder_ct,
+                       uintptr_t* tmp)
+            : founder_ctl2(QUATERCT_TO_WORDCT(founder_ct))
+            , founder_ctv2(QUATERCT_TO_ALIGNED_WORDCT(founder_ct))
+            , tmp_genotype(tmp)
+            , min_r2(clump_info.use_proxy
+                         ? std::min(clump_info.proxy, clump_info.r2)
+                         : clump_info.r2)
+        {
+            const uint32_t founder_ctv3 =
+                BITCT_TO_ALIGNED_WORDCT(static_cast<uint32_t>(founder_ct));
+            const uint32_t founder_ctsplit = 3 * founder_ctv3;
+            index_data.resize(3 * founder_ctsplit + founder_ctv3);
+            index_tots.resize(6);
+            if (clump_info.ld_dosage)
+            { index_dosage.resize(dosage_storage_size(founder_ct)); }
+            founder_include2.resize(founder_ctv2, 0);
+            fill_quatervec_55(static_cast<uint32_t>(founder_ct),
+                              founder_include2.data());
+        }
+        std::vector<uintptr_t> index_data;
+        std::vector<uintptr_t> index_tots;
+        // dosage of the index SNP, only used for dosage based LD
+        std::vector<uintptr_t> index_dosage;
+        std::vector<uintptr_t> founder_include2;
+        FileRead genotype_file;
+        uintptr_t founder_ctl2;
+        uintptr_t founder_ctv2;
+        uintptr_t* tmp_genotype;
+        double min_r2;
+        // scratch space for the batched LD calculation of a window
+        std::vector<size_t> window_idx;
+        std::vector<double> window_r2;
+        std::vector<size_t> batch_pos;
+        std::vector<uintptr_t*> batch_geno;
+        std::vector<uint32_t> batch_counts;
+        std::vector<const float*> batch_dosage;
+        std::vector<double> batch_r2;
+    };
+    /*!
+     * \brief Number of words required to store the mean centred dosages of
+     * founder_ct samples, with their sum of squares in the first word
+     */
+    static uintptr_t dosage_storage_size(uintptr_t founder_ct)
+    {
+        return 1 + (founder_ct * sizeof(float) + sizeof(uintptr_t) - 1)
+                       / sizeof(uintptr_t);
+    }
+    /*!
+     * \brief Number of words required by each SNP in the genotype pool used
+     * for clumping
+     */
+    static uintptr_t ld_storage_size(const Clumping& clump_info,
+                                     uintptr_t unfiltered_sample_ct,
+                                     uintptr_t founder_ct)
+    {
+        const uintptr_t unfiltered_sample_ctv2 =
+            2 * BITCT_TO_WORDCT(unfiltered_sample_ct);
+        if (!clump_info.ld_dosage) return unfiltered_sample_ctv2;
+        return std::max(unfiltered_sample_ctv2,
+                        dosage_storage_size(founder_ct));
+    }
+    static const float* dosage_vector(const uintptr_t* storage)
+    {
+        return reinterpret_cast<const float*>(storage + 1);
+    }
+    static double dosage_sum_sq(const uintptr_t* storage)
+    {
+        double sum_sq;
+        std::memcpy(&sum_sq, storage, sizeof(double));
+        return sum_sq;
+    }
+    /*!
+     * \brief Use the SNP at core_snp_idx of m_existed_snps as an index SNP
+     * and clump all SNPs within its window
+     * \return true if the SNP is an index SNP, false if it was already
+     * clumped or doesn't pass the p-value threshold
+     */
+    /*!
+     * \brief Calculate the r2 between each SNP in [start, end) of
+     * m_existed_snps and all SNPs after it within its clumping window. The
+     * range is split between the workers of the thread pool, each keeping
+     * the genotypes of its current window, and the number of workers is
+     * limited such that the genotypes fit in clump_info.memory
+     * \param add_pair is called with the index of both SNPs and their r2
+     * for pairs with r2 >= floor, in ascending order of the first SNP
+     */
+    template <typename Func>
+    void scan_ld_pairs(size_t start, size_t end, double floor,
+                       const Clumping& clump_info, Genotype& reference,
+                       Func&& add_pair);
+    template <typename Pool>
+    bool clump_index_snp(size_t core_snp_idx, const Clumping& clump_info,
+                         ClumpWorkspace& workspace, Pool& genotype_pool,
+                         Genotype& reference);
+    /*!
+     * \brief Spatial block of SNPs used by the parallel clumping. Each block
+     * is wider than the clumping window, so index SNPs from blocks that are
+     * not in each other's conflict list never touch the same SNP and can be
+     * processed concurrently.
+     */
+    struct ClumpBlock
+    {
+        // SNPs (index of m_existed_snps) in [begin, end) belong to this block
+        size_t begin = 0;
+        size_t end = 0;
+        // position (in m_sort_by_p_index) of the candidate index SNPs of
+        // this block, in ascending order
+        std::vector<size_t> rank;
+        // other blocks whose SNPs can be reached by the index SNPs of this
+        // block or vice versa
+        std::vector<size_t> conflict;
+        // rank of the next candidate, ~size_t(0) once the block is done
+        std::atomic<size_t> next_rank {~size_t(0)};
+        // only read or written by the thread that sets busy
+        size_t next = 0;
+        std::atomic<bool> busy {false};
+        /*!
+         * \brief Release the busy flag of a claimed block when the claim
+         * goes out of scope, including when clumping throws
+         */
+        class Claim
+        {
+        public:
+            explicit Claim(ClumpBlock& block) : m_block(block) {}
+            Claim(const Claim&) = delete;
+            Claim& operator=(const Claim&) = delete;
+            ~Claim() { m_block.busy.store(false, std::memory_order_release); }
+
+        private:
+            ClumpBlock& m_block;
+        };
+    };
+    /*!
+     * \brief Split m_existed_snps into partitions by the LD blocks and limit
+     * the clumping window of each SNP to its partition
+     */
+    void partition_clump_windows();
+    std::vector<ClumpBlock> build_clump_blocks(const Clumping& clump_info);
+    template <typename T>
+    void block_clumping(std::vector<ClumpBlock>& blocks, size_t start_block,
+                        std::atomic<size_t>& num_finished,
+                        std::atomic<bool>& abort, const Clumping& clump_info,
+                        T& progress_observer,
+                        std::vector<std::atomic<bool>>& remained_snps,
+                        std::atomic<size_t>& num_core,
+                        ConcurrentGenotypePool& genotype_pool,
+                        Genotype& reference);
+    /*!
+     * \brief Clumping where the reference genotypes are limited to
+     * clump_info.memory bytes. Blocks are loaded sequentially in position
+     * order, as many as the budget allows, and each index SNP is processed
+     * once its window is in memory. The loaded blocks are read and clumped by
+     * up to threads workers, which share the budget and follow the same
+     * ordering rule as block_clumping. Blocks are evicted from the start of
+     * the loaded range, and further passes are made over blocks that still
+     * have unprocessed index SNPs. The result is identical to the unbounded
+     * clumping
+     */
+    template <typename T>
+    void budgeted_clumping(const Clumping& clump_info, T& progress_observer,
+                           std::vector<std::atomic<bool>>& remained_snps,
+                           std::atomic<size_t>& num_core, size_t threads,
+                           Genotype& reference);
 
     /*!
      * \brief Before each run of PRSice, we need to reset the in regression
@@ -419,29 +668,56 @@ public:
      * \param i is the sample index
      * \return the PRS
      */
-    inline double calculate_score(const std::vector<PRS>& prs_list,
-                                  size_t i) const
+    inline double calculate_score(const PRS& prs_list, size_t i) const
     {
         if (i >= prs_list.size())
             throw std::out_of_range("Sample name vector out of range");
-        const size_t num_snp = prs_list[i].num_snp;
-        double prs = prs_list[i].prs;
-        double avg = prs;
-        if (num_snp == 0) { avg = 0.0; }
-        else
+        switch (m_prs_calculation.scoring_method)
         {
-            avg = prs / static_cast<double>(num_snp);
+        case SCORING::SUM:
+            return score_kernel<SCORING::SUM>(prs_list, i);
+        case SCORING::STANDARDIZE:
+        case SCORING::CONTROL_STD:
+            return score_kernel<SCORING::STANDARDIZE>(prs_list, i);
+        default:
+            // default is avg
+            return score_kernel<SCORING::AVERAGE>(prs_list, i);
         }
+    }
+    /*!
+     * \brief Calculate the PRS for a list of samples. The scoring method is
+     * resolved once for the whole list instead of once per sample
+     * \param prs_list the PRS storage
+     * \param sample_index index of samples to calculate the score for
+     * \param out where the result is stored, out[i] will contain the PRS of
+     *        sample_index[i]. Can be any container with operator[] e.g. an
+     *        Eigen column or a std::vector
+     */
+    template <typename T>
+    void calculate_score(const PRS& prs_list,
+                         const std::vector<size_t>& sample_index,
+                         T&& out) const
+    {
         switch (m_prs_calculation.scoring_method)
         {
-        case SCORING::SUM: return prs_list[i].prs;
+        case SCORING::SUM:
+            fill_score<SCORING::SUM>(prs_list, sample_index, out);
+            break;
         case SCORING::STANDARDIZE:
-        case SCORING::CONTROL_STD: return (avg - m_mean_score) / m_score_sd;
+        case SCORING::CONTROL_STD:
+            fill_score<SCORING::STANDARDIZE>(prs_list, sample_index, out);
+            break;
         default:
-            // default is avg
-            return avg;
+            fill_score<SCORING::AVERAGE>(prs_list, sample_index, out);
+            break;
         }
     }
+    template <typename T>
+    void calculate_score(const std::vector<size_t>& sample_index,
+                         T&& out) const
+    {
+        calculate_score(m_prs_info, sample_index, out);
+    }
     inline double calculate_score(size_t i) const
     {
         return calculate_score(m_prs_info, i);
@@ -457,7 +733,7 @@ public:
      * \param require_standardize is a boolean representing if we need to
      * calculate the mean and SD
      */
-    void get_null_score(std::vector<PRS>& prs_list, const size_t& set_size,
+    void get_null_score(PRS& prs_list, const size_t& set_size,
                         const size_t& prev_size,
                         std::vector<size_t>& background_list,
                         const bool first_run);
@@ -558,6 +834,17 @@ public:
         m_is_ref = true;
         return *this;
     }
+    /*!
+     * \brief Keep every variant of the genotype file instead of those read
+     * from the base (or the target for the reference), e.g. when the file
+     * is read on its own for --make-ld-panel. --extract and --exclude are
+     * still honoured
+     */
+    Genotype& read_all_snps()
+    {
+        m_read_all_snps = true;
+        return *this;
+    }
     Genotype& intermediate(bool use)
     {
         m_intermediate = use;
@@ -635,7 +922,46 @@ public:
         m_dose_threshold = qc.dose_threshold;
     }
     void load_genotype_to_memory();
+    /*!
+     * \brief Read the effect size matrix used for scoring multiple weight sets
+     * in one pass. The file must contain a header with the SNP ID, the
+     * effect allele and one column per weight set
+     * \param input is the input stream
+     * \param snp_index return the index of each matched SNP
+     * \param flipped return true if the effect allele of the SNP is the
+     *        alternative allele in the target
+     * \param weights return the SNP x K weight matrix
+     * \return name of the K weight sets
+     */
+    std::vector<std::string>
+    load_weight_matrix(std::unique_ptr<std::istream> input,
+                       std::vector<size_t>& snp_index,
+                       std::vector<bool>& flipped, Eigen::MatrixXd& weights);
+    /*!
+     * \brief Calculate the PRS of K weight sets at once. Genotypes are
+     * decoded in blocks of SNPs and samples into dense tiles which are then
+     * multiplied with the corresponding block of the weight matrix. Missing
+     * genotypes are handled the same way as in read_prs
+     * \param snp_index is the index of SNPs to include
+     * \param flipped indicate if the weight is for the alternative allele
+     * \param weights is the SNP x K weight matrix
+     * \param scores return the sample x K score matrix
+     * \param num_snp return the number of alleles included for each sample
+     */
+    void matrix_score(const std::vector<size_t>& snp_index,
+                      const std::vector<bool>& flipped,
+                      const Eigen::MatrixXd& weights, Eigen::MatrixXd& scores,
+                      std::vector<uint32_t>& num_snp);
+    /*!
+     * \brief Convert the raw score from matrix_score according to the
+     * scoring method (e.g. average or standardize)
+     * \param scores is the sample x K score matrix
+     * \param num_snp is the number of alleles included for each sample
+     */
+    void finalize_matrix_score(Eigen::MatrixXd& scores,
+                               const std::vector<uint32_t>& num_snp) const;
     bool genotyped_stored() const { return m_genotype_stored; }
+    bool hard_coded() const { return m_hard_coded; }
     const std::unordered_map<std::string, size_t>& included_snps_idx() const
     {
         return m_existed_snps_index;
@@ -649,17 +975,30 @@ protected:
     // protected elements
     friend class BinaryPlink;
     friend class BinaryGen;
+    friend class LDPanel;
     // vector storing all the genotype files
     // std::vector<Sample> m_sample_names;
     FileRead m_genotype_file;
     GenotypePool m_genotype_pool;
+    LDCache m_ld_cache;
+    // pairs calculated for the clumping sweep, partners of the i th SNP are
+    // stored in [m_sweep_offset[i], m_sweep_offset[i+1]) in ascending order
+    std::vector<SNP> m_sweep_snps;
+    std::vector<size_t> m_sweep_offset;
+    std::vector<uint32_t> m_sweep_partner;
+    std::vector<double> m_sweep_r2;
+    // LD blocks used for partitioned clumping, and the index of the first SNP
+    // of each partition in m_existed_snps. Empty if clumping isn't
+    // partitioned
+    std::vector<IITree<size_t, size_t>> m_ld_blocks;
+    std::vector<size_t> m_ld_partition;
     std::vector<SNP> m_existed_snps;
     std::unordered_map<std::string, size_t> m_existed_snps_index;
     std::unordered_set<std::string> m_sample_selection_list;
     std::unordered_set<std::string> m_snp_selection_list;
     std::vector<std::set<double>> m_set_thresholds;
     std::vector<Sample_ID> m_sample_id;
-    std::vector<PRS> m_prs_info;
+    PRS m_prs_info;
     std::vector<std::string> m_genotype_file_names;
     std::vector<char> m_chr_id_symbol;
     std::vector<uintptr_t> m_tmp_genotype;
@@ -710,6 +1049,8 @@ protected:
     uintptr_t m_sample_ct = 0;
     uintptr_t m_founder_ct = 0;
     uintptr_t m_marker_ct = 0;
+    // hash of the ID of all founders, in the order of the sample file
+    uint64_t m_founder_id_hash = LDCache::HASH_SEED;
     uint32_t m_max_category = 0;
     uint32_t m_autosome_ct = 0;
     uint32_t m_max_code = 0;
@@ -721,6 +1062,7 @@ protected:
     bool m_ignore_fid = false;
     bool m_intermediate = false;
     bool m_is_ref = false;
+    bool m_read_all_snps = false;
     bool m_keep_nonfounder = false;
     bool m_keep_ambig = false;
     bool m_remove_sample = true;
@@ -731,6 +1073,7 @@ protected:
     bool m_very_small_thresholds = false;
     bool m_vector_initialized = false;
     bool m_has_chr_id_formula = false;
+    bool m_use_ld_cache = false;
     Reporter* m_reporter = nullptr;
     CalculatePRS m_prs_calculation;
 
@@ -1019,6 +1362,16 @@ protected:
     {
         return std::vector<Sample_ID>(0);
     }
+    /*!
+     * \brief Name of all files the genotypes are read from, used to identify
+     * the reference of an LD cache
+     */
+    virtual std::vector<std::string> genotype_files() const
+    {
+        std::vector<std::string> files = m_genotype_file_names;
+        if (!m_sample_file.empty()) files.push_back(m_sample_file);
+        return files;
+    }
 
     virtual void gen_snp_vector(
         const std::vector<IITree<size_t, size_t>>& /*exclusion_regions*/,
@@ -1064,6 +1417,79 @@ protected:
                   std::vector<uintptr_t>& index_tots)
     {
         assert(window_data_ptr != nullptr);
+        uint32_t counts[9];
+        genovec_3freq_batch(&window_data_ptr, 1, index_data.data(),
+                            founder_ctv2, founder_ctl2, counts);
+        return r2_from_counts(counts, index_tots);
+    }
+    /*!
+     * \brief Calculate the r2 between the index SNP and a block of SNPs in a
+     * single pass, so that the index SNP's masks are only streamed once per
+     * block instead of once per SNP
+     * \param window_data contains the genotype of each SNP in the block
+     * \param counts is the scratch space for the two-locus counts
+     * \param r2 is the return vector, r2[i] is the r2 between the index SNP
+     * and window_data[i] (-1 if it cannot be calculated)
+     */
+    void get_r2_batch(const uintptr_t founder_ctl2,
+                      const uintptr_t founder_ctv2,
+                      const std::vector<uintptr_t*>& window_data,
+                      const std::vector<uintptr_t>& index_data,
+                      const std::vector<uintptr_t>& index_tots,
+                      std::vector<uint32_t>& counts, std::vector<double>& r2)
+    {
+        r2.resize(window_data.size());
+        if (window_data.empty()) return;
+        counts.resize(9 * window_data.size());
+        genovec_3freq_batch(window_data.data(), window_data.size(),
+                            index_data.data(), founder_ctv2, founder_ctl2,
+                            counts.data());
+        for (size_t i = 0; i < window_data.size(); ++i)
+        { r2[i] = r2_from_counts(&(counts[9 * i]), index_tots); }
+    }
+    /*!
+     * \brief Calculate the Pearson r2 between the dosages of the index SNP
+     * and a block of SNPs
+     * \param index_storage contains the dosage of the index SNP
+     * \param window_data contains the dosage of each SNP in the block
+     * \param dosages is the scratch space for the dosage vectors
+     * \param r2 is the return vector, r2[i] is the r2 between the index SNP
+     * and window_data[i] (-1 if either SNP is monomorphic)
+     */
+    void get_dosage_r2_batch(const uintptr_t founder_ct,
+                             const uintptr_t* index_storage,
+                             const std::vector<uintptr_t*>& window_data,
+                             std::vector<const float*>& dosages,
+                             std::vector<double>& r2)
+    {
+        r2.resize(window_data.size());
+        if (window_data.empty()) return;
+        dosages.resize(window_data.size());
+        for (size_t i = 0; i < window_data.size(); ++i)
+        { dosages[i] = dosage_vector(window_data[i]); }
+        // the dosages are mean centred, so the dot products are the
+        // covariances (scaled by the number of founders)
+        dosage_dot_batch(dosage_vector(index_storage), dosages.data(),
+                         dosages.size(), founder_ct, r2.data());
+        const double index_sum_sq = dosage_sum_sq(index_storage);
+        for (size_t i = 0; i < window_data.size(); ++i)
+        {
+            const double sum_sq = dosage_sum_sq(window_data[i]);
+            if (index_sum_sq <= 0 || sum_sq <= 0)
+            {
+                r2[i] = -1;
+                continue;
+            }
+            r2[i] = r2[i] * r2[i] / (index_sum_sq * sum_sq);
+        }
+    }
+    /*!
+     * \brief Calculate the r2 from the missing, het and homset count of a
+     * SNP against the three masks of the index SNP
+     */
+    double r2_from_counts(const uint32_t* geno_counts,
+                          const std::vector<uintptr_t>& index_tots)
+    {
         // is_x is used in PLINK to indicate if the genotype is from the X
         // chromsome, as PRSice ignore any sex chromosome, we can set it as
         // a constant false
@@ -1076,17 +1502,11 @@ protected:
         double freqx1;
         double freqx2;
         double dxx;
-        // calculate the counts
         // these counts are then used for calculation of R2. However, I
         // don't fully understand the algorithm here (copy from PLINK2)
-        genovec_3freq(window_data_ptr, index_data.data(), founder_ctl2,
-                      &(counts[0]), &(counts[1]), &(counts[2]));
+        std::copy(geno_counts, geno_counts + 9, counts);
         counts[0] = index_tots[0] - counts[0] - counts[1] - counts[2];
-        genovec_3freq(window_data_ptr, &(index_data[founder_ctv2]),
-                      founder_ctl2, &(counts[3]), &(counts[4]), &(counts[5]));
         counts[3] = index_tots[1] - counts[3] - counts[4] - counts[5];
-        genovec_3freq(window_data_ptr, &(index_data[2 * founder_ctv2]),
-                      founder_ctl2, &(counts[6]), &(counts[7]), &(counts[8]));
         counts[6] = index_tots[2] - counts[6] - counts[7] - counts[8];
         if (!em_phase_hethet_nobase(counts, is_x, is_x, &freq1x, &freq2x,
                                     &freqx1, &freqx2, &freq11))
@@ -1110,26 +1530,59 @@ protected:
         return -1;
     }
 
-    void update_sample_prs(PRS& sample_prs, const uint32_t geno,
-                           const std::vector<double>& scores,
-                           const std::vector<size_t>& counts)
+    /*!
+     * \brief Calculate the PRS of the i th sample with the scoring method
+     * resolved at compile time. CONTROL_STD share the STANDARDIZE kernel
+     */
+    template <SCORING method>
+    inline double score_kernel(const PRS& prs_list, const size_t i) const
     {
-        sample_prs.num_snp += counts[geno];
-        sample_prs.prs += scores[geno];
+        const double prs = prs_list.score(i);
+        if constexpr (method == SCORING::SUM) { return prs; }
+        else
+        {
+            const uint32_t num_snp = prs_list.num_snp(i);
+            const double avg =
+                (num_snp == 0) ? 0.0 : prs / static_cast<double>(num_snp);
+            if constexpr (method == SCORING::AVERAGE) { return avg; }
+            else
+            {
+                return (avg - m_mean_score) / m_score_sd;
+            }
+        }
     }
-    void initialize_sample_prs(PRS& sample_prs, const uint32_t geno,
-                               const std::vector<double>& scores,
-                               const std::vector<size_t>& counts)
+    template <SCORING method, typename T>
+    void fill_score(const PRS& prs_list,
+                    const std::vector<size_t>& sample_index, T& out) const
     {
-        sample_prs.num_snp = counts[geno];
-        sample_prs.prs = scores[geno];
+        const size_t num_sample = sample_index.size();
+        for (size_t i = 0; i < num_sample; ++i)
+        {
+            const size_t idx = sample_index[i];
+            if (idx >= prs_list.size())
+                throw std::out_of_range("Sample name vector out of range");
+            out[static_cast<Eigen::Index>(i)] =
+                score_kernel<method>(prs_list, idx);
+        }
     }
-    template <class T>
-    void process_sample_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
-                            const std::vector<double>& scores,
-                            const std::vector<size_t>& counts, T load_prs)
+    /*!
+     * \brief Add the genotype score of all samples to the PRS storage.
+     * reset and the accumulator are resolved at compile time such that the
+     * inner loop is free of function pointer call and of branches on the
+     * run configuration
+     * \tparam reset if true, overwrite the PRS instead of adding to it
+     * \tparam compensated if true, accumulate with Kahan summation. Must
+     *         match prs_list.compensated()
+     * \param genotype the packed genotype
+     * \param prs_list the PRS storage
+     * \param scores score for each of the 4 genotype code
+     * \param counts number of alleles for each of the 4 genotype code
+     */
+    template <bool reset, bool compensated>
+    void process_sample_prs(const uintptr_t* genotype, PRS& prs_list,
+                            const double* scores, const uint32_t* counts)
     {
-        uintptr_t* lbptr = genotype;
+        const uintptr_t* lbptr = genotype;
         uintptr_t byte_block;
         uint32_t processed_samples;
         uint32_t sample_idx;
@@ -1157,10 +1610,19 @@ protected:
                 // and the sample index can be calculated as uii+(ujj/2)
                 if (processed_samples + (sample_idx / 2) >= m_sample_ct)
                 { break; }
-                auto& sample_prs =
-                    prs_list[processed_samples + (sample_idx / 2)];
                 // now we will get all genotypes (0, 1, 2, 3)
-                (this->*load_prs)(sample_prs, geno, scores, counts);
+                if constexpr (reset)
+                {
+                    prs_list.assign<compensated>(
+                        processed_samples + (sample_idx / 2), scores[geno],
+                        counts[geno]);
+                }
+                else
+                {
+                    prs_list.add<compensated>(
+                        processed_samples + (sample_idx / 2), scores[geno],
+                        counts[geno]);
+                }
                 sample_idx += 2;
             }
             // uii is the number of samples we have finished so far
@@ -1168,30 +1630,154 @@ protected:
         } while (processed_samples < m_sample_ct);
     }
 
-    void read_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
+    void read_prs(uintptr_t* genotype, PRS& prs_list,
                   const size_t ploidy, const double stat,
                   const double adj_score, const double miss_score,
                   const size_t miss_count, const double homcom_weight,
                   const double het_weight, const double homrar_weight,
                   const bool not_first)
     {
-        std::vector<double> scores = {homcom_weight * stat - adj_score,
-                                      het_weight * stat - adj_score, miss_score,
-                                      homrar_weight * stat - adj_score};
-        std::vector<size_t> counts = {ploidy, ploidy, miss_count, ploidy};
-        if (not_first)
+        // the genetic model, flipping and missing handling are all folded
+        // into this per-SNP look up table, so the per-sample loop only does
+        // the look up
+        const double scores[4] = {homcom_weight * stat - adj_score,
+                                  het_weight * stat - adj_score, miss_score,
+                                  homrar_weight * stat - adj_score};
+        const uint32_t ploidy_ct = static_cast<uint32_t>(ploidy);
+        const uint32_t counts[4] = {ploidy_ct, ploidy_ct,
+                                    static_cast<uint32_t>(miss_count),
+                                    ploidy_ct};
+        // one dispatch per SNP, such that the per-sample loop is specialized
+        // for both the reset and the accumulator
+        const bool compensated = prs_list.compensated();
+        if (not_first && compensated)
+        { process_sample_prs<false, true>(genotype, prs_list, scores, counts); }
+        else if (not_first)
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::update_sample_prs);
+            process_sample_prs<false, false>(genotype, prs_list, scores,
+                                             counts);
         }
+        else if (compensated)
+        { process_sample_prs<true, true>(genotype, prs_list, scores, counts); }
         else
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::initialize_sample_prs);
+            process_sample_prs<true, false>(genotype, prs_list, scores, counts);
+        }
+    }
+    /*!
+     * \brief Add the score of samples with a non-homcom genotype, used by
+     *        read_sparse_prs. The accumulator is resolved at compile time
+     * \tparam compensated if true, accumulate with Kahan summation. Must
+     *         match prs_list.compensated()
+     * \param genotype the packed genotype, subset to m_sample_ct samples
+     * \param prs_list the PRS storage
+     * \param scores score for each of the 4 genotype code
+     * \param counts number of alleles for each of the 4 genotype code
+     */
+    template <bool compensated>
+    void process_sparse_prs(const uintptr_t* genotype, PRS& prs_list,
+                            const double* scores, const uint32_t* counts)
+    {
+        const uintptr_t sample_ctl2 = QUATERCT_TO_WORDCT(m_sample_ct);
+        const uint32_t remain = m_sample_ct & (BITCT2 - 1);
+        uintptr_t inverted, non_homcom;
+        size_t sample_idx;
+        uint32_t shift, geno;
+        for (uintptr_t widx = 0; widx < sample_ctl2; ++widx)
+        {
+            // homcom is stored as 11, which become 00 after inversion
+            inverted = ~genotype[widx];
+            non_homcom = (inverted | (inverted >> 1)) & FIVEMASK;
+            if (remain && widx + 1 == sample_ctl2)
+            { non_homcom &= (ONELU << (remain * 2)) - ONELU; }
+            while (non_homcom)
+            {
+                shift = CTZLU(non_homcom);
+                geno = (inverted >> shift) & 3;
+                sample_idx = widx * BITCT2 + (shift / 2);
+                prs_list.add<compensated>(sample_idx, scores[geno],
+                                          counts[geno]);
+                non_homcom &= non_homcom - 1;
+            }
         }
     }
 
 
+    /*!
+     * \brief Check if a SNP is rare enough for us to use the sparse scoring
+     *        path
+     * \param homcom_ct number of homozygous common genotype
+     * \param het_ct number of heterozygous genotype
+     * \param homrar_ct number of homozygous rare genotype
+     * \param missing_ct number of missing genotype
+     * \return true if only a small fraction of samples are non-homcom
+     */
+    static bool use_sparse_score(const uint32_t homcom_ct,
+                                 const uint32_t het_ct,
+                                 const uint32_t homrar_ct,
+                                 const uint32_t missing_ct)
+    {
+        const uint64_t non_homcom = static_cast<uint64_t>(het_ct) + homrar_ct
+                                    + missing_ct;
+        return non_homcom * SPARSE_SCORE_RATIO
+               < non_homcom + static_cast<uint64_t>(homcom_ct);
+    }
+    /*!
+     * \brief Sparse version of read_prs for rare variants. The homozygous
+     *        common contribution is not added to each sample, but
+     *        accumulated into offset_score and offset_count, which should
+     *        be applied once to all samples through apply_prs_offset. Only
+     *        samples with a non-homcom or missing genotype are visited
+     * \param genotype the packed genotype, subset to m_sample_ct samples
+     * \param prs_list the PRS storage
+     * \param offset_score the accumulated homcom score
+     * \param offset_count the accumulated homcom count
+     */
+    void read_sparse_prs(uintptr_t* genotype, PRS& prs_list,
+                         const size_t ploidy, const double stat,
+                         const double adj_score, const double miss_score,
+                         const size_t miss_count, const double homcom_weight,
+                         const double het_weight, const double homrar_weight,
+                         const bool not_first, double& offset_score,
+                         size_t& offset_count)
+    {
+        if (!not_first) { prs_list.reset(); }
+        const double homcom_score = homcom_weight * stat - adj_score;
+        // remove the homcom contribution from the other genotypes, as it will
+        // be added back to every sample through the offset
+        const double scores[4] = {0, het_weight * stat - adj_score - homcom_score,
+                                  miss_score - homcom_score,
+                                  homrar_weight * stat - adj_score
+                                      - homcom_score};
+        // unsigned wrap around is fine here as the offset is always added
+        // back before the count is used
+        const uint32_t counts[4] = {
+            0, 0, static_cast<uint32_t>(miss_count - ploidy), 0};
+        offset_score += homcom_score;
+        offset_count += ploidy;
+        if (prs_list.compensated())
+        { process_sparse_prs<true>(genotype, prs_list, scores, counts); }
+        else
+        {
+            process_sparse_prs<false>(genotype, prs_list, scores, counts);
+        }
+    }
+    /*!
+     * \brief Add the homozygous common offset accumulated by read_sparse_prs
+     *        to all samples
+     * \param prs_list the PRS storage
+     * \param offset_score the accumulated score, will be reset to 0
+     * \param offset_count the accumulated count, will be reset to 0
+     */
+    static void apply_prs_offset(PRS& prs_list, double& offset_score,
+                                 size_t& offset_count)
+    {
+        if (offset_count == 0 && offset_score == 0.0) return;
+        prs_list.add_all(offset_score, static_cast<uint32_t>(offset_count));
+        offset_score = 0;
+        offset_count = 0;
+    }
+
     virtual inline void count_and_read_genotype(SNP& /* snp*/) {}
     virtual inline void
     read_genotype(const SNP& /*snp*/, const uintptr_t /* selected_size*/,
@@ -1200,8 +1786,20 @@ protected:
                   bool is_ref = false)
     {
     }
+    /*!
+     * \brief Read the mean centred expected dosages of the founders, used for
+     * dosage based LD calculation
+     * \param storage is the return storage, see dosage_storage_size
+     */
+    virtual void read_dosage(const SNP& /*snp*/, FileRead& /*genotype_file*/,
+                             uintptr_t* /*storage*/, bool /*is_ref*/)
+    {
+        throw std::runtime_error(
+            "Error: Dosage based LD calculation is only supported for bgen "
+            "files");
+    }
     virtual void
-    read_score(std::vector<PRS>& /*prs_list*/,
+    read_score(PRS& /*prs_list*/,
                const std::vector<size_t>::const_iterator& /*start*/,
                const std::vector<size_t>::const_iterator& /*end*/,
                bool /*reset_zero*/)
@@ -1,121 +1,314 @@
 #ifndef GenotypePool_HPP
 #define GenotypePool_HPP
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <plink_common.hpp>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
-// modified based on https://thinkingeek.com/2017/11/19/simple-memory-pool/
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
 
-class IndividualGenotype
+/*!
+ * \brief Usage statistic of a genotype pool, all in number of genotypes
+ */
+struct GenotypePoolStat
+{
+    // genotypes currently handed out
+    size_t in_use = 0;
+    // highest number of genotypes handed out at the same time
+    size_t peak = 0;
+    // genotypes reserved by all slabs
+    size_t capacity = 0;
+    size_t num_slab = 0;
+};
+
+/*!
+ * \brief Pool of fixed size genotype storage.
+ *
+ * Memory is reserved in contiguous, cache line aligned slabs, each holding
+ * the same number of genotypes, and free storage is tracked by a stack of slot
+ * indices, so no bookkeeping is stored next to the genotypes. A new slab is
+ * added whenever the pool runs out of storage, until the optional upper bound
+ * is reached. The pool is not thread safe, see ConcurrentGenotypePool.
+ */
+class GenotypePool
 {
 private:
-    IndividualGenotype* m_next;
-    uintptr_t* m_geno_start;
+    struct SlabDeleter
+    {
+        void operator()(uintptr_t* slab) const
+        {
+#ifdef _WIN32
+            _aligned_free(slab);
+#else
+            std::free(slab);
+#endif
+        }
+    };
+    using Slab = std::unique_ptr<uintptr_t[], SlabDeleter>;
+    // slabs of at least this size are aligned to, and backed by, huge pages
+    static constexpr size_t HUGE_PAGE = 2 * 1024 * 1024;
+    std::vector<Slab> m_slabs;
+    // start address and index of each slab, sorted by address so that the
+    // slot of a genotype can be found when it is freed
+    std::vector<std::pair<const uintptr_t*, size_t>> m_slab_order;
+    std::vector<uint32_t> m_free;
+    size_t m_num_snps = 0;
+    size_t m_memory_per_snp = 0;
+    size_t m_max_snps = 0;
+    size_t m_in_use = 0;
+    size_t m_peak = 0;
+    bool m_huge_page = false;
+    void add_slab()
+    {
+        const size_t capacity = m_slabs.size() * m_num_snps;
+        if (m_num_snps == 0 || (m_max_snps != 0 && capacity >= m_max_snps))
+        {
+            throw std::runtime_error(
+                "Error: Genotype pool exceeded its limit of "
+                + std::to_string(m_max_snps) + " genotypes");
+        }
+        // the last slab is trimmed to the limit
+        size_t num_snps = m_num_snps;
+        if (m_max_snps != 0)
+        { num_snps = std::min(num_snps, m_max_snps - capacity); }
+        if (capacity + num_snps > UINT32_MAX)
+        { throw std::runtime_error("Error: Too many genotypes in the pool"); }
+        const size_t bytes = num_snps * m_memory_per_snp * sizeof(uintptr_t);
+        const bool huge_page = m_huge_page && bytes >= HUGE_PAGE;
+        const size_t alignment = huge_page ? HUGE_PAGE : CACHELINE;
+        void* memory = nullptr;
+#ifdef _WIN32
+        memory = _aligned_malloc(bytes, alignment);
+#else
+        if (posix_memalign(&memory, alignment, bytes) != 0) memory = nullptr;
+#endif
+        if (memory == nullptr)
+        {
+            throw std::runtime_error(
+                "Error: Failed to allocate "
+                + std::to_string(bytes / 1048576 + 1)
+                + " MB for the genotype pool");
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // only a hint, the slab works either way
+        if (huge_page) madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+        Slab slab(static_cast<uintptr_t*>(memory));
+        m_slab_order.emplace_back(slab.get(), m_slabs.size());
+        std::sort(m_slab_order.begin(), m_slab_order.end());
+        m_slabs.push_back(std::move(slab));
+        // lower slots are handed out first
+        m_free.reserve(m_free.size() + num_snps);
+        for (size_t i = num_snps; i > 0; --i)
+        { m_free.push_back(static_cast<uint32_t>(capacity + i - 1)); }
+    }
+    uintptr_t* address(uint32_t slot) const
+    {
+        return m_slabs[slot / m_num_snps].get()
+               + (slot % m_num_snps) * m_memory_per_snp;
+    }
+    uint32_t slot(const uintptr_t* genotype) const
+    {
+        auto it = std::upper_bound(
+            m_slab_order.begin(), m_slab_order.end(), genotype,
+            [](const uintptr_t* geno,
+               const std::pair<const uintptr_t*, size_t>& slab) {
+                return geno < slab.first;
+            });
+        if (it != m_slab_order.begin())
+        {
+            --it;
+            const size_t offset = static_cast<size_t>(genotype - it->first);
+            if (offset < m_num_snps * m_memory_per_snp
+                && offset % m_memory_per_snp == 0)
+            {
+                return static_cast<uint32_t>(it->second * m_num_snps
+                                             + offset / m_memory_per_snp);
+            }
+        }
+        throw std::runtime_error(
+            "Error: Genotype does not belong to this pool!");
+    }
 
 public:
-    IndividualGenotype() {}
-    IndividualGenotype(uintptr_t* current)
+    GenotypePool() {}
+    /*!
+     * \brief Create the pool and reserve the first slab
+     * \param num_snps is the number of genotypes in each slab
+     * \param memory_per_snp is the size of each genotype in words
+     * \param max_snps is the maximum number of genotypes, 0 if unlimited
+     * \param huge_page indicate if large slabs should be backed by
+     * transparent huge pages where supported
+     */
+    GenotypePool(size_t num_snps, size_t memory_per_snp, size_t max_snps = 0,
+                 bool huge_page = false)
+        : m_num_snps(std::max<size_t>(num_snps, 1))
+        , m_memory_per_snp(round_up_pow2(memory_per_snp, CACHELINE_WORD))
+        , m_max_snps(max_snps)
+        , m_huge_page(huge_page)
+    {
+        add_slab();
+    }
+    GenotypePool(GenotypePool&&) = default;
+    GenotypePool& operator=(GenotypePool&&) = default;
+    uintptr_t* alloc()
     {
-        m_geno_start = current;
-        m_next = nullptr;
+        if (m_free.empty()) add_slab();
+        const uint32_t slot = m_free.back();
+        m_free.pop_back();
+        if (++m_in_use > m_peak) m_peak = m_in_use;
+        return address(slot);
+    }
+    void free(uintptr_t* genotype)
+    {
+        if (genotype == nullptr)
+        { throw std::runtime_error("Error: Can't free null pointer!"); }
+        m_free.push_back(slot(genotype));
+        --m_in_use;
+    }
+    // number of genotypes currently allocated
+    size_t in_use() const { return m_in_use; }
+    GenotypePoolStat stat() const
+    {
+        GenotypePoolStat stat;
+        stat.in_use = m_in_use;
+        stat.peak = m_peak;
+        stat.capacity = m_slabs.size() * m_num_snps;
+        if (m_max_snps != 0)
+        { stat.capacity = std::min(stat.capacity, m_max_snps); }
+        stat.num_slab = m_slabs.size();
+        return stat;
+    }
+    // size of each genotype (in bytes)
+    static size_t snp_size(size_t memory_per_snp)
+    {
+        return round_up_pow2(memory_per_snp, CACHELINE_WORD)
+               * sizeof(uintptr_t);
     }
-    IndividualGenotype* get_next_item() const { return m_next; }
-    void set_next_item(IndividualGenotype* n) { m_next = n; }
-    void set_start_location(uintptr_t* i) { m_geno_start = i; }
-    uintptr_t* get_geno() { return m_geno_start; }
-    // Methods for the storage of the item.
 };
 
-
-class GenotypePool
+/*!
+ * \brief GenotypePool that can be shared between threads. Each thread should
+ * allocate through its own Cache, which only takes the lock when it runs out
+ * of storage or holds too many free genotypes. The returned storage can be
+ * used without locking
+ */
+class ConcurrentGenotypePool
 {
 private:
-    class MemoryPool
+    // number of genotypes moved between a cache and the shared pool at once
+    static constexpr size_t BATCH = 16;
+    GenotypePool m_pool;
+    std::mutex m_mutex;
+    std::atomic<size_t> m_in_use {0};
+    std::atomic<size_t> m_peak {0};
+    void acquired(size_t n)
     {
-        // actual memory storage
-        std::unique_ptr<uintptr_t[]> m_genotypes alignas(alignof(uintptr_t));
-        // std::vector<uintptr_t> m_genotypes alignas(alignof(uintptr_t));
-        // storing the pointer location as a linked list, this allow us to find
-        // the next empty space
-        std::unique_ptr<IndividualGenotype[]> m_genotype_list;
-        // pointer to the next memory storage
-        std::unique_ptr<MemoryPool> m_next;
-
-    public:
-        ~MemoryPool() {}
-        MemoryPool(const size_t num_snps, const size_t memory_per_snp)
-            : m_genotypes(new uintptr_t[num_snps * memory_per_snp])
-            , m_genotype_list(new IndividualGenotype[num_snps])
+        const size_t in_use = m_in_use.fetch_add(n) + n;
+        size_t peak = m_peak.load();
+        while (in_use > peak && !m_peak.compare_exchange_weak(peak, in_use))
+        {
+            // peak is reloaded by compare_exchange_weak on failure
+        }
+    }
 
+public:
+    /*!
+     * \brief Per-thread front end of the shared pool
+     */
+    class Cache
+    {
+    private:
+        ConcurrentGenotypePool& m_shared;
+        std::vector<uintptr_t*> m_local;
+        void release(size_t n)
         {
-            // m_genotypes.resize(num_snps * memory_per_snp, 0);
-            // initialize the linked list
-            m_genotype_list[0].set_start_location(m_genotypes.get());
-            // m_genotype_list[0].set_start_location(m_genotypes.data());
-            for (size_t i = 1; i < num_snps; ++i)
+            std::lock_guard<std::mutex> lock(m_shared.m_mutex);
+            for (size_t i = 0; i < n; ++i)
             {
-                m_genotype_list[i - 1].set_next_item(&m_genotype_list[i]);
-                m_genotype_list[i].set_start_location(m_genotypes.get()
-                                                      + i * memory_per_snp);
+                m_shared.m_pool.free(m_local.back());
+                m_local.pop_back();
             }
-            m_genotype_list[num_snps - 1].set_next_item(nullptr);
         }
-        // return pointer to the start of the linked list, can be used to
-        // appoint to the free list pointer
-        IndividualGenotype* get_genotype_location()
+
+    public:
+        explicit Cache(ConcurrentGenotypePool& shared) : m_shared(shared)
         {
-            return m_genotype_list.get();
+            m_local.reserve(2 * BATCH);
         }
-        uintptr_t* get_genotype_storage() { return m_genotypes.get(); }
-        // connect the new memory pool to the current memory pool
-        void set_next_collection(std::unique_ptr<MemoryPool>&& n)
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+        ~Cache() { release(m_local.size()); }
+        uintptr_t* alloc()
         {
-            assert(!m_next);
-            m_next.reset(n.release());
+            if (m_local.empty())
+            {
+                std::lock_guard<std::mutex> lock(m_shared.m_mutex);
+                // only take what is needed once the pool can no longer grow,
+                // so that other threads aren't starved
+                m_local.push_back(m_shared.m_pool.alloc());
+                auto&& pool = m_shared.m_pool;
+                while (m_local.size() < BATCH
+                       && pool.in_use() < pool.stat().capacity)
+                { m_local.push_back(pool.alloc()); }
+            }
+            uintptr_t* genotype = m_local.back();
+            m_local.pop_back();
+            m_shared.acquired(1);
+            return genotype;
+        }
+        void free(uintptr_t* genotype)
+        {
+            if (genotype == nullptr)
+            { throw std::runtime_error("Error: Can't free null pointer!"); }
+            m_local.push_back(genotype);
+            --m_shared.m_in_use;
+            if (m_local.size() >= 2 * BATCH) release(BATCH);
         }
     };
-    size_t m_num_snps;
-    size_t m_memory_per_snp;
-    std::unique_ptr<MemoryPool> m_memory_pool;
-    IndividualGenotype* m_free_list;
-
-public:
-    GenotypePool() {};
-    GenotypePool(size_t num_snps, size_t memory_per_snp)
-        : m_num_snps(num_snps)
-        , m_memory_per_snp(round_up_pow2(memory_per_snp, CACHELINE))
-        , m_memory_pool(new MemoryPool(m_num_snps, m_memory_per_snp))
-        , m_free_list(m_memory_pool->get_genotype_location())
+    ConcurrentGenotypePool(size_t num_snps, size_t memory_per_snp,
+                           size_t max_snps = 0)
+        : m_pool(num_snps, memory_per_snp, max_snps)
     {
     }
-    IndividualGenotype* alloc()
+    uintptr_t* alloc()
     {
-        if (m_free_list == nullptr)
+        uintptr_t* genotype;
         {
-            std::unique_ptr<MemoryPool> new_pool(
-                new MemoryPool(m_num_snps, m_memory_per_snp));
-            new_pool->set_next_collection(std::move(m_memory_pool));
-            m_memory_pool.reset(new_pool.release());
-            m_free_list = m_memory_pool->get_genotype_location();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            genotype = m_pool.alloc();
         }
-        IndividualGenotype* current_item = m_free_list;
-        // Update the free list to the next free item.
-        m_free_list = current_item->get_next_item();
-        // Get the storage for T.
-        assert(current_item != nullptr);
-        return current_item;
+        acquired(1);
+        return genotype;
     }
-    void free(IndividualGenotype* t)
+    void free(uintptr_t* genotype)
     {
-        // Convert this pointer to T to its enclosing pointer of an item of the
-        // arena.
-        if (t == nullptr)
-        { throw std::runtime_error("Error: Can't free null pointer!"); }
-        IndividualGenotype* current_item = std::move(t);
-        t = nullptr;
-        // Add the item at the beginning of the free list.
-        current_item->set_next_item(m_free_list);
-        m_free_list = current_item;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pool.free(genotype);
+        }
+        --m_in_use;
+    }
+    // number of genotypes currently handed out
+    size_t in_use() const { return m_in_use; }
+    GenotypePoolStat stat()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        GenotypePoolStat stat = m_pool.stat();
+        stat.in_use = m_in_use;
+        stat.peak = m_peak;
+        return stat;
     }
 };
 #endif // GenotypePool_HPP
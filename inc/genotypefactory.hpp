@@ -18,6 +18,7 @@
 #define SRC_GENOTYPEFACTORY_HPP_
 #include "binarygen.hpp"
 #include "binaryplink.hpp"
+#include "ldpanel.hpp"
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "misc.hpp"
@@ -30,9 +31,8 @@
 class GenomeFactory
 {
 private:
-    const std::unordered_map<std::string, int> file_type {{"bed", 0},
-                                                          {"ped", 1},
-                                                          {"bgen", 2}};
+    const std::unordered_map<std::string, int> file_type {
+        {"bed", 0}, {"ped", 1}, {"bgen", 2}, {"ldp", 3}};
 
 public:
     Genotype* createGenotype(const GenoFile& geno, const Phenotype& pheno,
@@ -55,6 +55,10 @@ public:
         {
             return new BinaryGen(geno, pheno, delim, &reporter);
         }
+        case 3:
+        {
+            return new LDPanel(geno, pheno, delim, &reporter);
+        }
         default:
             throw std::invalid_argument("ERROR: Only support bgen and bed");
         }
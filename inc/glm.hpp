@@ -102,9 +102,43 @@ public:
         update_dev_resids();
         m_rank = m_nvars;
     }
+    /*!
+     * \brief Warm start the IRLS from known coefficients, e.g. the result of
+     * a closely related model
+     * \param start is the starting coefficients
+     * \return false if the start gives invalid fitted values, in which case
+     * init_parms() should be used instead
+     */
+    bool init_parms(const Eigen::VectorXd& start)
+    {
+        if (start.rows() != m_nvars)
+        {
+            throw std::runtime_error(
+                "Error: Number of starting values does not match the model");
+        }
+        m_type = 1;
+        m_beta = start;
+        update_eta();
+        update_mu();
+        if (!m_family.validmu(m_mu) || !m_family.valideta(m_eta))
+        { return false; }
+        update_dev_resids_no_update();
+        m_devold = m_dev;
+        m_rank = m_nvars;
+        return std::isfinite(m_dev);
+    }
+    /*!
+     * \brief Replace a column of the design matrix, so that models only
+     * differing by one predictor can reuse the same workspace
+     */
+    void set_column(Eigen::Index idx, const Eigen::VectorXd& x)
+    {
+        m_X.col(idx) = x;
+    }
     int solve(int maxit = 100)
     {
         int i = 0;
+        m_converged = false;
         for (; i < maxit; ++i)
         {
             update_var_mu();
@@ -130,6 +164,46 @@ public:
         save_se();
         return std::min(i + 1, maxit);
     }
+    /*!
+     * \brief Derive the standard errors from the IRLS weights evaluated at
+     * the current coefficients, without updating the coefficients. solve
+     * uses the weights of its last iteration instead, which lag one step
+     * behind the fitted coefficients
+     */
+    void update_se()
+    {
+        update_var_mu();
+        update_mu_eta();
+        update_w();
+        if (m_type == 0)
+        {
+            m_Ch.compute(static_cast<Eigen::MatrixXd>(XtWX())
+                             .selfadjointView<Eigen::Lower>());
+        }
+        else
+        {
+            if (m_type == 1)
+            {
+                m_WX.noalias() = m_w.asDiagonal() * m_X;
+                m_PQR.compute(m_WX);
+            }
+            else
+            {
+                m_PQR.compute(static_cast<Eigen::MatrixXd>(XtWX())
+                                  .selfadjointView<Eigen::Lower>());
+            }
+            m_Pmat = m_PQR.colsPermutation();
+            m_rank = m_PQR.rank();
+            if (m_rank != m_nvars)
+            {
+                m_Rinv = static_cast<Eigen::MatrixXd>(
+                             m_PQR.matrixQR().topLeftCorner(m_rank, m_rank))
+                             .triangularView<Eigen::Upper>()
+                             .solve(Eigen::MatrixXd::Identity(m_rank, m_rank));
+            }
+        }
+        save_se();
+    }
     const Eigen::VectorXd& get_beta() const { return m_beta; }
     const Eigen::VectorXd& get_se() const { return m_se; }
     double deviance() const { return m_dev; }
@@ -151,7 +225,7 @@ public:
     }
 
 private:
-    const Eigen::MatrixXd m_X;
+    Eigen::MatrixXd m_X;
     const Eigen::VectorXd m_Y;
     const Eigen::VectorXd m_weights;
     const Eigen::Index m_nvars;
@@ -171,6 +245,10 @@ private:
     Eigen::VectorXd m_w;
     Eigen::VectorXd m_se;
     Eigen::VectorXd m_effects;
+    // workspace of the weighted least square, kept to avoid reallocating them
+    // in every iteration
+    Eigen::MatrixXd m_WX;
+    Eigen::VectorXd m_wz;
     // Eigen::VectorXd m_offset;
     double m_dev, m_devold;
     double m_tol = 1e-8;
@@ -183,10 +261,10 @@ private:
     {
         return (std::fabs(m_dev - m_devold) / (0.1 + std::fabs(m_dev)) < m_tol);
     }
-    void update_eta() { m_eta = m_X * m_beta; }
-    void update_var_mu() { m_var_mu = m_family.variance(m_mu); }
-    void update_mu_eta() { m_mu_eta = m_family.mu_eta(m_eta); }
-    void update_mu() { m_mu = m_family.linkinv(m_eta); }
+    void update_eta() { m_eta.noalias() = m_X * m_beta; }
+    void update_var_mu() { m_family.variance_into(m_mu, m_var_mu); }
+    void update_mu_eta() { m_family.mu_eta_into(m_eta, m_mu_eta); }
+    void update_mu() { m_family.linkinv_into(m_eta, m_mu); }
     void update_z()
     {
         //   m_z = (m_eta.array() - m_offset.array())
@@ -274,12 +352,14 @@ private:
         else if (m_type == 1)
         {
             // use Col QR
-            m_PQR.compute(m_w.asDiagonal() * m_X); // decompose the model matrix
+            m_WX.noalias() = m_w.asDiagonal() * m_X;
+            m_wz = m_z.array() * m_w.array();
+            m_PQR.compute(m_WX); // decompose the model matrix
             m_Pmat = (m_PQR.colsPermutation());
             m_rank = m_PQR.rank();
             if (m_rank == m_nvars)
             { // full rank case
-                m_beta = m_PQR.solve((m_z.array() * m_w.array()).matrix());
+                m_beta = m_PQR.solve(m_wz);
             }
             else
             {
@@ -287,8 +367,7 @@ private:
                              m_PQR.matrixQR().topLeftCorner(m_rank, m_rank))
                              .triangularView<Eigen::Upper>()
                              .solve(Eigen::MatrixXd::Identity(m_rank, m_rank));
-                m_effects = m_PQR.householderQ().adjoint()
-                            * (m_z.array() * m_w.array()).matrix();
+                m_effects = m_PQR.householderQ().adjoint() * m_wz;
                 m_beta.head(m_rank) = m_Rinv * m_effects.head(m_rank);
                 m_beta = m_Pmat * m_beta;
                 // create fitted values from effects
@@ -0,0 +1,200 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef LD_CACHE_HPP
+#define LD_CACHE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Persistent store of the pairwise LD (r2) between reference variants.
+ *
+ * The file contains one sparse, symmetric matrix per chromosome in CSR
+ * format. Variants are identified by a key derived from their location in the
+ * reference genotype files (see LDCache::variant_key), so the same cache can
+ * be reused by any base file clumped against the same reference panel. Only
+ * pairs within the clumping distance with r2 >= floor are stored; a missing
+ * pair between two cached variants within the distance therefore has r2 below
+ * the floor.
+ *
+ * The header also stores a fingerprint of the reference files, the founders
+ * and the sample and genotype filters used, so that a cache is never reused
+ * with a reference that would give different r2.
+ *
+ * File layout (native byte order, every section 8 byte aligned):
+ * header | chromosome directory | per chromosome: keys, row offsets, r2,
+ * column index. The file is memory mapped on POSIX systems and read into
+ * memory otherwise.
+ */
+class LDCache
+{
+public:
+    /*!
+     * \brief Sparse LD matrix of one chromosome, used for writing the cache
+     */
+    struct Chromosome
+    {
+        size_t chr = 0;
+        // keys of all variants, sorted in ascending order
+        std::vector<uint64_t> keys;
+        // row i contains entries [row_offset[i], row_offset[i+1])
+        std::vector<uint64_t> row_offset;
+        // column (index into keys) of each entry, sorted within each row
+        std::vector<uint32_t> column;
+        std::vector<double> r2;
+    };
+    /*!
+     * \brief Read-only view of one chromosome of a loaded cache
+     */
+    struct ChromosomeView
+    {
+        size_t chr = 0;
+        size_t num_variant = 0;
+        const uint64_t* keys = nullptr;
+        const uint64_t* row_offset = nullptr;
+        const double* r2 = nullptr;
+        const uint32_t* column = nullptr;
+        size_t index(uint64_t key) const
+        {
+            auto it = std::lower_bound(keys, keys + num_variant, key);
+            if (it == keys + num_variant || *it != key) return ~size_t(0);
+            return static_cast<size_t>(it - keys);
+        }
+    };
+    /*!
+     * \brief Location of a variant within the cache, obtained from find
+     */
+    struct Variant
+    {
+        const ChromosomeView* chr = nullptr;
+        size_t index = 0;
+        bool valid() const { return chr != nullptr; }
+    };
+    /*!
+     * \brief Hashes identifying the input used to build the cache
+     */
+    struct Fingerprint
+    {
+        // name, size and modification time of the reference files
+        uint64_t files = 0;
+        // founders used for LD calculation
+        uint64_t founders = 0;
+        // sample selection and genotype calling thresholds
+        uint64_t filters = 0;
+    };
+    // seed of the FNV-1a hash used for the fingerprint
+    static constexpr uint64_t HASH_SEED = 14695981039346656037ULL;
+    /*!
+     * \brief Update the FNV-1a hash with a block of data
+     * \param data is the data to add
+     * \param size is the size of data in bytes
+     * \param seed is the current hash
+     * \return the updated hash
+     */
+    static uint64_t hash(const void* data, size_t size, uint64_t seed)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            seed ^= bytes[i];
+            seed *= 1099511628211ULL;
+        }
+        return seed;
+    }
+    static uint64_t hash(const std::string& value, uint64_t seed)
+    {
+        // include the size so that consecutive strings can't be confused
+        const uint64_t size = value.size();
+        seed = hash(&size, sizeof(size), seed);
+        return hash(value.data(), value.size(), seed);
+    }
+    /*!
+     * \brief Update the hash with the name, size and modification time of a
+     * file. Only the name is used if the file doesn't exist
+     */
+    static uint64_t hash_file(const std::string& file, uint64_t seed);
+    LDCache() {}
+    ~LDCache();
+    LDCache(const LDCache&) = delete;
+    LDCache& operator=(const LDCache&) = delete;
+    /*!
+     * \brief Generate the key used to identify a variant in the cache
+     * \param file_idx is the index of the reference genotype file
+     * \param byte_pos is the location of the variant within that file
+     * \return the key
+     */
+    static uint64_t variant_key(size_t file_idx, uint64_t byte_pos)
+    {
+        return (static_cast<uint64_t>(file_idx) << 48) | byte_pos;
+    }
+    /*!
+     * \brief Write the cache to file
+     * \param file is the name of the output file
+     * \param floor is the minimum r2 stored
+     * \param distance is the distance (in bp) used when building the cache
+     * \param founder_ct is the number of founders used for LD calculation
+     * \param fingerprint identifies the reference used
+     * \param chromosomes contains the LD matrix of each chromosome
+     */
+    static void write(const std::string& file, double floor, size_t distance,
+                      size_t founder_ct, const Fingerprint& fingerprint,
+                      const std::vector<Chromosome>& chromosomes);
+    /*!
+     * \brief Open an existing cache
+     * \param file is the name of the cache file
+     */
+    void load(const std::string& file);
+    bool loaded() const { return m_data != nullptr; }
+    double floor() const { return m_floor; }
+    size_t distance() const { return m_distance; }
+    size_t founder_ct() const { return m_founder_ct; }
+    const Fingerprint& fingerprint() const { return m_fingerprint; }
+    /*!
+     * \brief Locate a variant in the cache
+     * \param chr is the chromosome of the variant
+     * \param key is the key of the variant
+     * \return the variant, invalid if it is not in the cache
+     */
+    Variant find(size_t chr, uint64_t key) const;
+    /*!
+     * \brief Obtain the r2 between two variants on the same chromosome
+     * \param index is the index variant
+     * \param key is the key of the other variant
+     * \param r2 is the return value, 0 if the r2 is below the floor
+     * \return false if the other variant is not in the cache
+     */
+    bool r2(const Variant& index, uint64_t key, double& r2) const;
+
+private:
+    std::vector<ChromosomeView> m_chromosomes;
+    std::vector<char> m_buffer;
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    double m_floor = 0;
+    size_t m_distance = 0;
+    size_t m_founder_ct = 0;
+    Fingerprint m_fingerprint;
+    bool m_mapped = false;
+    void release();
+};
+
+#endif // LD_CACHE_HPP
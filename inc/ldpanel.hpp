@@ -0,0 +1,157 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef LDPANEL_HPP
+#define LDPANEL_HPP
+
+#include "genotype.hpp"
+#include "misc.hpp"
+#include "reporter.hpp"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Compact LD reference panel, generated by --make-ld-panel and read
+ * with --ld-type ldp.
+ *
+ * The panel only contains the founders that passed sample selection, stored
+ * as hard-coded 2-bit genotypes, together with the founder genotype counts of
+ * each variant. Sample parsing, decompression, hard coding and frequency
+ * calculation are therefore done once when the panel is built instead of in
+ * every run.
+ *
+ * File layout (native byte order, every section 8 byte aligned):
+ * header | genotypes | variant records (sorted by chr and loc) | variant ID
+ * and alleles. The file is memory mapped on POSIX systems and read into
+ * memory otherwise.
+ */
+class LDPanel : public Genotype
+{
+public:
+    /*!
+     * \brief Information of a variant stored in the panel
+     */
+    struct Record
+    {
+        uint64_t loc = 0;
+        // offset of the genotypes from the start of the file
+        uint64_t genotype = 0;
+        // offset of "ID\0A1\0A2\0" from the start of the string section
+        uint64_t name = 0;
+        uint32_t chr = 0;
+        uint32_t homcom = 0;
+        uint32_t het = 0;
+        uint32_t homrar = 0;
+        uint32_t missing = 0;
+        uint32_t reserved = 0;
+    };
+    /*!
+     * \brief Streaming writer for the panel. Variants must be added in
+     * ascending chr and loc order
+     */
+    class Writer
+    {
+    public:
+        /*!
+         * \brief Open the panel for writing
+         * \param file is the name of the panel
+         * \param founder_ct is the number of founders in the panel
+         */
+        Writer(const std::string& file, uintptr_t founder_ct);
+        /*!
+         * \brief Add a variant to the panel
+         * \param genotype contains the founder only genotypes, coded with
+         * respect to a1 and a2
+         */
+        void add(const std::string& rs, size_t chr, size_t loc,
+                 const std::string& a1, const std::string& a2,
+                 const uintptr_t* genotype);
+        /*!
+         * \brief Write the variant records and finalize the header
+         */
+        void close();
+
+    private:
+        std::ofstream m_out;
+        std::string m_file;
+        std::vector<Record> m_records;
+        std::vector<char> m_names;
+        std::vector<uintptr_t> m_founder_include2;
+        uintptr_t m_founder_ct = 0;
+        uintptr_t m_founder_ctl2 = 0;
+        uint64_t m_offset = 0;
+    };
+    LDPanel() {}
+    LDPanel(const GenoFile& geno, const Phenotype& pheno,
+            const std::string& delim, Reporter* reporter);
+    ~LDPanel();
+    LDPanel(const LDPanel&) = delete;
+    LDPanel& operator=(const LDPanel&) = delete;
+
+protected:
+    std::vector<char> m_buffer;
+    const char* m_data = nullptr;
+    const Record* m_records = nullptr;
+    const char* m_names = nullptr;
+    size_t m_size = 0;
+    size_t m_num_variant = 0;
+    uintptr_t m_panel_founder_ct = 0;
+    uintptr_t m_founder_ctl2 = 0;
+    bool m_mapped = false;
+    void load(const std::string& file);
+    void release();
+    const Record& record(const SNP& snp) const;
+    std::vector<Sample_ID> gen_sample_vector() override;
+    std::vector<std::string> genotype_files() const override
+    {
+        return {m_genotype_file_names.front() + ".ldp"};
+    }
+    void
+    gen_snp_vector(const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+                   const std::string& out_prefix,
+                   Genotype* target = nullptr) override;
+    bool calc_freq_gen_inter(const QCFiltering& filter_info, const std::string&,
+                             Genotype* target = nullptr) override;
+    void count_and_read_genotype(SNP&) override
+    {
+        throw std::runtime_error(
+            "Error: LD panel can only be used as LD reference");
+    }
+    inline void read_genotype(const SNP& snp, const uintptr_t,
+                              FileRead&, uintptr_t* __restrict,
+                              uintptr_t* __restrict genotype,
+                              uintptr_t* __restrict,
+                              bool is_ref = false) override
+    {
+        // all samples in the panel are founders, so the stored genotypes can
+        // be used as is
+        std::memcpy(genotype,
+                    m_data + static_cast<size_t>(snp.get_byte_pos(is_ref)),
+                    m_founder_ctl2 * sizeof(uintptr_t));
+    }
+    void read_score(PRS&, const std::vector<size_t>::const_iterator&,
+                    const std::vector<size_t>::const_iterator&, bool) override
+    {
+        throw std::runtime_error(
+            "Error: LD panel can only be used as LD reference");
+    }
+};
+
+#endif // LDPANEL_HPP
@@ -285,6 +285,32 @@ double dnorm(double x, double mu = 0.0, double sigma = 1.0, bool log = false);
 double qnorm(double p, double mu = 0.0, double sigma = 1.0,
              bool lower_tail = true, bool log_p = false);
 
+// Generalized Pareto approximation of permutation p-values (Knijnenburg et
+// al. 2009). Only worth using when fewer than gpd_min_exceedance permuted
+// statistics exceed the observed one
+constexpr size_t gpd_min_exceedance = 10;
+// largest number of permuted statistics used to fit the tail. The fit needs
+// one more statistic than that to place the threshold
+constexpr size_t gpd_max_tail = 250;
+/*!
+ * \brief Fit a generalized Pareto distribution to the upper tail of the
+ * permuted statistics and use it to approximate the p-value of obs. The tail
+ * is shrunk until the fit passes an Anderson-Darling goodness-of-fit test
+ * (parametric bootstrap, p > 0.05)
+ * \param null_stat contains at least the largest gpd_max_tail + 1 permuted
+ * statistics, in any order
+ * \param num_perm is the total number of permutations
+ * \param obs is the observed statistic
+ * \param seed is used for the parametric bootstrap
+ * \param p_value is the approximated p-value
+ * \param fit_p is the p-value of the goodness-of-fit test
+ * \return false if no acceptable fit was found, or if obs is beyond the
+ * fitted upper bound of the statistic
+ */
+bool gpd_tail_pvalue(std::vector<double> null_stat, const size_t num_perm,
+                     const double obs, const uint32_t seed, double& p_value,
+                     double& fit_p);
+
 // codes from stackoverflow
 inline std::vector<std::string> split(const std::string& seq,
                                       const std::string& separators = "\t ")
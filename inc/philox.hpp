@@ -0,0 +1,97 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef PHILOX_HPP
+#define PHILOX_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/*!
+ * \brief Counter based random number generator (Philox4x32-10, Salmon et al.
+ * 2011).
+ *
+ * Each stream is a pure function of (seed, stream), so that permutation i can
+ * be generated by any thread, in any order, as Philox(seed, i) without
+ * walking through the previous permutations. Satisfies the
+ * UniformRandomBitGenerator requirement and can therefore be used with
+ * std::shuffle and the std distributions.
+ */
+class Philox
+{
+public:
+    typedef uint32_t result_type;
+    Philox(const uint32_t seed, const uint64_t stream)
+        : m_key {{seed, 0}}
+        , m_stream {{static_cast<uint32_t>(stream),
+                     static_cast<uint32_t>(stream >> 32)}}
+    {
+    }
+    static constexpr result_type min()
+    {
+        return std::numeric_limits<result_type>::min();
+    }
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+    result_type operator()()
+    {
+        if (m_idx == 4)
+        {
+            generate();
+            m_idx = 0;
+        }
+        return m_output[m_idx++];
+    }
+
+private:
+    static constexpr uint32_t M0 = 0xD2511F53u;
+    static constexpr uint32_t M1 = 0xCD9E8D57u;
+    static constexpr uint32_t W0 = 0x9E3779B9u;
+    static constexpr uint32_t W1 = 0xBB67AE85u;
+    std::array<uint32_t, 2> m_key;
+    std::array<uint32_t, 2> m_stream;
+    std::array<uint32_t, 4> m_output {{0, 0, 0, 0}};
+    // number of blocks generated within the stream
+    uint64_t m_counter = 0;
+    size_t m_idx = 4;
+    void generate()
+    {
+        std::array<uint32_t, 4> ctr = {{static_cast<uint32_t>(m_counter),
+                                        static_cast<uint32_t>(m_counter >> 32),
+                                        m_stream[0], m_stream[1]}};
+        std::array<uint32_t, 2> key = m_key;
+        for (size_t round = 0; round < 10; ++round)
+        {
+            const uint64_t prod0 = static_cast<uint64_t>(M0) * ctr[0];
+            const uint64_t prod1 = static_cast<uint64_t>(M1) * ctr[2];
+            ctr = {{static_cast<uint32_t>(prod1 >> 32) ^ ctr[1] ^ key[0],
+                    static_cast<uint32_t>(prod1),
+                    static_cast<uint32_t>(prod0 >> 32) ^ ctr[3] ^ key[1],
+                    static_cast<uint32_t>(prod0)}};
+            key[0] += W0;
+            key[1] += W1;
+        }
+        m_output = ctr;
+        ++m_counter;
+    }
+};
+
+#endif // PHILOX_HPP
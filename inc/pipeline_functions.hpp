@@ -104,6 +104,31 @@ inline void initialize_reference(
     initialize_genotype(exclusion_regions, commander, reference_file, reporter,
                         target_file);
 }
+inline void initialize_ld_panel(
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+    const Commander& commander, Genotype* reference_file, Reporter& reporter)
+{
+    const std::string separator =
+        "==================================================";
+    // ambiguous variants are kept, as they are only resolved once the panel
+    // is matched against the base and target
+    reference_file =
+        &reference_file->keep_nonfounder(commander.nonfounders())
+             .keep_ambig(true)
+             .reference()
+             .read_all_snps();
+    reference_file->parse_chr_id_formula(commander.chr_id_formula());
+    reference_file->snp_extraction(commander.extract_file(),
+                                   commander.exclude_file());
+    reference_file->set_thresholds(commander.get_ref_qc());
+    reporter.report("Loading Genotype info from reference\n" + separator);
+    reference_file->load_samples();
+    const bool verbose = true;
+    reference_file->load_snps(commander.out(), exclusion_regions, verbose,
+                              reference_file);
+    reference_file->calc_freqs_and_intermediate(
+        commander.get_ref_qc(), commander.out(), verbose, reference_file);
+}
 
 std::string print_project_summary(std::vector<size_t>& significant_store)
 {
@@ -166,7 +191,84 @@ add_gene_set_info(const Commander& commander, Genotype* target_file,
     return {region.get_names(), num_regions};
 }
 
+/*!
+ * \brief Suffix of the output files of a setting of the clumping sweep
+ */
+inline std::string clump_setting_suffix(const ClumpSetting& setting)
+{
+    return ".r2_" + misc::to_string(setting.r2) + "."
+           + setting.distance_string();
+}
+
+inline void initialize_weight_target(
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+    const Commander& commander, Genotype* target_file, Reporter& reporter)
+{
+    const std::string separator =
+        "==================================================";
+    target_file =
+        &target_file->keep_nonfounder(commander.nonfounders())
+             .keep_ambig(commander.keep_ambig())
+             .set_prs_instruction(commander.get_prs_instruction())
+             .set_weight(commander.get_prs_instruction().genetic_model)
+             .read_all_snps();
+    target_file->parse_chr_id_formula(commander.chr_id_formula());
+    // the first column of the weight matrix is the variant ID, so only
+    // variants in the weight matrix are loaded
+    target_file->snp_extraction(commander.weight_matrix(), "");
+    target_file->set_thresholds(commander.get_target_qc());
+    reporter.report("Loading Genotype info from target for the weight "
+                    "matrix\n"
+                    + separator);
+    target_file->load_samples();
+    const bool verbose = true;
+    target_file->load_snps(commander.out(), exclusion_regions, verbose);
+    target_file->calc_freqs_and_intermediate(commander.get_target_qc(),
+                                             commander.out(), verbose);
+}
+
+inline void matrix_score(const Commander& commander, Genotype* target_file,
+                         const std::string& prefix, Reporter& reporter)
+{
+    if (!target_file->hard_coded())
+    {
+        throw std::runtime_error("Error: --weight-matrix only works with hard "
+                                 "coded genotypes");
+    }
+    std::vector<size_t> snp_index;
+    std::vector<bool> flipped;
+    Eigen::MatrixXd weights;
+    auto names = target_file->load_weight_matrix(
+        misc::load_stream(commander.weight_matrix()), snp_index, flipped,
+        weights);
+    if (snp_index.empty())
+    {
+        reporter.report("Warning: No variant from the weight matrix can be "
+                        "found in the target, skipping the matrix scoring");
+        return;
+    }
+    Eigen::MatrixXd scores;
+    std::vector<uint32_t> num_snp;
+    target_file->matrix_score(snp_index, flipped, weights, scores, num_snp);
+    target_file->finalize_matrix_score(scores, num_snp);
+    const std::string out_name = prefix + ".mscore";
+    auto out = misc::load_ostream(out_name);
+    (*out) << "FID\tIID";
+    for (auto&& name : names) { (*out) << "\t" << name; }
+    (*out) << "\n";
+    for (size_t i = 0; i < target_file->num_sample(); ++i)
+    {
+        (*out) << target_file->fid(i) << "\t" << target_file->iid(i);
+        for (Eigen::Index k = 0; k < scores.cols(); ++k)
+        { (*out) << "\t" << scores(static_cast<Eigen::Index>(i), k); }
+        (*out) << "\n";
+    }
+    reporter.report("Scores of " + std::to_string(names.size())
+                    + " weight set(s) written to " + out_name);
+}
+
 void print_prsice_header(const bool has_prevalence, const bool no_regress,
+                         const bool score_screen,
                          std::unique_ptr<std::ostream>& prsice_out)
 {
     (*prsice_out) << "Pheno\tSet\tThreshold";
@@ -176,10 +278,13 @@ void print_prsice_header(const bool has_prevalence, const bool no_regress,
         if (has_prevalence) (*prsice_out) << "\tR2.adj";
         (*prsice_out) << "\tP\tCoefficient\tStandard.Error";
     }
-    (*prsice_out) << "\tNum_SNP\n";
+    (*prsice_out) << "\tNum_SNP";
+    // indicate if the row is a score test approximation
+    if (score_screen && !no_regress) (*prsice_out) << "\tApprox";
+    (*prsice_out) << "\n";
 }
 void print_summary_header(const bool has_prevalence, const bool run_set_perm,
-                          const bool run_perm,
+                          const bool run_perm, const bool tail_approx,
                           std::unique_ptr<std::ostream>& summary_file)
 {
     (*summary_file) << "Phenotype\tSet\tThreshold\tPRS.R2";
@@ -188,7 +293,10 @@ void print_summary_header(const bool has_prevalence, const bool run_set_perm,
         << "\tFull.R2\tNull."
            "R2\tPrevalence\tCoefficient\tStandard.Error\tP\tNum_SNP";
     if (run_set_perm) (*summary_file) << "\tCompetitive.P";
+    if (run_set_perm && tail_approx)
+        (*summary_file) << "\tCompetitive.Tail.Fit";
     if (run_perm) (*summary_file) << "\tEmpirical-P";
+    if (run_perm && tail_approx) (*summary_file) << "\tEmpirical.Tail.Fit";
     (*summary_file) << "\n";
 }
 #endif // PIPELINE_FUNCTIONS_HPP
@@ -21,11 +21,13 @@
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "misc.hpp"
+#include "philox.hpp"
 #include "plink_common.hpp"
 #include "regression.hpp"
 #include "reporter.hpp"
 #include "snp.hpp"
 #include "storage.hpp"
+#include "thread_pool.hpp"
 #include "thread_queue.hpp"
 #include <Eigen/Dense>
 #include <algorithm>
@@ -37,6 +39,7 @@
 #include <map>
 #include <math.h>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <stdexcept>
 #include <stdio.h>
@@ -147,12 +150,16 @@ public:
      * encounter a more significant result
      * \param target is the target genotype file containing the PRS information
      * \param threshold is the current p-value threshold, use for output
-     * \param thread is the number of thread allowed
      * \param pheno_index is the index of the current phenotype
      * \param iter_threshold is the index of the current threshold
      */
     void regress_score(Genotype& target, const double threshold,
-                       const int thread, const size_t prs_result_idx);
+                       const size_t prs_result_idx);
+    /*!
+     * \brief Perform the logistic regression on the thresholds kept by the
+     * score test screening and select the best threshold among them
+     */
+    void refit_screened();
 
     void print_all_score(const size_t num_sample,
                          std::unique_ptr<std::ostream>& all_score_file,
@@ -293,6 +300,25 @@ protected:
         double se;
         double competitive_p;
         size_t num_snp; // num snp should always be positive
+        // result is a score test approximation, see --score-screen
+        bool score_test = false;
+        // goodness-of-fit p-value of the generalized Pareto tail used for the
+        // empirical and competitive p-value, -1 if the p-value was counted,
+        // see --perm-tail
+        double tail_fit_p = -1;
+        double competitive_tail_fit_p = -1;
+    };
+    /*!
+     * \brief Threshold kept by the score test screening, with everything
+     * required to refit it once all thresholds are screened
+     */
+    struct screened_threshold
+    {
+        Eigen::VectorXd prs;
+        // score of all samples, including those not used in the regression
+        std::vector<double> sample_score;
+        double stat;
+        size_t result_idx;
     };
     struct prsice_summary
     {
@@ -306,6 +332,68 @@ protected:
         std::string set;
         bool has_competitive;
     };
+    /*!
+     * \brief Number of times the permuted T is bigger than the observed T of
+     * each set. With --adaptive-perm, the permutations are also recorded, such
+     * that we can find the permutation where each set reached the required
+     * number of exceedances, regardless of the order they were performed in.
+     * With --perm-tail, the largest permuted T of each set size are kept for
+     * the generalized Pareto approximation
+     */
+    struct competitive_hits
+    {
+        competitive_hits() {}
+        competitive_hits(const size_t num_set, const bool record,
+                         const bool tail = false)
+            : count(num_set, 0), perm_idx(record ? num_set : 0), keep_tail(tail)
+        {
+        }
+        std::vector<size_t> count;
+        std::vector<std::vector<size_t>> perm_idx;
+        bool keep_tail = false;
+        // key: set size, value: min heap of at most gpd_max_tail + 1 T
+        std::map<size_t, std::vector<double>> null_tail;
+        void add(const size_t set_idx, const size_t perm)
+        {
+            ++count[set_idx];
+            if (!perm_idx.empty()) perm_idx[set_idx].push_back(perm);
+        }
+        void add_null(const size_t set_size, const double t_value)
+        {
+            if (!keep_tail) return;
+            auto&& heap = null_tail[set_size];
+            if (heap.size() <= misc::gpd_max_tail)
+            { heap.push_back(t_value); }
+            else if (t_value > heap.front())
+            {
+                std::pop_heap(heap.begin(), heap.end(), std::greater<double>());
+                heap.back() = t_value;
+            }
+            else
+                return;
+            std::push_heap(heap.begin(), heap.end(), std::greater<double>());
+        }
+        void merge_tail(const competitive_hits& other)
+        {
+            for (auto&& tail : other.null_tail)
+            {
+                for (auto&& t_value : tail.second)
+                { add_null(tail.first, t_value); }
+            }
+        }
+        void merge(const competitive_hits& other)
+        {
+            merge_tail(other);
+            for (size_t i = 0; i < count.size(); ++i)
+            {
+                count[i] += other.count[i];
+                if (perm_idx.empty()) continue;
+                perm_idx[i].insert(perm_idx[i].end(),
+                                   other.perm_idx[i].begin(),
+                                   other.perm_idx[i].end());
+            }
+        }
+    };
     struct column_file_info
     {
         long long header_length;
@@ -337,7 +425,10 @@ protected:
             (*prsice_out) << "\tNA";
         }
         (*prsice_out) << "\t" << res.p << "\t" << res.coefficient << "\t"
-                      << res.se << "\t" << m_num_snp_included << "\n";
+                      << res.se << "\t" << res.num_snp;
+        if (m_prs_info.score_screen != 0)
+            (*prsice_out) << "\t" << (res.score_test ? 1 : 0);
+        (*prsice_out) << "\n";
     }
     // store the number of non-sig, margin sig, and sig pathway & phenotype
     static std::mutex lock_guard;
@@ -358,6 +449,7 @@ protected:
     Eigen::VectorXd m_phenotype;
     std::unordered_map<std::string, size_t> m_sample_with_phenotypes;
     std::vector<prsice_result> m_prs_results;
+    std::vector<screened_threshold> m_screened;
     std::vector<prsice_summary> m_prs_summary; // for multiple traits
     std::vector<double> m_perm_result;
     std::vector<double> m_permuted_pheno;
@@ -368,6 +460,20 @@ protected:
     column_file_info m_all_file, m_best_file;
     double m_previous_percentage = -1.0;
     double m_previous_competitive_percentage = -1.0;
+    // decomposed covariates of quantitative traits, see Regression::ResidualLm
+    Regression::ResidualLm m_residual_lm;
+    // logistic regression of binary traits, see Regression::WarmGlm
+    Regression::WarmGlm m_warm_glm;
+    // residualized permuted phenotypes, see Regression::PermutedLm
+    Regression::PermutedLm m_perm_lm;
+    // permuted phenotypes and their null logistic fit for --logit-perm, see
+    // Regression::PermutedGlm
+    Regression::PermutedGlm m_perm_glm;
+    // number of permuted phenotypes that fit into --memory at once
+    size_t m_perm_block_size = 0;
+    // true if all permuted phenotypes fit into a single block, which is then
+    // reused for all thresholds
+    bool m_perm_block_cached = false;
     double m_null_r2 = 0.0;
     double m_null_p = 1.0;
     double m_null_se = 0.0;
@@ -398,8 +504,40 @@ protected:
      */
     void permutation(const int n_thread);
 
+    /*!
+     * \brief Calculate the permuted t-value of all permutations with the
+     * block of residualized permuted phenotypes
+     * \return false if the PRS is collinear with the covariates, in which case
+     * each permutation has to be regressed separately
+     */
+    bool batch_permutation();
+    /*!
+     * \brief Decompose the covariates and, if the block of all permuted
+     * phenotypes fits into --memory, generate it once for all thresholds
+     * \param covariates is the intercept and covariates of the regression
+     */
+    void init_perm_block(const Eigen::MatrixXd& covariates);
+    /*!
+     * \brief Generate permutation start to start + num_perm - 1 and load them
+     * into m_perm_lm or m_perm_glm. The phenotypes are the same as those used by
+     * run_null_perm
+     */
+    void load_perm_block(const size_t start, const size_t num_perm);
+    /*!
+     * \brief Absolute statistic of the current PRS for each permuted
+     * phenotype of the loaded block, from m_perm_glm with --logit-perm and
+     * from m_perm_lm otherwise
+     * \return false if the PRS is collinear with the covariates
+     */
+    bool perm_abs_t(Eigen::VectorXd& t_value) const;
     void slow_print_best(std::unique_ptr<std::ostream>& best_file,
                          Genotype& target);
+    /*!
+     * \brief Keep the current threshold for refitting if its score test
+     * statistic is among the best --score-screen thresholds
+     */
+    void keep_screened(Genotype& target, const double stat,
+                       const size_t prs_result_idx);
     double get_adjusted_r2(const double r2, const double top, const double bot)
     {
         return top * r2 / (1 + bot * r2);
@@ -461,10 +599,21 @@ protected:
     void subject_set_perm(T& progress_observer, Genotype& target,
                           std::vector<size_t> background,
                           std::map<size_t, std::vector<size_t>>& set_index,
-                          std::vector<size_t>& set_perm_res,
+                          competitive_hits& set_perm_res,
                           const std::vector<double>& obs_t_value,
-                          const std::random_device::result_type seed,
-                          const Regress& decomposed, const size_t num_perm);
+                          const Regress& decomposed, const size_t start,
+                          const size_t num_perm);
+    /*!
+     * \brief Perform competitive permutation start to start + num_perm - 1 on
+     * the sets in set_index
+     * \param set_perm_res is where the exceedances are added to
+     */
+    void competitive_permutation(
+        Genotype& target, const std::vector<size_t>& background,
+        std::map<size_t, std::vector<size_t>>& set_index,
+        const std::vector<double>& obs_t_value, const Regress& decomposed,
+        const int num_thread, const size_t start, const size_t num_perm,
+        competitive_hits& set_perm_res);
     /*!
      * \brief Once PRS analysis and permutation has been performed for all
      * p-value thresholds we will run this function to calculate the
@@ -487,10 +636,11 @@ protected:
      * standardized PRS
      */
     void
-    produce_null_prs(Thread_Queue<std::pair<std::vector<double>, size_t>>& q,
-                     Genotype& target, std::vector<size_t> background,
-                     size_t num_consumer,
-                     std::map<size_t, std::vector<size_t>>& set_index);
+    produce_null_prs(
+        Thread_Queue<std::tuple<std::vector<double>, size_t, size_t>>& q,
+        Genotype& target, std::vector<size_t> background, size_t num_consumer,
+        std::map<size_t, std::vector<size_t>>& set_index, const size_t start,
+        const size_t num_perm);
     /*!
      * \brief This is the "consumer" function responsible for reading in the PRS
      * and perform the regression analysis
@@ -504,11 +654,11 @@ protected:
      * for a specific set
      * \param is_binary indicate if the phenotype is binary or not
      */
-    void consume_prs(Thread_Queue<std::pair<std::vector<double>, size_t>>& q,
-                     const Regress& decomposed,
-                     std::map<size_t, std::vector<size_t>>& set_index,
-                     const std::vector<double>& obs_t_value,
-                     std::vector<size_t>& set_perm_res);
+    void consume_prs(
+        Thread_Queue<std::tuple<std::vector<double>, size_t, size_t>>& q,
+        const Regress& decomposed,
+        std::map<size_t, std::vector<size_t>>& set_index,
+        const std::vector<double>& obs_t_value, competitive_hits& set_perm_res);
 
     void null_set_no_thread(
         Genotype& target, const size_t num_background,
@@ -523,34 +673,18 @@ protected:
                                             Eigen::VectorXd& beta,
                                             Eigen::VectorXd& effects);
     /*!
-     * \brief The "producer" for generating the permuted phenotypes
-     * \param q is the queue for contacting the consumers
-     * \param num_consumer is the number of consumer
-     */
-    void gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                        size_t num_consumer);
-    /*!
-     * \brief The "consumer" for calculating the T-value on permuted phenotypes
-     * \param q is the queue where the producer generated the permuted phenotype
-     * \param decomposed is the pre-computed decomposition
-     * \param rank is the pre-computed rank
-     * \param pre_se is the pre-computed SE matrix
-     * \param run_glm is a boolean indicate if we want to run logistic
-     * regression
-     */
-    void consume_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                            const Regress& decomposed, bool run_glm);
-    /*!
-     * \brief Funtion to perform single threaded permutation
+     * \brief Funtion to perform permutation start to end - 1. Permutation i
+     * only depends on the seed and i, so the permutations can be split
+     * between any number of threads
      * \param decomposed is the pre-decomposed independent matrix. If run glm is
      * true, this will be ignored
-     * \param rank is the rank of the decomposition
-     * \param pre_se is the pre-computed SE matrix required for calculating the
-     * final SE
      * \param run_glm indicate if we want to run GLM instead of using
      * precomputed matrix
+     * \param start is the first permutation to perform
+     * \param end is one past the last permutation to perform
      */
-    void run_null_perm_no_thread(const Regress& decomposed, const bool run_glm);
+    void run_null_perm(const Regress& decomposed, const bool run_glm,
+                       const size_t start, const size_t end);
 
     void parse_pheno(const std::string& pheno, std::vector<double>& pheno_store,
                      int& max_pheno_code);
@@ -563,7 +697,15 @@ protected:
     void reset_result_containers(const Genotype& target,
                                  const size_t region_idx);
 
-    void fisher_yates(std::vector<size_t>& idx, std::mt19937& g, size_t n);
+    /*!
+     * \brief Select n random elements without replacement by moving them to
+     * the front of idx. The swaps are recorded in swapped such that
+     * undo_fisher_yates can restore idx
+     */
+    void fisher_yates(std::vector<size_t>& idx, Philox& g, size_t n,
+                      std::vector<size_t>& swapped);
+    void undo_fisher_yates(std::vector<size_t>& idx,
+                           const std::vector<size_t>& swapped);
     template <typename T>
     class dummy_reporter
     {
@@ -67,6 +67,14 @@ public:
     virtual ~Region();
     static void generate_exclusion(std::vector<IITree<size_t, size_t>>& cr,
                                    const std::string& exclusion_range);
+    /*!
+     * \brief Read the boundaries of the LD blocks used for partitioned
+     * clumping
+     * \param cr is the return value, containing one tree per chromosome
+     * \param ld_block_file is the BED file containing the LD blocks
+     */
+    static void generate_ld_blocks(std::vector<IITree<size_t, size_t>>& cr,
+                                   const std::string& ld_block_file);
     size_t generate_regions(
         const std::unordered_map<std::string, size_t>& included_snp_idx,
         const std::vector<SNP>& included_snps, const size_t max_chr);
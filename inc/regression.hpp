@@ -22,20 +22,257 @@
 #include "fastlm.hpp"
 #include "glm.hpp"
 #include "misc.hpp"
+#include "thread_pool.hpp"
 #include <Eigen/Dense>
+#include <atomic>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <math.h>
+#include <memory>
 #include <stdexcept>
+#include <vector>
 namespace Regression
 {
 void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
-         double& r2, double& coeff, double& standard_error, int thread = 1);
+         double& r2, double& coeff, double& standard_error);
 void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
             double& r2, double& r2_adjust, double& coeff,
-            double& standard_error, int thread, bool intercept, int type = 0);
+            double& standard_error, bool intercept, int type = 0);
+
+/*!
+ * \brief Linear regression of y on the covariates and one extra predictor,
+ * for many predictors.
+ *
+ * The covariates are decomposed once and y is residualized against them, so
+ * that each predictor only needs to be projected out of the covariate space
+ * (Frisch-Waugh-Lovell), which takes O(n*p) instead of a new QR
+ * decomposition of the full design matrix. The covariates must contain the
+ * intercept.
+ */
+class ResidualLm
+{
+public:
+    ResidualLm() {}
+    ResidualLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& covariates);
+    /*!
+     * \brief Regress y on the covariates and x, giving the same result as
+     * fastLm on [intercept, x, covariates]
+     * \return false if x is (almost) within the span of the covariates, in
+     * which case which column the QR drops is decided by the pivoting and
+     * fastLm should be used instead
+     */
+    bool fit(const Eigen::VectorXd& x, double& p_value, double& r2,
+             double& r2_adjust, double& coeff, double& standard_error) const;
+    bool empty() const { return m_q.size() == 0; }
+
+private:
+    // orthonormal basis of the column space of the covariates
+    Eigen::MatrixXd m_q;
+    Eigen::VectorXd m_y_resid;
+    double m_tss = 0.0;
+    Eigen::Index m_rank = 0;
+    Eigen::VectorXd project_out(const Eigen::VectorXd& x) const
+    {
+        // project twice to recover the precision lost when x is close to the
+        // covariate space
+        Eigen::VectorXd resid = x - m_q * (m_q.transpose() * x);
+        resid -= m_q * (m_q.transpose() * resid);
+        return resid;
+    }
+};
+
+/*!
+ * \brief Linear regression of a block of (permuted) phenotypes on the
+ * covariates and one extra predictor.
+ *
+ * Each column of the block is residualized against the covariates when it
+ * is loaded, so the t-statistics of all columns for a predictor only take a
+ * single matrix-vector product with the residualized block instead of one
+ * regression per column.
+ */
+class PermutedLm
+{
+public:
+    PermutedLm() {}
+    explicit PermutedLm(const Eigen::MatrixXd& covariates);
+    /*!
+     * \brief Residualize and store the phenotype block, replacing the
+     * previous block
+     */
+    void load(const Eigen::MatrixXd& y);
+    /*!
+     * \brief Calculate the absolute t-statistic of x for each column of the
+     * block, same as the one from fastLm on [intercept, x, covariates]
+     * \return false if x is (almost) within the span of the covariates, in
+     * which case fastLm should be used instead
+     */
+    bool abs_t(const Eigen::VectorXd& x, Eigen::VectorXd& t_value) const;
+    // number of phenotypes in the current block
+    Eigen::Index size() const { return m_y_resid.cols(); }
+    bool empty() const { return m_q.size() == 0; }
+
+private:
+    // orthonormal basis of the column space of the covariates
+    Eigen::MatrixXd m_q;
+    Eigen::MatrixXd m_y_resid;
+    // residual sum of square of the covariate only model of each column
+    Eigen::VectorXd m_y_ss;
+    Eigen::Index m_rank = 0;
+};
+
+// largest change of the predictor coefficient in the second Newton step, in
+// standard errors, for the estimate after that step to be used instead of
+// the full logistic regression. As Newton converges quadratically, the Wald
+// statistic after that step is then within a fraction of one_step_tol of the
+// one of glm
+constexpr double one_step_tol = 1e-2;
+
+/*!
+ * \brief Logistic regression of a block of (permuted) binary phenotypes on
+ * the covariates and one extra predictor.
+ *
+ * The covariate only (null) model of each column is fitted when the block is
+ * loaded, and its coefficients, residuals and IRLS weights are kept, such
+ * that the score statistics and the one step (Newton) estimates of all
+ * columns for a predictor take a few matrix-vector products. A second Newton
+ * step is taken from the one step estimate of each column, and columns where
+ * it moves the coefficient by more than one_step_tol standard errors are
+ * refitted with the IRLS warm started from the one step estimate.
+ */
+class PermutedGlm
+{
+public:
+    PermutedGlm() {}
+    /*!
+     * \brief Prepare the null model
+     * \param covariates is the intercept and covariates of the regression
+     */
+    explicit PermutedGlm(const Eigen::MatrixXd& covariates);
+    /*!
+     * \brief Fit the null model of each column and store the block,
+     * replacing the previous block
+     */
+    void load(const Eigen::MatrixXd& y);
+    /*!
+     * \brief Calculate the absolute z of glm on [intercept, x, covariates]
+     * for each column of the block. For columns within one_step_tol after
+     * the second Newton step, this is the Wald statistic of that step
+     * \return false if x is (almost) within the span of the covariates, in
+     * which case glm should be used instead
+     */
+    bool abs_t(const Eigen::VectorXd& x, Eigen::VectorXd& t_value) const;
+    // number of phenotypes in the current block
+    Eigen::Index size() const { return m_y.cols(); }
+    bool empty() const { return m_covariates.size() == 0; }
+    // number of columns refitted by the last abs_t
+    size_t refitted() const { return m_refitted; }
+
+private:
+    Eigen::MatrixXd m_covariates;
+    Eigen::MatrixXd m_y;
+    // coefficients, residuals and IRLS weights of the null model of each
+    // column
+    Eigen::MatrixXd m_null_beta;
+    Eigen::MatrixXd m_resid;
+    Eigen::MatrixXd m_weight;
+    // inverse of the weighted cross product of the covariates of each
+    // column, stored side by side
+    Eigen::MatrixXd m_cov_info_inv;
+    mutable size_t m_refitted = 0;
+    // run job(begin, end) on the columns of the block with the thread pool
+    template <typename Job>
+    void for_each_column(const Eigen::Index num_col, Job job) const;
+};
+
+/*!
+ * \brief Logistic regression of y on [intercept, x, covariates] for many x.
+ *
+ * The covariate only (null) model is fitted once and the full model keeps its
+ * workspace between fits. Each fit is warm started from whichever of the null
+ * coefficients and the previous fit has the smaller deviance, so that the
+ * cumulative PRS of successive thresholds usually converges within a few
+ * iterations. Falls back to the default starting values when the warm start
+ * fails.
+ */
+class WarmGlm
+{
+public:
+    WarmGlm() {}
+    /*!
+     * \brief Fit the null model and prepare the workspace of the full model
+     * \param x is the design matrix, with the intercept as the first column
+     * and the predictor as the second column. The content of the second
+     * column is ignored
+     */
+    WarmGlm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x);
+    /*!
+     * \brief Statistic of the first covariate in the null model, same as
+     * glm on [intercept, covariates]. Only available when there are
+     * covariates
+     */
+    void null_stat(double& p_value, double& r2, double& coeff,
+                   double& standard_error) const;
+    /*!
+     * \brief Regress y on [intercept, x, covariates], giving the same
+     * coefficient and r2 as glm. The standard error is derived from the IRLS
+     * weights at the fitted coefficients, whereas glm uses those of its last
+     * iteration, so the two differ by the order of the convergence tolerance
+     */
+    void fit(const Eigen::VectorXd& x, double& p_value, double& r2,
+             double& coeff, double& standard_error);
+    /*!
+     * \brief Score test of x against the null model, which only takes
+     * O(n*p) as no iteration is required. The coefficient is the one step
+     * estimate from the null model and r2 uses the score statistic as the
+     * approximated reduction in deviance
+     * \return false if x is (almost) within the span of the covariates, in
+     * which case fit should be used instead
+     */
+    bool score(const Eigen::VectorXd& x, double& p_value, double& r2,
+               double& coeff, double& standard_error) const;
+    /*!
+     * \brief Take a second Newton step from the one step estimate of score,
+     * and use the Wald statistic of that step when it moves the coefficient
+     * by less than one_step_tol standard errors, otherwise fit the full
+     * model. r2 is then the approximation of score
+     */
+    void one_step_fit(const Eigen::VectorXd& x, double& p_value, double& r2,
+                      double& coeff, double& standard_error);
+    bool empty() const { return m_glm == nullptr; }
+    // number of IRLS iterations used by the last fit
+    int iterations() const { return m_iter; }
+
+private:
+    std::unique_ptr<GLM<Binomial>> m_glm;
+    // orthonormal basis of the weighted null design matrix
+    Eigen::MatrixXd m_score_q;
+    // square root of the IRLS weights and the residuals of the null model
+    Eigen::VectorXd m_score_weight;
+    Eigen::VectorXd m_score_resid;
+    // design matrix, phenotype and linear predictor of the null model, for
+    // the second Newton step
+    Eigen::MatrixXd m_design;
+    Eigen::VectorXd m_y;
+    Eigen::VectorXd m_null_eta;
+    Eigen::VectorXd m_one_step_eta;
+    Eigen::VectorXd m_null_start;
+    Eigen::VectorXd m_previous;
+    double m_null_dev = 0.0;
+    // deviance of the intercept only model, used for the r2
+    double m_intercept_dev = 0.0;
+    double m_null_p = 1.0;
+    double m_null_r2 = 0.0;
+    double m_null_coeff = 0.0;
+    double m_null_se = 0.0;
+    int m_iter = 0;
+    bool m_has_covariate = false;
+    // warm start from the given coefficients, return false if the warm
+    // started IRLS does not converge
+    bool warm_solve(const Eigen::VectorXd& start);
+    void init_score(const Eigen::VectorXd& y, const Eigen::MatrixXd& null_x);
+};
 }
 
 #endif /* PRSICE_REGRESSION_H_ */
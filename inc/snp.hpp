@@ -442,16 +442,10 @@ public:
             return allele; // Cannot flip, so will just return it as is
     }
     std::vector<uintptr_t>& mod_genotype() { return m_genotype; }
-    void set_genotype_storage(IndividualGenotype* geno)
-    {
-        m_genotype_storage = geno;
-    }
-    uintptr_t* current_genotype()
-    {
-        if (m_genotype_storage == nullptr) return nullptr;
-        return m_genotype_storage->get_geno();
-    }
-    void freed_geno_storage(GenotypePool& pool)
+    void set_genotype_storage(uintptr_t* geno) { m_genotype_storage = geno; }
+    uintptr_t* current_genotype() { return m_genotype_storage; }
+    template <typename Pool>
+    void freed_geno_storage(Pool& pool)
     {
         pool.free(m_genotype_storage);
         m_genotype_storage = nullptr;
@@ -466,7 +460,7 @@ private:
     FileInfo m_target;
     FileInfo m_reference;
     SNPClump m_clump_info;
-    IndividualGenotype* m_genotype_storage = nullptr;
+    uintptr_t* m_genotype_storage = nullptr;
     std::vector<uintptr_t> m_genotype;
     std::string m_alt;
     std::string m_ref;
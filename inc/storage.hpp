@@ -19,9 +19,13 @@
 #define PRSICE_INC_STORAGE_HPP_
 #include "enumerators.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <memory>
+#include <new>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 // From http://stackoverflow.com/a/12927952/1441789
@@ -42,11 +46,167 @@ struct Regress
     Eigen::VectorXd se_base;
 };
 
-struct PRS
+/*!
+ * \brief Allocator returning cacheline (64 byte) aligned storage such that the
+ *        PRS arrays can be processed with aligned SIMD load
+ */
+template <typename T, std::size_t Align = 64>
+struct AlignedAllocator
 {
-    double prs;
-    size_t num_snp;
-    PRS() : prs(0.0), num_snp(0) {}
+    typedef T value_type;
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Align> other;
+    };
+    AlignedAllocator() noexcept {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept
+    {
+    }
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return false;
+    }
+};
+
+/*!
+ * \brief Storage of the PRS and number of SNPs included for each sample. The
+ *        score and the count are stored in two separated aligned arrays
+ *        instead of an array of struct, which allow the per-sample loops to
+ *        be vectorized and reduce the footprint from 16 to 12 bytes per
+ *        sample (20 bytes when compensated). When compensated is set, scores
+ *        are accumulated with Kahan summation, which keep the error
+ *        independent of the number of SNPs added
+ */
+class PRS
+{
+public:
+    PRS() {}
+    PRS(const size_t num_sample, const bool compensated = false)
+    {
+        set_compensated(compensated);
+        resize(num_sample);
+    }
+    void resize(const size_t num_sample)
+    {
+        m_score.resize(num_sample, 0.0);
+        m_num_snp.resize(num_sample, 0);
+        if (m_compensated) m_compensation.resize(num_sample, 0.0);
+    }
+    void set_compensated(const bool compensated)
+    {
+        m_compensated = compensated;
+        if (m_compensated) m_compensation.assign(m_score.size(), 0.0);
+        else
+            m_compensation.clear();
+    }
+    bool compensated() const { return m_compensated; }
+    size_t size() const { return m_score.size(); }
+    bool empty() const { return m_score.empty(); }
+    double score(const size_t i) const { return m_score[i]; }
+    uint32_t num_snp(const size_t i) const { return m_num_snp[i]; }
+    double* score_data() { return m_score.data(); }
+    uint32_t* num_snp_data() { return m_num_snp.data(); }
+    /*!
+     * \brief Overwrite the score and count of the i th sample
+     */
+    void assign(const size_t i, const double score, const uint32_t num_snp)
+    {
+        if (m_compensated) assign<true>(i, score, num_snp);
+        else
+            assign<false>(i, score, num_snp);
+    }
+    /*!
+     * \brief Add score and count to the i th sample
+     */
+    void add(const size_t i, const double score, const uint32_t num_snp)
+    {
+        if (m_compensated) add<true>(i, score, num_snp);
+        else
+            add<false>(i, score, num_snp);
+    }
+    /*!
+     * \brief Version of assign with the accumulator resolved at compile
+     *        time, for the per-sample scoring kernels. compensated must
+     *        match compensated()
+     */
+    template <bool compensated>
+    void assign(const size_t i, const double score, const uint32_t num_snp)
+    {
+        m_score[i] = score;
+        m_num_snp[i] = num_snp;
+        if constexpr (compensated) m_compensation[i] = 0.0;
+    }
+    /*!
+     * \brief Version of add with the accumulator resolved at compile time,
+     *        for the per-sample scoring kernels. compensated must match
+     *        compensated()
+     */
+    template <bool compensated>
+    void add(const size_t i, const double score, const uint32_t num_snp)
+    {
+        m_num_snp[i] += num_snp;
+        if constexpr (!compensated) { m_score[i] += score; }
+        else
+        {
+            const double y = score - m_compensation[i];
+            const double t = m_score[i] + y;
+            m_compensation[i] = (t - m_score[i]) - y;
+            m_score[i] = t;
+        }
+    }
+    /*!
+     * \brief Add the same score and count to all samples
+     */
+    void add_all(const double score, const uint32_t num_snp)
+    {
+        const size_t num_sample = m_score.size();
+        if (m_compensated)
+        {
+            for (size_t i = 0; i < num_sample; ++i)
+            { add<true>(i, score, num_snp); }
+            return;
+        }
+        double* score_ptr = m_score.data();
+        uint32_t* num_snp_ptr = m_num_snp.data();
+        for (size_t i = 0; i < num_sample; ++i)
+        {
+            score_ptr[i] += score;
+            num_snp_ptr[i] += num_snp;
+        }
+    }
+    /*!
+     * \brief Set the score and count of all samples to 0
+     */
+    void reset()
+    {
+        std::fill(m_score.begin(), m_score.end(), 0.0);
+        std::fill(m_num_snp.begin(), m_num_snp.end(), 0);
+        std::fill(m_compensation.begin(), m_compensation.end(), 0.0);
+    }
+
+private:
+    std::vector<double, AlignedAllocator<double>> m_score;
+    std::vector<uint32_t, AlignedAllocator<uint32_t>> m_num_snp;
+    // running compensation for Kahan summation
+    std::vector<double, AlignedAllocator<double>> m_compensation;
+    bool m_compensated = false;
 };
 
 struct Sample_ID
@@ -116,7 +276,15 @@ struct Permutations
 {
     size_t num_permutation = 0;
     std::random_device::result_type seed = std::random_device()();
+    // maximum memory (in bytes) for the block of permuted phenotypes, 0 if
+    // unlimited
+    size_t memory = 0;
+    // stop the competitive permutation of a set after this number of
+    // exceedances, 0 to always perform all permutations
+    size_t adaptive_hit = 0;
     int logit_perm = false;
+    // approximate small empirical p-values with a generalized Pareto fit
+    int tail_approx = false;
     bool run_perm = false;
     bool run_set_perm = false;
 };
@@ -175,6 +343,10 @@ struct CalculatePRS
     int no_regress = false;
     int non_cumulate = false;
     int use_ref_maf = false;
+    int kahan_sum = false;
+    // number of thresholds refitted after the score test screening of
+    // binary traits, 0 to fit all thresholds
+    size_t score_screen = 0;
 };
 
 struct QCFiltering
@@ -190,15 +362,50 @@ struct QCFiltering
     bool provided_dose_thres = false;
 };
 
+/*!
+ * \brief One setting of the clumping sweep
+ */
+struct ClumpSetting
+{
+    double r2 = 0.1;
+    size_t distance = 250000;
+    // unit the distance was provided in, as a power of 1000 (0 for bp, 1 for
+    // kb and 2 for mb)
+    size_t unit_power = 1;
+    // distance in the unit it was provided in, e.g. 250kb
+    std::string distance_string() const
+    {
+        const char* unit[] = {"bp", "kb", "mb"};
+        const size_t power = std::min<size_t>(unit_power, 2);
+        std::ostringstream out;
+        out << static_cast<double>(distance) / std::pow(1000.0, power)
+            << unit[power];
+        return out.str();
+    }
+};
 struct Clumping
 {
+    // settings of the clumping sweep, empty if only one setting is used
+    std::vector<ClumpSetting> sweep;
+    // BED file of the LD blocks, empty if clumping isn't partitioned
+    std::string ld_block = "";
+    std::string ld_cache = "";
+    // prefix of the LD panel to generate, empty if not required
+    std::string ld_panel = "";
     double r2 = 0.1;
     double proxy = 0.0;
     double pvalue = 1;
+    double ld_cache_r2 = 0.0;
     size_t distance = 250000;
+    // maximum memory (in bytes) for the reference genotypes, 0 if unlimited
+    size_t memory = 0;
     int no_clump = false;
+    // calculate the LD from the expected dosages instead of hard coded
+    // genotypes
+    int ld_dosage = false;
     bool use_proxy = false;
     bool provided_distance = false;
+    bool provided_ld_cache_r2 = false;
 };
 // Passkey idiom, allow safer access to
 // the raw pointer info in SNP
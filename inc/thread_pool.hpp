@@ -0,0 +1,309 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * \brief Process-wide work-stealing thread pool, sized once by --thread.
+ *
+ * Each worker owns a deque of tasks. It takes its own tasks from the back
+ * and, once it runs out, steals from the front of the other workers'
+ * deques, so that uneven tasks are balanced without a central queue.
+ *
+ * Nested parallelism rules, such that the pool never oversubscribes the
+ * cores:
+ *  - parallel_for called from within a task runs inline on that task
+ *  - a task waiting on a TaskGroup runs other tasks while it waits, so
+ *    nested waits cannot deadlock
+ *  - Eigen stays single threaded, all parallelism goes through the pool
+ *
+ * Without workers (the default, and with --thread 1), every task runs inline
+ * on the submitting thread.
+ */
+class ThreadPool
+{
+public:
+    static ThreadPool& global()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+    ThreadPool() = default;
+    explicit ThreadPool(const size_t num_thread) { resize(num_thread); }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool() { stop(); }
+    /*!
+     * \brief Restart the pool with num_thread workers. Must not be called
+     * while tasks are running
+     */
+    void resize(const size_t num_thread)
+    {
+        if (num_thread == m_workers.size()) return;
+        stop();
+        m_stop = false;
+        m_queues.clear();
+        for (size_t i = 0; i < num_thread; ++i)
+        { m_queues.emplace_back(std::make_unique<TaskDeque>()); }
+        for (size_t i = 0; i < num_thread; ++i)
+        { m_workers.emplace_back(&ThreadPool::worker_loop, this, i); }
+    }
+    size_t size() const { return m_workers.size(); }
+    // true if the calling thread is a worker of any pool
+    static bool in_task() { return current_worker().pool != nullptr; }
+
+    /*!
+     * \brief Set of tasks that can be waited on together. The first exception
+     * thrown by a task is rethrown by wait
+     */
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(ThreadPool& pool = ThreadPool::global())
+            : m_pool(pool)
+        {
+        }
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+        ~TaskGroup()
+        {
+            // tasks refer to the group, so they must be done before it is
+            // destroyed, even when we are unwinding from an exception
+            try
+            {
+                wait();
+            }
+            catch (...)
+            {
+            }
+        }
+        template <typename Task>
+        void run(Task&& task)
+        {
+            if (m_pool.size() == 0)
+            {
+                execute(task);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_pending;
+            }
+            m_pool.submit([this, task]() mutable {
+                execute(task);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_pending == 0) m_cond.notify_all();
+            });
+        }
+        void wait()
+        {
+            auto&& self = current_worker();
+            if (self.pool == &m_pool)
+            {
+                // help the pool instead of blocking one of its workers
+                while (pending() != 0)
+                {
+                    if (!m_pool.run_one(self.idx)) std::this_thread::yield();
+                }
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this] { return m_pending == 0; });
+            }
+            std::exception_ptr error;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::swap(error, m_error);
+            }
+            if (error) std::rethrow_exception(error);
+        }
+
+    private:
+        ThreadPool& m_pool;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::exception_ptr m_error;
+        size_t m_pending = 0;
+        size_t pending()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_pending;
+        }
+        template <typename Task>
+        void execute(Task& task)
+        {
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error) m_error = std::current_exception();
+            }
+        }
+    };
+
+    /*!
+     * \brief Run job(chunk_begin, chunk_end) over num_chunk consecutive
+     * ranges of [begin, end) and wait for all of them. Runs inline when
+     * called from within a task, as the outer loop already uses the workers
+     * \param num_chunk is the number of ranges, default to the number of
+     * workers
+     */
+    template <typename Job>
+    void parallel_for(const size_t begin, const size_t end, Job job,
+                      size_t num_chunk = 0)
+    {
+        if (end <= begin) return;
+        const size_t num_job = end - begin;
+        if (num_chunk == 0) num_chunk = size();
+        num_chunk = std::min(num_chunk, num_job);
+        if (num_chunk <= 1 || size() == 0 || in_task())
+        {
+            job(begin, end);
+            return;
+        }
+        TaskGroup group(*this);
+        const size_t job_per_chunk = num_job / num_chunk;
+        const size_t remain = num_job % num_chunk;
+        size_t chunk_begin = begin;
+        for (size_t i = 0; i < num_chunk; ++i)
+        {
+            const size_t chunk_end = chunk_begin + job_per_chunk + (i < remain);
+            group.run([&job, chunk_begin, chunk_end]() {
+                job(chunk_begin, chunk_end);
+            });
+            chunk_begin = chunk_end;
+        }
+        group.wait();
+    }
+
+private:
+    struct TaskDeque
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    struct WorkerId
+    {
+        ThreadPool* pool = nullptr;
+        size_t idx = 0;
+    };
+    std::vector<std::unique_ptr<TaskDeque>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    // number of tasks waiting in the deques
+    std::atomic<size_t> m_num_queued {0};
+    // deque receiving the next task submitted from outside the pool
+    std::atomic<size_t> m_next_queue {0};
+    bool m_stop = false;
+
+    static WorkerId& current_worker()
+    {
+        static thread_local WorkerId id;
+        return id;
+    }
+    void submit(std::function<void()> task)
+    {
+        auto&& self = current_worker();
+        // tasks submitted by a worker stay local until they are stolen
+        const size_t idx = self.pool == this
+                               ? self.idx
+                               : m_next_queue.fetch_add(1) % m_queues.size();
+        // count the task first, such that the counter never goes below the
+        // number of tasks in the deques
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_num_queued;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queues[idx]->mutex);
+            m_queues[idx]->tasks.push_back(std::move(task));
+        }
+        m_cond.notify_one();
+    }
+    bool pop_task(const size_t idx, const bool steal,
+                  std::function<void()>& task)
+    {
+        auto&& queue = *m_queues[idx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        if (steal)
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        --m_num_queued;
+        return true;
+    }
+    // run one task, from our own deque first, return false if there is none
+    bool run_one(const size_t self)
+    {
+        std::function<void()> task;
+        bool found = pop_task(self, false, task);
+        for (size_t i = 1; !found && i < m_queues.size(); ++i)
+        { found = pop_task((self + i) % m_queues.size(), true, task); }
+        if (!found) return false;
+        task();
+        return true;
+    }
+    void worker_loop(const size_t idx)
+    {
+        current_worker() = WorkerId {this, idx};
+        while (true)
+        {
+            if (run_one(idx)) continue;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock,
+                        [this] { return m_stop || m_num_queued.load() != 0; });
+            if (m_stop && m_num_queued.load() == 0) return;
+        }
+    }
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (auto&& worker : m_workers) worker.join();
+        m_workers.clear();
+    }
+};
+
+#endif // THREAD_POOL_HPP
@@ -17,110 +17,276 @@
 #ifndef THREAD_QUEUE_H
 #define THREAD_QUEUE_H
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <vector>
 
+/*!
+ * \brief Bounded multi-producer multi-consumer queue.
+ *
+ * The items are stored in a ring of slots, each with its own sequence
+ * number telling whether the slot is free or filled for the current lap
+ * (D. Vyukov's bounded MPMC queue). Producers and consumers only meet on a
+ * single compare and swap of the tail or head, which can claim several
+ * consecutive slots at once for the batched push and pop.
+ *
+ * A thread that cannot make progress first spins, then parks on a
+ * condition variable. The other side only takes the mutex when someone is
+ * actually parked, so the uncontended path is lock free.
+ *
+ * Each producer calls completed() once it is done. pop returns true once
+ * the expected number of producers have completed AND the queue is
+ * drained, so items pushed before completed() are never lost.
+ */
 template <typename T>
 class Thread_Queue
 {
 public:
-    bool pop(T& item)
-    {
-        bool completed = false;
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        m_cond_not_empty.wait(
-            mlock, [this] { return (m_storage_queue.size() || m_completed); });
-        completed = m_completed;
-        if (!completed)
-        {
-            item = std::move(m_storage_queue.front());
-            m_storage_queue.pop();
-        }
-        m_num_processing--;
-        mlock.unlock();
-        m_cond_not_full.notify_one();
-        return completed;
+    explicit Thread_Queue(size_t capacity = 1024)
+    {
+        while (m_capacity < capacity) m_capacity <<= 1;
+        m_mask = m_capacity - 1;
+        m_slots.reset(new Slot[m_capacity]);
+        for (size_t i = 0; i < m_capacity; ++i)
+        { m_slots[i].seq.store(i, std::memory_order_relaxed); }
     }
+    Thread_Queue(const Thread_Queue&) = delete;            // disable copying
+    Thread_Queue& operator=(const Thread_Queue&) = delete; // disable assignment
 
-    bool pop(T& item, size_t num_thread)
+    /*!
+     * \brief Pop one item, waiting until one is available
+     * \param num_thread is the number of producers that will call completed
+     * \return true once all producers completed and the queue is empty, in
+     * which case item is untouched
+     */
+    bool pop(T& item, size_t num_thread = 1)
     {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        m_cond_not_empty.wait(mlock, [this, num_thread] {
-            return (m_storage_queue.size() || (m_num_completed == num_thread));
-        });
-        if (m_num_completed != num_thread)
-        {
-            item = std::move(m_storage_queue.front());
-            m_storage_queue.pop();
-        }
-        m_num_processing--;
-        mlock.unlock();
-        m_cond_not_full.notify_one();
-        return (m_num_completed == num_thread);
+        return dequeue_wait(&item, 1, num_thread) == 0;
     }
+    /*!
+     * \brief Pop up to max_item items at once, waiting until at least one is
+     * available. Same return value as pop
+     */
+    bool pop_batch(std::vector<T>& items, size_t max_item,
+                   size_t num_thread = 1)
+    {
+        items.clear();
+        return dequeue_wait(std::back_inserter(items), max_item, num_thread)
+               == 0;
+    }
+    // stop producer from producing extra data when there are already
+    // max_process items waiting in the queue
     void push(const T& item, size_t max_process)
     {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        // stop producer from producing extra data when
-        // we have not finish enough jobs
-        while (max_process <= m_num_processing) { m_cond_not_full.wait(mlock); }
-        m_storage_queue.push(item);
-        m_num_processing++;
-        mlock.unlock();
-        m_cond_not_empty.notify_one();
+        push_batch(&item, &item + 1, max_process);
     }
     void push(T&& item, size_t max_process)
     {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        // stop producer from producing extra data when
-        // we have not finish enough jobs
-        while (max_process <= m_num_processing) { m_cond_not_full.wait(mlock); }
-        m_storage_queue.push(std::move(item));
-        m_num_processing++;
-        mlock.unlock();
-        m_cond_not_empty.notify_one();
+        push_batch(std::make_move_iterator(&item),
+                   std::make_move_iterator(&item + 1), max_process);
     }
     void emplace(T&& item, size_t max_process)
     {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        while (max_process <= m_num_processing) { m_cond_not_full.wait(mlock); }
-        m_storage_queue.emplace(std::forward<T>(item));
-        // m_storage_queue.push(item);
-        m_num_processing++;
-        mlock.unlock();
-        m_cond_not_empty.notify_one();
+        push(std::move(item), max_process);
     }
-    void emplace(T&& item)
-    {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        m_storage_queue.emplace(std::forward<T>(item));
-        // m_storage_queue.push(item);
-        m_num_processing++;
-        mlock.unlock();
-        m_cond_not_empty.notify_one();
+    void emplace(T&& item) { push(std::move(item), m_capacity); }
+    /*!
+     * \brief Push [first, last), claiming as many slots as possible at once
+     */
+    template <typename Iter>
+    void push_batch(Iter first, Iter last,
+                    size_t max_process = std::numeric_limits<size_t>::max())
+    {
+        const size_t limit = std::max<size_t>(
+            1, std::min(max_process, m_capacity));
+        size_t remain = static_cast<size_t>(std::distance(first, last));
+        while (remain != 0)
+        {
+            size_t num_pushed = 0;
+            wait_until(m_not_full, [&] {
+                num_pushed = try_enqueue(first, remain, limit);
+                return num_pushed != 0;
+            });
+            std::advance(first, num_pushed);
+            remain -= num_pushed;
+            wake(m_not_empty, num_pushed > 1);
+        }
     }
     void completed()
     {
-        std::unique_lock<std::mutex> mlock(m_mutex);
-        m_completed = true;
-        ++m_num_completed;
-        mlock.unlock();
-        m_cond_not_empty.notify_all();
+        m_num_completed.fetch_add(1, std::memory_order_release);
+        wake(m_not_empty, true);
     }
-    size_t num_processing() const { return m_num_processing; }
-    Thread_Queue() = default;
-    Thread_Queue(const Thread_Queue&) = delete;            // disable copying
-    Thread_Queue& operator=(const Thread_Queue&) = delete; // disable assignment
+    // number of items pushed but not yet popped
+    size_t num_processing() const
+    {
+        const size_t head = m_head.load(std::memory_order_acquire);
+        const size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+    size_t capacity() const { return m_capacity; }
+
 private:
-    std::queue<T> m_storage_queue;
-    std::mutex m_mutex;
-    std::condition_variable m_cond_not_empty;
-    std::condition_variable m_cond_not_full;
-    size_t m_num_processing = 0;
-    size_t m_num_completed = 0;
-    bool m_completed = false;
+    // keep each slot, and the two ends of the ring, on their own cache line
+    struct alignas(64) Slot
+    {
+        std::atomic<size_t> seq;
+        T item;
+    };
+    struct Parking
+    {
+        std::atomic<size_t> num_waiting {0};
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+    // spins before a thread yields, and before it parks
+    static constexpr size_t busy_spin = 64;
+    static constexpr size_t yield_spin = 16;
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_capacity = 1;
+    size_t m_mask = 0;
+    alignas(64) std::atomic<size_t> m_tail {0};
+    alignas(64) std::atomic<size_t> m_head {0};
+    alignas(64) std::atomic<size_t> m_num_completed {0};
+    Parking m_not_empty;
+    Parking m_not_full;
+
+    static void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    template <typename Ready>
+    void wait_until(Parking& parking, Ready&& ready)
+    {
+        for (size_t spin = 0; spin < busy_spin + yield_spin; ++spin)
+        {
+            if (ready()) return;
+            if (spin < busy_spin)
+                cpu_relax();
+            else
+                std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(parking.mutex);
+        parking.num_waiting.fetch_add(1, std::memory_order_seq_cst);
+        // pairs with the fence in wake, either the waker sees us waiting or
+        // we see its update when checking ready
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        parking.cond.wait(lock, ready);
+        parking.num_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void wake(Parking& parking, bool all)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parking.num_waiting.load(std::memory_order_relaxed) == 0) return;
+        // taking the mutex ensures the waiter is either inside wait or has
+        // not checked ready yet, so the notification cannot be lost
+        {
+            std::lock_guard<std::mutex> lock(parking.mutex);
+        }
+        if (all)
+            parking.cond.notify_all();
+        else
+            parking.cond.notify_one();
+    }
+    template <typename Out>
+    size_t dequeue_wait(Out out, size_t max_item, size_t num_thread)
+    {
+        if (max_item == 0) max_item = 1;
+        size_t num_popped = 0;
+        wait_until(m_not_empty, [&] {
+            // read the completion first, such that everything pushed before
+            // the last completed() is visible to the dequeue
+            const bool done =
+                m_num_completed.load(std::memory_order_acquire) >= num_thread;
+            num_popped = try_dequeue(out, max_item);
+            return num_popped != 0 || done;
+        });
+        if (num_popped != 0) wake(m_not_full, true);
+        return num_popped;
+    }
+    // claim up to n consecutive free slots and fill them from first, without
+    // having more than limit items in the queue. Return the number pushed
+    template <typename Iter>
+    size_t try_enqueue(Iter first, size_t n, size_t limit)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const size_t head = m_head.load(std::memory_order_acquire);
+            const size_t in_queue = pos > head ? pos - head : 0;
+            const size_t room =
+                std::min(n, limit > in_queue ? limit - in_queue : 0);
+            size_t num_free = 0;
+            while (num_free < room
+                   && m_slots[(pos + num_free) & m_mask].seq.load(
+                          std::memory_order_acquire)
+                          == pos + num_free)
+            { ++num_free; }
+            if (num_free == 0)
+            {
+                // either the queue is full, or another producer got ahead
+                const size_t cur = m_tail.load(std::memory_order_relaxed);
+                if (cur == pos) return 0;
+                pos = cur;
+                continue;
+            }
+            if (m_tail.compare_exchange_weak(pos, pos + num_free,
+                                             std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < num_free; ++i, ++first)
+                {
+                    auto&& slot = m_slots[(pos + i) & m_mask];
+                    slot.item = *first;
+                    slot.seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return num_free;
+            }
+        }
+    }
+    // claim up to n consecutive filled slots and move them into out. Return
+    // the number popped
+    template <typename Out>
+    size_t try_dequeue(Out& out, size_t n)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            size_t num_ready = 0;
+            while (num_ready < n
+                   && m_slots[(pos + num_ready) & m_mask].seq.load(
+                          std::memory_order_acquire)
+                          == pos + num_ready + 1)
+            { ++num_ready; }
+            if (num_ready == 0)
+            {
+                const size_t cur = m_head.load(std::memory_order_relaxed);
+                if (cur == pos) return 0;
+                pos = cur;
+                continue;
+            }
+            if (m_head.compare_exchange_weak(pos, pos + num_ready,
+                                             std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < num_ready; ++i, ++out)
+                {
+                    auto&& slot = m_slots[(pos + i) & m_mask];
+                    *out = std::move(slot.item);
+                    slot.seq.store(pos + i + m_capacity,
+                                   std::memory_order_release);
+                }
+                return num_ready;
+            }
+        }
+    }
 };
 
 
@@ -162,6 +162,15 @@
 #endif
 #include <emmintrin.h>
 
+// Kernels using instruction sets newer than SSE2 (BMI2, AVX2, AVX-512) are
+// only compiled for 64-bit GCC-compatible x86 builds, and are selected at run
+// time based on what the processor supports, so a single binary stays
+// portable.
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__)
+#define PLINK_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 #define VECFTYPE __m128
 #define VECITYPE __m128i
 #define VECDTYPE __m128d
@@ -2878,12 +2887,98 @@ void genovec_set_freq_y(const uintptr_t* __restrict geno_vec,
                         uintptr_t sample_ctl2, uint32_t* __restrict set_ctp,
                         uint32_t* __restrict missing_ctp);
 
+// SSE2 (or plain 64-bit words in 32-bit builds) implementation, always
+// available
+void genovec_3freq_generic(const uintptr_t* __restrict geno_vec,
+                           const uintptr_t* __restrict include_quatervec,
+                           uintptr_t sample_ctl2,
+                           uint32_t* __restrict missing_ctp,
+                           uint32_t* __restrict het_ctp,
+                           uint32_t* __restrict homset_ctp);
+
+#ifdef PLINK_X86_DISPATCH
+// must only be called when the processor supports AVX2 and POPCNT
+void genovec_3freq_avx2(const uintptr_t* __restrict geno_vec,
+                        const uintptr_t* __restrict include_quatervec,
+                        uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
+                        uint32_t* __restrict het_ctp,
+                        uint32_t* __restrict homset_ctp);
+
+// must only be called when the processor supports AVX512F and
+// AVX512_VPOPCNTDQ
+void genovec_3freq_avx512(const uintptr_t* __restrict geno_vec,
+                          const uintptr_t* __restrict include_quatervec,
+                          uintptr_t sample_ctl2,
+                          uint32_t* __restrict missing_ctp,
+                          uint32_t* __restrict het_ctp,
+                          uint32_t* __restrict homset_ctp);
+#endif
+
+// Dispatches to the widest implementation supported by the processor
 void genovec_3freq(const uintptr_t* __restrict geno_vec,
                    const uintptr_t* __restrict include_quatervec,
                    uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
                    uint32_t* __restrict het_ctp,
                    uint32_t* __restrict homset_ctp);
 
+// Two-locus counts of one index variant against a block of variants. The
+// three include masks of the index variant start index_stride words apart.
+// For every variant in geno_vecs, counts receives the missing, het and homset
+// count against each of the three masks (9 values per variant, in the same
+// order as three genovec_3freq calls)
+void genovec_3freq_batch_generic(const uintptr_t* const* geno_vecs,
+                                 uintptr_t geno_ct,
+                                 const uintptr_t* __restrict index_quatervecs,
+                                 uintptr_t index_stride, uintptr_t sample_ctl2,
+                                 uint32_t* __restrict counts);
+
+#ifdef PLINK_X86_DISPATCH
+// must only be called when the processor supports AVX2 and POPCNT
+void genovec_3freq_batch_avx2(const uintptr_t* const* geno_vecs,
+                              uintptr_t geno_ct,
+                              const uintptr_t* __restrict index_quatervecs,
+                              uintptr_t index_stride, uintptr_t sample_ctl2,
+                              uint32_t* __restrict counts);
+
+// must only be called when the processor supports AVX512F and
+// AVX512_VPOPCNTDQ
+void genovec_3freq_batch_avx512(const uintptr_t* const* geno_vecs,
+                                uintptr_t geno_ct,
+                                const uintptr_t* __restrict index_quatervecs,
+                                uintptr_t index_stride, uintptr_t sample_ctl2,
+                                uint32_t* __restrict counts);
+#endif
+
+// Dispatches to the widest implementation supported by the processor
+void genovec_3freq_batch(const uintptr_t* const* geno_vecs, uintptr_t geno_ct,
+                         const uintptr_t* __restrict index_quatervecs,
+                         uintptr_t index_stride, uintptr_t sample_ctl2,
+                         uint32_t* __restrict counts);
+
+// Dot products of one dosage vector against a block of dosage vectors, all
+// containing sample_ct floats. Products are summed in single precision over
+// short runs of samples, and the runs are accumulated in double precision
+void dosage_dot_batch_generic(const float* __restrict index_dosage,
+                              const float* const* dosages, uintptr_t dosage_ct,
+                              uintptr_t sample_ct, double* __restrict result);
+
+#ifdef PLINK_X86_DISPATCH
+// must only be called when the processor supports AVX2
+void dosage_dot_batch_avx2(const float* __restrict index_dosage,
+                           const float* const* dosages, uintptr_t dosage_ct,
+                           uintptr_t sample_ct, double* __restrict result);
+
+// must only be called when the processor supports AVX512F
+void dosage_dot_batch_avx512(const float* __restrict index_dosage,
+                             const float* const* dosages, uintptr_t dosage_ct,
+                             uintptr_t sample_ct, double* __restrict result);
+#endif
+
+// Dispatches to the widest implementation supported by the processor
+void dosage_dot_batch(const float* __restrict index_dosage,
+                      const float* const* dosages, uintptr_t dosage_ct,
+                      uintptr_t sample_ct, double* __restrict result);
+
 uintptr_t count_01(const uintptr_t* quatervec, uintptr_t word_ct);
 
 HEADER_INLINE void zero_trailing_bits(uintptr_t unfiltered_ct,
@@ -3002,8 +3097,23 @@ uint32_t load_and_collapse(uint32_t unfiltered_sample_ct, uint32_t sample_ct,
                            FILE* bedfile, uintptr_t* __restrict rawbuf,
                            uintptr_t* __restrict mainbuf);
 
+// portable implementation, always available
+void copy_quaterarr_nonempty_subset_scalar(
+    const uintptr_t* __restrict raw_quaterarr,
+    const uintptr_t* __restrict subset_mask, uint32_t raw_quaterarr_size,
+    uint32_t subset_size, uintptr_t* __restrict output_quaterarr);
+
+#ifdef PLINK_X86_DISPATCH
+// must only be called when the processor supports BMI2
+void copy_quaterarr_nonempty_subset_bmi2(
+    const uintptr_t* __restrict raw_quaterarr,
+    const uintptr_t* __restrict subset_mask, uint32_t raw_quaterarr_size,
+    uint32_t subset_size, uintptr_t* __restrict output_quaterarr);
+#endif
+
 // was "collapse_copy_quaterarr_incl", but this should be better way to think
-// about it
+// about it.  Dispatches to the BMI2 version when the processor has a fast
+// PEXT (Intel, or AMD Zen 3 and later).
 void copy_quaterarr_nonempty_subset(const uintptr_t* __restrict raw_quaterarr,
                                     const uintptr_t* __restrict subset_mask,
                                     uint32_t raw_quaterarr_size,
@@ -431,6 +431,7 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                                     Genotype* genotype)
 {
     const std::string intermediate_name = prefix + ".inter";
+    auto [buffer1, buffer2] = decompress_buffer();
     std::vector<bool> retain_snps(genotype->m_existed_snps.size(), false);
     std::streampos byte_pos, tmp_byte_pos;
     size_t processed_count = 0;
@@ -478,7 +479,7 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
         // now read in the genotype information
         genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
             m_genotype_file, m_genotype_file_names[cur_file_idx] + ".bgen",
-            m_context_map[cur_file_idx], setter, &m_buffer1, &m_buffer2,
+            m_context_map[cur_file_idx], setter, buffer1, buffer2,
             byte_pos);
         // no founder, much easier
         setter.get_count(ref_count, het_count, alt_count, missing_count);
@@ -567,7 +568,7 @@ BinaryGen::~BinaryGen()
 }
 
 void BinaryGen::dosage_score(
-    std::vector<PRS>& prs_list,
+    PRS& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
     const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
 {
@@ -575,6 +576,7 @@ void BinaryGen::dosage_score(
     // main reason is we need expected value instead of
     // the MAF
     bool not_first = !reset_zero;
+    auto [buffer1, buffer2] = decompress_buffer();
     // we initialize the PRS interpretor with the required information.
     // m_prs_info is where we store the PRS information
     // and m_sample_include let us know if the sample is required.
@@ -604,7 +606,7 @@ void BinaryGen::dosage_score(
         // start performing the parsing
         genfile::bgen::read_and_parse_genotype_data_block<PRS_Interpreter>(
             m_genotype_file, m_genotype_file_names[file_idx] + ".bgen", context,
-            *setter, &m_buffer1, &m_buffer2, byte_pos);
+            *setter, buffer1, buffer2, byte_pos);
         if (!not_first)
         {
             setter.reset(new Add_PRS(&prs_list, &m_calculate_prs,
@@ -617,10 +619,11 @@ void BinaryGen::dosage_score(
 
 
 void BinaryGen::hard_code_score(
-    std::vector<PRS>& prs_list,
+    PRS& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
     const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
 {
+    auto [buffer1, buffer2] = decompress_buffer();
     // genotype counts
     uint32_t homrar_ct = 0;
     uint32_t missing_ct = 0;
@@ -641,6 +644,9 @@ void BinaryGen::hard_code_score(
     // check if we need to reset the sample's PRS
     bool not_first = !reset_zero;
     double stat, maf, adj_score, miss_score;
+    // homozygous common contribution of SNPs scored with the sparse path
+    double offset_score = 0;
+    size_t offset_count = 0;
     genfile::bgen::Context context;
     PLINK_generator setter(m_calculate_prs.data(), m_tmp_genotype.data(),
                            m_hard_threshold, m_dose_threshold);
@@ -677,7 +683,7 @@ void BinaryGen::hard_code_score(
                 genfile::bgen::read_and_parse_genotype_data_block<
                     PLINK_generator>(
                     m_genotype_file, m_genotype_file_names[idx] + ".bgen",
-                    context, setter, &m_buffer1, &m_buffer2, byte_pos);
+                    context, setter, buffer1, buffer2, byte_pos);
                 if (!m_prs_calculation.use_ref_maf)
                 {
                     setter.get_count(homcom_ct, het_ct, homrar_ct, missing_ct);
@@ -719,11 +725,22 @@ void BinaryGen::hard_code_score(
         if (is_centre) { adj_score = ploidy * stat * maf; }
         miss_score = 0;
         if (mean_impute) { miss_score = ploidy * stat * maf; }
-        read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score, miss_score,
-                 miss_count, homcom_weight, het_weight, homrar_weight,
-                 not_first);
+        if (use_sparse_score(homcom_ct, het_ct, homrar_ct, missing_ct))
+        {
+            read_sparse_prs(genotype_ptr, prs_list, ploidy, stat, adj_score,
+                            miss_score, miss_count, homcom_weight, het_weight,
+                            homrar_weight, not_first, offset_score,
+                            offset_count);
+        }
+        else
+        {
+            read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score,
+                     miss_score, miss_count, homcom_weight, het_weight,
+                     homrar_weight, not_first);
+        }
         not_first = true;
     }
+    apply_prs_offset(prs_list, offset_score, offset_count);
 }
 
 void BinaryGen::count_and_read_genotype(SNP& snp)
@@ -732,7 +749,7 @@ void BinaryGen::count_and_read_genotype(SNP& snp)
     auto&& genotype = snp.current_genotype();
     // load into memory is useless for dosage score
     if (!m_hard_coded) return;
-
+    auto [buffer1, buffer2] = decompress_buffer();
     if (m_intermediate)
     {
         // this is the intermediate
@@ -757,11 +774,11 @@ void BinaryGen::count_and_read_genotype(SNP& snp)
                                m_hard_threshold, m_dose_threshold);
         genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
             m_genotype_file, m_genotype_file_names[file_idx] + ".bgen",
-            m_context_map[file_idx], setter, &m_buffer1, &m_buffer2, byte_pos);
+            m_context_map[file_idx], setter, buffer1, buffer2, byte_pos);
     }
 }
 
-void BinaryGen::read_score(std::vector<PRS>& prs_list,
+void BinaryGen::read_score(PRS& prs_list,
                            const std::vector<size_t>::const_iterator& start_idx,
                            const std::vector<size_t>::const_iterator& end_idx,
                            bool reset_zero)
@@ -357,7 +357,7 @@ void BinaryPlink::check_bed(const std::string& bed_name, size_t num_marker,
 
 BinaryPlink::~BinaryPlink() {}
 void BinaryPlink::read_score(
-    std::vector<PRS>& prs_list,
+    PRS& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
     const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
 {
@@ -392,6 +392,9 @@ void BinaryPlink::read_score(
     // the PRS to zero instead of addint it up
     bool not_first = !reset_zero;
     double stat, maf, adj_score, miss_score;
+    // homozygous common contribution of SNPs scored with the sparse path
+    double offset_score = 0;
+    size_t offset_count = 0;
     std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
     std::vector<size_t>::const_iterator cur_idx = start_idx;
     uintptr_t* genotype_ptr;
@@ -465,9 +468,20 @@ void BinaryPlink::read_score(
         if (is_centre) { adj_score = ploidy * stat * maf; }
         miss_score = 0;
         if (mean_impute) { miss_score = ploidy * stat * maf; }
-        read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score, miss_score,
-                 miss_count, homcom_weight, het_weight, homrar_weight,
-                 not_first);
+        if (use_sparse_score(homcom_ct, het_ct, homrar_ct, missing_ct))
+        {
+            read_sparse_prs(genotype_ptr, prs_list, ploidy, stat, adj_score,
+                            miss_score, miss_count, homcom_weight, het_weight,
+                            homrar_weight, not_first, offset_score,
+                            offset_count);
+        }
+        else
+        {
+            read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score,
+                     miss_score, miss_count, homcom_weight, het_weight,
+                     homrar_weight, not_first);
+        }
         not_first = true;
     }
+    apply_prs_offset(prs_list, offset_score, offset_count);
 }
@@ -93,7 +93,9 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"hard", no_argument, &m_target.hard_coded, 1},
         {"ignore-fid", no_argument, &m_pheno_info.ignore_fid, 1},
         {"index", no_argument, &m_base_info.is_index, 1},
+        {"kahan-sum", no_argument, &m_prs_info.kahan_sum, 1},
         {"keep-ambig", no_argument, &m_keep_ambig, 1},
+        {"ld-dosage", no_argument, &m_clump_info.ld_dosage, 1},
         {"logit-perm", no_argument, &m_perm_info.logit_perm, 1},
         {"no-clump", no_argument, &m_clump_info.no_clump, 1},
         {"non-cumulate", no_argument, &m_prs_info.non_cumulate, 1},
@@ -102,6 +104,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"no-regress", no_argument, &m_prs_info.no_regress, 1},
         {"nonfounders", no_argument, &m_include_nonfounders, 1},
         {"or", no_argument, &m_base_info.is_or, 1},
+        {"perm-tail", no_argument, &m_perm_info.tail_approx, 1},
         {"print-snp", no_argument, &m_print_snp, 1},
         {"ultra", no_argument, &m_ultra_aggressive, 1},
         {"use-ref-maf", no_argument, &m_prs_info.use_ref_maf, 1},
@@ -110,6 +113,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"A2", required_argument, nullptr, 0},
         {"a1", required_argument, nullptr, 0},
         {"a2", required_argument, nullptr, 0},
+        {"adaptive-perm", required_argument, nullptr, 0},
         {"background", required_argument, nullptr, 0},
         {"bar-levels", required_argument, nullptr, 0},
         {"base-info", required_argument, nullptr, 0},
@@ -121,6 +125,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"clump-kb", required_argument, nullptr, 0},
         {"clump-p", required_argument, nullptr, 0},
         {"clump-r2", required_argument, nullptr, 0},
+        {"clump-sweep", required_argument, nullptr, 0},
         {"cov-factor", required_argument, nullptr, 0},
         {"dose-thres", required_argument, nullptr, 0},
         {"exclude", required_argument, nullptr, 0},
@@ -132,6 +137,9 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"info", required_argument, nullptr, 0},
         {"info-type", required_argument, nullptr, 0},
         {"keep", required_argument, nullptr, 0},
+        {"ld-block", required_argument, nullptr, 0},
+        {"ld-cache", required_argument, nullptr, 0},
+        {"ld-cache-r2", required_argument, nullptr, 0},
         {"ld-dose-thres", required_argument, nullptr, 0},
         {"ld-keep", required_argument, nullptr, 0},
         {"ld-list", required_argument, nullptr, 0},
@@ -142,6 +150,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"ld-hard-thres", required_argument, nullptr, 0},
         {"ld-info", required_argument, nullptr, 0},
         {"maf", required_argument, nullptr, 0},
+        {"make-ld-panel", required_argument, nullptr, 0},
         {"memory", required_argument, nullptr, 0},
         {"missing", required_argument, nullptr, 0},
         {"model", required_argument, nullptr, 0},
@@ -150,6 +159,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"proxy", required_argument, nullptr, 0},
         {"remove", required_argument, nullptr, 0},
         {"score", required_argument, nullptr, 0},
+        {"score-screen", required_argument, nullptr, 0},
         {"set-perm", required_argument, nullptr, 0},
         {"snp", required_argument, nullptr, 0},
         {"snp-set", required_argument, nullptr, 0},
@@ -157,6 +167,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"target-list", required_argument, nullptr, 0},
         {"type", required_argument, nullptr, 0},
         {"wind-5", required_argument, nullptr, 0},
+        {"weight-matrix", required_argument, nullptr, 0},
         {"wind-3", required_argument, nullptr, 0},
         {"x-range", required_argument, nullptr, 0},
         {nullptr, 0, nullptr, 0}};
@@ -195,6 +206,9 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 set_string(optarg, "a1", +BASE_INDEX::EFFECT);
             else if (command == "A2" || command == "a2")
                 set_string(optarg, "a2", +BASE_INDEX::NONEFFECT);
+            else if (command == "adaptive-perm")
+                error |= !set_numeric<size_t>(optarg, command,
+                                              m_perm_info.adaptive_hit);
             else if (command == "background")
                 set_string(optarg, command, m_prset.background);
             else if (command == "bar-levels")
@@ -227,6 +241,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                     !set_numeric<double>(optarg, command, m_clump_info.pvalue);
             else if (command == "clump-r2")
                 error |= !set_numeric<double>(optarg, command, m_clump_info.r2);
+            else if (command == "clump-sweep")
+                error |= !parse_clump_sweep(optarg, command);
             else if (command == "cov-factor")
                 load_string_vector(optarg, command, m_pheno_info.factor_cov);
             else if (command == "dose-thres")
@@ -253,6 +269,14 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 error |= !set_info(optarg);
             else if (command == "keep")
                 set_string(optarg, command, m_target.keep);
+            else if (command == "ld-block")
+                set_string(optarg, command, m_clump_info.ld_block);
+            else if (command == "ld-cache")
+                set_string(optarg, command, m_clump_info.ld_cache);
+            else if (command == "ld-cache-r2")
+                error |= !set_numeric<double>(
+                    optarg, command, m_clump_info.ld_cache_r2,
+                    m_clump_info.provided_ld_cache_r2);
             else if (command == "ld-dose-thres")
                 error |= !set_numeric<double>(optarg, command,
                                               m_ref_filter.dose_threshold);
@@ -279,6 +303,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
             else if (command == "maf")
                 error |=
                     !set_numeric<double>(optarg, command, m_target_filter.maf);
+            else if (command == "make-ld-panel")
+                set_string(optarg, command, m_clump_info.ld_panel);
             else if (command == "memory")
                 error |= !set_memory(optarg);
             else if (command == "missing")
@@ -311,6 +337,9 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 set_string(optarg, command, m_target.remove);
             else if (command == "score")
                 error |= !set_score(optarg);
+            else if (command == "score-screen")
+                error |= !set_numeric<size_t>(optarg, command,
+                                              m_prs_info.score_screen);
             else if (command == "set-perm")
             {
                 error |= !set_numeric<size_t>(optarg, command,
@@ -330,6 +359,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                 set_string(optarg, command, m_target.file_list);
             else if (command == "type")
                 set_string(optarg, command, m_target.type);
+            else if (command == "weight-matrix")
+                set_string(optarg, command, m_weight_matrix);
             else if (command == "wind-3")
                 error |= !parse_unit_value(optarg, command, 0, m_prset.wind_3);
             else if (command == "wind-5")
@@ -421,6 +452,7 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
     if (m_pheno_info.ignore_fid) m_parameter_log["ignore-fid"] = "";
     if (m_include_nonfounders) m_parameter_log["nonfounders"] = "";
     if (m_base_info.is_index) m_parameter_log["index"] = "";
+    if (m_prs_info.kahan_sum) m_parameter_log["kahan-sum"] = "";
     if (m_keep_ambig) m_parameter_log["keep-ambig"] = "";
     if (m_perm_info.logit_perm) m_parameter_log["logit-perm"] = "";
     if (m_clump_info.no_clump) m_parameter_log["no-clump"] = "";
@@ -431,6 +463,7 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
     if (m_print_snp) m_parameter_log["print-snp"] = "";
     if (m_base_info.is_beta) m_parameter_log["beta"] = "";
     if (m_base_info.is_or) m_parameter_log["or"] = "";
+    if (m_perm_info.tail_approx) m_parameter_log["perm-tail"] = "";
     if (m_target.hard_coded) m_parameter_log["hard"] = "";
     if (m_ultra_aggressive) m_parameter_log["ultra"] = "";
     if (m_prs_info.use_ref_maf) m_parameter_log["use-ref-maf"] = "";
@@ -440,18 +473,27 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
 
 bool Commander::validate_command(Reporter& reporter)
 {
-    bool error = !base_check();
-    error |= !clump_check();
-    error |= !covariate_check();
+    // --make-ld-panel only reads the LD reference and --weight-matrix only
+    // reads the target, the base and the PRS settings are not used. The panel
+    // is generated first when both are requested
+    const bool panel_only = !m_clump_info.ld_panel.empty();
+    const bool weight_only = !panel_only && !m_weight_matrix.empty();
+    const bool standalone = panel_only || weight_only;
+    bool error = !standalone && !base_check();
+    error |= !weight_only && !clump_check();
+    error |= !standalone && !covariate_check();
     error |= !filter_check();
     error |= !misc_check();
-    error |= !ref_check();
-    // pheno_check must come after base check because we want the beta / or
-    // information for defining the default
-    error |= !pheno_check();
-    error |= !prset_check();
-    error |= !prsice_check();
-    error |= !target_check();
+    error |= !weight_only && !ref_check();
+    if (!standalone)
+    {
+        // pheno_check must come after base check because we want the beta /
+        // or information for defining the default
+        error |= !pheno_check();
+        error |= !prset_check();
+        error |= !prsice_check();
+    }
+    if (!panel_only) error |= !target_check();
     // check all flags
     std::string log_name = m_out_prefix + ".log";
     try
@@ -696,6 +738,17 @@ void Commander::set_help_message()
           "                            Default: "
         + misc::to_string(m_clump_info.pvalue)
         + "\n"
+          "    --clump-sweep           Comma separated list of clumping "
+          "settings, each in\n"
+          "                            the form of r2:distance (kb unless "
+          "a unit is given),\n"
+          "                            e.g. 0.1:250,0.2:1mb. LD is "
+          "calculated once and each\n"
+          "                            setting is clumped and scored "
+          "separately, with\n"
+          "                            outputs suffixed by the setting. "
+          "Overrides --clump-r2\n"
+          "                            and --clump-kb\n"
           "    --ld            | -L    LD reference file. Use for LD "
           "calculation. If not\n"
           "                            provided, will use the post-filtered "
@@ -704,6 +757,38 @@ void Commander::set_help_message()
           "chromosome input\n"
           "                            Please see --target for more "
           "information\n"
+          "    --ld-block              BED file of approximately independent "
+          "LD blocks. Each\n"
+          "                            block is clumped independently, "
+          "ignoring the LD between\n"
+          "                            SNPs of different blocks. SNPs outside "
+          "the blocks are\n"
+          "                            grouped by the gap between two blocks\n"
+          "    --ld-cache              LD cache file. If the file doesn't "
+          "exist, r2 of all\n"
+          "                            SNP pairs within the clumping "
+          "distance is calculated\n"
+          "                            from the LD reference and stored in "
+          "this file.\n"
+          "                            Otherwise, LD stored in the file is "
+          "used for clumping\n"
+          "                            and only SNPs not found in the cache "
+          "are recalculated.\n"
+          "                            The cache is refused if the LD "
+          "reference files,\n"
+          "                            founders or sample and genotype "
+          "filters differ\n"
+          "    --ld-cache-r2           Minimum r2 stored in the LD cache. "
+          "Must not be higher\n"
+          "                            than the clumping threshold of runs "
+          "using the cache.\n"
+          "                            Default: the clumping threshold\n"
+          "    --ld-dosage             Calculate the LD from the expected "
+          "dosages of the\n"
+          "                            LD reference instead of the hard coded "
+          "genotypes.\n"
+          "                            Missing dosages are mean imputed. Only "
+          "support bgen\n"
           "    --ld-dose-thres         Translate any SNPs with highest "
           "genotype probability\n"
           "                            less than this threshold to missing "
@@ -747,8 +832,21 @@ void Commander::set_help_message()
           "                            set, first column should be IID\n"
           "                            Mutually exclusive from --ld-keep\n"
           "    --ld-type               File type of the LD file. Support bed "
-          "(binary plink)\n"
-          "                            and bgen format. Default: bed\n"
+          "(binary plink),\n"
+          "                            bgen and ldp (LD panel generated by\n"
+          "                            --make-ld-panel) format. Default: bed\n"
+          "    --make-ld-panel         Generate an LD panel with this prefix "
+          "from the LD\n"
+          "                            reference and exit. The panel contains "
+          "the founder\n"
+          "                            genotypes and counts of all variants "
+          "passing the LD\n"
+          "                            reference filters. Use it with\n"
+          "                            --ld <prefix> --ld-type ldp to skip "
+          "sample loading,\n"
+          "                            decompression and frequency "
+          "calculation of the\n"
+          "                            LD reference in later runs\n"
           "    --no-clump              Stop PRSice from performing clumping\n"
           "    --proxy                 Proxy threshold for index SNP to be "
           "considered\n"
@@ -809,6 +907,13 @@ void Commander::set_help_message()
           "Default: "
         + misc::to_string(m_p_thresholds.inter)
         + "\n"
+          "    --kahan-sum             Accumulate the PRS with compensated "
+          "(Kahan)\n"
+          "                            summation. Slightly slower, but "
+          "reduce the\n"
+          "                            rounding error when a large number of "
+          "SNPs\n"
+          "                            are included in the score\n"
           "    --lower         | -l    The starting p-value threshold. "
           "Default: "
         + misc::to_string(m_p_thresholds.lower)
@@ -858,10 +963,22 @@ void Commander::set_help_message()
           "samples\n"
           "                            sum     - Direct summation of the "
           "effect size \n"
+          "    --score-screen          Screen the thresholds of binary traits "
+          "with a\n"
+          "                            score test against the covariate only "
+          "model and\n"
+          "                            only perform the logistic regression "
+          "on the\n"
+          "                            given number of best thresholds\n"
           "    --upper         | -u    The final p-value threshold. Default: "
         + misc::to_string(m_p_thresholds.upper)
         + "\n"
           "\nPRSet:\n"
+          "    --adaptive-perm         Stop the competitive permutation of a "
+          "set once\n"
+          "                            the permuted statistic exceeded the "
+          "observed\n"
+          "                            statistic this number of times\n"
           "    --background            String to indicate a background file. "
           "This string\n"
           "                            should have the format of Name:Type "
@@ -955,11 +1072,19 @@ void Commander::set_help_message()
           "    --logit-perm            When performing permutation, still use "
           "logistic\n"
           "                            regression instead of linear "
-          "regression. This\n"
-          "                            will substantially slow down PRSice\n"
+          "regression. Permuted\n"
+          "                            statistics are taken after two Newton "
+          "steps when\n"
+          "                            these are within 0.01 standard error "
+          "of convergence\n"
           "    --memory                Maximum memory usage allowed (in Mb). "
           "PRSice will try\n"
-          "                            its best to honor this setting\n"
+          "                            its best to honor this setting. When "
+          "provided,\n"
+          "                            clumping will read the LD reference "
+          "sequentially\n"
+          "                            and keep its genotypes within this "
+          "limit\n"
           "    --non-cumulate          Calculate non-cumulative PRS. PRS will "
           "be reset\n"
           "                            to 0 for each new P-value threshold "
@@ -971,6 +1096,13 @@ void Commander::set_help_message()
           "                            generate the empirical p-value. "
           "Recommend to\n"
           "                            use value larger than 10,000\n"
+          "    --perm-tail             Approximate the empirical p-value "
+          "from a\n"
+          "                            generalized Pareto fit to the tail of "
+          "the\n"
+          "                            permuted statistics when fewer than 10 "
+          "of them\n"
+          "                            exceed the observed statistic\n"
           "    --print-snp             Print all SNPs that remains in the "
           "analysis \n"
           "                            after clumping is performed. For PRSet, "
@@ -1006,6 +1138,22 @@ void Commander::set_help_message()
           "at the expense\n"
           "                            of higher memory consumption.\n"
           "                            Has no effect for dosage score\n"
+          "    --weight-matrix         File containing multiple sets of effect "
+          "sizes.\n"
+          "                            First column should be the SNP ID, "
+          "second\n"
+          "                            column the effect allele, followed by "
+          "one\n"
+          "                            column per weight set. Scores of all "
+          "sets are\n"
+          "                            calculated in a single pass and written "
+          "to\n"
+          "                            the .mscore file, then PRSice exits. "
+          "Variants are\n"
+          "                            matched against all target variants. "
+          "The base is\n"
+          "                            not required. Requires --hard for bgen "
+          "target\n"
           "    --x-range               Range of SNPs to be excluded from the "
           "whole\n"
           "                            analysis. It can either be a single bed "
@@ -1267,6 +1415,13 @@ void Commander::add_base_to_log()
 bool Commander::clump_check()
 {
     bool error = false;
+    if (!m_clump_info.ld_panel.empty() && !use_ref()
+        && m_target.file_name.empty() && m_target.file_list.empty())
+    {
+        m_error_message.append("Error: --make-ld-panel requires an LD "
+                               "reference or a target file!\n");
+        return false;
+    }
     if (m_clump_info.no_clump) return true;
     if (m_clump_info.use_proxy
         && !misc::within_bound<double>(m_clump_info.proxy, 0.0, 1.0))
@@ -1294,6 +1449,81 @@ bool Commander::clump_check()
     { m_clump_info.distance = 1000000; }
     m_parameter_log["clump-kb"] =
         std::to_string(m_clump_info.distance / 1000) + "kb";
+    if (m_provided_memory) { m_clump_info.memory = m_memory; }
+    if (!m_clump_info.ld_cache.empty())
+    {
+        if (!m_clump_info.provided_ld_cache_r2)
+        {
+            m_clump_info.ld_cache_r2 =
+                m_clump_info.use_proxy
+                    ? std::min(m_clump_info.proxy, m_clump_info.r2)
+                    : m_clump_info.r2;
+        }
+        else if (!misc::within_bound<double>(m_clump_info.ld_cache_r2, 0.0,
+                                             1.0))
+        {
+            error = true;
+            m_error_message.append(
+                "Error: LD cache r2 must be within 0 and 1!\n");
+        }
+        if (m_allow_inter)
+        {
+            // intermediate files change the location of variants, which is
+            // what we use to identify them in the cache
+            error = true;
+            m_error_message.append(
+                "Error: --ld-cache cannot be used together with "
+                "--allow-inter!\n");
+        }
+        if (m_clump_info.ld_dosage)
+        {
+            // the cache stores r2 calculated from the hard coded genotypes
+            error = true;
+            m_error_message.append(
+                "Error: --ld-cache cannot be used together with "
+                "--ld-dosage!\n");
+        }
+    }
+    if (!m_clump_info.ld_block.empty() && !m_clump_info.ld_cache.empty())
+    {
+        // pairs across blocks are never calculated, which can't be
+        // distinguished from pairs below the floor of the cache
+        error = true;
+        m_error_message.append(
+            "Error: --ld-block cannot be used together with --ld-cache!\n");
+    }
+    for (auto&& setting : m_clump_info.sweep)
+    {
+        if (!misc::within_bound<double>(setting.r2, 0.0, 1.0))
+        {
+            error = true;
+            m_error_message.append(
+                "Error: R2 threshold of clumping sweep must be within 0 and "
+                "1!\n");
+            break;
+        }
+    }
+    if (!m_clump_info.sweep.empty()
+        && (!m_clump_info.ld_cache.empty() || m_clump_info.ld_dosage))
+    {
+        // the sweep keeps its own pair list of hard coded r2
+        error = true;
+        m_error_message.append(
+            "Error: --clump-sweep cannot be used together with --ld-cache "
+            "or --ld-dosage!\n");
+    }
+    if (m_clump_info.ld_dosage)
+    {
+        m_parameter_log["ld-dosage"] = "";
+        if (m_allow_inter)
+        {
+            // intermediate files only contain the hard coded genotypes
+            error = true;
+            m_error_message.append(
+                "Error: --ld-dosage cannot be used together with "
+                "--allow-inter!\n");
+        }
+    }
     return !error;
 }
 
@@ -1352,7 +1582,16 @@ bool Commander::ref_check()
                                "--remove but not both\n");
     }
 
-    if (need_target_as_reference())
+    // the panel is always generated from m_reference, which is the target
+    // when --ld isn't provided
+    const bool panel_from_target = !m_clump_info.ld_panel.empty() && !use_ref();
+    if (panel_from_target && m_reference.keep.empty()
+        && m_reference.remove.empty())
+    {
+        m_reference.keep = m_target.keep;
+        m_reference.remove = m_target.remove;
+    }
+    if (panel_from_target || need_target_as_reference())
     {
         // assign name over
         m_reference.file_list = m_target.file_list;
@@ -1366,9 +1605,9 @@ bool Commander::ref_check()
     }
     if (!m_reference.type.empty())
     {
-        if (std::find(supported_types.begin(), supported_types.end(),
+        if (std::find(supported_ld_types.begin(), supported_ld_types.end(),
                       m_reference.type)
-            == supported_types.end())
+            == supported_ld_types.end())
         {
             error = true;
             m_error_message.append(
@@ -1390,6 +1629,27 @@ bool Commander::ref_check()
         m_error_message.append("Error: You can only use --ld or --ld-list "
                                "but not both\n");
     }
+    if (m_reference.type == "ldp"
+        && (!m_reference.keep.empty() || !m_reference.remove.empty()))
+    {
+        // the panel only contains the founders selected when it was generated
+        error = true;
+        m_error_message.append("Error: --ld-keep and --ld-remove cannot be "
+                               "used with LD panel\n");
+    }
+
+    if (m_clump_info.ld_dosage && !m_clump_info.no_clump)
+    {
+        const bool has_ref =
+            !m_reference.file_name.empty() || !m_reference.file_list.empty();
+        if ((has_ref ? m_reference.type : m_target.type) != "bgen")
+        {
+            error = true;
+            m_error_message.append(
+                "Error: --ld-dosage can only be used with bgen LD "
+                "reference\n");
+        }
+    }
 
     if (m_reference.type == "bgen"
         || (m_reference.file_name.empty() && !m_reference.file_list.empty()
@@ -1910,9 +2170,31 @@ bool Commander::misc_check()
         m_error_message.append("Warning: Permutation not required, "
                                "--logit-perm has no effect\n");
     }
+    if (m_perm_info.adaptive_hit != 0 && !m_perm_info.run_set_perm)
+    {
+        m_error_message.append("Warning: Competitive permutation not "
+                               "required, --adaptive-perm has no effect\n");
+        m_perm_info.adaptive_hit = 0;
+    }
+    if (!m_perm_info.run_perm && !m_perm_info.run_set_perm
+        && m_perm_info.tail_approx)
+    {
+        m_error_message.append("Warning: Permutation not required, "
+                               "--perm-tail has no effect\n");
+        m_perm_info.tail_approx = false;
+    }
+    // the permuted phenotypes are kept within the default memory limit even
+    // when --memory is not provided
+    m_perm_info.memory = m_memory;
     // for no regress, we will alway print the scores (otherwise no point
     // running PRSice)
     if (m_prs_info.no_regress) m_print_all_scores = true;
+    if (m_prs_info.no_regress && m_prs_info.score_screen != 0)
+    {
+        m_error_message.append("Warning: Regression not required, "
+                               "--score-screen has no effect\n");
+        m_prs_info.score_screen = 0;
+    }
     // Just in case thread wasn't provided, we will print the default number
     // of thread used
     m_parameter_log["thread"] = std::to_string(m_prs_info.thread);
@@ -1953,6 +2235,14 @@ bool Commander::misc_check()
             "phenotype provided. As regression isn't performed, we will not "
             "utilize any of the phenotype information\n");
     }
+    if (!m_weight_matrix.empty() && m_target.type == "bgen"
+        && !m_target.hard_coded)
+    {
+        error = true;
+        m_error_message.append("Error: --weight-matrix only works with hard "
+                               "coded genotypes. Please use --hard for bgen "
+                               "target\n");
+    }
     if (m_target.type == "bgen" && !m_target.hard_coded && m_ultra_aggressive)
     {
         m_error_message.append("Warning: --ultra does not work with none "
@@ -15,6 +15,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "genotype.hpp"
+#include "ldpanel.hpp"
 
 std::string Genotype::print_duplicated_snps(
     const std::unordered_set<std::string>& duplicated_snp,
@@ -122,6 +123,56 @@ void Genotype::build_clump_windows(const unsigned long long& clump_distance)
         if (idx == 0) break;
         --idx;
     }
+    m_ld_partition.clear();
+    if (!m_ld_blocks.empty()) partition_clump_windows();
+}
+
+void Genotype::partition_clump_windows()
+{
+    // consecutive SNPs within the same LD block (or between the same pair of
+    // blocks) form a partition
+    const size_t num_snp = m_existed_snps.size();
+    std::vector<size_t> overlap;
+    size_t prev_chr = ~size_t(0), prev_block = ~size_t(0);
+    for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
+    {
+        auto&& snp = m_existed_snps[i_snp];
+        size_t block = ~size_t(0);
+        if (snp.chr() < m_ld_blocks.size())
+        {
+            // block boundaries are inclusive
+            m_ld_blocks[snp.chr()].overlap(snp.loc() == 0 ? 0 : snp.loc() - 1,
+                                           snp.loc() + 1, overlap);
+            // SNPs in overlapping blocks belong to the first block
+            if (!overlap.empty()) block = overlap.front();
+        }
+        if (snp.chr() != prev_chr || block != prev_block)
+        { m_ld_partition.push_back(i_snp); }
+        prev_chr = snp.chr();
+        prev_block = block;
+    }
+    m_max_window_size = 0;
+    size_t max_partition = 0;
+    for (size_t i = 0; i < m_ld_partition.size(); ++i)
+    {
+        const size_t start = m_ld_partition[i];
+        const size_t end =
+            (i + 1 < m_ld_partition.size()) ? m_ld_partition[i + 1] : num_snp;
+        max_partition = std::max(max_partition, end - start);
+        for (size_t i_snp = start; i_snp < end; ++i_snp)
+        {
+            auto&& snp = m_existed_snps[i_snp];
+            snp.set_low_bound(std::max(snp.low_bound(), start));
+            snp.set_up_bound(std::min(snp.up_bound(), end));
+            m_max_window_size =
+                std::max(m_max_window_size, snp.up_bound() - snp.low_bound());
+        }
+    }
+    m_reporter->report("Clumping is performed independently within "
+                       + misc::to_string(m_ld_partition.size())
+                       + " LD block(s), with at most "
+                       + misc::to_string(max_partition)
+                       + " variant(s) per block");
 }
 
 // std::mutex Genotype::m_mutex;
@@ -586,6 +637,21 @@ bool Genotype::process_snp(
     misc::to_upper(snp.ref());
     misc::to_upper(snp.alt());
     auto chr_id = chr_id_from_genotype(snp);
+    if (m_read_all_snps && !snp.rs().empty() && snp.rs() != "."
+        && genotype->m_existed_snps_index.find(snp.rs())
+               == genotype->m_existed_snps_index.end())
+    {
+        // there is nothing to match against, so the variant is added and
+        // then matched with itself. Duplicates are found by check_rs
+        auto&& selection = m_snp_selection_list.find(snp.rs());
+        if ((!m_exclude_snp && selection == m_snp_selection_list.end())
+            || (m_exclude_snp && selection != m_snp_selection_list.end()))
+        { return false; }
+        genotype->m_existed_snps_index[snp.rs()] =
+            genotype->m_existed_snps.size();
+        genotype->m_existed_snps.push_back(snp);
+        retain_snp.push_back(false);
+    }
     if (!check_rs(snpid, chr_id, snp.rs(), processed_snps, duplicated_snps,
                   genotype))
         return false;
@@ -661,6 +727,7 @@ void Genotype::gen_sample(const size_t fid_idx, const size_t iid_idx,
         else
         {
             ++m_founder_ct;
+            m_founder_id_hash = LDCache::hash(id, m_founder_id_hash);
             SET_BIT(cur_idx, m_sample_for_ld.data());
             SET_BIT(cur_idx, m_calculate_prs.data());
             in_regression = true;
@@ -1173,6 +1240,463 @@ std::vector<std::pair<size_t, size_t>> Genotype::get_chrom_boundary()
 
     return chrom_bound;
 }
+std::vector<Genotype::ClumpBlock>
+Genotype::build_clump_blocks(const Clumping& clump_info)
+{
+    // m_existed_snps is sorted by coordinate. A new block is started once we
+    // reach a SNP that is outside the window of the first SNP of the current
+    // block, so each block is at least as wide as the clumping window (and
+    // never span across chromosomes as windows never do). With LD blocks,
+    // each partition forms a block, which never conflicts with another as
+    // windows are restricted to the partition
+    std::vector<size_t> block_start = m_ld_partition;
+    const size_t num_snp = m_existed_snps.size();
+    if (m_ld_partition.empty())
+    {
+        for (size_t i_snp = 0; i_snp < num_snp; ++i_snp)
+        {
+            if (block_start.empty()
+                || i_snp >= m_existed_snps[block_start.back()].up_bound())
+            { block_start.push_back(i_snp); }
+        }
+    }
+    std::vector<ClumpBlock> blocks(block_start.size());
+    std::vector<size_t> block_of(num_snp);
+    for (size_t i_block = 0; i_block < block_start.size(); ++i_block)
+    {
+        const size_t end = (i_block + 1 < block_start.size())
+                               ? block_start[i_block + 1]
+                               : num_snp;
+        blocks[i_block].begin = block_start[i_block];
+        blocks[i_block].end = end;
+        for (size_t i_snp = block_start[i_block]; i_snp < end; ++i_snp)
+        { block_of[i_snp] = i_block; }
+    }
+    // SNPs that don't pass the p-value threshold can never be an index SNP
+    for (size_t rank = 0; rank < m_sort_by_p_index.size(); ++rank)
+    {
+        const size_t snp_idx = m_sort_by_p_index[rank];
+        if (m_existed_snps[snp_idx].p_value() > clump_info.pvalue) continue;
+        blocks[block_of[snp_idx]].rank.push_back(rank);
+    }
+    // the range of SNPs that can be touched by index SNPs of a block is
+    // [low bound of its first SNP, up bound of its last SNP). Both bounds
+    // increase with the block index, so conflicting blocks are contiguous
+    auto low = [this, &block_start](size_t i_block) {
+        return m_existed_snps[block_start[i_block]].low_bound();
+    };
+    auto up = [this, &block_start, &blocks, num_snp](size_t i_block) {
+        const size_t last = (i_block + 1 < blocks.size())
+                                ? block_start[i_block + 1] - 1
+                                : num_snp - 1;
+        return m_existed_snps[last].up_bound();
+    };
+    for (size_t i_block = 0; i_block < blocks.size(); ++i_block)
+    {
+        auto&& block = blocks[i_block];
+        for (size_t prev = i_block; prev > 0 && up(prev - 1) > low(i_block);
+             --prev)
+        { block.conflict.push_back(prev - 1); }
+        for (size_t next = i_block + 1;
+             next < blocks.size() && low(next) < up(i_block); ++next)
+        { block.conflict.push_back(next); }
+        block.next_rank = block.rank.empty() ? ~size_t(0) : block.rank.front();
+    }
+    return blocks;
+}
+
+template <typename Func>
+void Genotype::scan_ld_pairs(size_t start, size_t end, double floor,
+                             const Clumping& clump_info, Genotype& reference,
+                             Func&& add_pair)
+{
+    if (end <= start) return;
+    const uintptr_t storage_size = ld_storage_size(
+        clump_info, reference.m_unfiltered_sample_ct, reference.m_founder_ct);
+    // each task keeps the genotypes of the window of its current SNP, plus
+    // one for reading the genotype file
+    const size_t window_size = m_max_window_size + 1;
+    const size_t task_size = window_size + 1;
+    size_t num_task = std::max<size_t>(ThreadPool::global().size(), 1);
+    if (clump_info.memory != 0)
+    {
+        const size_t snp_size = GenotypePool::snp_size(storage_size);
+        const size_t capacity = clump_info.memory / snp_size;
+        if (capacity < task_size)
+        {
+            throw std::runtime_error(
+                "Error: Insufficient memory for LD calculation! Require "
+                + misc::to_string(task_size * snp_size / 1048576 + 1)
+                + " MB but only "
+                + misc::to_string(clump_info.memory / 1048576)
+                + " MB allowed by --memory");
+        }
+        num_task = std::min(num_task, capacity / task_size);
+    }
+    num_task = std::min(num_task, end - start);
+    struct LDPair
+    {
+        size_t first;
+        size_t second;
+        double r2;
+    };
+    // pairs found by each task. Tasks process consecutive ranges of SNPs, so
+    // concatenating them keeps the pairs in ascending order of the first SNP
+    std::vector<std::vector<LDPair>> pairs(num_task);
+    auto&& sample_for_ld = reference.m_sample_for_ld.data();
+    auto scan = [&](size_t i_task) {
+        const size_t task_start = start + (end - start) * i_task / num_task;
+        const size_t task_end = start + (end - start) * (i_task + 1) / num_task;
+        GenotypePool genotype_pool(task_size, storage_size, task_size);
+        auto tmp_genotype = genotype_pool.alloc();
+        ClumpWorkspace workspace(clump_info, reference.m_founder_ct,
+                                 tmp_genotype);
+        // genotype of the i th SNP is stored in window[i % window_size]
+        std::vector<uintptr_t*> window(window_size);
+        for (auto&& storage : window) { storage = genotype_pool.alloc(); }
+        size_t num_loaded = task_start;
+        auto&& result = pairs[i_task];
+        for (size_t i_snp = task_start; i_snp < task_end; ++i_snp)
+        {
+            const size_t up_bound =
+                std::max(m_existed_snps[i_snp].up_bound(), i_snp + 1);
+            for (; num_loaded < up_bound; ++num_loaded)
+            {
+                auto&& snp = m_existed_snps[num_loaded];
+                auto&& storage = window[num_loaded % window_size];
+                if (clump_info.ld_dosage)
+                {
+                    reference.read_dosage(snp, workspace.genotype_file,
+                                          storage, true);
+                    continue;
+                }
+                reference.read_genotype(snp, reference.m_founder_ct,
+                                        workspace.genotype_file,
+                                        workspace.tmp_genotype, storage,
+                                        sample_for_ld, true);
+            }
+            workspace.batch_geno.clear();
+            for (size_t j_snp = i_snp + 1; j_snp < up_bound; ++j_snp)
+            { workspace.batch_geno.push_back(window[j_snp % window_size]); }
+            auto&& core_genotype = window[i_snp % window_size];
+            if (clump_info.ld_dosage)
+            {
+                get_dosage_r2_batch(reference.m_founder_ct, core_genotype,
+                                    workspace.batch_geno,
+                                    workspace.batch_dosage,
+                                    workspace.batch_r2);
+            }
+            else
+            {
+                update_index_tot(workspace.founder_ctl2, workspace.founder_ctv2,
+                                 reference.m_founder_ct, workspace.index_data,
+                                 workspace.index_tots,
+                                 workspace.founder_include2, core_genotype);
+                get_r2_batch(workspace.founder_ctl2, workspace.founder_ctv2,
+                             workspace.batch_geno, workspace.index_data,
+                             workspace.index_tots, workspace.batch_counts,
+                             workspace.batch_r2);
+            }
+            for (size_t j_snp = i_snp + 1; j_snp < up_bound; ++j_snp)
+            {
+                const double r2 = workspace.batch_r2[j_snp - i_snp - 1];
+                if (r2 >= floor) result.push_back({i_snp, j_snp, r2});
+            }
+        }
+        for (auto&& storage : window) { genotype_pool.free(storage); }
+        genotype_pool.free(tmp_genotype);
+    };
+    ThreadPool::global().parallel_for(
+        0, num_task,
+        [&scan](size_t task_begin, size_t task_end) {
+            for (size_t i_task = task_begin; i_task < task_end; ++i_task)
+            { scan(i_task); }
+        },
+        num_task);
+    for (auto&& task_pairs : pairs)
+    {
+        for (auto&& pair : task_pairs)
+        { add_pair(pair.first, pair.second, pair.r2); }
+        std::vector<LDPair>().swap(task_pairs);
+    }
+}
+
+void Genotype::build_ld_cache(const Clumping& clump_info, Genotype& reference)
+{
+    m_reporter->report("Building LD cache: " + clump_info.ld_cache);
+    auto snp_key = [](const SNP& snp) {
+        auto [file_idx, byte_pos] = snp.get_file_info(true);
+        return LDCache::variant_key(file_idx, static_cast<uint64_t>(byte_pos));
+    };
+    std::vector<LDCache::Chromosome> chromosomes;
+    // partners[i] contains all SNPs (index within the chromosome) in LD with
+    // the i th SNP of the chromosome
+    std::vector<std::vector<std::pair<uint32_t, double>>> partners;
+    size_t chr_start = 0;
+    const size_t num_snp = m_existed_snps.size();
+    while (chr_start < num_snp)
+    {
+        const size_t chr = m_existed_snps[chr_start].chr();
+        size_t chr_end = chr_start;
+        while (chr_end < num_snp && m_existed_snps[chr_end].chr() == chr)
+        { ++chr_end; }
+        const size_t num_chr_snp = chr_end - chr_start;
+        partners.assign(num_chr_snp, {});
+        scan_ld_pairs(chr_start, chr_end, clump_info.ld_cache_r2, clump_info,
+                      reference, [&](size_t i_snp, size_t j_snp, double r2) {
+                          partners[i_snp - chr_start].emplace_back(
+                              j_snp - chr_start, r2);
+                          partners[j_snp - chr_start].emplace_back(
+                              i_snp - chr_start, r2);
+                      });
+        // rows of the cache are ordered by the variant key
+        std::vector<size_t> order(num_chr_snp);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return snp_key(m_existed_snps[chr_start + a])
+                   < snp_key(m_existed_snps[chr_start + b]);
+        });
+        std::vector<uint32_t> rank(num_chr_snp);
+        for (size_t i = 0; i < num_chr_snp; ++i)
+        { rank[order[i]] = static_cast<uint32_t>(i); }
+        chromosomes.emplace_back();
+        auto&& cur_chr = chromosomes.back();
+        cur_chr.chr = chr;
+        cur_chr.row_offset.push_back(0);
+        for (auto&& i : order)
+        {
+            cur_chr.keys.push_back(snp_key(m_existed_snps[chr_start + i]));
+            auto&& row = partners[i];
+            for (auto&& entry : row) { entry.first = rank[entry.first]; }
+            std::sort(row.begin(), row.end());
+            for (auto&& entry : row)
+            {
+                cur_chr.column.push_back(entry.first);
+                cur_chr.r2.push_back(entry.second);
+            }
+            cur_chr.row_offset.push_back(cur_chr.r2.size());
+        }
+        chr_start = chr_end;
+    }
+    LDCache::write(clump_info.ld_cache, clump_info.ld_cache_r2,
+                   clump_info.distance, reference.m_founder_ct,
+                   reference.ld_fingerprint(clump_info), chromosomes);
+}
+
+LDCache::Fingerprint
+Genotype::ld_fingerprint(const Clumping& clump_info) const
+{
+    LDCache::Fingerprint fingerprint;
+    fingerprint.files = LDCache::HASH_SEED;
+    for (auto&& file : genotype_files())
+    { fingerprint.files = LDCache::hash_file(file, fingerprint.files); }
+    // the IDs are only known for samples read from a sample file, so the
+    // founders are also identified by their position in the genotype file
+    fingerprint.founders = LDCache::hash(&m_founder_ct, sizeof(m_founder_ct),
+                                         m_founder_id_hash);
+    fingerprint.founders = LDCache::hash(
+        m_sample_for_ld.data(), m_sample_for_ld.size() * sizeof(uintptr_t),
+        fingerprint.founders);
+    fingerprint.filters = LDCache::hash_file(m_keep_file, LDCache::HASH_SEED);
+    fingerprint.filters =
+        LDCache::hash_file(m_remove_file, fingerprint.filters);
+    const uint8_t dosage = clump_info.ld_dosage;
+    fingerprint.filters =
+        LDCache::hash(&dosage, sizeof(dosage), fingerprint.filters);
+    // thresholds are only used when converting dosages to hard calls
+    if (!m_hard_coded && !clump_info.ld_dosage)
+    {
+        fingerprint.filters = LDCache::hash(
+            &m_hard_threshold, sizeof(m_hard_threshold), fingerprint.filters);
+        fingerprint.filters = LDCache::hash(
+            &m_dose_threshold, sizeof(m_dose_threshold), fingerprint.filters);
+    }
+    return fingerprint;
+}
+
+void Genotype::prepare_ld_cache(const Clumping& clump_info,
+                                Genotype& reference)
+{
+    if (!std::ifstream(clump_info.ld_cache.c_str()).good())
+    { build_ld_cache(clump_info, reference); }
+    m_ld_cache.load(clump_info.ld_cache);
+    if (m_ld_cache.founder_ct() != reference.m_founder_ct)
+    {
+        throw std::runtime_error(
+            "Error: LD cache " + clump_info.ld_cache + " was generated from "
+            + misc::to_string(m_ld_cache.founder_ct())
+            + " founders but the LD reference contains "
+            + misc::to_string(reference.m_founder_ct)
+            + " founders. Was it generated from a different reference?");
+    }
+    const LDCache::Fingerprint fingerprint =
+        reference.ld_fingerprint(clump_info);
+    std::string mismatch;
+    if (m_ld_cache.fingerprint().files != fingerprint.files)
+    {
+        mismatch = "the LD reference files differ (or were modified since "
+                   "the cache was generated)";
+    }
+    else if (m_ld_cache.fingerprint().founders != fingerprint.founders)
+    {
+        mismatch = "a different set of founders is used";
+    }
+    else if (m_ld_cache.fingerprint().filters != fingerprint.filters)
+    {
+        mismatch = "the --ld-keep, --ld-remove, --ld-hard-thres, "
+                   "--ld-dose-thres or --ld-dosage setting differs";
+    }
+    if (!mismatch.empty())
+    {
+        throw std::runtime_error(
+            "Error: LD cache " + clump_info.ld_cache
+            + " does not match the current LD reference: " + mismatch
+            + ". Please remove the cache or use a different --ld-cache");
+    }
+    const double min_r2 = clump_info.use_proxy
+                              ? std::min(clump_info.proxy, clump_info.r2)
+                              : clump_info.r2;
+    m_use_ld_cache = m_ld_cache.floor() <= min_r2;
+    if (!m_use_ld_cache)
+    {
+        m_reporter->report(
+            "Warning: LD cache only contains pairs with r2 >= "
+            + misc::to_string(m_ld_cache.floor())
+            + ", which is higher than the clumping threshold. LD cache will "
+              "not be used");
+    }
+    else if (m_ld_cache.distance() < clump_info.distance)
+    {
+        m_reporter->report(
+            "Warning: LD cache was generated with a clumping distance of "
+            + misc::to_string(m_ld_cache.distance() / 1000)
+            + "kb. LD between SNPs further apart will be recalculated");
+    }
+}
+
+void Genotype::prepare_clump_sweep(const Clumping& clump_info,
+                                   Genotype& reference)
+{
+    if (clump_info.sweep.empty())
+    { throw std::runtime_error("Error: No clumping setting for the sweep"); }
+    size_t max_distance = 0;
+    double floor = 1.0;
+    for (auto&& setting : clump_info.sweep)
+    {
+        max_distance = std::max(max_distance, setting.distance);
+        floor = std::min(floor, clump_info.use_proxy
+                                    ? std::min(clump_info.proxy, setting.r2)
+                                    : setting.r2);
+    }
+    m_reporter->report("Calculating LD for "
+                       + misc::to_string(clump_info.sweep.size())
+                       + " clumping settings");
+    // windows of all settings are contained in the widest window
+    build_clump_windows(max_distance);
+    sort_by_p();
+    const size_t num_snp = m_existed_snps.size();
+    std::vector<std::vector<std::pair<uint32_t, double>>> partners(num_snp);
+    // pairs are found in ascending order of the first SNP, so each row is
+    // sorted without further work
+    scan_ld_pairs(0, num_snp, floor, clump_info, reference,
+                  [&partners](size_t i_snp, size_t j_snp, double r2) {
+                      partners[i_snp].emplace_back(j_snp, r2);
+                      partners[j_snp].emplace_back(i_snp, r2);
+                  });
+    m_sweep_offset.assign(1, 0);
+    m_sweep_partner.clear();
+    m_sweep_r2.clear();
+    for (auto&& row : partners)
+    {
+        for (auto&& entry : row)
+        {
+            m_sweep_partner.push_back(entry.first);
+            m_sweep_r2.push_back(entry.second);
+        }
+        m_sweep_offset.push_back(m_sweep_r2.size());
+        std::vector<std::pair<uint32_t, double>>().swap(row);
+    }
+    m_sweep_snps = m_existed_snps;
+}
+
+void Genotype::sweep_clumping(const Clumping& clump_info,
+                              const ClumpSetting& setting)
+{
+    m_reporter->report("Start performing clumping with r2 = "
+                       + misc::to_string(setting.r2) + " and distance = "
+                       + setting.distance_string());
+    // every setting starts from the state before clumping
+    m_existed_snps = m_sweep_snps;
+    const double min_r2 = clump_info.use_proxy
+                              ? std::min(clump_info.proxy, setting.r2)
+                              : setting.r2;
+    std::vector<bool> remain_snps(m_existed_snps.size(), false);
+    size_t num_core = 0;
+    for (auto&& core_snp_idx : m_sort_by_p_index)
+    {
+        auto&& core_snp = m_existed_snps[core_snp_idx];
+        if (core_snp.clumped() || core_snp.p_value() > clump_info.pvalue)
+        { continue; }
+        // same order as the clumping window, as proxy clumping changes the
+        // flags of the index SNP
+        for (size_t i = m_sweep_offset[core_snp_idx];
+             i < m_sweep_offset[core_snp_idx + 1]; ++i)
+        {
+            const double r2 = m_sweep_r2[i];
+            if (r2 < min_r2) continue;
+            auto&& clump_snp = m_existed_snps[m_sweep_partner[i]];
+            if (clump_snp.clumped() || clump_snp.p_value() > clump_info.pvalue)
+            { continue; }
+            const size_t distance = clump_snp.loc() > core_snp.loc()
+                                        ? clump_snp.loc() - core_snp.loc()
+                                        : core_snp.loc() - clump_snp.loc();
+            if (distance > setting.distance) continue;
+            core_snp.clump(clump_snp, r2, clump_info.use_proxy,
+                           clump_info.proxy);
+        }
+        core_snp.set_clumped();
+        remain_snps[core_snp_idx] = true;
+        ++num_core;
+    }
+    if (num_core != m_existed_snps.size()) { shrink_snp_vector(remain_snps); }
+    m_existed_snps_index.clear();
+    m_reporter->report("Number of variant(s) after clumping : "
+                       + misc::to_string(m_existed_snps.size()));
+}
+
+void Genotype::write_ld_panel(const std::string& file)
+{
+    m_reporter->report("Generating LD panel: " + file);
+    // the panel is sorted by chr and loc, SNPs at the same position are kept
+    // in file order
+    std::sort(begin(m_existed_snps), end(m_existed_snps),
+              [](SNP const& t1, SNP const& t2) {
+                  if (t1.chr() != t2.chr()) return t1.chr() < t2.chr();
+                  if (t1.loc() != t2.loc()) return t1.loc() < t2.loc();
+                  if (t1.get_file_idx(true) == t2.get_file_idx(true))
+                  { return t1.get_byte_pos(true) < t2.get_byte_pos(true); }
+                  return t1.get_file_idx(true) < t2.get_file_idx(true);
+              });
+    update_snp_index();
+    const uintptr_t unfiltered_sample_ctv2 =
+        2 * BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+    std::vector<uintptr_t> tmp_genotype(unfiltered_sample_ctv2, 0);
+    std::vector<uintptr_t> genotype(unfiltered_sample_ctv2, 0);
+    FileRead genotype_file;
+    LDPanel::Writer writer(file, m_founder_ct);
+    for (auto&& snp : m_existed_snps)
+    {
+        read_genotype(snp, m_founder_ct, genotype_file, tmp_genotype.data(),
+                      genotype.data(), m_sample_for_ld.data(), true);
+        // genotypes are coded with respect to the alleles of the reference
+        const bool flipped = snp.is_ref_flipped();
+        writer.add(snp.rs(), snp.chr(), snp.loc(),
+                   flipped ? snp.alt() : snp.ref(),
+                   flipped ? snp.ref() : snp.alt(), genotype.data());
+    }
+    writer.close();
+}
+
 void Genotype::clumping(const Clumping& clump_info, Genotype& reference,
                         size_t threads)
 {
@@ -1180,43 +1704,71 @@ void Genotype::clumping(const Clumping& clump_info, Genotype& reference,
     std::vector<std::atomic<bool>> remain_snps(m_existed_snps.size());
     for (auto&& s : remain_snps) { s = false; }
     std::atomic<size_t> num_core = 0;
-    using range = std::pair<size_t, size_t>;
-    // get boundaries
-    std::vector<range> snp_range = get_chrom_boundary();
-    if (threads == 1)
+    // the progress observer runs on this thread and the progress queue is
+    // bounded, so every subject needs its own worker. Otherwise a subject run
+    // inline would fill the queue before the observer starts
+    threads = std::min(threads, ThreadPool::global().size());
+    if (clump_info.memory != 0)
+    {
+        dummy_reporter progress_reporter(m_existed_snps.size(),
+                                         !m_reporter->unit_testing());
+        budgeted_clumping(clump_info, progress_reporter, remain_snps, num_core,
+                          threads, reference);
+    }
+    else if (threads <= 1)
     {
         dummy_reporter progress_reporter(m_existed_snps.size(),
                                          !m_reporter->unit_testing());
-        threaded_clumping(snp_range, clump_info, progress_reporter, remain_snps,
-                          num_core, reference);
+        threaded_clumping(get_chrom_boundary(), clump_info, progress_reporter,
+                          remain_snps, num_core, reference);
     }
     else
     {
-        if (threads > m_autosome_ct) { threads = m_autosome_ct; }
+        // chromosomes are split into blocks so that we are not limited by the
+        // number (and size) of chromosomes
+        std::vector<ClumpBlock> blocks = build_clump_blocks(clump_info);
+        if (threads > blocks.size()) { threads = blocks.size(); }
+        if (threads == 0) { threads = 1; }
+        const uintptr_t storage_size =
+            ld_storage_size(clump_info, reference.m_unfiltered_sample_ct,
+                            reference.m_founder_ct);
+        ConcurrentGenotypePool genotype_pool((m_max_window_size + 1) * threads,
+                                             storage_size);
+        std::atomic<size_t> num_finished = 0;
+        std::atomic<bool> abort = false;
+        for (auto&& block : blocks)
+        {
+            if (block.rank.empty()) ++num_finished;
+        }
         Thread_Queue<size_t> progress_observer;
-        std::thread observer(&Genotype::clump_progress_observer, this,
-                             std::ref(progress_observer), m_existed_snps.size(),
-                             threads, !m_reporter->unit_testing());
-        std::vector<std::thread> subjects;
-        size_t job_per_thread = snp_range.size() / static_cast<size_t>(threads);
-        int remain = static_cast<int>(static_cast<size_t>(snp_range.size())
-                                      % static_cast<size_t>(threads));
-        size_t job_start = 0;
+        ThreadPool::TaskGroup subjects;
         for (size_t i_thread = 0; i_thread < threads; ++i_thread)
         {
-            std::vector<range> job_sets(snp_range.begin() + job_start,
-                                        snp_range.begin() + job_start
-                                            + job_per_thread + (remain > 0));
-            subjects.push_back(
-                std::thread(&Genotype::threaded_clumping<Thread_Queue<size_t>>,
-                            this, job_sets, std::cref(clump_info),
-                            std::ref(progress_observer), std::ref(remain_snps),
-                            std::ref(num_core), std::ref(reference)));
-            job_start += job_per_thread + (remain > 0);
-            remain--;
+            // start each task at a different part of the genome to reduce
+            // contention on the block flags
+            const size_t start_block = i_thread * blocks.size() / threads;
+            subjects.run([&, start_block]() {
+                try
+                {
+                    block_clumping(blocks, start_block, num_finished, abort,
+                                   clump_info, progress_observer, remain_snps,
+                                   num_core, genotype_pool, reference);
+                }
+                catch (...)
+                {
+                    // stop the other tasks and release the observer, the
+                    // error is rethrown by wait
+                    abort.store(true, std::memory_order_release);
+                    progress_observer.completed();
+                    throw;
+                }
+            });
         }
-        observer.join();
-        for (auto&& thread : subjects) thread.join();
+        // each subject has its own worker, so the progress can be observed
+        // from this thread
+        clump_progress_observer(progress_observer, m_existed_snps.size(),
+                                threads, !m_reporter->unit_testing());
+        subjects.wait();
     }
     if (!m_reporter->unit_testing())
     { fprintf(stderr, "\rClumping Progress: %03.2f%%\n", 100.0); }
@@ -1234,11 +1786,15 @@ void Genotype::clump_progress_observer(Thread_Queue<size_t>& progress_observer,
                                        size_t total_snp, size_t num_thread,
                                        bool verbose)
 {
-    size_t progress = 0, total_run = 0;
+    // drain all pending updates at once, the subjects emplace one per step
+    std::vector<size_t> progress;
+    size_t total_run = 0;
     double cur_progress = 0, prev_progress = 0;
-    while (!progress_observer.pop(progress, num_thread))
+    while (!progress_observer.pop_batch(progress, progress_observer.capacity(),
+                                        num_thread))
     {
-        total_run += progress;
+        total_run += std::accumulate(progress.begin(), progress.end(),
+                                     size_t(0));
         cur_progress = static_cast<double>(total_run)
                        / static_cast<double>(total_snp) * 100;
         if (verbose && cur_progress - prev_progress > 0.01)
@@ -1249,6 +1805,147 @@ void Genotype::clump_progress_observer(Thread_Queue<size_t>& progress_observer,
     }
 }
 
+template <typename Pool>
+bool Genotype::clump_index_snp(size_t core_snp_idx, const Clumping& clump_info,
+                               ClumpWorkspace& workspace, Pool& genotype_pool,
+                               Genotype& reference)
+{
+    auto&& core_snp = m_existed_snps[core_snp_idx];
+    if (core_snp.clumped() || core_snp.p_value() > clump_info.pvalue)
+    { return false; }
+    auto&& sample_for_ld = reference.m_sample_for_ld.data();
+    auto load_genotype = [&](SNP& snp) {
+        if (snp.current_genotype() != nullptr) return;
+        // store SNP's genotype into our genotype pool
+        snp.set_genotype_storage(genotype_pool.alloc());
+        if (clump_info.ld_dosage)
+        {
+            reference.read_dosage(snp, workspace.genotype_file,
+                                  snp.current_genotype(), true);
+            return;
+        }
+        reference.read_genotype(snp, reference.m_founder_ct,
+                                workspace.genotype_file, workspace.tmp_genotype,
+                                snp.current_genotype(), sample_for_ld, true);
+    };
+    bool index_ready = false;
+    auto prepare_index = [&]() {
+        if (index_ready) return;
+        load_genotype(core_snp);
+        if (clump_info.ld_dosage)
+        {
+            std::copy_n(core_snp.current_genotype(),
+                        workspace.index_dosage.size(),
+                        workspace.index_dosage.begin());
+        }
+        else
+        {
+            update_index_tot(workspace.founder_ctl2, workspace.founder_ctv2,
+                             reference.m_founder_ct, workspace.index_data,
+                             workspace.index_tots, workspace.founder_include2,
+                             core_snp.current_genotype());
+        }
+        // free core SNP's genotype form the genotype pool as we will no
+        // longer need it. (it will never be clumped by another SNP)
+        core_snp.freed_geno_storage(genotype_pool);
+        index_ready = true;
+    };
+    LDCache::Variant cached_core;
+    if (m_use_ld_cache)
+    {
+        auto [file_idx, byte_pos] = core_snp.get_file_info(true);
+        cached_core = m_ld_cache.find(
+            core_snp.chr(),
+            LDCache::variant_key(file_idx, static_cast<uint64_t>(byte_pos)));
+    }
+    const size_t clump_start_idx = core_snp.low_bound();
+    const size_t clump_end_idx = core_snp.up_bound();
+    if (!cached_core.valid())
+    {
+        // the reason this is a two part process is so that we can reduce
+        // the number of fseek
+        for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
+             ++clump_idx)
+        {
+            auto&& clump_snp = m_existed_snps[clump_idx];
+            if (clump_snp.clumped() || clump_snp.p_value() > clump_info.pvalue)
+            { continue; }
+            load_genotype(clump_snp);
+        }
+        prepare_index();
+    }
+    // first collect the r2 of every SNP within the window, so that the r2 of
+    // SNPs not found in the LD cache can be calculated in a single batch
+    workspace.window_idx.clear();
+    workspace.window_r2.clear();
+    workspace.batch_pos.clear();
+    workspace.batch_geno.clear();
+    for (size_t clump_idx = clump_start_idx; clump_idx < clump_end_idx;
+         ++clump_idx)
+    {
+        auto&& clump_snp = m_existed_snps[clump_idx];
+        if (clump_idx == core_snp_idx || clump_snp.clumped()
+            || clump_snp.p_value() > clump_info.pvalue)
+        { continue; }
+        double r2 = -1;
+        bool from_cache = false;
+        const size_t distance = clump_snp.loc() > core_snp.loc()
+                                    ? clump_snp.loc() - core_snp.loc()
+                                    : core_snp.loc() - clump_snp.loc();
+        if (cached_core.valid() && distance <= m_ld_cache.distance())
+        {
+            auto [file_idx, byte_pos] = clump_snp.get_file_info(true);
+            from_cache = m_ld_cache.r2(
+                cached_core,
+                LDCache::variant_key(file_idx, static_cast<uint64_t>(byte_pos)),
+                r2);
+        }
+        if (!from_cache)
+        {
+            prepare_index();
+            load_genotype(clump_snp);
+            workspace.batch_pos.push_back(workspace.window_idx.size());
+            workspace.batch_geno.push_back(clump_snp.current_genotype());
+        }
+        workspace.window_idx.push_back(clump_idx);
+        workspace.window_r2.push_back(r2);
+    }
+    if (clump_info.ld_dosage)
+    {
+        get_dosage_r2_batch(reference.m_founder_ct,
+                            workspace.index_dosage.data(), workspace.batch_geno,
+                            workspace.batch_dosage, workspace.batch_r2);
+    }
+    else
+    {
+        get_r2_batch(workspace.founder_ctl2, workspace.founder_ctv2,
+                     workspace.batch_geno, workspace.index_data,
+                     workspace.index_tots, workspace.batch_counts,
+                     workspace.batch_r2);
+    }
+    for (size_t i = 0; i < workspace.batch_pos.size(); ++i)
+    { workspace.window_r2[workspace.batch_pos[i]] = workspace.batch_r2[i]; }
+    // then clump them in order, as proxy clumping changes the flags of the
+    // index SNP
+    for (size_t i = 0; i < workspace.window_idx.size(); ++i)
+    {
+        const double r2 = workspace.window_r2[i];
+        if (r2 < workspace.min_r2) continue;
+        auto&& clump_snp = m_existed_snps[workspace.window_idx[i]];
+        core_snp.clump(clump_snp, r2, clump_info.use_proxy, clump_info.proxy);
+        // remove SNP's genotype data from the genotype pool if it
+        // is clumped out
+        if (clump_snp.clumped() && clump_snp.current_genotype() != nullptr)
+        { clump_snp.freed_geno_storage(genotype_pool); }
+    }
+    // genotype of the core SNP might have been loaded when it was part of
+    // another window
+    if (core_snp.current_genotype() != nullptr)
+    { core_snp.freed_geno_storage(genotype_pool); }
+    core_snp.set_clumped();
+    return true;
+}
+
 template <typename T>
 void Genotype::threaded_clumping(
     const std::vector<std::pair<size_t, size_t>> snp_range,
@@ -1256,24 +1953,8 @@ void Genotype::threaded_clumping(
     std::vector<std::atomic<bool>>& remain_snps, std::atomic<size_t>& num_core,
     Genotype& reference)
 {
-    const double min_r2 = clump_info.use_proxy
-                              ? std::min(clump_info.proxy, clump_info.r2)
-                              : clump_info.r2;
-    const uint32_t founder_ctv3 =
-        BITCT_TO_ALIGNED_WORDCT(static_cast<uint32_t>(reference.m_founder_ct));
-    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.m_founder_ct);
-    const uint32_t founder_ctsplit = 3 * founder_ctv3;
-    const uintptr_t founder_ctv2 =
-        QUATERCT_TO_ALIGNED_WORDCT(reference.m_founder_ct);
-    const uintptr_t unfiltered_sample_ctl =
-        BITCT_TO_WORDCT(reference.m_unfiltered_sample_ct);
-    const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
-    std::vector<uintptr_t> index_data(3 * founder_ctsplit + founder_ctv3);
-    std::vector<uintptr_t> index_tots(6);
-
-    std::vector<uintptr_t> founder_include2(founder_ctv2, 0);
-    fill_quatervec_55(static_cast<uint32_t>(reference.m_founder_ct),
-                      founder_include2.data());
+    const uintptr_t storage_size = ld_storage_size(
+        clump_info, reference.m_unfiltered_sample_ct, reference.m_founder_ct);
 
     // available memory size
     // can set number to way higher with ultra (e.g. all SNPs)
@@ -1291,14 +1972,12 @@ void Genotype::threaded_clumping(
     const auto max_size = m_max_window_size > std::floor(max_snp_in_chr * 0.2)
                               ? m_max_window_size
                               : std::floor(max_snp_in_chr * 0.2);
-    GenotypePool genotype_pool(max_size + 1, unfiltered_sample_ctv2);
+    GenotypePool genotype_pool(max_size + 1, storage_size);
     auto tmp_genotype = genotype_pool.alloc();
-    double r2 = -1;
-    FileRead genotype_file;
+    ClumpWorkspace workspace(clump_info, reference.m_founder_ct, tmp_genotype);
     size_t num_processed = 0, prev_processed = 0;
     double local_progress = 0.0, prev_progress = 0.0;
     size_t local_num_core = 0;
-    auto&& sample_for_ld = reference.m_sample_for_ld.data();
     for (auto&& range : snp_range)
     {
         for (size_t i_snp = std::get<0>(range); i_snp < std::get<1>(range);
@@ -1312,116 +1991,343 @@ void Genotype::threaded_clumping(
                 prev_progress = num_processed;
                 prev_processed = num_processed;
             }
-
-            // first implement it without the progress bar
             auto&& core_snp_idx = m_sort_by_p_index[i_snp];
-            auto&& core_snp = m_existed_snps[core_snp_idx];
-            if (core_snp.clumped() || core_snp.p_value() > clump_info.pvalue)
+            if (!clump_index_snp(core_snp_idx, clump_info, workspace,
+                                 genotype_pool, reference))
             { continue; }
-            const size_t clump_start_idx = core_snp.low_bound();
-            const size_t clump_end_idx = core_snp.up_bound();
-            // the reason this is a two part process is so that we can reduce
-            // the number of fseek
-            for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
-                 ++clump_idx)
+            // we set the remain_core to true so that we will keep it at the end
+            remain_snps[core_snp_idx] = true;
+            ++num_processed;
+            ++local_num_core;
+        }
+        // in theory, by the time we reached here, genotype_pool should be empty
+        // as all SNPs should either be clumped out or are index
+    }
+
+    progress_observer.completed();
+    num_core += local_num_core;
+    genotype_pool.free(tmp_genotype);
+}
+
+template <typename T>
+void Genotype::block_clumping(std::vector<ClumpBlock>& blocks,
+                              size_t start_block,
+                              std::atomic<size_t>& num_finished,
+                              std::atomic<bool>& abort,
+                              const Clumping& clump_info, T& progress_observer,
+                              std::vector<std::atomic<bool>>& remain_snps,
+                              std::atomic<size_t>& num_core,
+                              ConcurrentGenotypePool& shared_pool,
+                              Genotype& reference)
+{
+    // genotypes are allocated through a thread local cache so that the lock
+    // of the shared pool is rarely taken
+    ConcurrentGenotypePool::Cache genotype_pool(shared_pool);
+    auto tmp_genotype = genotype_pool.alloc();
+    ClumpWorkspace workspace(clump_info, reference.m_founder_ct, tmp_genotype);
+    const size_t num_block = blocks.size();
+    size_t local_num_core = 0;
+    // A candidate can only be processed once every conflicting block has
+    // moved past all candidates with a smaller rank (i.e. more significant).
+    // Two index SNPs whose windows overlap are therefore always processed in
+    // the same order as the sequential algorithm, while those that don't
+    // overlap commute, which gives us the exact same set of index SNPs
+    auto ready = [&blocks](const ClumpBlock& block, size_t rank) {
+        for (auto&& c : block.conflict)
+        {
+            if (blocks[c].next_rank.load(std::memory_order_acquire) < rank)
+            { return false; }
+        }
+        return true;
+    };
+    // a task that throws leaves its block unfinished, so the others must
+    // stop instead of waiting for it
+    while (!abort.load(std::memory_order_acquire)
+           && num_finished.load(std::memory_order_acquire) < num_block)
+    {
+        size_t processed = 0;
+        for (size_t i = 0; i < num_block; ++i)
+        {
+            auto&& block = blocks[(start_block + i) % num_block];
+            if (block.next_rank.load(std::memory_order_acquire) == ~size_t(0)
+                || block.busy.exchange(true, std::memory_order_acquire))
+            { continue; }
+            ClumpBlock::Claim claim(block);
+            size_t rank = block.next_rank.load(std::memory_order_relaxed);
+            while (rank != ~size_t(0)
+                   && !abort.load(std::memory_order_relaxed)
+                   && ready(block, rank))
             {
-                auto&& clump_snp = m_existed_snps[clump_idx];
-                if (clump_snp.clumped()
-                    || clump_snp.p_value() > clump_info.pvalue)
-                { continue; }
-                if (clump_snp.current_genotype() == nullptr)
+                const size_t core_snp_idx = m_sort_by_p_index[rank];
+                if (clump_index_snp(core_snp_idx, clump_info, workspace,
+                                    genotype_pool, reference))
                 {
-                    // store clump SNP's genotype into our genotype pool
-                    clump_snp.set_genotype_storage(genotype_pool.alloc());
-                    reference.read_genotype(
-                        clump_snp, reference.m_founder_ct, genotype_file,
-                        tmp_genotype->get_geno(), clump_snp.current_genotype(),
-                        sample_for_ld, true);
+                    remain_snps[core_snp_idx] = true;
+                    ++local_num_core;
                 }
+                ++processed;
+                ++block.next;
+                rank = (block.next < block.rank.size()) ? block.rank[block.next]
+                                                        : ~size_t(0);
+                block.next_rank.store(rank, std::memory_order_release);
+                if (rank == ~size_t(0)) { ++num_finished; }
             }
-            if (core_snp.current_genotype() == nullptr)
-            {
-                // store core SNP's genotype into our genotype pool
-                core_snp.set_genotype_storage(genotype_pool.alloc());
-                reference.read_genotype(core_snp, reference.m_founder_ct,
-                                        genotype_file, tmp_genotype->get_geno(),
-                                        core_snp.current_genotype(),
-                                        sample_for_ld, true);
-            }
-            update_index_tot(founder_ctl2, founder_ctv2, reference.m_founder_ct,
-                             index_data, index_tots, founder_include2,
-                             core_snp.current_genotype());
-            // free core SNP's genotype form the genotype pool as we will no
-            // longer need it. (it will never be clumped by another SNP)
-            core_snp.freed_geno_storage(genotype_pool);
+        }
+        if (processed) { progress_observer.emplace(std::move(processed)); }
+        else
+        {
+            // all remaining candidates are waiting for blocks that are being
+            // processed by other threads
+            std::this_thread::yield();
+        }
+    }
+    progress_observer.completed();
+    num_core += local_num_core;
+    genotype_pool.free(tmp_genotype);
+}
 
-            for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
-                 ++clump_idx)
+template <typename T>
+void Genotype::budgeted_clumping(const Clumping& clump_info,
+                                 T& progress_observer,
+                                 std::vector<std::atomic<bool>>& remain_snps,
+                                 std::atomic<size_t>& num_core, size_t threads,
+                                 Genotype& reference)
+{
+    const uintptr_t storage_size = ld_storage_size(
+        clump_info, reference.m_unfiltered_sample_ct, reference.m_founder_ct);
+    const size_t snp_size = GenotypePool::snp_size(storage_size);
+    std::vector<ClumpBlock> blocks = build_clump_blocks(clump_info);
+    const size_t num_block = blocks.size();
+    auto candidate = [&clump_info](const SNP& snp) {
+        return !snp.clumped() && snp.p_value() <= clump_info.pvalue;
+    };
+    // number of genotypes that will be read when the block is loaded
+    auto block_size = [this, &blocks, &candidate](size_t i_block) {
+        size_t size = 0;
+        for (size_t i = blocks[i_block].begin; i < blocks[i_block].end; ++i)
+        {
+            auto&& snp = m_existed_snps[i];
+            if (candidate(snp) && snp.current_genotype() == nullptr) ++size;
+        }
+        return size;
+    };
+    std::vector<size_t> num_genotype(num_block);
+    size_t total = 0;
+    for (size_t i_block = 0; i_block < num_block; ++i_block)
+    {
+        num_genotype[i_block] = block_size(i_block);
+        total += num_genotype[i_block];
+    }
+    // an index SNP can only be processed if every block that its window can
+    // reach is loaded. Unlike conflict, this excludes blocks that only share
+    // SNPs with a neighbouring block
+    std::vector<std::vector<size_t>> touch(num_block);
+    size_t required = 0;
+    for (size_t i_block = 0; i_block < num_block; ++i_block)
+    {
+        auto&& block = blocks[i_block];
+        const size_t low = m_existed_snps[block.begin].low_bound();
+        const size_t up = m_existed_snps[block.end - 1].up_bound();
+        size_t size = num_genotype[i_block];
+        for (auto&& c : block.conflict)
+        {
+            if (blocks[c].begin >= up || blocks[c].end <= low) continue;
+            touch[i_block].push_back(c);
+            size += num_genotype[c];
+        }
+        required = std::max(required, size);
+    }
+    // each worker reserves one genotype for reading the genotype file, the
+    // rest of the budget is shared by the loaded blocks
+    const size_t capacity = clump_info.memory / snp_size;
+    if (capacity < required + 1)
+    {
+        throw std::runtime_error(
+            "Error: Insufficient memory for clumping! Require "
+            + misc::to_string((required + 1) * snp_size / 1048576 + 1)
+            + " MB but only "
+            + misc::to_string(clump_info.memory / 1048576)
+            + " MB allowed by --memory");
+    }
+    threads = std::max<size_t>(1, std::min(threads, capacity - required));
+    // the whole data set is loaded in one pass when it fits in the budget
+    ConcurrentGenotypePool genotype_pool(std::min(capacity, total + threads),
+                                         storage_size, capacity);
+    std::deque<ClumpWorkspace> workspaces;
+    for (size_t i_thread = 0; i_thread < threads; ++i_thread)
+    {
+        workspaces.emplace_back(clump_info, reference.m_founder_ct,
+                                genotype_pool.alloc());
+    }
+    auto&& sample_for_ld = reference.m_sample_for_ld.data();
+    // SNPs of blocks in [first, last) are read by the workers in parallel
+    std::vector<size_t> to_load;
+    auto load_blocks = [&](size_t first, size_t last) {
+        to_load.clear();
+        for (size_t i = blocks[first].begin; i < blocks[last - 1].end; ++i)
+        {
+            auto&& snp = m_existed_snps[i];
+            if (candidate(snp) && snp.current_genotype() == nullptr)
+            { to_load.push_back(i); }
+        }
+        ThreadPool::global().parallel_for(
+            0, threads,
+            [&](size_t task_begin, size_t task_end) {
+                for (size_t i_task = task_begin; i_task < task_end; ++i_task)
+                {
+                    auto&& workspace = workspaces[i_task];
+                    for (size_t i = i_task; i < to_load.size(); i += threads)
+                    {
+                        auto&& snp = m_existed_snps[to_load[i]];
+                        snp.set_genotype_storage(genotype_pool.alloc());
+                        if (clump_info.ld_dosage)
+                        {
+                            reference.read_dosage(snp, workspace.genotype_file,
+                                                  snp.current_genotype(), true);
+                            continue;
+                        }
+                        reference.read_genotype(
+                            snp, reference.m_founder_ct,
+                            workspace.genotype_file, workspace.tmp_genotype,
+                            snp.current_genotype(), sample_for_ld, true);
+                    }
+                }
+            },
+            threads);
+    };
+    auto evict_block = [&](size_t i_block) {
+        for (size_t i = blocks[i_block].begin; i < blocks[i_block].end; ++i)
+        {
+            auto&& snp = m_existed_snps[i];
+            if (snp.current_genotype() != nullptr)
+            { snp.freed_geno_storage(genotype_pool); }
+        }
+    };
+    // blocks in [lo, hi) are loaded. SNPs of a finished block are either
+    // index or clumped and will never be touched again, so only unfinished
+    // blocks need to be loaded
+    size_t lo = 0, hi = 0;
+    auto loaded = [&](size_t i_block) {
+        return (i_block >= lo && i_block < hi)
+               || blocks[i_block].next_rank.load(std::memory_order_acquire)
+                      == ~size_t(0);
+    };
+    auto ready = [&](size_t i_block, size_t rank) {
+        for (auto&& c : blocks[i_block].conflict)
+        {
+            if (blocks[c].next_rank.load(std::memory_order_acquire) < rank)
+            { return false; }
+        }
+        for (auto&& c : touch[i_block])
+        {
+            if (!loaded(c)) return false;
+        }
+        return true;
+    };
+    auto first_unfinished = [&blocks, num_block](size_t start) {
+        while (start < num_block && blocks[start].next_rank == ~size_t(0))
+        { ++start; }
+        return start;
+    };
+    // The loaded blocks are clumped by the block parallel scheduler (see
+    // block_clumping). Each worker scans the loaded blocks until it finds no
+    // candidate that is ready, and the scan is repeated until a round makes
+    // no progress, as a candidate skipped by one worker might become ready
+    // once another worker is done
+    std::vector<size_t> processed(threads), local_num_core(threads, 0);
+    auto clump_loaded = [&](size_t i_task) {
+        auto&& workspace = workspaces[i_task];
+        size_t progress = 1;
+        while (progress)
+        {
+            progress = 0;
+            for (size_t i = 0; i < hi - lo; ++i)
             {
-                auto&& clump_snp = m_existed_snps[clump_idx];
-                if (clump_snp.clumped()
-                    || clump_snp.p_value() > clump_info.pvalue)
+                // start each worker at a different block to reduce
+                // contention on the block flags
+                const size_t i_block = lo + (i + i_task * (hi - lo) / threads)
+                                                % (hi - lo);
+                auto&& block = blocks[i_block];
+                if (block.next_rank.load(std::memory_order_acquire)
+                        == ~size_t(0)
+                    || block.busy.exchange(true, std::memory_order_acquire))
                 { continue; }
-                r2 = get_r2(founder_ctl2, founder_ctv2,
-                            clump_snp.current_genotype(), index_data,
-                            index_tots);
-
-                if (r2 >= min_r2)
+                ClumpBlock::Claim claim(block);
+                size_t rank = block.next_rank.load(std::memory_order_relaxed);
+                while (rank != ~size_t(0) && ready(i_block, rank))
                 {
-                    core_snp.clump(clump_snp, r2, clump_info.use_proxy,
-                                   clump_info.proxy);
-                    // remove SNP's genotype data from the genotype pool if it
-                    // is clumped out
-                    if (clump_snp.clumped())
-                    { clump_snp.freed_geno_storage(genotype_pool); }
+                    const size_t core_snp_idx = m_sort_by_p_index[rank];
+                    if (clump_index_snp(core_snp_idx, clump_info, workspace,
+                                        genotype_pool, reference))
+                    {
+                        remain_snps[core_snp_idx] = true;
+                        ++local_num_core[i_task];
+                    }
+                    ++progress;
+                    ++block.next;
+                    rank = (block.next < block.rank.size())
+                               ? block.rank[block.next]
+                               : ~size_t(0);
+                    block.next_rank.store(rank, std::memory_order_release);
                 }
             }
-            // now we can read the SNPs that come after the index SNP in the
-            // file
-            for (size_t clump_idx = core_snp_idx + 1; clump_idx < clump_end_idx;
-                 ++clump_idx)
+            processed[i_task] += progress;
+        }
+    };
+    lo = hi = first_unfinished(0);
+    while (lo < num_block)
+    {
+        const size_t load_start = hi;
+        size_t in_use = genotype_pool.in_use();
+        while (hi < num_block
+               && (lo == hi || in_use + block_size(hi) <= capacity))
+        {
+            in_use += block_size(hi);
+            ++hi;
+        }
+        if (hi > load_start) load_blocks(load_start, hi);
+        size_t round = 0;
+        do
+        {
+            std::fill(processed.begin(), processed.end(), 0);
+            ThreadPool::global().parallel_for(
+                0, threads,
+                [&clump_loaded](size_t task_begin, size_t task_end) {
+                    for (size_t i_task = task_begin; i_task < task_end;
+                         ++i_task)
+                    { clump_loaded(i_task); }
+                },
+                threads);
+            round = std::accumulate(processed.begin(), processed.end(),
+                                    size_t(0));
+            if (round) { progress_observer.emplace(std::move(round)); }
+        } while (round);
+        if (hi == num_block)
+        {
+            // reached the end, start another pass from the first block that
+            // still has candidates
+            for (size_t i_block = lo; i_block < hi; ++i_block)
+            { evict_block(i_block); }
+            lo = hi = first_unfinished(0);
+        }
+        else
+        {
+            evict_block(lo);
+            lo = first_unfinished(lo + 1);
+            if (lo > hi)
             {
-                auto&& clump_snp = m_existed_snps[clump_idx];
-                if (clump_snp.clumped()
-                    || clump_snp.p_value() > clump_info.pvalue)
-                    continue;
-                if (clump_snp.current_genotype() == nullptr)
-                {
-                    // store clump SNP's genotype into our genotype pool
-                    clump_snp.set_genotype_storage(genotype_pool.alloc());
-                    reference.read_genotype(
-                        clump_snp, reference.m_founder_ct, genotype_file,
-                        tmp_genotype->get_geno(), clump_snp.current_genotype(),
-                        sample_for_ld, true);
-                }
-                r2 = get_r2(founder_ctl2, founder_ctv2,
-                            clump_snp.current_genotype(), index_data,
-                            index_tots);
-
-                if (r2 >= min_r2)
-                {
-                    // remove SNP's genotype data from the genotype pool if it
-                    // is clumped out
-                    core_snp.clump(clump_snp, r2, clump_info.use_proxy,
-                                   clump_info.proxy);
-                    if (clump_snp.clumped())
-                    { clump_snp.freed_geno_storage(genotype_pool); }
-                }
+                // blocks in between are finished and were already evicted
+                hi = lo;
             }
-            core_snp.set_clumped();
-            // we set the remain_core to true so that we will keep it at the end
-            remain_snps[core_snp_idx] = true;
-            ++num_processed;
-            ++local_num_core;
         }
-        // in theory, by the time we reached here, genotype_pool should be empty
-        // as all SNPs should either be clumped out or are index
     }
-
     progress_observer.completed();
-    num_core += local_num_core;
-    genotype_pool.free(tmp_genotype);
+    num_core += std::accumulate(local_num_core.begin(), local_num_core.end(),
+                                size_t(0));
+    for (auto&& workspace : workspaces)
+    { genotype_pool.free(workspace.tmp_genotype); }
 }
+
 void Genotype::recalculate_categories(const PThresholding& p_info)
 { // need to loop through the SNPs to check
     std::sort(begin(m_existed_snps), end(m_existed_snps),
@@ -1614,18 +2520,18 @@ void Genotype::standardize_prs()
         if (!IS_SET(m_calculate_prs, i) || !m_sample_id[i].in_regression
             || IS_SET(m_exclude_from_std, i))
             continue;
-        if (m_prs_info[i].num_snp == 0) { rs.push(0.0); }
+        if (m_prs_info.num_snp(i) == 0) { rs.push(0.0); }
         else
         {
-            rs.push(m_prs_info[i].prs
-                    / static_cast<double>(m_prs_info[i].num_snp));
+            rs.push(m_prs_info.score(i)
+                    / static_cast<double>(m_prs_info.num_snp(i)));
         }
     }
     m_mean_score = rs.mean();
     m_score_sd = rs.sd();
 }
 
-void Genotype::get_null_score(std::vector<PRS>& prs_list,
+void Genotype::get_null_score(PRS& prs_list,
                               const size_t& set_size, const size_t& prev_size,
                               std::vector<size_t>& background_list,
                               const bool first_run)
@@ -1651,28 +2557,298 @@ void Genotype::load_genotype_to_memory()
     // don't reserve memory if we don't need to run hard coding
     if (!m_hard_coded) { return; }
     m_genotype_stored = true;
+    // each setting of the clumping sweep starts from a copy of m_sweep_snps,
+    // so genotypes stored there are loaded once and shared by all settings
+    auto&& snps = m_sweep_snps.empty() ? m_existed_snps : m_sweep_snps;
     // this is use for initialize the array sizes
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
-    std::streampos cur_line;
+    // everything is loaded at once, so the slab is backed by huge pages to
+    // reduce TLB misses during scoring
     m_genotype_pool =
-        GenotypePool(m_existed_snps.size(), unfiltered_sample_ctv2);
-    std::sort(begin(m_existed_snps), end(m_existed_snps),
-              [](SNP const& t1, SNP const& t2) {
-                  if (t1.get_file_idx() == t2.get_file_idx())
-                  { return t1.get_byte_pos() < t2.get_byte_pos(); }
-                  else
-                      return t1.get_file_idx() < t2.get_file_idx();
-              });
-    for (auto&& snp : m_existed_snps)
+        GenotypePool(snps.size(), unfiltered_sample_ctv2, 0, true);
+    // read in file order, without changing the order of the SNPs as the
+    // sweep refers to them by index
+    std::vector<size_t> order(snps.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&snps](size_t a, size_t b) {
+        auto&& t1 = snps[a];
+        auto&& t2 = snps[b];
+        if (t1.get_file_idx() == t2.get_file_idx())
+        { return t1.get_byte_pos() < t2.get_byte_pos(); }
+        else
+            return t1.get_file_idx() < t2.get_file_idx();
+    });
+    for (auto&& idx : order)
     {
+        auto&& snp = snps[idx];
         snp.set_genotype_storage(m_genotype_pool.alloc());
         this->count_and_read_genotype(snp);
     }
 }
 
 
+std::vector<std::string>
+Genotype::load_weight_matrix(std::unique_ptr<std::istream> input,
+                             std::vector<size_t>& snp_index,
+                             std::vector<bool>& flipped,
+                             Eigen::MatrixXd& weights)
+{
+    std::string line;
+    if (!std::getline(*input, line))
+    { throw std::runtime_error("Error: Weight matrix file is empty"); }
+    misc::trim(line);
+    std::vector<std::string> header = misc::split(line);
+    if (header.size() < 3)
+    {
+        throw std::runtime_error(
+            "Error: Weight matrix file must contain the SNP ID, the effect "
+            "allele and at least one weight column");
+    }
+    const std::vector<std::string> names(header.begin() + 2, header.end());
+    const size_t num_weight = names.size();
+    std::unordered_map<std::string, size_t> snp_lookup;
+    for (size_t i = 0; i < m_existed_snps.size(); ++i)
+    { snp_lookup[m_existed_snps[i].rs()] = i; }
+    std::vector<double> weight_store;
+    std::vector<std::string_view> token;
+    snp_index.clear();
+    flipped.clear();
+    size_t num_line = 1, not_found = 0, mismatch = 0;
+    std::string allele;
+    while (std::getline(*input, line))
+    {
+        ++num_line;
+        misc::trim(line);
+        if (line.empty()) continue;
+        token = misc::tokenize(line);
+        if (token.size() != header.size())
+        {
+            throw std::runtime_error(
+                "Error: Number of column on line " + std::to_string(num_line)
+                + " of the weight matrix does not match the header");
+        }
+        auto&& snp_iter = snp_lookup.find(std::string(token[0]));
+        if (snp_iter == snp_lookup.end())
+        {
+            ++not_found;
+            continue;
+        }
+        auto&& snp = m_existed_snps[snp_iter->second];
+        allele = std::string(token[1]);
+        misc::to_upper(allele);
+        // unflipped SNP count the reference allele, the same as read_prs
+        if (allele == snp.ref()) { flipped.push_back(false); }
+        else if (allele == snp.alt())
+        {
+            flipped.push_back(true);
+        }
+        else
+        {
+            ++mismatch;
+            continue;
+        }
+        snp_index.push_back(snp_iter->second);
+        for (size_t i = 0; i < num_weight; ++i)
+        {
+            try
+            {
+                weight_store.push_back(
+                    misc::convert<double>(std::string(token[i + 2])));
+            }
+            catch (...)
+            {
+                throw std::runtime_error(
+                    "Error: Non-numeric weight on line "
+                    + std::to_string(num_line) + " of the weight matrix");
+            }
+        }
+    }
+    input.reset();
+    weights = Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+                                      Eigen::RowMajor>>(
+        weight_store.data(), static_cast<Eigen::Index>(snp_index.size()),
+        static_cast<Eigen::Index>(num_weight));
+    std::string message = std::to_string(snp_index.size())
+                          + " variant(s) included from the weight matrix";
+    if (not_found != 0)
+    {
+        message.append("\n" + std::to_string(not_found)
+                       + " variant(s) not found in the target");
+    }
+    if (mismatch != 0)
+    {
+        message.append("\n" + std::to_string(mismatch)
+                       + " variant(s) with mismatched effect allele");
+    }
+    m_reporter->report(message);
+    return names;
+}
+
+void Genotype::matrix_score(const std::vector<size_t>& snp_index,
+                            const std::vector<bool>& flipped,
+                            const Eigen::MatrixXd& weights,
+                            Eigen::MatrixXd& scores,
+                            std::vector<uint32_t>& num_snp)
+{
+    assert(snp_index.size() == static_cast<size_t>(weights.rows()));
+    assert(snp_index.size() == flipped.size());
+    const Eigen::Index num_weight = weights.cols();
+    scores = Eigen::MatrixXd::Zero(static_cast<Eigen::Index>(m_sample_ct),
+                                   num_weight);
+    num_snp.assign(m_sample_ct, 0);
+    if (snp_index.empty() || m_sample_ct == 0) return;
+    const uintptr_t unfiltered_sample_ctv2 =
+        2 * BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+    const uint32_t ploidy = 2;
+    const uint32_t miss_count =
+        (m_prs_calculation.missing_score != MISSING_SCORE::SET_ZERO) * ploidy;
+    const bool is_centre =
+        (m_prs_calculation.missing_score == MISSING_SCORE::CENTER);
+    const bool mean_impute =
+        (m_prs_calculation.missing_score == MISSING_SCORE::MEAN_IMPUTE);
+    const size_t total_snp = snp_index.size();
+    const size_t snp_block =
+        std::min<size_t>(MATRIX_SCORE_SNP_BLOCK, total_snp);
+    const size_t sample_block =
+        std::min<size_t>(MATRIX_SCORE_SAMPLE_BLOCK, m_sample_ct);
+    // storage for SNPs that are not already loaded into memory
+    std::vector<uintptr_t> genotype_block(snp_block * unfiltered_sample_ctv2,
+                                          0);
+    std::vector<uintptr_t*> genotype_ptr(snp_block, nullptr);
+    // value and count of each genotype code (homcom, het, missing, homrar)
+    // of each SNP in the current block
+    std::vector<std::array<double, 4>> values(snp_block);
+    std::vector<std::array<uint32_t, 4>> counts(snp_block);
+    Eigen::MatrixXd tile(static_cast<Eigen::Index>(sample_block),
+                         static_cast<Eigen::Index>(snp_block));
+    uint32_t homcom_ct, het_ct, homrar_ct, missing_ct;
+    double homcom_weight, het_weight, homrar_weight, expected;
+    for (size_t block_start = 0; block_start < total_snp;
+         block_start += snp_block)
+    {
+        const size_t cur_snp_block =
+            std::min(snp_block, total_snp - block_start);
+        for (size_t j = 0; j < cur_snp_block; ++j)
+        {
+            auto&& snp = m_existed_snps[snp_index[block_start + j]];
+            genotype_ptr[j] = snp.current_genotype();
+            if (genotype_ptr[j] == nullptr)
+            {
+                genotype_ptr[j] = &genotype_block[j * unfiltered_sample_ctv2];
+                read_genotype(snp, m_sample_ct, m_genotype_file,
+                              m_tmp_genotype.data(), genotype_ptr[j],
+                              m_calculate_prs.data(), false);
+            }
+            if (!snp.get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                                m_prs_calculation.use_ref_maf))
+            {
+                // count from the selected samples
+                uint32_t code_ct[4] = {0, 0, 0, 0};
+                for (size_t i = 0; i < m_sample_ct; ++i)
+                {
+                    ++code_ct[(~genotype_ptr[j][i / BITCT2]
+                               >> (2 * (i % BITCT2)))
+                              & 3];
+                }
+                homcom_ct = code_ct[0];
+                het_ct = code_ct[1];
+                missing_ct = code_ct[2];
+                homrar_ct = code_ct[3];
+            }
+            if (homcom_ct + het_ct + homrar_ct == 0)
+            {
+                // problematic SNP, doesn't contribute to the score
+                values[j].fill(0.0);
+                counts[j].fill(0);
+                continue;
+            }
+            homcom_weight = m_homcom_weight;
+            het_weight = m_het_weight;
+            homrar_weight = m_homrar_weight;
+            if (flipped[block_start + j])
+            { std::swap(homcom_weight, homrar_weight); }
+            // same as ploidy * maf in read_score
+            expected = ploidy
+                       * (1.0
+                          - (homcom_weight * homcom_ct + het_weight * het_ct
+                             + homrar_weight * homrar_ct)
+                                / (static_cast<double>(homcom_ct + het_ct
+                                                       + homrar_ct)
+                                   * ploidy));
+            const double adj = is_centre ? expected : 0.0;
+            values[j] = {homcom_weight - adj, het_weight - adj,
+                         mean_impute ? expected : 0.0, homrar_weight - adj};
+            counts[j] = {ploidy, ploidy, miss_count, ploidy};
+        }
+        for (size_t sample_start = 0; sample_start < m_sample_ct;
+             sample_start += sample_block)
+        {
+            const size_t cur_sample_block =
+                std::min(sample_block, m_sample_ct - sample_start);
+            // sample_block is a multiple of BITCT2, so each tile start at
+            // the beginning of a word
+            const size_t word_start = sample_start / BITCT2;
+            for (size_t j = 0; j < cur_snp_block; ++j)
+            {
+                const uintptr_t* geno_word = genotype_ptr[j] + word_start;
+                const auto& value = values[j];
+                const auto& count = counts[j];
+                double* tile_col = tile.col(static_cast<Eigen::Index>(j)).data();
+                uint32_t* sample_count = &num_snp[sample_start];
+                uintptr_t cur_word = 0;
+                for (size_t i = 0; i < cur_sample_block; ++i)
+                {
+                    if ((i & (BITCT2 - 1)) == 0) { cur_word = ~(*geno_word++); }
+                    const uintptr_t geno = cur_word & 3;
+                    cur_word >>= 2;
+                    tile_col[i] = value[geno];
+                    sample_count[i] += count[geno];
+                }
+            }
+            scores.middleRows(static_cast<Eigen::Index>(sample_start),
+                              static_cast<Eigen::Index>(cur_sample_block))
+                .noalias() +=
+                tile.topLeftCorner(
+                    static_cast<Eigen::Index>(cur_sample_block),
+                    static_cast<Eigen::Index>(cur_snp_block))
+                * weights.middleRows(static_cast<Eigen::Index>(block_start),
+                                     static_cast<Eigen::Index>(cur_snp_block));
+        }
+    }
+}
+
+void Genotype::finalize_matrix_score(Eigen::MatrixXd& scores,
+                                     const std::vector<uint32_t>& num_snp) const
+{
+    if (m_prs_calculation.scoring_method == SCORING::SUM) return;
+    for (Eigen::Index i = 0; i < scores.rows(); ++i)
+    {
+        const uint32_t cur_num = num_snp[static_cast<size_t>(i)];
+        if (cur_num == 0) { scores.row(i).setZero(); }
+        else
+        {
+            scores.row(i) /= static_cast<double>(cur_num);
+        }
+    }
+    if (m_prs_calculation.scoring_method == SCORING::AVERAGE) return;
+    // use the same samples as standardize_prs
+    for (Eigen::Index k = 0; k < scores.cols(); ++k)
+    {
+        misc::RunningStat rs;
+        for (size_t i = 0; i < static_cast<size_t>(scores.rows()); ++i)
+        {
+            if (!IS_SET(m_calculate_prs, i) || !m_sample_id[i].in_regression
+                || IS_SET(m_exclude_from_std, i))
+                continue;
+            rs.push(scores(static_cast<Eigen::Index>(i), k));
+        }
+        scores.col(k).array() -= rs.mean();
+        scores.col(k) /= rs.sd();
+    }
+}
+
 bool Genotype::get_score(std::vector<size_t>::const_iterator& start_index,
                          const std::vector<size_t>::const_iterator& end_index,
                          double& cur_threshold, uint32_t& num_snp_included,
@@ -0,0 +1,256 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ld_cache.hpp"
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const char LD_CACHE_MAGIC[8] = {'P', 'R', 'S', 'L', 'D', 'C', 'H', 'E'};
+const uint64_t LD_CACHE_VERSION = 2;
+// magic, version, floor, distance, founder count, fingerprint (files,
+// founders, filters), number of chromosome
+const size_t LD_CACHE_HEADER_SIZE = 9 * sizeof(uint64_t);
+// chr, number of variants, number of entries, offset
+const size_t LD_CACHE_DIRECTORY_SIZE = 4 * sizeof(uint64_t);
+
+size_t section_size(uint64_t num_variant, uint64_t num_entry)
+{
+    const size_t size = (2 * num_variant + 1) * sizeof(uint64_t)
+                        + num_entry * (sizeof(double) + sizeof(uint32_t));
+    return (size + 7) & ~size_t(7);
+}
+
+template <typename T>
+void write_value(std::ofstream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void write_vector(std::ofstream& out, const std::vector<T>& value)
+{
+    if (value.empty()) return;
+    out.write(reinterpret_cast<const char*>(value.data()),
+              static_cast<std::streamsize>(value.size() * sizeof(T)));
+}
+
+template <typename T>
+T read_value(const char* data, size_t offset)
+{
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+} // namespace
+
+uint64_t LDCache::hash_file(const std::string& file, uint64_t seed)
+{
+    seed = hash(file, seed);
+    struct stat file_stat;
+    if (stat(file.c_str(), &file_stat) != 0) return seed;
+    const int64_t size = static_cast<int64_t>(file_stat.st_size);
+    const int64_t mtime = static_cast<int64_t>(file_stat.st_mtime);
+    seed = hash(&size, sizeof(size), seed);
+    return hash(&mtime, sizeof(mtime), seed);
+}
+
+LDCache::~LDCache() { release(); }
+
+void LDCache::release()
+{
+#ifndef _WIN32
+    if (m_mapped && m_data != nullptr)
+    { munmap(const_cast<char*>(m_data), m_size); }
+#endif
+    m_buffer.clear();
+    m_chromosomes.clear();
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+}
+
+void LDCache::write(const std::string& file, double floor, size_t distance,
+                    size_t founder_ct, const Fingerprint& fingerprint,
+                    const std::vector<Chromosome>& chromosomes)
+{
+    std::ofstream out(file.c_str(), std::ios::binary);
+    if (!out.is_open())
+    {
+        throw std::runtime_error("Error: Cannot open LD cache to write: "
+                                 + file);
+    }
+    out.write(LD_CACHE_MAGIC, sizeof(LD_CACHE_MAGIC));
+    write_value(out, LD_CACHE_VERSION);
+    write_value(out, floor);
+    write_value(out, static_cast<uint64_t>(distance));
+    write_value(out, static_cast<uint64_t>(founder_ct));
+    write_value(out, fingerprint.files);
+    write_value(out, fingerprint.founders);
+    write_value(out, fingerprint.filters);
+    write_value(out, static_cast<uint64_t>(chromosomes.size()));
+    uint64_t offset =
+        LD_CACHE_HEADER_SIZE + chromosomes.size() * LD_CACHE_DIRECTORY_SIZE;
+    for (auto&& chr : chromosomes)
+    {
+        if (chr.row_offset.size() != chr.keys.size() + 1
+            || chr.column.size() != chr.r2.size()
+            || chr.row_offset.back() != chr.r2.size()
+            || !std::is_sorted(chr.keys.begin(), chr.keys.end()))
+        { throw std::runtime_error("Error: Malformed LD cache matrix"); }
+        write_value(out, static_cast<uint64_t>(chr.chr));
+        write_value(out, static_cast<uint64_t>(chr.keys.size()));
+        write_value(out, static_cast<uint64_t>(chr.r2.size()));
+        write_value(out, offset);
+        offset += section_size(chr.keys.size(), chr.r2.size());
+    }
+    const char padding[8] = {0};
+    for (auto&& chr : chromosomes)
+    {
+        write_vector(out, chr.keys);
+        write_vector(out, chr.row_offset);
+        write_vector(out, chr.r2);
+        write_vector(out, chr.column);
+        const size_t used =
+            (2 * chr.keys.size() + 1) * sizeof(uint64_t)
+            + chr.r2.size() * (sizeof(double) + sizeof(uint32_t));
+        out.write(padding,
+                  static_cast<std::streamsize>(
+                      section_size(chr.keys.size(), chr.r2.size()) - used));
+    }
+    if (!out.good())
+    { throw std::runtime_error("Error: Failed to write LD cache: " + file); }
+}
+
+void LDCache::load(const std::string& file)
+{
+    release();
+#ifndef _WIN32
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+    { throw std::runtime_error("Error: Cannot open LD cache: " + file); }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error("Error: Cannot read LD cache: " + file);
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        m_size = 0;
+        throw std::runtime_error("Error: Cannot map LD cache: " + file);
+    }
+    m_data = static_cast<const char*>(mapped);
+    m_mapped = true;
+#else
+    std::ifstream in(file.c_str(), std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    { throw std::runtime_error("Error: Cannot open LD cache: " + file); }
+    m_size = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    m_buffer.resize(m_size);
+    if (!in.read(m_buffer.data(), static_cast<std::streamsize>(m_size)))
+    { throw std::runtime_error("Error: Cannot read LD cache: " + file); }
+    m_data = m_buffer.data();
+#endif
+    if (m_size < LD_CACHE_HEADER_SIZE
+        || std::memcmp(m_data, LD_CACHE_MAGIC, sizeof(LD_CACHE_MAGIC)) != 0)
+    {
+        release();
+        throw std::runtime_error("Error: " + file + " is not an LD cache");
+    }
+    if (read_value<uint64_t>(m_data, 8) != LD_CACHE_VERSION)
+    {
+        release();
+        throw std::runtime_error("Error: Unsupported LD cache version: "
+                                 + file);
+    }
+    m_floor = read_value<double>(m_data, 16);
+    m_distance = read_value<uint64_t>(m_data, 24);
+    m_founder_ct = read_value<uint64_t>(m_data, 32);
+    m_fingerprint.files = read_value<uint64_t>(m_data, 40);
+    m_fingerprint.founders = read_value<uint64_t>(m_data, 48);
+    m_fingerprint.filters = read_value<uint64_t>(m_data, 56);
+    const uint64_t num_chr = read_value<uint64_t>(m_data, 64);
+    if (m_size < LD_CACHE_HEADER_SIZE + num_chr * LD_CACHE_DIRECTORY_SIZE)
+    {
+        release();
+        throw std::runtime_error("Error: Truncated LD cache: " + file);
+    }
+    m_chromosomes.resize(num_chr);
+    for (size_t i = 0; i < num_chr; ++i)
+    {
+        const size_t dir = LD_CACHE_HEADER_SIZE + i * LD_CACHE_DIRECTORY_SIZE;
+        auto&& view = m_chromosomes[i];
+        view.chr = read_value<uint64_t>(m_data, dir);
+        view.num_variant = read_value<uint64_t>(m_data, dir + 8);
+        const uint64_t num_entry = read_value<uint64_t>(m_data, dir + 16);
+        const uint64_t offset = read_value<uint64_t>(m_data, dir + 24);
+        if ((offset & 7) != 0
+            || offset + section_size(view.num_variant, num_entry) > m_size)
+        {
+            release();
+            throw std::runtime_error("Error: Truncated LD cache: " + file);
+        }
+        const char* start = m_data + offset;
+        view.keys = reinterpret_cast<const uint64_t*>(start);
+        view.row_offset = view.keys + view.num_variant;
+        view.r2 = reinterpret_cast<const double*>(view.row_offset
+                                                  + view.num_variant + 1);
+        view.column = reinterpret_cast<const uint32_t*>(view.r2 + num_entry);
+    }
+}
+
+LDCache::Variant LDCache::find(size_t chr, uint64_t key) const
+{
+    Variant result;
+    for (auto&& view : m_chromosomes)
+    {
+        if (view.chr != chr) continue;
+        const size_t idx = view.index(key);
+        if (idx != ~size_t(0))
+        {
+            result.chr = &view;
+            result.index = idx;
+        }
+        break;
+    }
+    return result;
+}
+
+bool LDCache::r2(const Variant& index, uint64_t key, double& r2) const
+{
+    const size_t target = index.chr->index(key);
+    if (target == ~size_t(0)) return false;
+    auto&& chr = *index.chr;
+    const uint64_t row_start = chr.row_offset[index.index];
+    const uint32_t* first = chr.column + row_start;
+    const uint32_t* last = chr.column + chr.row_offset[index.index + 1];
+    auto it = std::lower_bound(first, last, static_cast<uint32_t>(target));
+    r2 = (it != last && *it == target) ? chr.r2[row_start + (it - first)] : 0;
+    return true;
+}
@@ -0,0 +1,334 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ldpanel.hpp"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const char LD_PANEL_MAGIC[8] = {'P', 'R', 'S', 'L', 'D', 'P', 'N', 'L'};
+const uint64_t LD_PANEL_VERSION = 1;
+// magic, version, founder count, number of variants, record offset, string
+// offset, string size
+const size_t LD_PANEL_HEADER_SIZE = 7 * sizeof(uint64_t);
+static_assert(sizeof(LDPanel::Record) == 6 * sizeof(uint64_t),
+              "Unexpected padding in LD panel record");
+
+template <typename T>
+void write_value(std::ofstream& out, const T& value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read_value(const char* data, size_t offset)
+{
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+} // namespace
+
+LDPanel::Writer::Writer(const std::string& file, uintptr_t founder_ct)
+    : m_file(file)
+    , m_founder_ct(founder_ct)
+    , m_founder_ctl2(QUATERCT_TO_WORDCT(founder_ct))
+    , m_offset(LD_PANEL_HEADER_SIZE)
+{
+    if (founder_ct == 0)
+    {
+        throw std::runtime_error(
+            "Error: Cannot generate LD panel without founders");
+    }
+    m_out.open(file.c_str(), std::ios::binary);
+    if (!m_out.is_open())
+    {
+        throw std::runtime_error("Error: Cannot open LD panel to write: "
+                                 + file);
+    }
+    // header is written in close, when the section sizes are known
+    const char header[LD_PANEL_HEADER_SIZE] = {0};
+    m_out.write(header, LD_PANEL_HEADER_SIZE);
+    m_founder_include2.resize(QUATERCT_TO_ALIGNED_WORDCT(founder_ct), 0);
+    fill_quatervec_55(static_cast<uint32_t>(founder_ct),
+                      m_founder_include2.data());
+}
+
+void LDPanel::Writer::add(const std::string& rs, size_t chr, size_t loc,
+                          const std::string& a1, const std::string& a2,
+                          const uintptr_t* genotype)
+{
+    if (!m_records.empty()
+        && (chr < m_records.back().chr
+            || (chr == m_records.back().chr && loc < m_records.back().loc)))
+    {
+        throw std::runtime_error(
+            "Error: Variants must be added to the LD panel in order of "
+            "chromosome and coordinate");
+    }
+    Record record;
+    record.loc = loc;
+    record.genotype = m_offset;
+    record.name = m_names.size();
+    record.chr = static_cast<uint32_t>(chr);
+    uint32_t het = 0, homrar = 0;
+    genovec_3freq(genotype, m_founder_include2.data(), m_founder_ctl2,
+                  &record.missing, &het, &homrar);
+    record.het = het;
+    record.homrar = homrar;
+    record.homcom = static_cast<uint32_t>(m_founder_ct) - record.missing
+                    - record.het - record.homrar;
+    for (auto&& str : {rs, a1, a2})
+    {
+        m_names.insert(m_names.end(), str.begin(), str.end());
+        m_names.push_back('\0');
+    }
+    m_out.write(reinterpret_cast<const char*>(genotype),
+                static_cast<std::streamsize>(m_founder_ctl2
+                                             * sizeof(uintptr_t)));
+    m_offset += m_founder_ctl2 * sizeof(uintptr_t);
+    m_records.push_back(record);
+}
+
+void LDPanel::Writer::close()
+{
+    const uint64_t record_offset = m_offset;
+    const uint64_t name_offset =
+        record_offset + m_records.size() * sizeof(Record);
+    if (!m_records.empty())
+    {
+        m_out.write(reinterpret_cast<const char*>(m_records.data()),
+                    static_cast<std::streamsize>(m_records.size()
+                                                 * sizeof(Record)));
+    }
+    m_out.write(m_names.data(), static_cast<std::streamsize>(m_names.size()));
+    const char padding[8] = {0};
+    m_out.write(padding, static_cast<std::streamsize>(
+                             (8 - (m_names.size() & 7)) & 7));
+    m_out.seekp(0, std::ios::beg);
+    m_out.write(LD_PANEL_MAGIC, sizeof(LD_PANEL_MAGIC));
+    write_value(m_out, LD_PANEL_VERSION);
+    write_value(m_out, static_cast<uint64_t>(m_founder_ct));
+    write_value(m_out, static_cast<uint64_t>(m_records.size()));
+    write_value(m_out, record_offset);
+    write_value(m_out, name_offset);
+    write_value(m_out, static_cast<uint64_t>(m_names.size()));
+    if (!m_out.good())
+    {
+        throw std::runtime_error("Error: Failed to write LD panel: "
+                                 + m_file);
+    }
+    m_out.close();
+}
+
+LDPanel::LDPanel(const GenoFile& geno, const Phenotype& pheno,
+                 const std::string& delim, Reporter* reporter)
+{
+    const std::string message = initialize(geno, pheno, delim, "ldp", reporter);
+    if (m_genotype_file_names.size() != 1)
+    {
+        throw std::runtime_error(
+            "Error: LD panel must be provided as a single file");
+    }
+    if (!m_sample_file.empty())
+    {
+        throw std::runtime_error(
+            "Error: External sample file is not supported for LD panel");
+    }
+    m_reporter->report(message);
+    m_hard_coded = true;
+    load(m_genotype_file_names.front() + ".ldp");
+}
+
+LDPanel::~LDPanel() { release(); }
+
+void LDPanel::release()
+{
+#ifndef _WIN32
+    if (m_mapped && m_data != nullptr)
+    { munmap(const_cast<char*>(m_data), m_size); }
+#endif
+    m_buffer.clear();
+    m_data = nullptr;
+    m_records = nullptr;
+    m_names = nullptr;
+    m_size = 0;
+    m_num_variant = 0;
+    m_mapped = false;
+}
+
+void LDPanel::load(const std::string& file)
+{
+    release();
+#ifndef _WIN32
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+    { throw std::runtime_error("Error: Cannot open LD panel: " + file); }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Error: Cannot read LD panel: " + file);
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    void* mapped = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        m_size = 0;
+        throw std::runtime_error("Error: Cannot map LD panel: " + file);
+    }
+    m_data = static_cast<const char*>(mapped);
+    m_mapped = true;
+#else
+    std::ifstream in(file.c_str(), std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    { throw std::runtime_error("Error: Cannot open LD panel: " + file); }
+    m_size = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    m_buffer.resize(m_size);
+    if (!in.read(m_buffer.data(), static_cast<std::streamsize>(m_size)))
+    { throw std::runtime_error("Error: Cannot read LD panel: " + file); }
+    m_data = m_buffer.data();
+#endif
+    if (m_size < LD_PANEL_HEADER_SIZE
+        || std::memcmp(m_data, LD_PANEL_MAGIC, sizeof(LD_PANEL_MAGIC)) != 0)
+    {
+        release();
+        throw std::runtime_error("Error: " + file + " is not an LD panel");
+    }
+    if (read_value<uint64_t>(m_data, 8) != LD_PANEL_VERSION)
+    {
+        release();
+        throw std::runtime_error("Error: Unsupported LD panel version: "
+                                 + file);
+    }
+    m_panel_founder_ct = read_value<uint64_t>(m_data, 16);
+    m_num_variant = read_value<uint64_t>(m_data, 24);
+    const uint64_t record_offset = read_value<uint64_t>(m_data, 32);
+    const uint64_t name_offset = read_value<uint64_t>(m_data, 40);
+    const uint64_t name_size = read_value<uint64_t>(m_data, 48);
+    m_founder_ctl2 = QUATERCT_TO_WORDCT(m_panel_founder_ct);
+    if ((record_offset & 7) != 0
+        || record_offset
+               != LD_PANEL_HEADER_SIZE
+                      + m_num_variant * m_founder_ctl2 * sizeof(uintptr_t)
+        || name_offset != record_offset + m_num_variant * sizeof(Record)
+        || name_offset + name_size > m_size
+        || (name_size != 0 && m_data[name_offset + name_size - 1] != '\0'))
+    {
+        release();
+        throw std::runtime_error("Error: Truncated LD panel: " + file);
+    }
+    m_records = reinterpret_cast<const Record*>(m_data + record_offset);
+    m_names = m_data + name_offset;
+}
+
+const LDPanel::Record& LDPanel::record(const SNP& snp) const
+{
+    // genotypes are stored in the same order as the records
+    const size_t offset = static_cast<size_t>(snp.get_byte_pos(m_is_ref));
+    return m_records[(offset - LD_PANEL_HEADER_SIZE)
+                     / (m_founder_ctl2 * sizeof(uintptr_t))];
+}
+
+std::vector<Sample_ID> LDPanel::gen_sample_vector()
+{
+    if (!m_keep_file.empty() || !m_remove_file.empty())
+    {
+        throw std::runtime_error(
+            "Error: Sample selection cannot be performed on LD panel. Please "
+            "apply it when generating the panel");
+    }
+    m_unfiltered_sample_ct = m_panel_founder_ct;
+    init_sample_vectors();
+    // the panel only contains founders that passed the sample selection
+    fill_all_bits(m_unfiltered_sample_ct, m_sample_for_ld.data());
+    fill_all_bits(m_unfiltered_sample_ct, m_calculate_prs.data());
+    m_sample_ct = m_unfiltered_sample_ct;
+    m_founder_ct = m_unfiltered_sample_ct;
+    post_sample_read_init();
+    // sample IDs are not stored
+    return std::vector<Sample_ID>(0);
+}
+
+void LDPanel::gen_snp_vector(
+    const std::vector<IITree<size_t, size_t>>& exclusion_regions,
+    const std::string& out_prefix, Genotype* target)
+{
+    const std::string mismatch_snp_record_name = out_prefix + ".mismatch";
+    const std::string mismatch_source = m_is_ref ? "Reference" : "Base";
+    std::unordered_set<std::string> processed_snps;
+    std::unordered_set<std::string> duplicated_snp;
+    auto&& genotype = (m_is_ref) ? target : this;
+    std::vector<bool> retain_snp(genotype->m_existed_snps.size(), false);
+    size_t num_retained = 0;
+    for (size_t i = 0; i < m_num_variant; ++i)
+    {
+        auto&& record = m_records[i];
+        const char* rs = m_names + record.name;
+        const char* a1 = rs + std::strlen(rs) + 1;
+        const char* a2 = a1 + std::strlen(a1) + 1;
+        SNP cur_snp(rs, record.chr, record.loc, a1, a2, 0,
+                    static_cast<std::streampos>(record.genotype));
+        if (process_snp(exclusion_regions, mismatch_snp_record_name,
+                        mismatch_source, "", cur_snp, processed_snps,
+                        duplicated_snp, retain_snp, genotype))
+        { ++num_retained; }
+    }
+    if (num_retained != genotype->m_existed_snps.size())
+    {
+        genotype->shrink_snp_vector(retain_snp);
+        // need to update index search after we updated the vector
+        genotype->update_snp_index();
+    }
+    if (duplicated_snp.size() != 0)
+    {
+        throw std::runtime_error(
+            genotype->print_duplicated_snps(duplicated_snp, out_prefix));
+    }
+}
+
+bool LDPanel::calc_freq_gen_inter(const QCFiltering& filter_info,
+                                  const std::string&, Genotype* genotype)
+{
+    // counts were calculated when the panel was generated, and all samples
+    // are founders
+    const size_t total_snp = genotype->m_existed_snps.size();
+    std::vector<bool> retain_snps(total_snp, false);
+    size_t retained = 0;
+    uint32_t missing_founder_ct = 0;
+    for (size_t i = 0; i < total_snp; ++i)
+    {
+        auto&& snp = genotype->m_existed_snps[i];
+        auto&& info = record(snp);
+        if (filter_snp(info.homcom, info.het, info.homrar, info.homcom,
+                       info.het, info.homrar, filter_info.geno,
+                       filter_info.maf, missing_founder_ct))
+        { continue; }
+        snp.set_counts(info.homcom, info.het, info.homrar, missing_founder_ct,
+                       m_is_ref);
+        retain_snps[i] = true;
+        ++retained;
+    }
+    if (retained != total_snp) { genotype->shrink_snp_vector(retain_snps); }
+    return true;
+}
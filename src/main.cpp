@@ -27,6 +27,7 @@
 #include "reporter.hpp"
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -55,6 +56,12 @@ int main(int argc, char* argv[])
         {
             return -1; // all error messages should have printed
         }
+        // all parallel stages share the same workers. Eigen is kept single
+        // threaded such that it does not compete with them
+        const int num_thread = commander.get_prs_instruction().thread;
+        ThreadPool::global().resize(
+            num_thread > 1 ? static_cast<size_t>(num_thread) : 0);
+        Eigen::setNbThreads(1);
         // parse the exclusion range and put it into the exclusion object
         // Generate the exclusion region
         std::vector<IITree<size_t, size_t>> exclusion_regions;
@@ -64,6 +71,32 @@ int main(int argc, char* argv[])
         Genotype *target_file = nullptr, *reference_file = nullptr;
         try
         {
+            if (!commander.get_clump_info().ld_panel.empty())
+            {
+                // the panel only depends on the LD reference
+                reference_file = factory.createGenotype(
+                    commander.get_reference(), commander.get_pheno(),
+                    commander.delim(), reporter);
+                initialize_ld_panel(exclusion_regions, commander,
+                                    reference_file, reporter);
+                reference_file->write_ld_panel(
+                    commander.get_clump_info().ld_panel + ".ldp");
+                delete reference_file;
+                return 0;
+            }
+            if (!commander.weight_matrix().empty())
+            {
+                // the weight matrix is matched against all target variants,
+                // independent of the base and clumping
+                std::unique_ptr<Genotype> weight_target(factory.createGenotype(
+                    commander.get_target(), commander.get_pheno(),
+                    commander.delim(), reporter));
+                initialize_weight_target(exclusion_regions, commander,
+                                         weight_target.get(), reporter);
+                matrix_score(commander, weight_target.get(), commander.out(),
+                             reporter);
+                return 0;
+            }
             // initialize the target object using the factory
             target_file = factory.createGenotype(commander.get_target(),
                                                  commander.get_pheno(),
@@ -99,153 +132,196 @@ int main(int argc, char* argv[])
             const bool no_regress = prs_instruction.no_regress;
             PRSice::pheno_check(no_regress, pheno_info, reporter);
 
-            if (!commander.get_clump_info().no_clump)
+            auto&& clump_info = commander.get_clump_info();
+            const bool run_sweep =
+                !clump_info.no_clump && !clump_info.sweep.empty();
+            if (!clump_info.no_clump)
             {
-                target_file->build_clump_windows(
-                    commander.get_clump_info().distance);
+                if (!clump_info.ld_block.empty())
+                {
+                    std::vector<IITree<size_t, size_t>> ld_blocks;
+                    Region::generate_ld_blocks(ld_blocks, clump_info.ld_block);
+                    target_file->set_ld_blocks(std::move(ld_blocks));
+                }
+                target_file->build_clump_windows(clump_info.distance);
                 target_file->sort_by_p();
-                // now perform clumping
-                target_file->clumping(commander.get_clump_info(),
-                                      commander.use_ref() ? *reference_file
-                                                          : *target_file,
-                                      commander.get_prs_instruction().thread);
+                Genotype& ld_reference =
+                    commander.use_ref() ? *reference_file : *target_file;
+                if (run_sweep)
+                {
+                    // LD is calculated once, each setting is clumped later
+                    target_file->prepare_clump_sweep(clump_info, ld_reference);
+                }
+                else
+                {
+                    if (!clump_info.ld_cache.empty())
+                    {
+                        target_file->prepare_ld_cache(clump_info,
+                                                      ld_reference);
+                    }
+                    // now perform clumping
+                    target_file->clumping(
+                        clump_info, ld_reference,
+                        commander.get_prs_instruction().thread);
+                }
             }
             // immediately free the memory
             if (reference_file != nullptr) { delete reference_file; }
+            std::vector<size_t> significant_count = {0, 0, 0};
+            // with the sweep, genotypes are loaded once for all settings
             if (commander.ultra_aggressive())
             { target_file->load_genotype_to_memory(); }
-            target_file->prepare_prsice();
-            // from now on, we are not allow to sort the m_existed_snps
-            auto snp_file = commander.print_snp()
-                                ? misc::load_ostream(commander.out() + ".snp")
-                                : nullptr;
-            // vector containing the index for each SNP in each set
-            // structure is [vec of Set][vec of SNP]
-            auto region_membership = target_file->build_membership_matrix(
-                num_regions, region_names, commander.print_snp(),
-                *snp_file.get());
-            // we can now quickly check if any of the region are empty
-            try
-            {
-                print_empty_region(commander.out(), region_membership,
-                                   region_names);
-            }
-            catch (const std::runtime_error& er)
+            const size_t num_run = run_sweep ? clump_info.sweep.size() : 1;
+            for (size_t i_run = 0; i_run < num_run; ++i_run)
             {
-                reporter.report(er.what());
-                return -1;
-            }
-            // Initialize the progress bar
-            // one progress bar per phenotype
-            // one extra progress bar for competitive permutation
-            assert(target_file->get_set_thresholds().size() == num_regions);
-
-            const auto [max_fid, max_iid] = target_file->get_max_id_length();
-            const size_t num_pheno = pheno_info.pheno_col_idx.size();
-            // prsice and summary file will be per run
-            // all score and best file will be per phenotype
-            // this is mainly because of the size of the file and the way we
-            // need to generate them
-            // with prsice and summary file, we can do row wise output, so it is
-            // ok for us to keep using it
-            // but for all and best, we are doing column-wise output, which need
-            // expensive seek operations
-            std::unique_ptr<std::ostream> summary_file = nullptr;
-            auto prefix = commander.out();
-            auto prsice_out = misc::load_ostream(prefix + ".prsice");
-            const bool has_prevalence = !pheno_info.prevalence.empty();
-            print_prsice_header(has_prevalence, no_regress, prsice_out);
-            auto perm_info = commander.get_perm();
-            if (!no_regress)
-            {
-                summary_file = misc::load_ostream(prefix + ".summary");
-                print_summary_header(has_prevalence, perm_info.run_set_perm,
-                                     perm_info.run_perm, summary_file);
-            }
-            size_t i_prevalence = 0;
-            std::vector<size_t> significant_count = {0, 0, 0};
-            for (size_t i_pheno = 0; i_pheno < num_pheno; ++i_pheno)
-            {
-                if (pheno_info.skip_pheno[i_pheno])
+                std::string prefix = commander.out();
+                if (run_sweep)
                 {
-                    reporter.report("Skipping the "
-                                    + std::to_string(i_pheno + 1)
-                                    + " th phenotype");
-                    continue;
+                    auto&& setting = clump_info.sweep[i_run];
+                    target_file->sweep_clumping(clump_info, setting);
+                    prefix += clump_setting_suffix(setting);
                 }
-                if (!no_regress)
+                target_file->prepare_prsice();
+                // from now on, we are not allow to sort the m_existed_snps
+                auto snp_file = commander.print_snp()
+                                    ? misc::load_ostream(prefix + ".snp")
+                                    : nullptr;
+                // vector containing the index for each SNP in each set
+                // structure is [vec of Set][vec of SNP]
+                auto region_membership = target_file->build_membership_matrix(
+                    num_regions, region_names, commander.print_snp(),
+                    *snp_file.get());
+                // we can now quickly check if any of the region are empty
+                try
                 {
-                    reporter.report("Processing the "
-                                    + std::to_string(i_pheno + 1)
-                                    + " th phenotype");
+                    print_empty_region(prefix, region_membership, region_names);
                 }
-                else
+                catch (const std::runtime_error& er)
                 {
-                    reporter.report("Start calculating the scores\n");
+                    reporter.report(er.what());
+                    return -1;
                 }
-                const std::string pheno_name =
-                    (num_pheno > 1) ? pheno_info.pheno_col[i_pheno] : "-";
-                const std::string file_suffix =
-                    (num_pheno > 1) ? "." + pheno_name : "";
-                PRSice prsice(commander.get_prs_instruction(),
-                              commander.get_p_threshold(), perm_info, prefix,
-                              pheno_info.binary[i_pheno], &reporter);
-                const double prevalence =
-                    (i_prevalence < pheno_info.prevalence.size())
-                        ? pheno_info.prevalence[i_prevalence]
-                        : 2;
-                if (pheno_info.binary[i_pheno]) ++i_prevalence;
-                prsice.init_progress_count(target_file->get_set_thresholds());
-                prsice.init_matrix(pheno_info, commander.delim(), i_pheno,
-                                   *target_file);
-                std::unique_ptr<std::ostream> best_file = nullptr,
-                                              all_score_file = nullptr;
-                if (!no_regress)
-                {
+                // Initialize the progress bar
+                // one progress bar per phenotype
+                // one extra progress bar for competitive permutation
+                assert(target_file->get_set_thresholds().size()
+                       == num_regions);
 
-                    best_file =
-                        misc::load_ostream(prefix + file_suffix + ".best");
-                    prsice.prep_best_output(*target_file, region_membership,
-                                            region_names, max_fid, max_iid,
-                                            best_file);
-                }
-                if (commander.all_scores())
+                const auto [max_fid, max_iid] =
+                    target_file->get_max_id_length();
+                const size_t num_pheno = pheno_info.pheno_col_idx.size();
+                // prsice and summary file will be per run
+                // all score and best file will be per phenotype
+                // this is mainly because of the size of the file and the way
+                // we need to generate them
+                // with prsice and summary file, we can do row wise output, so
+                // it is ok for us to keep using it
+                // but for all and best, we are doing column-wise output, which
+                // need expensive seek operations
+                std::unique_ptr<std::ostream> summary_file = nullptr;
+                auto prsice_out = misc::load_ostream(prefix + ".prsice");
+                const bool has_prevalence = !pheno_info.prevalence.empty();
+                print_prsice_header(
+                    has_prevalence, no_regress,
+                    commander.get_prs_instruction().score_screen != 0,
+                    prsice_out);
+                auto perm_info = commander.get_perm();
+                if (!no_regress)
                 {
-                    all_score_file =
-                        misc::load_ostream(prefix + file_suffix + ".all_score");
-                    prsice.prep_all_score_output(
-                        *target_file, region_membership, region_names, max_fid,
-                        max_iid, all_score_file);
+                    summary_file = misc::load_ostream(prefix + ".summary");
+                    print_summary_header(has_prevalence,
+                                         perm_info.run_set_perm,
+                                         perm_info.run_perm,
+                                         perm_info.tail_approx, summary_file);
                 }
-                // go through each region
-                fprintf(stderr, "\nStart Processing\n");
-                for (size_t i_region = 0; i_region < num_regions; ++i_region)
+                size_t i_prevalence = 0;
+                for (size_t i_pheno = 0; i_pheno < num_pheno; ++i_pheno)
                 {
-                    // always skip background region and empty regions
-                    if (i_region == 1 || region_membership[i_region].empty())
+                    if (pheno_info.skip_pheno[i_pheno])
+                    {
+                        reporter.report("Skipping the "
+                                        + std::to_string(i_pheno + 1)
+                                        + " th phenotype");
                         continue;
-                    prsice.run_prsice(region_membership[i_region], region_names,
-                                      pheno_name, prevalence, i_pheno, i_region,
-                                      commander.all_scores(), has_prevalence,
-                                      prsice_out, best_file, all_score_file,
-                                      *target_file);
-                }
-                prsice.print_progress(true);
-                if (!no_regress)
-                {
-                    // best file is nullptr after this
-                    prsice.print_best(region_membership, std::move(best_file),
-                                      *target_file);
-                    if (perm_info.run_set_perm && region_names.size() > 2)
+                    }
+                    if (!no_regress)
+                    {
+                        reporter.report("Processing the "
+                                        + std::to_string(i_pheno + 1)
+                                        + " th phenotype");
+                    }
+                    else
+                    {
+                        reporter.report("Start calculating the scores\n");
+                    }
+                    const std::string pheno_name =
+                        (num_pheno > 1) ? pheno_info.pheno_col[i_pheno] : "-";
+                    const std::string file_suffix =
+                        (num_pheno > 1) ? "." + pheno_name : "";
+                    PRSice prsice(commander.get_prs_instruction(),
+                                  commander.get_p_threshold(), perm_info,
+                                  prefix, pheno_info.binary[i_pheno],
+                                  &reporter);
+                    const double prevalence =
+                        (i_prevalence < pheno_info.prevalence.size())
+                            ? pheno_info.prevalence[i_prevalence]
+                            : 2;
+                    if (pheno_info.binary[i_pheno]) ++i_prevalence;
+                    prsice.init_progress_count(
+                        target_file->get_set_thresholds());
+                    prsice.init_matrix(pheno_info, commander.delim(), i_pheno,
+                                       *target_file);
+                    std::unique_ptr<std::ostream> best_file = nullptr,
+                                                  all_score_file = nullptr;
+                    if (!no_regress)
+                    {
+
+                        best_file =
+                            misc::load_ostream(prefix + file_suffix + ".best");
+                        prsice.prep_best_output(
+                            *target_file, region_membership, region_names,
+                            max_fid, max_iid, best_file);
+                    }
+                    if (commander.all_scores())
+                    {
+                        all_score_file = misc::load_ostream(
+                            prefix + file_suffix + ".all_score");
+                        prsice.prep_all_score_output(
+                            *target_file, region_membership, region_names,
+                            max_fid, max_iid, all_score_file);
+                    }
+                    // go through each region
+                    fprintf(stderr, "\nStart Processing\n");
+                    for (size_t i_region = 0; i_region < num_regions;
+                         ++i_region)
+                    {
+                        // always skip background region and empty regions
+                        if (i_region == 1
+                            || region_membership[i_region].empty())
+                            continue;
+                        prsice.run_prsice(
+                            region_membership[i_region], region_names,
+                            pheno_name, prevalence, i_pheno, i_region,
+                            commander.all_scores(), has_prevalence, prsice_out,
+                            best_file, all_score_file, *target_file);
+                    }
+                    prsice.print_progress(true);
+                    if (!no_regress)
                     {
-                        assert(region_membership.size() >= 2);
-                        prsice.run_competitive(*target_file,
-                                               region_membership[1].begin(),
-                                               region_membership[1].end());
+                        // best file is nullptr after this
+                        prsice.print_best(region_membership,
+                                          std::move(best_file), *target_file);
+                        if (perm_info.run_set_perm && region_names.size() > 2)
+                        {
+                            assert(region_membership.size() >= 2);
+                            prsice.run_competitive(*target_file,
+                                                   region_membership[1].begin(),
+                                                   region_membership[1].end());
+                        }
                     }
+                    prsice.print_summary(pheno_name, prevalence, has_prevalence,
+                                         significant_count, summary_file);
                 }
-                prsice.print_summary(pheno_name, prevalence, has_prevalence,
-                                     significant_count, summary_file);
             }
             if (!no_regress)
                 reporter.report(print_project_summary(significant_count));
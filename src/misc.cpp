@@ -16,6 +16,7 @@
 
 
 #include "misc.hpp"
+#include "philox.hpp"
 
 namespace misc
 {
@@ -178,4 +179,119 @@ double qnorm(double p, double mu, double sigma, bool lower_tail, bool log_p)
     }
     return mu + sigma * val;
 }
+
+namespace
+{
+// generalized Pareto distribution, with F(y) = 1 - (1 - ky/sigma)^(1/k)
+struct GPD
+{
+    double k = 0.0;
+    double sigma = 0.0;
+    double survival(const double y) const
+    {
+        if (std::fabs(k) < 1e-8) return std::exp(-y / sigma);
+        const double z = 1.0 - k * y / sigma;
+        // beyond the upper bound of the distribution when k > 0
+        if (z <= 0.0) return 0.0;
+        return std::pow(z, 1.0 / k);
+    }
+    double quantile(const double u) const
+    {
+        if (std::fabs(k) < 1e-8) return -sigma * std::log1p(-u);
+        return sigma / k * (1.0 - std::pow(1.0 - u, k));
+    }
+};
+
+// probability weighted moment estimates (Hosking & Wallis 1987) from the
+// ascending excesses, return false if the estimate is invalid
+bool fit_gpd(const std::vector<double>& excess, GPD& gpd)
+{
+    const double n = static_cast<double>(excess.size());
+    double a0 = 0.0, a1 = 0.0;
+    for (size_t i = 0; i < excess.size(); ++i)
+    {
+        const double p = (static_cast<double>(i) + 1.0 - 0.35) / n;
+        a0 += excess[i];
+        a1 += (1.0 - p) * excess[i];
+    }
+    a0 /= n;
+    a1 /= n;
+    const double denom = a0 - 2.0 * a1;
+    if (!(denom > 0.0)) return false;
+    gpd.sigma = 2.0 * a0 * a1 / denom;
+    gpd.k = a0 / denom - 2.0;
+    return gpd.sigma > 0.0 && std::isfinite(gpd.k);
+}
+
+// Anderson-Darling statistic of the ascending excesses
+double anderson_darling(const std::vector<double>& excess, const GPD& gpd)
+{
+    const size_t n = excess.size();
+    const double lower = 1e-12, upper = 1.0 - 1e-12;
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double cdf = std::clamp(1.0 - gpd.survival(excess[i]), lower,
+                                      upper);
+        const double rev_cdf = std::clamp(
+            1.0 - gpd.survival(excess[n - 1 - i]), lower, upper);
+        sum += (2.0 * static_cast<double>(i) + 1.0)
+               * (std::log(cdf) + std::log1p(-rev_cdf));
+    }
+    return -static_cast<double>(n) - sum / static_cast<double>(n);
+}
+}
+
+bool gpd_tail_pvalue(std::vector<double> null_stat, const size_t num_perm,
+                     const double obs, const uint32_t seed, double& p_value,
+                     double& fit_p)
+{
+    // smallest tail we are willing to fit
+    const size_t min_tail = 50;
+    const size_t num_bootstrap = 200;
+    const double min_fit_p = 0.05;
+    size_t num_tail = std::min(gpd_max_tail, num_perm / 4);
+    if (null_stat.size() <= num_tail) num_tail = null_stat.size() - 1;
+    if (null_stat.empty() || num_tail < min_tail) return false;
+    // only the largest num_tail + 1 statistics are required
+    std::partial_sort(null_stat.begin(), null_stat.begin() + num_tail + 1,
+                      null_stat.end(), std::greater<double>());
+    std::vector<double> excess, simulated;
+    GPD gpd, simulated_gpd;
+    for (; num_tail >= min_tail; num_tail -= 10)
+    {
+        // place the threshold between the tail and the rest
+        const double threshold =
+            (null_stat[num_tail - 1] + null_stat[num_tail]) / 2.0;
+        if (!(obs > threshold)) return false;
+        excess.resize(num_tail);
+        for (size_t i = 0; i < num_tail; ++i)
+        { excess[i] = null_stat[num_tail - 1 - i] - threshold; }
+        if (!fit_gpd(excess, gpd)) continue;
+        // parametric bootstrap of the goodness-of-fit statistic, as the null
+        // distribution of A2 depends on the estimated shape
+        const double stat = anderson_darling(excess, gpd);
+        Philox rand_gen(seed, num_tail);
+        std::uniform_real_distribution<double> unif(0.0, 1.0);
+        size_t num_worse = 0;
+        simulated.resize(num_tail);
+        for (size_t b = 0; b < num_bootstrap; ++b)
+        {
+            for (auto&& y : simulated) y = gpd.quantile(unif(rand_gen));
+            std::sort(simulated.begin(), simulated.end());
+            if (!fit_gpd(simulated, simulated_gpd)
+                || !(anderson_darling(simulated, simulated_gpd) < stat))
+            { ++num_worse; }
+        }
+        fit_p = (static_cast<double>(num_worse) + 1.0)
+                / (static_cast<double>(num_bootstrap) + 1.0);
+        if (!(fit_p > min_fit_p)) continue;
+        p_value = static_cast<double>(num_tail)
+                  / static_cast<double>(num_perm)
+                  * gpd.survival(obs - threshold);
+        // the observed statistic is beyond the fitted upper bound
+        return p_value > 0.0;
+    }
+    return false;
+}
 }
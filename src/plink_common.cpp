@@ -16,6 +16,9 @@
 
 
 #include "plink_common.hpp"
+#ifdef PLINK_X86_DISPATCH
+#include <cpuid.h>
+#endif
 
 // #include "pigz.h"
 
@@ -9438,11 +9441,59 @@ void genovec_set_freq_y(const uintptr_t* __restrict geno_vec,
     *missing_ctp = accm;
 }
 
-void genovec_3freq(const uintptr_t* __restrict geno_vec,
-                   const uintptr_t* __restrict include_quatervec,
-                   uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
-                   uint32_t* __restrict het_ctp,
-                   uint32_t* __restrict homset_ctp)
+#ifdef PLINK_X86_DISPATCH
+// features are queried once by the dispatchers and cached in a static
+static uint32_t cpu_has_bmi2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") ? 1 : 0;
+}
+
+// PEXT/PDEP are microcoded on AMD processors before Zen 3 (family 19h) and
+// take hundreds of cycles, which is slower than the scalar loop. They are
+// only considered fast on Intel and on AMD family 19h or later
+static uint32_t cpu_has_fast_pext()
+{
+    if (!cpu_has_bmi2()) return 0;
+    if (__builtin_cpu_is("intel")) return 1;
+    if (!__builtin_cpu_is("amd")) return 0;
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    uint32_t family = (eax >> 8) & 0xf;
+    if (family == 0xf) { family += (eax >> 20) & 0xff; }
+    return (family >= 0x19) ? 1 : 0;
+}
+
+static uint32_t cpu_has_avx2()
+{
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+               ? 1
+               : 0;
+}
+
+static uint32_t cpu_has_avx512f()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") ? 1 : 0;
+}
+
+static uint32_t cpu_has_avx512_popcnt()
+{
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512vpopcntdq"))
+               ? 1
+               : 0;
+}
+#endif
+
+void genovec_3freq_generic(const uintptr_t* __restrict geno_vec,
+                           const uintptr_t* __restrict include_quatervec,
+                           uintptr_t sample_ctl2,
+                           uint32_t* __restrict missing_ctp,
+                           uint32_t* __restrict het_ctp,
+                           uint32_t* __restrict homset_ctp)
 {
     // generic routine for getting all counts.
     const uintptr_t* geno_vec_end = &(geno_vec[sample_ctl2]);
@@ -9497,6 +9548,582 @@ void genovec_3freq(const uintptr_t* __restrict geno_vec,
     *homset_ctp = acc_and;
 }
 
+#ifdef PLINK_X86_DISPATCH
+// Both wide versions count the same three quantities as the generic version
+// (even bits, odd bits and both bits set within the include mask), but on
+// 256 / 512 bits at a time. Loads are unaligned as the genotype vectors are
+// only guaranteed to be 16 byte aligned.
+__attribute__((target("avx2,popcnt"))) static inline __m256i
+popcount_epi8_avx2(__m256i vv)
+{
+    // nibble lookup table
+    const __m256i lookup =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(vv, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(vv, 4), low_mask);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                           _mm256_shuffle_epi8(lookup, hi));
+}
+
+__attribute__((target("avx2,popcnt"))) static inline uint64_t
+hsum_epi64_avx2(__m256i vv)
+{
+    return static_cast<uint64_t>(_mm256_extract_epi64(vv, 0))
+           + static_cast<uint64_t>(_mm256_extract_epi64(vv, 1))
+           + static_cast<uint64_t>(_mm256_extract_epi64(vv, 2))
+           + static_cast<uint64_t>(_mm256_extract_epi64(vv, 3));
+}
+
+__attribute__((target("avx2,popcnt"))) void
+genovec_3freq_avx2(const uintptr_t* __restrict geno_vec,
+                   const uintptr_t* __restrict include_quatervec,
+                   uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
+                   uint32_t* __restrict het_ctp,
+                   uint32_t* __restrict homset_ctp)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc_even = zero;
+    __m256i acc_odd = zero;
+    __m256i acc_and = zero;
+    const uintptr_t vec_end = sample_ctl2 & ~uintptr_t(3);
+    uintptr_t widx = 0;
+    while (widx < vec_end)
+    {
+        // each byte gains at most 8 per iteration, so we can accumulate 31
+        // iterations in bytes before they have to be widened
+        const uintptr_t block_end = std::min(vec_end, widx + 4 * 31);
+        __m256i byte_even = zero;
+        __m256i byte_odd = zero;
+        __m256i byte_and = zero;
+        for (; widx < block_end; widx += 4)
+        {
+            const __m256i loader = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(geno_vec[widx])));
+            const __m256i loader2 = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(&(include_quatervec[widx])));
+            const __m256i loader3 =
+                _mm256_and_si256(loader2, _mm256_srli_epi64(loader, 1));
+            byte_even = _mm256_add_epi8(
+                byte_even,
+                popcount_epi8_avx2(_mm256_and_si256(loader, loader2)));
+            byte_odd = _mm256_add_epi8(byte_odd, popcount_epi8_avx2(loader3));
+            byte_and = _mm256_add_epi8(
+                byte_and,
+                popcount_epi8_avx2(_mm256_and_si256(loader, loader3)));
+        }
+        acc_even = _mm256_add_epi64(acc_even, _mm256_sad_epu8(byte_even, zero));
+        acc_odd = _mm256_add_epi64(acc_odd, _mm256_sad_epu8(byte_odd, zero));
+        acc_and = _mm256_add_epi64(acc_and, _mm256_sad_epu8(byte_and, zero));
+    }
+    uint64_t even = hsum_epi64_avx2(acc_even);
+    uint64_t odd = hsum_epi64_avx2(acc_odd);
+    uint64_t both = hsum_epi64_avx2(acc_and);
+    for (; widx < sample_ctl2; ++widx)
+    {
+        const uintptr_t loader = geno_vec[widx];
+        const uintptr_t loader2 = include_quatervec[widx];
+        const uintptr_t loader3 = loader2 & (loader >> 1);
+        even += __builtin_popcountll(loader & loader2);
+        odd += __builtin_popcountll(loader3);
+        both += __builtin_popcountll(loader & loader3);
+    }
+    *missing_ctp = static_cast<uint32_t>(even - both);
+    *het_ctp = static_cast<uint32_t>(odd - both);
+    *homset_ctp = static_cast<uint32_t>(both);
+}
+
+// The unmasked forms of some AVX-512 intrinsics (e.g. _mm512_reduce_add_epi64,
+// _mm512_extracti64x4_epi64 and _mm512_srli_epi64) pass _mm512_undefined_*()
+// as the pass-through operand, which GCC 12 flags with -Wuninitialized (GCC
+// bug 105593). The zero-masked forms with a full mask compile to the same
+// instructions without the warning
+__attribute__((target("avx512f,avx2,popcnt"))) static inline uint64_t
+hsum_epi64_avx512(__m512i vv)
+{
+    const __m256i lo = _mm512_maskz_extracti64x4_epi64(0xf, vv, 0);
+    const __m256i hi = _mm512_maskz_extracti64x4_epi64(0xf, vv, 1);
+    return hsum_epi64_avx2(_mm256_add_epi64(lo, hi));
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt"))) void
+genovec_3freq_avx512(const uintptr_t* __restrict geno_vec,
+                     const uintptr_t* __restrict include_quatervec,
+                     uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
+                     uint32_t* __restrict het_ctp,
+                     uint32_t* __restrict homset_ctp)
+{
+    __m512i acc_even = _mm512_setzero_si512();
+    __m512i acc_odd = _mm512_setzero_si512();
+    __m512i acc_and = _mm512_setzero_si512();
+    uintptr_t widx = 0;
+    for (; widx + 8 <= sample_ctl2; widx += 8)
+    {
+        const __m512i loader = _mm512_loadu_si512(&(geno_vec[widx]));
+        const __m512i loader2 = _mm512_loadu_si512(&(include_quatervec[widx]));
+        const __m512i loader3 =
+            _mm512_and_si512(loader2, _mm512_maskz_srli_epi64(0xff, loader, 1));
+        acc_even = _mm512_add_epi64(
+            acc_even, _mm512_popcnt_epi64(_mm512_and_si512(loader, loader2)));
+        acc_odd = _mm512_add_epi64(acc_odd, _mm512_popcnt_epi64(loader3));
+        acc_and = _mm512_add_epi64(
+            acc_and, _mm512_popcnt_epi64(_mm512_and_si512(loader, loader3)));
+    }
+    // the remaining words are handled with a masked load
+    if (widx < sample_ctl2)
+    {
+        const __mmask8 tail_mask =
+            static_cast<__mmask8>((1U << (sample_ctl2 - widx)) - 1);
+        const __m512i loader =
+            _mm512_maskz_loadu_epi64(tail_mask, &(geno_vec[widx]));
+        const __m512i loader2 =
+            _mm512_maskz_loadu_epi64(tail_mask, &(include_quatervec[widx]));
+        const __m512i loader3 =
+            _mm512_and_si512(loader2, _mm512_maskz_srli_epi64(0xff, loader, 1));
+        acc_even = _mm512_add_epi64(
+            acc_even, _mm512_popcnt_epi64(_mm512_and_si512(loader, loader2)));
+        acc_odd = _mm512_add_epi64(acc_odd, _mm512_popcnt_epi64(loader3));
+        acc_and = _mm512_add_epi64(
+            acc_and, _mm512_popcnt_epi64(_mm512_and_si512(loader, loader3)));
+    }
+    const uint64_t even = hsum_epi64_avx512(acc_even);
+    const uint64_t odd = hsum_epi64_avx512(acc_odd);
+    const uint64_t both = hsum_epi64_avx512(acc_and);
+    *missing_ctp = static_cast<uint32_t>(even - both);
+    *het_ctp = static_cast<uint32_t>(odd - both);
+    *homset_ctp = static_cast<uint32_t>(both);
+}
+#endif
+
+void genovec_3freq(const uintptr_t* __restrict geno_vec,
+                   const uintptr_t* __restrict include_quatervec,
+                   uintptr_t sample_ctl2, uint32_t* __restrict missing_ctp,
+                   uint32_t* __restrict het_ctp,
+                   uint32_t* __restrict homset_ctp)
+{
+#ifdef PLINK_X86_DISPATCH
+    static const uint32_t use_avx512 = cpu_has_avx512_popcnt();
+    static const uint32_t use_avx2 = cpu_has_avx2();
+    if (use_avx512)
+    {
+        genovec_3freq_avx512(geno_vec, include_quatervec, sample_ctl2,
+                             missing_ctp, het_ctp, homset_ctp);
+        return;
+    }
+    if (use_avx2)
+    {
+        genovec_3freq_avx2(geno_vec, include_quatervec, sample_ctl2,
+                           missing_ctp, het_ctp, homset_ctp);
+        return;
+    }
+#endif
+    genovec_3freq_generic(geno_vec, include_quatervec, sample_ctl2,
+                          missing_ctp, het_ctp, homset_ctp);
+}
+
+void genovec_3freq_batch_generic(const uintptr_t* const* geno_vecs,
+                                 uintptr_t geno_ct,
+                                 const uintptr_t* __restrict index_quatervecs,
+                                 uintptr_t index_stride, uintptr_t sample_ctl2,
+                                 uint32_t* __restrict counts)
+{
+    for (uintptr_t geno_idx = 0; geno_idx < geno_ct; ++geno_idx)
+    {
+        for (uintptr_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+        {
+            genovec_3freq_generic(geno_vecs[geno_idx],
+                                  &(index_quatervecs[mask_idx * index_stride]),
+                                  sample_ctl2, &(counts[0]), &(counts[1]),
+                                  &(counts[2]));
+            counts += 3;
+        }
+    }
+}
+
+#ifdef PLINK_X86_DISPATCH
+__attribute__((target("avx2,popcnt"))) void
+genovec_3freq_batch_avx2(const uintptr_t* const* geno_vecs, uintptr_t geno_ct,
+                         const uintptr_t* __restrict index_quatervecs,
+                         uintptr_t index_stride, uintptr_t sample_ctl2,
+                         uint32_t* __restrict counts)
+{
+    // each word of the variant is loaded once and reused for all three index
+    // masks. The nine byte counters, the loaded words, the nibble lookup
+    // table, the nibble mask and the popcount temporaries already fill the 16
+    // ymm registers, so tiling more than one variant would spill counters
+    const uintptr_t* index_masks[3] = {index_quatervecs,
+                                       &(index_quatervecs[index_stride]),
+                                       &(index_quatervecs[2 * index_stride])};
+    const __m256i zero = _mm256_setzero_si256();
+    const uintptr_t vec_end = sample_ctl2 & ~uintptr_t(3);
+    for (uintptr_t geno_idx = 0; geno_idx < geno_ct; ++geno_idx)
+    {
+        const uintptr_t* geno_vec = geno_vecs[geno_idx];
+        __m256i acc[9];
+        for (uint32_t i = 0; i < 9; ++i) acc[i] = zero;
+        uintptr_t widx = 0;
+        while (widx < vec_end)
+        {
+            const uintptr_t block_end = std::min(vec_end, widx + 4 * 31);
+            __m256i byte_acc[9];
+            for (uint32_t i = 0; i < 9; ++i) byte_acc[i] = zero;
+            for (; widx < block_end; widx += 4)
+            {
+                const __m256i loader = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(&(geno_vec[widx])));
+                const __m256i shifted = _mm256_srli_epi64(loader, 1);
+                for (uint32_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+                {
+                    const __m256i loader2 =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                            &(index_masks[mask_idx][widx])));
+                    const __m256i loader3 = _mm256_and_si256(loader2, shifted);
+                    __m256i* cur = &(byte_acc[3 * mask_idx]);
+                    cur[0] = _mm256_add_epi8(
+                        cur[0],
+                        popcount_epi8_avx2(_mm256_and_si256(loader, loader2)));
+                    cur[1] =
+                        _mm256_add_epi8(cur[1], popcount_epi8_avx2(loader3));
+                    cur[2] = _mm256_add_epi8(
+                        cur[2],
+                        popcount_epi8_avx2(_mm256_and_si256(loader, loader3)));
+                }
+            }
+            for (uint32_t i = 0; i < 9; ++i)
+            {
+                acc[i] = _mm256_add_epi64(acc[i],
+                                          _mm256_sad_epu8(byte_acc[i], zero));
+            }
+        }
+        for (uint32_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+        {
+            uint64_t even = hsum_epi64_avx2(acc[3 * mask_idx]);
+            uint64_t odd = hsum_epi64_avx2(acc[3 * mask_idx + 1]);
+            uint64_t both = hsum_epi64_avx2(acc[3 * mask_idx + 2]);
+            for (uintptr_t tidx = widx; tidx < sample_ctl2; ++tidx)
+            {
+                const uintptr_t loader = geno_vec[tidx];
+                const uintptr_t loader2 = index_masks[mask_idx][tidx];
+                const uintptr_t loader3 = loader2 & (loader >> 1);
+                even += __builtin_popcountll(loader & loader2);
+                odd += __builtin_popcountll(loader3);
+                both += __builtin_popcountll(loader & loader3);
+            }
+            counts[0] = static_cast<uint32_t>(even - both);
+            counts[1] = static_cast<uint32_t>(odd - both);
+            counts[2] = static_cast<uint32_t>(both);
+            counts += 3;
+        }
+    }
+}
+
+template <uint32_t tile_ct>
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt"))) static inline void
+genovec_3freq_tile_avx512(const uintptr_t* const* geno_vecs,
+                          const uintptr_t* __restrict index_quatervecs,
+                          uintptr_t index_stride, uintptr_t sample_ctl2,
+                          uint32_t* __restrict counts)
+{
+    // the three index masks are loaded once per word and reused for every
+    // variant in the tile. With two variants, the 18 accumulators, 3 masks
+    // and the temporaries all fit within the 32 zmm registers
+    __m512i acc[tile_ct][9];
+    for (uint32_t tile_idx = 0; tile_idx < tile_ct; ++tile_idx)
+    {
+        for (uint32_t i = 0; i < 9; ++i)
+        { acc[tile_idx][i] = _mm512_setzero_si512(); }
+    }
+    for (uintptr_t widx = 0; widx < sample_ctl2; widx += 8)
+    {
+        const __mmask8 load_mask =
+            (sample_ctl2 - widx >= 8)
+                ? static_cast<__mmask8>(0xff)
+                : static_cast<__mmask8>((1U << (sample_ctl2 - widx)) - 1);
+        __m512i index[3];
+        for (uint32_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+        {
+            index[mask_idx] = _mm512_maskz_loadu_epi64(
+                load_mask, &(index_quatervecs[mask_idx * index_stride + widx]));
+        }
+        for (uint32_t tile_idx = 0; tile_idx < tile_ct; ++tile_idx)
+        {
+            const __m512i loader = _mm512_maskz_loadu_epi64(
+                load_mask, &(geno_vecs[tile_idx][widx]));
+            const __m512i shifted = _mm512_maskz_srli_epi64(0xff, loader, 1);
+            for (uint32_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+            {
+                const __m512i loader3 =
+                    _mm512_and_si512(index[mask_idx], shifted);
+                __m512i* cur = &(acc[tile_idx][3 * mask_idx]);
+                cur[0] = _mm512_add_epi64(
+                    cur[0], _mm512_popcnt_epi64(
+                                _mm512_and_si512(loader, index[mask_idx])));
+                cur[1] = _mm512_add_epi64(cur[1], _mm512_popcnt_epi64(loader3));
+                cur[2] = _mm512_add_epi64(
+                    cur[2],
+                    _mm512_popcnt_epi64(_mm512_and_si512(loader, loader3)));
+            }
+        }
+    }
+    for (uint32_t tile_idx = 0; tile_idx < tile_ct; ++tile_idx)
+    {
+        for (uint32_t mask_idx = 0; mask_idx < 3; ++mask_idx)
+        {
+            const __m512i* cur = &(acc[tile_idx][3 * mask_idx]);
+            const uint64_t even = hsum_epi64_avx512(cur[0]);
+            const uint64_t odd = hsum_epi64_avx512(cur[1]);
+            const uint64_t both = hsum_epi64_avx512(cur[2]);
+            counts[0] = static_cast<uint32_t>(even - both);
+            counts[1] = static_cast<uint32_t>(odd - both);
+            counts[2] = static_cast<uint32_t>(both);
+            counts += 3;
+        }
+    }
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt"))) void
+genovec_3freq_batch_avx512(const uintptr_t* const* geno_vecs,
+                           uintptr_t geno_ct,
+                           const uintptr_t* __restrict index_quatervecs,
+                           uintptr_t index_stride, uintptr_t sample_ctl2,
+                           uint32_t* __restrict counts)
+{
+    uintptr_t geno_idx = 0;
+    for (; geno_idx + 2 <= geno_ct; geno_idx += 2)
+    {
+        genovec_3freq_tile_avx512<2>(&(geno_vecs[geno_idx]), index_quatervecs,
+                                     index_stride, sample_ctl2,
+                                     &(counts[9 * geno_idx]));
+    }
+    if (geno_idx < geno_ct)
+    {
+        genovec_3freq_tile_avx512<1>(&(geno_vecs[geno_idx]), index_quatervecs,
+                                     index_stride, sample_ctl2,
+                                     &(counts[9 * geno_idx]));
+    }
+}
+#endif
+
+void genovec_3freq_batch(const uintptr_t* const* geno_vecs, uintptr_t geno_ct,
+                         const uintptr_t* __restrict index_quatervecs,
+                         uintptr_t index_stride, uintptr_t sample_ctl2,
+                         uint32_t* __restrict counts)
+{
+#ifdef PLINK_X86_DISPATCH
+    static const uint32_t use_avx512 = cpu_has_avx512_popcnt();
+    static const uint32_t use_avx2 = cpu_has_avx2();
+    if (use_avx512)
+    {
+        genovec_3freq_batch_avx512(geno_vecs, geno_ct, index_quatervecs,
+                                   index_stride, sample_ctl2, counts);
+        return;
+    }
+    if (use_avx2)
+    {
+        genovec_3freq_batch_avx2(geno_vecs, geno_ct, index_quatervecs,
+                                 index_stride, sample_ctl2, counts);
+        return;
+    }
+#endif
+    genovec_3freq_batch_generic(geno_vecs, geno_ct, index_quatervecs,
+                                index_stride, sample_ctl2, counts);
+}
+
+// number of samples whose products are summed in single precision before
+// being added to the double precision total
+#define DOSAGE_DOT_RUN 512
+
+void dosage_dot_batch_generic(const float* __restrict index_dosage,
+                              const float* const* dosages, uintptr_t dosage_ct,
+                              uintptr_t sample_ct, double* __restrict result)
+{
+    for (uintptr_t dosage_idx = 0; dosage_idx < dosage_ct; ++dosage_idx)
+    {
+        const float* dosage = dosages[dosage_idx];
+        double total = 0;
+        for (uintptr_t run_start = 0; run_start < sample_ct;
+             run_start += DOSAGE_DOT_RUN)
+        {
+            const uintptr_t run_end = (sample_ct - run_start > DOSAGE_DOT_RUN)
+                                          ? run_start + DOSAGE_DOT_RUN
+                                          : sample_ct;
+            float partial = 0;
+            for (uintptr_t i = run_start; i < run_end; ++i)
+            { partial += index_dosage[i] * dosage[i]; }
+            total += partial;
+        }
+        result[dosage_idx] = total;
+    }
+}
+
+#ifdef PLINK_X86_DISPATCH
+__attribute__((target("avx2"))) static inline double
+hsum_ps_avx2(__m256 vv)
+{
+    const __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(vv));
+    const __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(vv, 1));
+    const __m256d sum = _mm256_add_pd(low, high);
+    const __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum),
+                                    _mm256_extractf128_pd(sum, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+// the index dosages are loaded once for tile_ct variants
+template <uint32_t tile_ct>
+__attribute__((target("avx2"))) static inline void
+dosage_dot_tile_avx2(const float* __restrict index_dosage,
+                     const float* const* dosages, uintptr_t sample_ct,
+                     double* __restrict result)
+{
+    const uintptr_t vec_ct = sample_ct / 8;
+    double total[tile_ct];
+    for (uint32_t k = 0; k < tile_ct; ++k) { total[k] = 0; }
+    uintptr_t vidx = 0;
+    while (vidx < vec_ct)
+    {
+        const uintptr_t run_end = (vec_ct - vidx > DOSAGE_DOT_RUN / 8)
+                                      ? vidx + DOSAGE_DOT_RUN / 8
+                                      : vec_ct;
+        __m256 acc[tile_ct];
+        for (uint32_t k = 0; k < tile_ct; ++k) { acc[k] = _mm256_setzero_ps(); }
+        for (; vidx < run_end; ++vidx)
+        {
+            const __m256 index_vec = _mm256_loadu_ps(&(index_dosage[vidx * 8]));
+            for (uint32_t k = 0; k < tile_ct; ++k)
+            {
+                acc[k] = _mm256_add_ps(
+                    acc[k],
+                    _mm256_mul_ps(index_vec,
+                                  _mm256_loadu_ps(&(dosages[k][vidx * 8]))));
+            }
+        }
+        for (uint32_t k = 0; k < tile_ct; ++k)
+        { total[k] += hsum_ps_avx2(acc[k]); }
+    }
+    for (uint32_t k = 0; k < tile_ct; ++k)
+    {
+        float partial = 0;
+        for (uintptr_t i = vec_ct * 8; i < sample_ct; ++i)
+        { partial += index_dosage[i] * dosages[k][i]; }
+        result[k] = total[k] + partial;
+    }
+}
+
+__attribute__((target("avx2"))) void
+dosage_dot_batch_avx2(const float* __restrict index_dosage,
+                      const float* const* dosages, uintptr_t dosage_ct,
+                      uintptr_t sample_ct, double* __restrict result)
+{
+    uintptr_t dosage_idx = 0;
+    for (; dosage_idx + 4 <= dosage_ct; dosage_idx += 4)
+    {
+        dosage_dot_tile_avx2<4>(index_dosage, &(dosages[dosage_idx]), sample_ct,
+                                &(result[dosage_idx]));
+    }
+    for (; dosage_idx < dosage_ct; ++dosage_idx)
+    {
+        dosage_dot_tile_avx2<1>(index_dosage, &(dosages[dosage_idx]), sample_ct,
+                                &(result[dosage_idx]));
+    }
+}
+
+__attribute__((target("avx512f"))) static inline double
+hsum_ps_avx512(__m512 vv)
+{
+    // only called once per run of samples, so a plain store is cheap enough
+    float lanes[16];
+    _mm512_storeu_ps(lanes, vv);
+    double sum = 0;
+    for (uint32_t i = 0; i < 16; ++i) { sum += lanes[i]; }
+    return sum;
+}
+
+template <uint32_t tile_ct>
+__attribute__((target("avx512f"))) static inline void
+dosage_dot_tile_avx512(const float* __restrict index_dosage,
+                       const float* const* dosages, uintptr_t sample_ct,
+                       double* __restrict result)
+{
+    // the last vector is loaded with a mask, so no scalar tail is required
+    const uintptr_t vec_ct = (sample_ct + 15) / 16;
+    const __mmask16 last_mask =
+        (sample_ct % 16) ? static_cast<__mmask16>((1U << (sample_ct % 16)) - 1)
+                         : static_cast<__mmask16>(0xffff);
+    double total[tile_ct];
+    for (uint32_t k = 0; k < tile_ct; ++k) { total[k] = 0; }
+    uintptr_t vidx = 0;
+    while (vidx < vec_ct)
+    {
+        const uintptr_t run_end = (vec_ct - vidx > DOSAGE_DOT_RUN / 16)
+                                      ? vidx + DOSAGE_DOT_RUN / 16
+                                      : vec_ct;
+        __m512 acc[tile_ct];
+        for (uint32_t k = 0; k < tile_ct; ++k) { acc[k] = _mm512_setzero_ps(); }
+        for (; vidx < run_end; ++vidx)
+        {
+            const __mmask16 mask = (vidx + 1 == vec_ct)
+                                       ? last_mask
+                                       : static_cast<__mmask16>(0xffff);
+            const __m512 index_vec =
+                _mm512_maskz_loadu_ps(mask, &(index_dosage[vidx * 16]));
+            for (uint32_t k = 0; k < tile_ct; ++k)
+            {
+                acc[k] = _mm512_fmadd_ps(
+                    index_vec,
+                    _mm512_maskz_loadu_ps(mask, &(dosages[k][vidx * 16])),
+                    acc[k]);
+            }
+        }
+        for (uint32_t k = 0; k < tile_ct; ++k)
+        { total[k] += hsum_ps_avx512(acc[k]); }
+    }
+    for (uint32_t k = 0; k < tile_ct; ++k) { result[k] = total[k]; }
+}
+
+__attribute__((target("avx512f"))) void
+dosage_dot_batch_avx512(const float* __restrict index_dosage,
+                        const float* const* dosages, uintptr_t dosage_ct,
+                        uintptr_t sample_ct, double* __restrict result)
+{
+    uintptr_t dosage_idx = 0;
+    for (; dosage_idx + 4 <= dosage_ct; dosage_idx += 4)
+    {
+        dosage_dot_tile_avx512<4>(index_dosage, &(dosages[dosage_idx]),
+                                  sample_ct, &(result[dosage_idx]));
+    }
+    for (; dosage_idx < dosage_ct; ++dosage_idx)
+    {
+        dosage_dot_tile_avx512<1>(index_dosage, &(dosages[dosage_idx]),
+                                  sample_ct, &(result[dosage_idx]));
+    }
+}
+#endif
+
+void dosage_dot_batch(const float* __restrict index_dosage,
+                      const float* const* dosages, uintptr_t dosage_ct,
+                      uintptr_t sample_ct, double* __restrict result)
+{
+#ifdef PLINK_X86_DISPATCH
+    static const uint32_t use_avx512 = cpu_has_avx512f();
+    static const uint32_t use_avx2 = cpu_has_avx2();
+    if (use_avx512)
+    {
+        dosage_dot_batch_avx512(index_dosage, dosages, dosage_ct, sample_ct,
+                                result);
+        return;
+    }
+    if (use_avx2)
+    {
+        dosage_dot_batch_avx2(index_dosage, dosages, dosage_ct, sample_ct,
+                              result);
+        return;
+    }
+#endif
+    dosage_dot_batch_generic(index_dosage, dosages, dosage_ct, sample_ct,
+                             result);
+}
+
 uintptr_t count_01(const uintptr_t* quatervec, uintptr_t word_ct)
 {
     // really just for getting a missing count
@@ -10143,11 +10770,10 @@ uint32_t load_and_collapse(uint32_t unfiltered_sample_ct, uint32_t sample_ct,
     return 0;
 }
 
-void copy_quaterarr_nonempty_subset(const uintptr_t* __restrict raw_quaterarr,
-                                    const uintptr_t* __restrict subset_mask,
-                                    uint32_t raw_quaterarr_size,
-                                    uint32_t subset_size,
-                                    uintptr_t* __restrict output_quaterarr)
+void copy_quaterarr_nonempty_subset_scalar(
+    const uintptr_t* __restrict raw_quaterarr,
+    const uintptr_t* __restrict subset_mask, uint32_t raw_quaterarr_size,
+    uint32_t subset_size, uintptr_t* __restrict output_quaterarr)
 {
     // in plink 2.0, we probably want (0-based) bit raw_quaterarr_size of
     // subset_mask to be always allocated and unset.  This removes a few special
@@ -10289,6 +10915,71 @@ void copy_quaterarr_nonempty_subset(const uintptr_t* __restrict raw_quaterarr,
     }
 }
 
+#ifdef PLINK_X86_DISPATCH
+// BMI2 version: each raw word holds BITCT2 genotypes, and the matching half
+// word of subset_mask selects which of them are kept.  Spreading the mask to
+// both bits of every genotype lets a single PEXT gather all the kept
+// genotypes of the word, which are then appended to the output bit stream.
+__attribute__((target("bmi2"))) void copy_quaterarr_nonempty_subset_bmi2(
+    const uintptr_t* __restrict raw_quaterarr,
+    const uintptr_t* __restrict subset_mask, uint32_t raw_quaterarr_size,
+    uint32_t subset_size, uintptr_t* __restrict output_quaterarr)
+{
+    const uint32_t raw_word_ct = QUATERCT_TO_WORDCT(raw_quaterarr_size);
+    const uint32_t raw_remainder = raw_quaterarr_size % BITCT2;
+    uint32_t copied = 0;
+    uint32_t write_shift = 0;
+    uintptr_t cur_output_word = 0;
+    for (uint32_t widx = 0; widx < raw_word_ct; ++widx)
+    {
+        uintptr_t include_half =
+            (subset_mask[widx / 2] >> (BITCT2 * (widx & 1))) & 0xffffffffLLU;
+        if (raw_remainder && widx == raw_word_ct - 1)
+        { include_half &= (ONELU << raw_remainder) - ONELU; }
+        if (!include_half) continue;
+        const uintptr_t geno_mask = _pdep_u64(include_half, FIVEMASK) * 3;
+        const uintptr_t extracted = _pext_u64(raw_quaterarr[widx], geno_mask);
+        const uint32_t bit_ct = 2 * popcount_long(include_half);
+        cur_output_word |= extracted << write_shift;
+        write_shift += bit_ct;
+        if (write_shift >= BITCT)
+        {
+            *output_quaterarr++ = cur_output_word;
+            write_shift -= BITCT;
+            // shifting by BITCT is undefined, so handle the aligned case
+            // separately
+            cur_output_word =
+                write_shift ? (extracted >> (bit_ct - write_shift)) : 0;
+        }
+        copied += bit_ct / 2;
+        if (copied >= subset_size) break;
+    }
+    if (write_shift) { *output_quaterarr = cur_output_word; }
+}
+
+#endif
+
+void copy_quaterarr_nonempty_subset(const uintptr_t* __restrict raw_quaterarr,
+                                    const uintptr_t* __restrict subset_mask,
+                                    uint32_t raw_quaterarr_size,
+                                    uint32_t subset_size,
+                                    uintptr_t* __restrict output_quaterarr)
+{
+#ifdef PLINK_X86_DISPATCH
+    static const uint32_t use_bmi2 = cpu_has_fast_pext();
+    if (use_bmi2)
+    {
+        copy_quaterarr_nonempty_subset_bmi2(raw_quaterarr, subset_mask,
+                                            raw_quaterarr_size, subset_size,
+                                            output_quaterarr);
+        return;
+    }
+#endif
+    copy_quaterarr_nonempty_subset_scalar(raw_quaterarr, subset_mask,
+                                          raw_quaterarr_size, subset_size,
+                                          output_quaterarr);
+}
+
 /*
 void inplace_quaterarr_proper_subset(const uintptr_t* __restrict subset_mask,
 uint32_t orig_quaterarr_size, uint32_t subset_size, uintptr_t* __restrict
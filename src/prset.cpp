@@ -17,24 +17,25 @@
 #include "prsice.hpp"
 
 void PRSice::produce_null_prs(
-    Thread_Queue<std::pair<std::vector<double>, size_t>>& q, Genotype& target,
-    std::vector<size_t> background, size_t num_consumer,
-    std::map<size_t, std::vector<size_t>>& set_index)
+    Thread_Queue<std::tuple<std::vector<double>, size_t, size_t>>& q,
+    Genotype& target, std::vector<size_t> background, size_t num_consumer,
+    std::map<size_t, std::vector<size_t>>& set_index, const size_t start,
+    const size_t num_perm)
 {
     // we need to know the size of the biggest set
     const size_t max_size = set_index.rbegin()->first;
-    const size_t num_sample = m_matrix_index.size();
     const size_t num_regress_sample =
         static_cast<size_t>(m_independent_variables.rows());
-    size_t processed = 0;
+    size_t processed = start;
     size_t prev_size = 0;
-    // we seed the random number generator
-    std::mt19937 g(m_perm_info.seed);
+    std::vector<size_t> swapped;
     bool first_run = true;
-    while (processed < m_perm_info.num_permutation)
+    while (processed < start + num_perm)
     {
-        // sample without replacement
-        fisher_yates(background, g, max_size);
+        // sample without replacement, using the same random numbers as
+        // subject_set_perm
+        Philox g(m_perm_info.seed, processed);
+        fisher_yates(background, g, max_size, swapped);
         first_run = true;
         prev_size = 0;
         for (auto&& set_size : set_index)
@@ -49,18 +50,15 @@ void PRSice::produce_null_prs(
             // we store the PRS in a new vector to avoid crazy error with
             // move semetics and stuff which I have not fully understand
             std::vector<double> prs(num_regress_sample, 0);
-            for (size_t sample_id = 0; sample_id < num_sample; ++sample_id)
-            {
-                // propagate the prs vector
-                prs[sample_id] =
-                    target.calculate_score(m_matrix_index[sample_id]);
-            }
+            target.calculate_score(m_matrix_index, prs);
             // then we push the result prs to the queue, which can then
             // picked up by the consumers
-            q.emplace(std::make_pair(prs, set_size.first), num_consumer);
+            q.emplace(std::make_tuple(prs, set_size.first, processed),
+                      num_consumer);
             ++m_total_competitive_perm_done;
             print_competitive_progress();
         }
+        undo_fisher_yates(background, swapped);
         ++processed;
     }
     // send termination signal to the consumers
@@ -69,62 +67,60 @@ void PRSice::produce_null_prs(
 
 
 void PRSice::consume_prs(
-    Thread_Queue<std::pair<std::vector<double>, size_t>>& q,
+    Thread_Queue<std::tuple<std::vector<double>, size_t, size_t>>& q,
     const Regress& decomposed, std::map<size_t, std::vector<size_t>>& set_index,
-    const std::vector<double>& obs_t_value, std::vector<size_t>& set_perm_res)
+    const std::vector<double>& obs_t_value, competitive_hits& set_perm_res)
 {
     const Eigen::Index num_regress_sample =
         static_cast<Eigen::Index>(m_matrix_index.size());
-    Eigen::MatrixXd independent;
     Eigen::VectorXd prs, beta, effects;
+    // the null model is shared by all null PRS, so it is only fitted once
+    Regression::WarmGlm logit;
     if (m_perm_info.logit_perm && m_binary_trait)
-        independent = m_independent_variables;
+        logit = Regression::WarmGlm(m_phenotype, m_independent_variables);
     // to avoid false sharing and frequent lock, we wil first store all
     // permutation results within a temporary vector
     double coefficient, standard_error, r2;
     double obs_p = 2.0; // for safety reason, make sure it is out bound
     // results from queue will be stored in the prs_info
-    std::pair<std::vector<double>, size_t> prs_info;
-    std::vector<size_t> local_set_perm_res(set_perm_res.size(), 0);
+    std::tuple<std::vector<double>, size_t, size_t> prs_info;
+    competitive_hits local_set_perm_res(set_perm_res.count.size(),
+                                        !set_perm_res.perm_idx.empty(),
+                                        set_perm_res.keep_tail);
     // now listen for producer
     while (!q.pop(prs_info))
     {
-        // update the independent variable matrix with the new PRS
-
+        prs = Eigen::Map<Eigen::VectorXd>(std::get<0>(prs_info).data(),
+                                          num_regress_sample);
         if (m_binary_trait && m_perm_info.logit_perm)
-        {
-            independent.col(1) = Eigen::Map<Eigen::VectorXd>(
-                std::get<0>(prs_info).data(), num_regress_sample);
-            Regression::glm(m_phenotype, independent, obs_p, r2, coefficient,
-                            standard_error, 1);
-        }
+        { logit.one_step_fit(prs, obs_p, r2, coefficient, standard_error); }
         else
         {
-            prs = Eigen::Map<Eigen::VectorXd>(std::get<0>(prs_info).data(),
-                                              num_regress_sample);
             std::tie(coefficient, standard_error) =
                 get_coeff_se(decomposed, decomposed.YCov, prs, beta, effects);
         }
         double t_value = std::fabs(coefficient / standard_error);
+        local_set_perm_res.add_null(std::get<1>(prs_info), t_value);
         auto&& index = set_index[std::get<1>(prs_info)];
         for (auto&& ref : index)
         {
-            if (obs_t_value[ref] < t_value) ++local_set_perm_res[ref];
+            if (obs_t_value[ref] < t_value)
+                local_set_perm_res.add(ref, std::get<2>(prs_info));
         }
     }
     std::lock_guard<std::mutex> lock(lock_guard);
-    for (size_t i = 0; i < set_perm_res.size(); ++i)
-    { set_perm_res[i] += local_set_perm_res[i]; }
+    set_perm_res.merge(local_set_perm_res);
 }
 
 void PRSice::observe_set_perm(Thread_Queue<size_t>& progress_observer,
                               size_t num_thread)
 {
-    size_t progress = 0, total_run = 0;
-    while (!progress_observer.pop(progress, num_thread))
+    std::vector<size_t> progress;
+    while (!progress_observer.pop_batch(progress, progress_observer.capacity(),
+                                        num_thread))
     {
-        m_total_competitive_perm_done += progress;
-        total_run += progress;
+        m_total_competitive_perm_done +=
+            std::accumulate(progress.begin(), progress.end(), size_t(0));
         print_competitive_progress();
     }
 }
@@ -132,7 +128,8 @@ void PRSice::observe_set_perm(Thread_Queue<size_t>& progress_observer,
 // Shuffle the idx vector
 // By selecting the first n element from idx, we've got the random selection
 // without replacement
-void PRSice::fisher_yates(std::vector<size_t>& idx, std::mt19937& g, size_t n)
+void PRSice::fisher_yates(std::vector<size_t>& idx, Philox& g, size_t n,
+                          std::vector<size_t>& swapped)
 {
     size_t begin = 0;
     // we will shuffle n where n is the set with the largest size
@@ -140,23 +137,35 @@ void PRSice::fisher_yates(std::vector<size_t>& idx, std::mt19937& g, size_t n)
     // without replacement
     size_t num_idx = idx.size() - 1;
     size_t advance_index;
+    swapped.clear();
     while (n--)
     {
         std::uniform_int_distribution<size_t> dist(begin, num_idx);
         advance_index = dist(g);
         std::swap<size_t>(idx[begin], idx[advance_index]);
+        swapped.push_back(advance_index);
         ++begin;
     }
 }
 
+// Put idx back into the order before fisher_yates, such that each permutation
+// starts from the same background, no matter which permutations the thread
+// has performed before
+void PRSice::undo_fisher_yates(std::vector<size_t>& idx,
+                               const std::vector<size_t>& swapped)
+{
+    for (size_t i = swapped.size(); i-- > 0;)
+    { std::swap<size_t>(idx[i], idx[swapped[i]]); }
+}
+
 template <typename T>
 void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
                               std::vector<size_t> background,
                               std::map<size_t, std::vector<size_t>>& set_index,
-                              std::vector<size_t>& set_perm_res,
+                              competitive_hits& set_perm_res,
                               const std::vector<double>& obs_t_value,
-                              const std::random_device::result_type seed,
-                              const Regress& decomposed, const size_t num_perm)
+                              const Regress& decomposed, const size_t start,
+                              const size_t num_perm)
 {
     assert(set_index.size() != 0);
     const size_t max_size = set_index.rbegin()->first;
@@ -165,18 +174,23 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
     double coefficient, standard_error, r2, obs_p, t_value;
     Eigen::VectorXd prs = Eigen::VectorXd::Zero(num_sample);
     Eigen::VectorXd beta, effects;
-    Eigen::MatrixXd independent;
+    // the null model is shared by all null PRS, so it is only fitted once
+    Regression::WarmGlm logit;
     if (m_perm_info.logit_perm && m_binary_trait)
-    { independent = m_independent_variables; }
+    { logit = Regression::WarmGlm(m_phenotype, m_independent_variables); }
     // each thread should have their own cur_prs to ensure thread safety
-    std::vector<PRS> cur_prs(target.num_sample());
+    PRS cur_prs = target.new_prs_storage();
     bool first_run = true;
-    std::mt19937 g(seed);
     size_t processed = 0;
-    std::vector<size_t> local_set_perm_res(set_perm_res.size(), 0);
+    std::vector<size_t> swapped;
+    competitive_hits local_set_perm_res(set_perm_res.count.size(),
+                                        !set_perm_res.perm_idx.empty(),
+                                        set_perm_res.keep_tail);
     while (processed < num_perm)
     {
-        fisher_yates(background, g, max_size);
+        // permutation i only depends on the seed and i
+        Philox g(m_perm_info.seed, start + processed);
+        fisher_yates(background, g, max_size, swapped);
         //  we have now selected N SNPs from the background. We can then
         //  construct the PRS based on these index
         first_run = true;
@@ -187,45 +201,34 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
                                   background, first_run);
             first_run = false;
             prev_size = set_size.first;
+            target.calculate_score(cur_prs, m_matrix_index, prs);
             if (m_perm_info.logit_perm && m_binary_trait)
             {
-                for (Eigen::Index sample_id = 0; sample_id < num_sample;
-                     ++sample_id)
-                {
-                    size_t idx = m_matrix_index[static_cast<size_t>(sample_id)];
-                    independent(sample_id, 1) =
-                        target.calculate_score(cur_prs, idx);
-                }
-                Regression::glm(m_phenotype, m_independent_variables, obs_p, r2,
-                                coefficient, standard_error, 1);
+                logit.one_step_fit(prs, obs_p, r2, coefficient,
+                                   standard_error);
             }
             else
             {
-                for (Eigen::Index sample_id = 0; sample_id < num_sample;
-                     ++sample_id)
-                {
-                    size_t idx = m_matrix_index[static_cast<size_t>(sample_id)];
-                    prs(sample_id) = target.calculate_score(cur_prs, idx);
-                }
                 std::tie(coefficient, standard_error) = get_coeff_se(
                     decomposed, decomposed.YCov, prs, beta, effects);
             }
 
             progress_observer.emplace(1);
             t_value = std::fabs(coefficient / standard_error);
+            local_set_perm_res.add_null(set_size.first, t_value);
             // set_size second contain the indexs to each set with this size
             for (auto&& set_index : set_size.second)
             {
                 if (obs_t_value[set_index] < t_value)
-                    ++local_set_perm_res[set_index];
+                    local_set_perm_res.add(set_index, start + processed);
             }
         }
+        undo_fisher_yates(background, swapped);
         ++processed;
     }
     progress_observer.completed();
     std::lock_guard<std::mutex> lock(lock_guard);
-    for (size_t i = 0; i < set_perm_res.size(); ++i)
-    { set_perm_res[i] += local_set_perm_res[i]; }
+    set_perm_res.merge(local_set_perm_res);
 }
 
 void PRSice::print_set_warning()
@@ -249,10 +252,106 @@ void PRSice::print_set_warning()
     }
     else
     {
-        m_reporter->report("Warning: Using --logit-perm will be "
-                           "ridiculously slow\n");
+        m_reporter->report(
+            "Warning: Using --logit-perm, the logistic regression of each "
+            "null PRS takes two Newton steps from the covariate only model, "
+            "and is only iterated to convergence when the second step still "
+            "changes the coefficient by more than 0.01 standard error. This "
+            "will still be slower than the default\n");
+    }
+}
+void PRSice::competitive_permutation(
+    Genotype& target, const std::vector<size_t>& background,
+    std::map<size_t, std::vector<size_t>>& set_index,
+    const std::vector<double>& obs_t_value, const Regress& decomposed,
+    const int num_thread, const size_t start, const size_t num_perm,
+    competitive_hits& set_perm_res)
+{
+    // both the consumers and the observer block until the other side is
+    // done, so each of them needs its own worker
+    const int num_worker =
+        std::min(num_thread, static_cast<int>(ThreadPool::global().size()));
+    if (num_worker > 1)
+    {
+        ThreadPool::TaskGroup group;
+        if (!target.genotyped_stored())
+        {
+            Thread_Queue<std::tuple<std::vector<double>, size_t, size_t>>
+                set_perm_queue;
+            for (int i_thread = 0; i_thread < num_worker - 1; ++i_thread)
+            {
+                group.run([&]() {
+                    try
+                    {
+                        consume_prs(set_perm_queue, decomposed, set_index,
+                                    obs_t_value, set_perm_res);
+                    }
+                    catch (...)
+                    {
+                        // keep draining the queue such that the producer is
+                        // not blocked, the error is rethrown by wait
+                        std::tuple<std::vector<double>, size_t, size_t> item;
+                        while (!set_perm_queue.pop(item)) {}
+                        throw;
+                    }
+                });
+            }
+            // the producer runs on this thread
+            try
+            {
+                produce_null_prs(set_perm_queue, target, background,
+                                 static_cast<size_t>(num_worker - 1),
+                                 set_index, start, num_perm);
+            }
+            catch (...)
+            {
+                // release the consumers before leaving
+                set_perm_queue.completed();
+                throw;
+            }
+            group.wait();
+        }
+        else
+        {
+            // we don't need gatherer function, we can just let all the tasks
+            // run subset of the permutation. This should be much faster
+            Thread_Queue<size_t> progress_observer;
+            const size_t num_task = static_cast<size_t>(num_worker);
+            size_t job_per_task = num_perm / num_task;
+            size_t remain = num_perm % num_task;
+            size_t task_start = start;
+            for (size_t i_task = 0; i_task < num_task; ++i_task)
+            {
+                // each task performs a consecutive range of permutations
+                const size_t task_size = job_per_task + (i_task < remain);
+                group.run([&, task_start, task_size]() {
+                    try
+                    {
+                        subject_set_perm(progress_observer, target, background,
+                                         set_index, set_perm_res, obs_t_value,
+                                         decomposed, task_start, task_size);
+                    }
+                    catch (...)
+                    {
+                        // release the observer, the error is rethrown by wait
+                        progress_observer.completed();
+                        throw;
+                    }
+                });
+                task_start += task_size;
+            }
+            observe_set_perm(progress_observer, num_task);
+            group.wait();
+        }
+    }
+    else
+    {
+        dummy_reporter<size_t> dummy(*this);
+        subject_set_perm(dummy, target, background, set_index, set_perm_res,
+                         obs_t_value, decomposed, start, num_perm);
     }
 }
+
 void PRSice::run_competitive(
     Genotype& target, const std::vector<size_t>::const_iterator& bk_start_idx,
     const std::vector<size_t>::const_iterator& bk_end_idx)
@@ -301,7 +400,13 @@ void PRSice::run_competitive(
     }
     // set_perm_res stores number of perm where a more sig result is
     // obtained
-    std::vector<size_t> set_perm_res(obs_t_value.size(), 0);
+    const size_t num_set = obs_t_value.size();
+    const size_t hit_limit = m_perm_info.adaptive_hit;
+    competitive_hits set_perm_res(num_set, false, m_perm_info.tail_approx);
+    // number of permutation performed for each set, only smaller than
+    // --set-perm if the set was stopped by --adaptive-perm
+    std::vector<size_t> set_num_perm(num_set, 0);
+    std::vector<bool> set_stopped(num_set, false);
     if (max_set_size > num_bk_snps)
     {
         // can't do permutation
@@ -352,76 +457,68 @@ void PRSice::run_competitive(
     }
     m_reporter->report("Running permutation with " + misc::to_string(num_thread)
                        + " threads");
-    size_t ran_perm = 0;
-
+    const size_t num_perm = m_perm_info.num_permutation;
+    const std::vector<size_t> background(bk_start_idx, bk_end_idx);
     // count total number of permutation to run
-    m_total_competitive_process =
-        set_index.size() * m_perm_info.num_permutation;
-    if (num_thread > 1)
+    m_total_competitive_process = set_index.size() * num_perm;
+    if (hit_limit == 0)
     {
-        if (!target.genotyped_stored())
-        {
-            ran_perm = m_perm_info.num_permutation;
-            Thread_Queue<std::pair<std::vector<double>, size_t>> set_perm_queue;
-            std::thread producer(&PRSice::produce_null_prs, this,
-                                 std::ref(set_perm_queue), std::ref(target),
-                                 std::vector<size_t>(bk_start_idx, bk_end_idx),
-                                 num_thread - 1, std::ref(set_index));
-            std::vector<std::thread> consumer_store;
-            for (int i_thread = 0; i_thread < num_thread - 1; ++i_thread)
-            {
-                consumer_store.push_back(std::thread(
-                    &PRSice::consume_prs, this, std::ref(set_perm_queue),
-                    std::cref(decomposed), std::ref(set_index),
-                    std::cref(obs_t_value), std::ref(set_perm_res)));
-            }
-
-            producer.join();
-            for (auto&& thread : consumer_store) thread.join();
-        }
-        else
+        competitive_permutation(target, background, set_index, obs_t_value,
+                                decomposed, num_thread, 0, num_perm,
+                                set_perm_res);
+        std::fill(set_num_perm.begin(), set_num_perm.end(), num_perm);
+    }
+    else
+    {
+        // Besag & Clifford (1991) sequential permutation. The permutations are
+        // performed in rounds of doubling size, and after each round, a set
+        // is stopped at the permutation where it reached hit_limit
+        // exceedances. As we know which permutations exceeded, this gives the
+        // same result as performing the permutations one at a time
+        std::map<size_t, std::vector<size_t>> active_index = set_index;
+        size_t start = 0;
+        size_t round_size = hit_limit;
+        while (start < num_perm && !active_index.empty())
         {
-            // we don't need gatherer function, we can just let all the threads
-            // run subset of the permutation. This should be much faster
-            Thread_Queue<size_t> progress_observer;
-            std::thread observer(&PRSice::observe_set_perm, this,
-                                 std::ref(progress_observer), num_thread);
-            std::vector<std::thread> subjects;
-            std::mt19937 rand_gen {m_perm_info.seed};
-            std::uniform_int_distribution<unsigned int> dis(
-                std::numeric_limits<unsigned int>::min(),
-                std::numeric_limits<unsigned int>::max());
-            size_t job_per_thread =
-                m_perm_info.num_permutation / static_cast<size_t>(num_thread);
-            int remain = static_cast<int>(
-                static_cast<size_t>(m_perm_info.num_permutation)
-                % static_cast<size_t>(num_thread));
-            for (int i_thread = 0; i_thread < num_thread; ++i_thread)
+            const size_t cur_size = std::min(round_size, num_perm - start);
+            competitive_hits round_res(num_set, true, m_perm_info.tail_approx);
+            competitive_permutation(target, background, active_index,
+                                    obs_t_value, decomposed, num_thread, start,
+                                    cur_size, round_res);
+            set_perm_res.merge_tail(round_res);
+            std::map<size_t, std::vector<size_t>> next_index;
+            for (auto&& set_size : active_index)
             {
-                auto seed = dis(rand_gen);
-                subjects.push_back(std::thread(
-                    &PRSice::subject_set_perm<Thread_Queue<size_t>>, this,
-                    std::ref(progress_observer), std::ref(target),
-                    std::vector<size_t>(bk_start_idx, bk_end_idx),
-                    std::ref(set_index), std::ref(set_perm_res),
-                    std::cref(obs_t_value), seed, std::cref(decomposed),
-                    job_per_thread + (remain > 0)));
-                ran_perm += job_per_thread + (remain > 0);
-                remain--;
+                for (auto&& idx : set_size.second)
+                {
+                    auto&& hits = round_res.perm_idx[idx];
+                    const size_t required =
+                        hit_limit - set_perm_res.count[idx];
+                    if (hits.size() >= required)
+                    {
+                        std::sort(hits.begin(), hits.end());
+                        set_perm_res.count[idx] = hit_limit;
+                        set_num_perm[idx] = hits[required - 1] + 1;
+                        set_stopped[idx] = true;
+                    }
+                    else
+                    {
+                        set_perm_res.count[idx] += hits.size();
+                        set_num_perm[idx] = start + cur_size;
+                        next_index[set_size.first].push_back(idx);
+                    }
+                }
             }
-            observer.join();
-            for (auto&& thread : subjects) thread.join();
+            start += cur_size;
+            // a set size without any active set skips its remaining
+            // permutations, which are removed from the progress total such
+            // that the progress still ends at 100%
+            m_total_competitive_process -=
+                (active_index.size() - next_index.size()) * (num_perm - start);
+            active_index.swap(next_index);
+            round_size *= 2;
         }
     }
-    else
-    {
-        dummy_reporter<size_t> dummy(*this);
-        subject_set_perm(dummy, target,
-                         std::vector<size_t>(bk_start_idx, bk_end_idx),
-                         set_index, set_perm_res, obs_t_value, m_perm_info.seed,
-                         decomposed, m_perm_info.num_permutation);
-        ran_perm = m_perm_info.num_permutation;
-    }
     // start_index is the index of m_prs_summary[i], not the actual index
     // on set_perm_res.
     // this will iterate all sets from beginning of current phenotype
@@ -435,9 +532,26 @@ void PRSice::run_competitive(
         auto&& res = m_prs_summary[i].result;
         // we need to minus out the start index from i such that our index
         // start at 0, which is the assumption of set_perm_res
-        res.competitive_p =
-            (static_cast<double>(set_perm_res[(i - pheno_start_idx)]) + 1.0)
-            / (static_cast<double>(ran_perm) + 1.0);
+        const size_t idx = i - pheno_start_idx;
+        const double num_hit = static_cast<double>(set_perm_res.count[idx]);
+        const double ran_perm = static_cast<double>(set_num_perm[idx]);
+        // a stopped set has exactly hit_limit exceedances in ran_perm
+        // permutations, which gives the unbiased estimate of Besag & Clifford
+        res.competitive_p = set_stopped[idx]
+                                ? num_hit / ran_perm
+                                : (num_hit + 1.0) / (ran_perm + 1.0);
+        // a set that was not stopped went through all permutations, which are
+        // shared by all sets of the same size
+        double tail_p, fit_p;
+        if (m_perm_info.tail_approx && !set_stopped[idx]
+            && set_perm_res.count[idx] < misc::gpd_min_exceedance
+            && misc::gpd_tail_pvalue(set_perm_res.null_tail[res.num_snp],
+                                     set_num_perm[idx], obs_t_value[idx],
+                                     m_perm_info.seed, tail_p, fit_p))
+        {
+            res.competitive_p = tail_p;
+            res.competitive_tail_fit_p = fit_p;
+        }
         m_prs_summary[i].has_competitive = true;
     }
     print_competitive_progress(true);
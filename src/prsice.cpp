@@ -182,22 +182,9 @@ void PRSice::init_matrix(const Phenotype& pheno_info, const std::string& delim,
     bool has_covariate = m_independent_variables.cols() > 2;
     if (has_covariate)
     {
-        auto n_thread = m_prs_info.thread;
         // only do it if we have the correct number of sample
         assert(m_independent_variables.rows() == m_phenotype.rows());
-        if (m_binary_trait)
-        {
-            // ignore the first column
-            // this is ok as both the first column (intercept) and the
-            // second column (PRS) is currently 1
-            Regression::glm(m_phenotype,
-                            m_independent_variables.topRightCorner(
-                                m_independent_variables.rows(),
-                                m_independent_variables.cols() - 1),
-                            m_null_p, m_null_r2, m_null_coeff, m_null_se,
-                            n_thread);
-        }
-        else
+        if (!m_binary_trait)
         {
             // ignore the first column
             // and perform linear regression
@@ -206,9 +193,37 @@ void PRSice::init_matrix(const Phenotype& pheno_info, const std::string& delim,
                                    m_independent_variables.rows(),
                                    m_independent_variables.cols() - 1),
                                m_null_p, m_null_r2, null_r2_adjust,
-                               m_null_coeff, m_null_se, n_thread, true);
+                               m_null_coeff, m_null_se, true);
+        }
+    }
+    if (m_binary_trait)
+    {
+        // the null model is fitted once and used as the starting point of
+        // the logistic regression of each threshold
+        m_warm_glm =
+            Regression::WarmGlm(m_phenotype, m_independent_variables);
+        if (has_covariate)
+        {
+            m_warm_glm.null_stat(m_null_p, m_null_r2, m_null_coeff,
+                                 m_null_se);
         }
     }
+    // permutation uses linear regression unless --logit-perm is used, both
+    // of which are performed on blocks of permuted phenotypes
+    const bool batch_perm = m_perm_info.run_perm;
+    if (!m_binary_trait || batch_perm)
+    {
+        // only the PRS changes between thresholds, so the covariates (and
+        // intercept) are decomposed once
+        const Eigen::Index num_cov = m_independent_variables.cols() - 2;
+        Eigen::MatrixXd covariates(m_independent_variables.rows(), num_cov + 1);
+        covariates.col(0) = m_independent_variables.col(0);
+        covariates.rightCols(num_cov) =
+            m_independent_variables.rightCols(num_cov);
+        if (!m_binary_trait)
+        { m_residual_lm = Regression::ResidualLm(m_phenotype, covariates); }
+        if (batch_perm) init_perm_block(covariates);
+    }
     m_best_sample_score.resize(target.num_sample());
 }
 
@@ -872,6 +887,7 @@ void PRSice::reset_result_containers(const Genotype& target,
     // is then used for calculation of empirical p value
     m_perm_result.resize(m_perm_info.num_permutation, 0);
     m_prs_results.resize(target.num_threshold(region_idx), prsice_result());
+    m_screened.clear();
     std::fill(m_best_sample_score.begin(), m_best_sample_score.end(), 0);
 }
 
@@ -910,11 +926,12 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
 {
     const bool print_all_scores = all_scores && pheno_idx == 0;
     const bool no_regress = m_prs_info.no_regress;
+    // results of screened thresholds are only final after the refit
+    const bool screening = m_binary_trait && m_prs_info.score_screen != 0;
     const auto num_thread = m_prs_info.thread;
     const size_t num_sample = target.num_sample();
     if (set_snp_idx.empty()) return;
     Eigen::initParallel();
-    Eigen::setNbThreads(m_prs_info.thread);
     reset_result_containers(target, region_idx);
     size_t prs_result_idx = 0;
     double cur_threshold = 0.0;
@@ -933,10 +950,13 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
         { print_all_score(num_sample, all_score_file, target); }
         if (!no_regress)
         {
-            regress_score(target, cur_threshold, num_thread, prs_result_idx);
-            print_prsice_output(m_prs_results[prs_result_idx], pheno_name,
-                                region_names[region_idx], cur_threshold, top,
-                                bot, has_prevalence, prsice_out);
+            regress_score(target, cur_threshold, prs_result_idx);
+            if (!screening)
+            {
+                print_prsice_output(m_prs_results[prs_result_idx], pheno_name,
+                                    region_names[region_idx], cur_threshold,
+                                    top, bot, has_prevalence, prsice_out);
+            }
             if (m_perm_info.run_perm) { permutation(num_thread); }
         }
         else
@@ -948,6 +968,17 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
         ++prs_result_idx;
         first_run = false;
     }
+    if (screening && !no_regress)
+    {
+        refit_screened();
+        for (size_t i = 0; i < prs_result_idx; ++i)
+        {
+            print_prsice_output(m_prs_results[i], pheno_name,
+                                region_names[region_idx],
+                                m_prs_results[i].threshold, top, bot,
+                                has_prevalence, prsice_out);
+        }
+    }
 
     if (m_quick_best && !no_regress)
     {
@@ -1061,29 +1092,37 @@ void PRSice::print_best(
 }
 
 void PRSice::regress_score(Genotype& target, const double threshold,
-                           const int thread, const size_t prs_result_idx)
+                           const size_t prs_result_idx)
 {
     double r2 = 0.0, r2_adjust = 0.0, p_value = 0.0, coefficient = 0.0,
            se = 0.0;
-    const auto num_regress_samples = m_matrix_index.size();
     // should never have m_num_snp_included == 0
     assert(!m_prs_results.empty());
     if (m_num_snp_included == m_prs_results[prs_result_idx].num_snp
         && !m_prs_info.non_cumulate)
     { return; }
 
-    for (size_t sample_id = 0; sample_id < num_regress_samples; ++sample_id)
-    {
-        m_independent_variables(sample_id, 1) =
-            target.calculate_score(m_matrix_index[sample_id]);
-    }
+    target.calculate_score(m_matrix_index, m_independent_variables.col(1));
 
+    bool score_test = false;
     if (m_binary_trait)
     {
         try
         {
-            Regression::glm(m_phenotype, m_independent_variables, p_value, r2,
-                            coefficient, se, thread);
+            if (m_warm_glm.empty())
+            {
+                Regression::glm(m_phenotype, m_independent_variables, p_value,
+                                r2, coefficient, se);
+            }
+            else if (m_prs_info.score_screen != 0
+                     && m_warm_glm.score(m_independent_variables.col(1),
+                                         p_value, r2, coefficient, se))
+            { score_test = true; }
+            else
+            {
+                m_warm_glm.fit(m_independent_variables.col(1), p_value, r2,
+                               coefficient, se);
+            }
         }
         catch (const std::runtime_error& error)
         {
@@ -1096,14 +1135,22 @@ void PRSice::regress_score(Genotype& target, const double threshold,
     }
     else
     {
-        // we can run the linear regression
-        Regression::fastLm(m_phenotype, m_independent_variables, p_value, r2,
-                           r2_adjust, coefficient, se, thread, true);
+        // we can run the linear regression. Only fall back to the full QR
+        // when the PRS is collinear with the covariates
+        if (m_residual_lm.empty()
+            || !m_residual_lm.fit(m_independent_variables.col(1), p_value, r2,
+                                  r2_adjust, coefficient, se))
+        {
+            Regression::fastLm(m_phenotype, m_independent_variables, p_value,
+                               r2, r2_adjust, coefficient, se, true);
+        }
     }
     // If this is the best r2, then we will add it
     int best_index = m_best_index;
-    if (prs_result_idx == 0 || best_index < 0
-        || m_prs_results[static_cast<size_t>(best_index)].r2 < r2)
+    // the approximated r2 is monotonic in the score statistic
+    if (score_test) { keep_screened(target, r2, prs_result_idx); }
+    else if (prs_result_idx == 0 || best_index < 0
+             || m_prs_results[static_cast<size_t>(best_index)].r2 < r2)
     {
         m_best_index = static_cast<int>(prs_result_idx);
         const size_t num_include_samples = target.num_sample();
@@ -1116,6 +1163,74 @@ void PRSice::regress_score(Genotype& target, const double threshold,
     m_prs_results[prs_result_idx] =
         prsice_result(threshold, r2, r2_adjust, coefficient, p_value, -1, se,
                       -1, m_num_snp_included);
+    m_prs_results[prs_result_idx].score_test = score_test;
+}
+
+void PRSice::keep_screened(Genotype& target, const double stat,
+                           const size_t prs_result_idx)
+{
+    screened_threshold* slot = nullptr;
+    if (m_screened.size() < m_prs_info.score_screen)
+    {
+        m_screened.emplace_back();
+        slot = &m_screened.back();
+    }
+    else
+    {
+        // replace the threshold with the smallest statistic
+        auto worst = std::min_element(
+            m_screened.begin(), m_screened.end(),
+            [](const screened_threshold& a, const screened_threshold& b) {
+                return a.stat < b.stat;
+            });
+        if (!(worst->stat < stat)) return;
+        slot = &(*worst);
+    }
+    slot->prs = m_independent_variables.col(1);
+    const size_t num_include_samples = target.num_sample();
+    slot->sample_score.resize(num_include_samples);
+    for (size_t s = 0; s < num_include_samples; ++s)
+    { slot->sample_score[s] = target.calculate_score(s); }
+    slot->stat = stat;
+    slot->result_idx = prs_result_idx;
+}
+
+void PRSice::refit_screened()
+{
+    if (m_screened.empty()) return;
+    // refit in threshold order so that each fit is warm started from a
+    // similar PRS
+    std::sort(m_screened.begin(), m_screened.end(),
+              [](const screened_threshold& a, const screened_threshold& b) {
+                  return a.result_idx < b.result_idx;
+              });
+    const Eigen::VectorXd last_prs = m_independent_variables.col(1);
+    for (auto&& screened : m_screened)
+    {
+        auto&& res = m_prs_results[screened.result_idx];
+        m_independent_variables.col(1) = screened.prs;
+        try
+        {
+            m_warm_glm.fit(m_independent_variables.col(1), res.p, res.r2,
+                           res.coefficient, res.se);
+        }
+        catch (const std::runtime_error& error)
+        {
+            // keep the approximation
+            fprintf(stderr, "Error: GLM model did not converge!\n");
+            fprintf(stderr, "Error: %s\n", error.what());
+            continue;
+        }
+        res.score_test = false;
+        if (m_best_index < 0
+            || m_prs_results[static_cast<size_t>(m_best_index)].r2 < res.r2)
+        {
+            m_best_index = static_cast<int>(screened.result_idx);
+            m_best_sample_score = screened.sample_score;
+        }
+    }
+    m_independent_variables.col(1) = last_prs;
+    m_screened.clear();
 }
 
 
@@ -1131,6 +1246,16 @@ void PRSice::process_permutations()
                       [&best_t](double t) { return t > best_t; });
     m_prs_results[best_index].emp_p =
         (num_better + 1.0) / (m_perm_info.num_permutation + 1.0);
+    // too few exceedances for the count to be accurate
+    double tail_p, fit_p;
+    if (m_perm_info.tail_approx
+        && static_cast<size_t>(num_better) < misc::gpd_min_exceedance
+        && misc::gpd_tail_pvalue(m_perm_result, m_perm_info.num_permutation,
+                                 best_t, m_perm_info.seed, tail_p, fit_p))
+    {
+        m_prs_results[best_index].emp_p = tail_p;
+        m_prs_results[best_index].tail_fit_p = fit_p;
+    }
 }
 
 void PRSice::pre_decompose_matrix(const Eigen::MatrixXd& compute_target,
@@ -1151,30 +1276,27 @@ void PRSice::pre_decompose_matrix(const Eigen::MatrixXd& compute_target,
     get_se_matrix(p, decomposed);
 }
 
-void PRSice::run_null_perm_no_thread(const Regress& decomposed,
-                                     const bool run_glm)
+void PRSice::run_null_perm(const Regress& decomposed, const bool run_glm,
+                           const size_t start, const size_t end)
 {
-    std::mt19937 rand_gen {m_perm_info.seed};
     // we want to count the number of samples included in the analysis
     const Eigen::Index num_regress_sample = m_phenotype.rows();
-    Eigen::VectorXd perm_pheno = m_phenotype;
-    size_t processed = 0;
+    Eigen::VectorXd perm_pheno;
     double coefficient, standard_error, r2, obs_p;
     double obs_t = -1;
     Eigen::VectorXd beta, effects;
-    while (processed < m_perm_info.num_permutation)
+    for (size_t i_perm = start; i_perm < end; ++i_perm)
     {
-        // re-copy perm_pheno to ensure that given the same seed, single thread
-        // will return the same answer as multiple thread
+        // permutation i only depends on the seed and i, such that we get the
+        // same answer regardless of the number of thread
+        Philox rand_gen(m_perm_info.seed, i_perm);
         perm_pheno = m_phenotype;
         std::shuffle(perm_pheno.data(), perm_pheno.data() + num_regress_sample,
                      rand_gen);
-        ++m_analysis_done;
-        print_progress();
         if (run_glm)
         {
             Regression::glm(perm_pheno, m_independent_variables, obs_p, r2,
-                            coefficient, standard_error, 1);
+                            coefficient, standard_error);
         }
         else
         {
@@ -1182,15 +1304,13 @@ void PRSice::run_null_perm_no_thread(const Regress& decomposed,
                 decomposed, m_independent_variables, perm_pheno, beta, effects);
         }
         obs_t = std::fabs(coefficient / standard_error);
-        m_perm_result[processed] = std::max(obs_t, m_perm_result[processed]);
-        ++processed;
+        m_perm_result[i_perm] = std::max(obs_t, m_perm_result[i_perm]);
     }
 }
 void PRSice::permutation(const int n_thread)
 {
     Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
         m_phenotype.rows());
-    Eigen::setNbThreads(n_thread);
     // logit_perm can only be true if it is binary trait and user used the
     // --logit-perm flag
     // can always do the following if
@@ -1198,101 +1318,125 @@ void PRSice::permutation(const int n_thread)
     // 2. Not require logit perm
     Regress decomposed;
     bool run_glm = true;
+    if ((!m_perm_lm.empty() || !m_perm_glm.empty()) && batch_permutation())
+        return;
     if (!m_binary_trait || !m_perm_info.logit_perm)
     {
         pre_decompose_matrix(m_independent_variables, decomposed);
         run_glm = false;
     }
-    if (n_thread == 1)
-    {
-        // we will run the single thread function to reduce overhead
-        run_null_perm_no_thread(decomposed, run_glm);
+    const size_t num_perm = m_perm_info.num_permutation;
+    // each task works on its own range of permutations, no producer required
+    ThreadPool::global().parallel_for(
+        0, num_perm,
+        [this, &decomposed, run_glm](size_t start, size_t end) {
+            run_null_perm(decomposed, run_glm, start, end);
+        },
+        static_cast<size_t>(std::max(n_thread, 1)));
+    m_analysis_done += num_perm;
+    print_progress();
+}
+
+void PRSice::init_perm_block(const Eigen::MatrixXd& covariates)
+{
+    const size_t num_perm = m_perm_info.num_permutation;
+    const size_t num_sample = static_cast<size_t>(m_phenotype.rows());
+    // both the permuted phenotypes and their residuals are in memory when
+    // the block is loaded. For logistic regression, the permuted phenotypes
+    // are copied from the temporary block of load_perm_block, and the
+    // coefficients, deviance, weights and weighted covariate information of
+    // the null model are also kept
+    size_t col_byte = 2 * num_sample * sizeof(double);
+    m_perm_lm = Regression::PermutedLm();
+    m_perm_glm = Regression::PermutedGlm();
+    if (m_binary_trait && m_perm_info.logit_perm)
+    {
+        m_perm_glm = Regression::PermutedGlm(covariates);
+        const size_t num_cov = static_cast<size_t>(covariates.cols());
+        col_byte = (4 * num_sample + num_cov * num_cov + num_cov + 1)
+                   * sizeof(double);
     }
     else
+        m_perm_lm = Regression::PermutedLm(covariates);
+    m_perm_block_size = num_perm;
+    if (m_perm_info.memory != 0 && col_byte != 0)
     {
-        Thread_Queue<std::pair<Eigen::VectorXd, size_t>> set_perm_queue;
-        std::thread producer(&PRSice::gen_null_pheno, this,
-                             std::ref(set_perm_queue), n_thread - 1);
-        std::vector<std::thread> consume_store;
-        // we have used one thread as the producer, therefore we need to
-        // reduce the number of available thread by 1
-        for (int i = 0; i < n_thread - 1; ++i)
-        {
-            consume_store.push_back(std::thread(
-                &PRSice::consume_null_pheno, this, std::ref(set_perm_queue),
-                std::cref(decomposed), run_glm));
-        }
-        // wait for all the threads to complete their job
-        producer.join();
-        for (auto&& consume : consume_store) consume.join();
+        m_perm_block_size = std::max(
+            size_t(1), std::min(num_perm, m_perm_info.memory / col_byte));
     }
+    m_perm_block_cached = m_perm_block_size == num_perm;
+    if (m_perm_block_cached) load_perm_block(0, num_perm);
 }
 
-void PRSice::gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                            size_t num_consumer)
+void PRSice::load_perm_block(const size_t start, const size_t num_perm)
 {
-    size_t processed = 0;
-    std::mt19937 rand_gen {m_perm_info.seed};
-    Eigen::setNbThreads(1);
     const Eigen::Index num_regress_sample = m_phenotype.rows();
-    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
-        m_phenotype.rows());
+    Eigen::MatrixXd block(num_regress_sample,
+                          static_cast<Eigen::Index>(num_perm));
+    auto shuffle_columns = [this, &block, start,
+                            num_regress_sample](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            // same shuffle as run_null_perm
+            Philox rand_gen(m_perm_info.seed, start + i);
+            auto col = block.col(static_cast<Eigen::Index>(i));
+            col = m_phenotype;
+            std::shuffle(col.data(), col.data() + num_regress_sample,
+                         rand_gen);
+        }
+    };
+    // the columns are independent, so they can be generated in parallel
+    ThreadPool::global().parallel_for(0, num_perm, shuffle_columns);
+    if (!m_perm_glm.empty())
+        m_perm_glm.load(block);
+    else
+        m_perm_lm.load(block);
+}
 
-    while (processed < m_perm_info.num_permutation)
-    {
-        // TODO: Might want a thread safe memory pool heres
-        Eigen::VectorXd null_pheno = m_phenotype;
-        std::shuffle(null_pheno.data(), null_pheno.data() + num_regress_sample,
-                     rand_gen);
-        q.emplace(std::make_pair(null_pheno, processed), num_consumer);
-        ++m_analysis_done;
-        print_progress();
-        ++processed;
-    }
-    q.completed();
+bool PRSice::perm_abs_t(Eigen::VectorXd& t_value) const
+{
+    if (!m_perm_glm.empty())
+        return m_perm_glm.abs_t(m_independent_variables.col(1), t_value);
+    return m_perm_lm.abs_t(m_independent_variables.col(1), t_value);
 }
 
-void PRSice::consume_null_pheno(
-    Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-    const Regress& decomposed, bool run_glm)
+bool PRSice::batch_permutation()
 {
-    // to avoid false sharing, all consumer will first store their
-    // permutation result in their own vector and only update the master
-    // vector at the end of permutation temp_store stores all the T-value
-    std::vector<double> temp_store;
-    // and temp_index indicate which permutation the T-value corresponse to
-    // it is important we don't mix up the permutation order as we're
-    // supposed to mimic re-running PRSice N times with different
-    // permutation
-    std::vector<size_t> temp_index;
-    Eigen::VectorXd beta, effects;
-    std::pair<Eigen::VectorXd, size_t> input;
-    double coefficient, standard_error, r2, obs_p;
-    double obs_t = -1;
-    while (!q.pop(input))
+    Eigen::VectorXd t_value;
+    const size_t num_perm = m_perm_info.num_permutation;
+    if (m_perm_block_cached)
     {
-        if (run_glm)
+        if (!perm_abs_t(t_value)) return false;
+        for (size_t i = 0; i < num_perm; ++i)
         {
-            Regression::glm(std::get<0>(input), m_independent_variables, obs_p,
-                            r2, coefficient, standard_error, 1);
+            auto&& res = m_perm_result[i];
+            res = std::max(t_value(static_cast<Eigen::Index>(i)), res);
         }
-        else
+        m_analysis_done += num_perm;
+        print_progress();
+        return true;
+    }
+    // the block doesn't fit into memory, regenerate the permuted phenotypes
+    // one block at a time
+    size_t processed = 0;
+    while (processed < num_perm)
+    {
+        const size_t cur_size =
+            std::min(m_perm_block_size, num_perm - processed);
+        load_perm_block(processed, cur_size);
+        // collinearity only depends on the PRS, so this can only fail on the
+        // first block
+        if (!perm_abs_t(t_value)) return false;
+        for (size_t i = 0; i < cur_size; ++i)
         {
-            std::tie(coefficient, standard_error) =
-                get_coeff_se(decomposed, m_independent_variables,
-                             std::get<0>(input), beta, effects);
+            auto&& res = m_perm_result[processed + i];
+            res = std::max(t_value(static_cast<Eigen::Index>(i)), res);
         }
-        obs_t = std::fabs(coefficient / standard_error);
-        temp_store.push_back(obs_t);
-        temp_index.push_back(std::get<1>(input));
-    }
-    std::lock_guard<std::mutex> lock(lock_guard);
-    for (size_t i = 0; i < temp_store.size(); ++i)
-    {
-        double obs_t = temp_store[i];
-        auto&& index = temp_index[i];
-        if (m_perm_result[index] < obs_t) { m_perm_result[index] = obs_t; }
+        processed += cur_size;
+        m_analysis_done += cur_size;
+        print_progress();
     }
+    return true;
 }
 
 void PRSice::prep_best_output(
@@ -1520,7 +1664,22 @@ void PRSice::print_summary(const std::string& pheno_name,
         {
             (*summary_file) << "\tNA";
         }
+        // NA if the p-value was not approximated by the tail
+        if (m_perm_info.run_set_perm && m_perm_info.tail_approx)
+        {
+            if (sum.result.competitive_tail_fit_p >= 0.0)
+            { (*summary_file) << "\t" << sum.result.competitive_tail_fit_p; }
+            else
+                (*summary_file) << "\tNA";
+        }
         if (m_perm_info.run_perm) (*summary_file) << "\t" << sum.result.emp_p;
+        if (m_perm_info.run_perm && m_perm_info.tail_approx)
+        {
+            if (sum.result.tail_fit_p >= 0.0)
+            { (*summary_file) << "\t" << sum.result.tail_fit_p; }
+            else
+                (*summary_file) << "\tNA";
+        }
         (*summary_file) << "\n";
     }
 }
@@ -148,6 +148,15 @@ void Region::generate_exclusion(std::vector<IITree<size_t, size_t>>& cr,
     for (auto&& tree : cr) { tree.index(); }
 }
 
+void Region::generate_ld_blocks(std::vector<IITree<size_t, size_t>>& cr,
+                                const std::string& ld_block_file)
+{
+    if (ld_block_file.empty()) return;
+    bool dummy;
+    read_bed(misc::load_stream(ld_block_file), cr, dummy);
+    for (auto&& tree : cr) { tree.index(); }
+}
+
 
 size_t Region::generate_regions(
     const std::unordered_map<std::string, size_t>& included_snp_idx,
@@ -17,14 +17,43 @@
 #include "regression.hpp"
 namespace Regression
 {
+namespace
+{
+// take the second Newton step of glm on design, from the linear predictor
+// eta of the one step estimate coeff of the predictor (column 1). coeff and
+// standard_error are updated to those after the step. Return false when the
+// step moves the coefficient by more than one_step_tol standard errors, in
+// which case glm is still far from convergence
+bool second_step_converged(const Eigen::MatrixXd& design,
+                           const Eigen::VectorXd& y,
+                           const Eigen::VectorXd& eta, double& coeff,
+                           double& standard_error)
+{
+    Binomial family = Binomial();
+    const Eigen::VectorXd mu = family.linkinv(eta);
+    if (!family.validmu(mu)) return false;
+    const Eigen::VectorXd w = family.variance(mu);
+    // pseudo inverse in case the covariates are rank deficient
+    const Eigen::MatrixXd info_inv =
+        (design.transpose() * w.asDiagonal() * design)
+            .completeOrthogonalDecomposition()
+            .pseudoInverse();
+    const double step = info_inv.row(1).dot(design.transpose() * (y - mu));
+    const double variance = info_inv(1, 1);
+    // also catches NaN
+    if (!(variance > 0.0) || !std::isfinite(step)) return false;
+    standard_error = std::sqrt(variance);
+    coeff += step;
+    return std::fabs(step) < one_step_tol * standard_error;
+}
+} // namespace
 
 // This is an unsafe version of R's glm.fit
 // unsafe as in I have skipped some of the checking
 void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
-         double& r2, double& coeff, double& standard_error, int thread)
+         double& r2, double& coeff, double& standard_error)
 {
     Binomial family = Binomial();
-    Eigen::setNbThreads(thread);
     GLM<Binomial> run_glm(x, y, family);
     run_glm.init_parms();
     run_glm.solve();
@@ -34,9 +63,8 @@ void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
 
 void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
             double& r2, double& r2_adjust, double& coeff,
-            double& standard_error, int thread, bool intercept, int type)
+            double& standard_error, bool intercept, int type)
 {
-    Eigen::setNbThreads(thread);
     Eigen::Index n = X.rows();
     if (n != y.rows()) { throw std::runtime_error("Error: Size mismatch"); }
     lm ans;
@@ -66,4 +94,392 @@ void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
     p_value = misc::calc_tprob(tval, n);
 }
 
+ResidualLm::ResidualLm(const Eigen::VectorXd& y,
+                       const Eigen::MatrixXd& covariates)
+{
+    const Eigen::Index n = covariates.rows();
+    if (n != y.rows()) { throw std::runtime_error("Error: Size mismatch"); }
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> PQR(covariates);
+    m_rank = PQR.rank();
+    // the first rank columns of Q span the same space as the covariates,
+    // even when they are rank deficient
+    m_q = PQR.householderQ() * Eigen::MatrixXd::Identity(n, m_rank);
+    m_y_resid = project_out(y);
+    m_tss = (y.array() - y.mean()).square().sum();
+}
+
+bool ResidualLm::fit(const Eigen::VectorXd& x, double& p_value, double& r2,
+                     double& r2_adjust, double& coeff,
+                     double& standard_error) const
+{
+    const Eigen::Index n = m_q.rows();
+    if (n != x.rows()) { throw std::runtime_error("Error: Size mismatch"); }
+    const Eigen::VectorXd x_resid = project_out(x);
+    const double x_ss = x_resid.squaredNorm();
+    // also catches x containing NaN
+    if (!(x_ss > 1e-14 * x.squaredNorm())) return false;
+    coeff = x_resid.dot(m_y_resid) / x_ss;
+    const double rss = (m_y_resid - coeff * x_resid).squaredNorm();
+    const Eigen::Index df = n - m_rank - 1;
+    standard_error = std::sqrt(rss / static_cast<double>(df) / x_ss);
+    // the intercept is in the model, so mss = tss - rss
+    r2 = (m_tss - rss) / m_tss;
+    r2_adjust = 1.0
+                - (1.0 - r2)
+                      * (static_cast<double>(n - 1) / static_cast<double>(df));
+    p_value = misc::calc_tprob(coeff / standard_error, n);
+    return true;
+}
+
+PermutedLm::PermutedLm(const Eigen::MatrixXd& covariates)
+{
+    const Eigen::Index n = covariates.rows();
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> PQR(covariates);
+    m_rank = PQR.rank();
+    m_q = PQR.householderQ() * Eigen::MatrixXd::Identity(n, m_rank);
+}
+
+void PermutedLm::load(const Eigen::MatrixXd& y)
+{
+    if (empty())
+    { throw std::runtime_error("Error: Covariates were not initialized"); }
+    if (m_q.rows() != y.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    // project twice, same as ResidualLm
+    m_y_resid.noalias() = y - m_q * (m_q.transpose() * y);
+    m_y_resid -= m_q * (m_q.transpose() * m_y_resid);
+    m_y_ss = m_y_resid.colwise().squaredNorm().transpose();
+}
+
+bool PermutedLm::abs_t(const Eigen::VectorXd& x, Eigen::VectorXd& t_value) const
+{
+    const Eigen::Index n = m_q.rows();
+    if (n != x.rows()) { throw std::runtime_error("Error: Size mismatch"); }
+    Eigen::VectorXd x_resid = x - m_q * (m_q.transpose() * x);
+    x_resid -= m_q * (m_q.transpose() * x_resid);
+    const double x_ss = x_resid.squaredNorm();
+    // also catches x containing NaN
+    if (!(x_ss > 1e-14 * x.squaredNorm())) return false;
+    // x_resid is orthogonal to the covariates, so a single product gives the
+    // numerator of the coefficients of all columns
+    t_value.noalias() = m_y_resid.transpose() * x_resid;
+    const double df = static_cast<double>(n - m_rank - 1);
+    for (Eigen::Index i = 0; i < t_value.rows(); ++i)
+    {
+        const double u = t_value(i);
+        const double rss = m_y_ss(i) - u * u / x_ss;
+        t_value(i) = std::fabs(u) / std::sqrt(x_ss * rss / df);
+    }
+    return true;
+}
+
+PermutedGlm::PermutedGlm(const Eigen::MatrixXd& covariates)
+    : m_covariates(covariates)
+{
+}
+
+template <typename Job>
+void PermutedGlm::for_each_column(const Eigen::Index num_col, Job job) const
+{
+    // the columns are independent, so each task takes a consecutive range
+    ThreadPool::global().parallel_for(
+        0, static_cast<size_t>(num_col), [&job](size_t begin, size_t end) {
+            job(static_cast<Eigen::Index>(begin),
+                static_cast<Eigen::Index>(end));
+        });
+}
+
+void PermutedGlm::load(const Eigen::MatrixXd& y)
+{
+    if (empty())
+    { throw std::runtime_error("Error: Covariates were not initialized"); }
+    if (m_covariates.rows() != y.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    const Eigen::Index n = y.rows();
+    const Eigen::Index p = m_covariates.cols();
+    m_y = y;
+    m_null_beta.resize(p, y.cols());
+    m_resid.resize(n, y.cols());
+    m_weight.resize(n, y.cols());
+    m_cov_info_inv.resize(p, p * y.cols());
+    for_each_column(y.cols(), [this, n, p](Eigen::Index begin,
+                                           Eigen::Index end) {
+        Binomial family = Binomial();
+        Eigen::VectorXd mu;
+        for (Eigen::Index i = begin; i < end; ++i)
+        {
+            if (p == 1)
+            {
+                // the intercept only model has a closed form solution
+                const double mean = m_y.col(i).mean();
+                m_null_beta(0, i) = std::log(mean / (1.0 - mean));
+                mu = Eigen::VectorXd::Constant(n, mean);
+            }
+            else
+            {
+                GLM<Binomial> null_glm(m_covariates, m_y.col(i), family);
+                null_glm.init_parms();
+                null_glm.solve();
+                m_null_beta.col(i) = null_glm.get_beta();
+                mu = family.linkinv(m_covariates * null_glm.get_beta());
+            }
+            m_resid.col(i) = m_y.col(i) - mu;
+            m_weight.col(i) = family.variance(mu);
+            // pseudo inverse in case the covariates are rank deficient
+            m_cov_info_inv.block(0, i * p, p, p) =
+                (m_covariates.transpose() * m_weight.col(i).asDiagonal()
+                 * m_covariates)
+                    .completeOrthogonalDecomposition()
+                    .pseudoInverse();
+        }
+    });
+}
+
+bool PermutedGlm::abs_t(const Eigen::VectorXd& x,
+                        Eigen::VectorXd& t_value) const
+{
+    const Eigen::Index n = m_covariates.rows();
+    const Eigen::Index p = m_covariates.cols();
+    if (n != x.rows()) { throw std::runtime_error("Error: Size mismatch"); }
+    // the null residuals are orthogonal to the covariates, so a single
+    // product gives the score of all columns
+    t_value.noalias() = m_resid.transpose() * x;
+    const Eigen::VectorXd x_info = m_weight.transpose() * x.cwiseAbs2();
+    const Eigen::MatrixXd cross =
+        m_weight.transpose()
+        * (m_covariates.array().colwise() * x.array()).matrix();
+    // coefficient of x after one Newton step from the null model
+    Eigen::VectorXd step(t_value.rows());
+    for (Eigen::Index i = 0; i < t_value.rows(); ++i)
+    {
+        // information of x after adjusting for the covariates
+        const Eigen::VectorXd a = cross.row(i).transpose();
+        const double info =
+            x_info(i) - a.dot(m_cov_info_inv.block(0, i * p, p, p) * a);
+        // also catches x containing NaN
+        if (!(info > 1e-10 * x_info(i))) return false;
+        step(i) = t_value(i) / info;
+        t_value(i) = std::fabs(t_value(i)) / std::sqrt(info);
+    }
+    Eigen::MatrixXd design(n, p + 1);
+    design.col(0) = m_covariates.col(0);
+    design.col(1) = x;
+    design.rightCols(p - 1) = m_covariates.rightCols(p - 1);
+    std::atomic<size_t> num_refit {0};
+    for_each_column(
+        t_value.rows(), [this, n, p, &x, &cross, &step, &design, &t_value,
+                         &num_refit](Eigen::Index begin, Eigen::Index end) {
+            Eigen::VectorXd cov_beta(p), eta(n), start(p + 1);
+            double p_value, coeff, standard_error;
+            size_t local_refit = 0;
+            for (Eigen::Index i = begin; i < end; ++i)
+            {
+                // the covariates absorb the part of x they explain, so they
+                // move against the step of x
+                cov_beta.noalias() =
+                    m_cov_info_inv.block(0, i * p, p, p)
+                    * cross.row(i).transpose();
+                cov_beta = m_null_beta.col(i) - step(i) * cov_beta;
+                eta.noalias() = m_covariates * cov_beta;
+                eta += step(i) * x;
+                coeff = step(i);
+                if (second_step_converged(design, m_y.col(i), eta, coeff,
+                                          standard_error))
+                {
+                    t_value(i) = std::fabs(coeff / standard_error);
+                    continue;
+                }
+                ++local_refit;
+                start(0) = cov_beta(0);
+                start(1) = step(i);
+                start.tail(p - 1) = cov_beta.tail(p - 1);
+                GLM<Binomial> full(design, m_y.col(i), Binomial());
+                bool fitted = false;
+                try
+                {
+                    if (full.init_parms(start))
+                    {
+                        full.solve();
+                        fitted = full.has_converged();
+                    }
+                }
+                catch (const std::runtime_error&)
+                {
+                }
+                if (!fitted)
+                {
+                    full.init_parms();
+                    full.solve();
+                }
+                // same standard error as WarmGlm::fit
+                full.update_se();
+                full.get_stat(1, p_value, coeff, standard_error);
+                t_value(i) = std::fabs(coeff / standard_error);
+            }
+            num_refit += local_refit;
+        });
+    m_refitted = num_refit;
+    return true;
+}
+
+WarmGlm::WarmGlm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x)
+{
+    const Eigen::Index n = x.rows();
+    if (n != y.rows() || x.cols() < 2)
+    { throw std::runtime_error("Error: Size mismatch"); }
+    const Eigen::Index num_cov = x.cols() - 2;
+    m_has_covariate = num_cov > 0;
+    m_null_start = Eigen::VectorXd::Zero(x.cols());
+    Eigen::MatrixXd null_x(n, num_cov + 1);
+    null_x.col(0) = x.col(0);
+    null_x.rightCols(num_cov) = x.rightCols(num_cov);
+    if (m_has_covariate)
+    {
+        Binomial family = Binomial();
+        GLM<Binomial> null_glm(null_x, y, family);
+        null_glm.init_parms();
+        null_glm.solve();
+        m_null_r2 = null_glm.get_r2();
+        null_glm.get_stat(1, m_null_p, m_null_coeff, m_null_se);
+        m_null_start(0) = null_glm.get_beta()(0);
+        m_null_start.tail(num_cov) = null_glm.get_beta().tail(num_cov);
+    }
+    else
+    {
+        // the intercept only model has a closed form solution
+        const double mean = y.mean();
+        m_null_start(0) = std::log(mean / (1.0 - mean));
+    }
+    init_score(y, null_x);
+    m_design = x;
+    m_glm.reset(new GLM<Binomial>(x, y, Binomial()));
+}
+
+void WarmGlm::init_score(const Eigen::VectorXd& y,
+                         const Eigen::MatrixXd& null_x)
+{
+    const Eigen::Index n = null_x.rows();
+    Binomial family = Binomial();
+    const Eigen::VectorXd weights = Eigen::VectorXd::Ones(n);
+    Eigen::VectorXd null_beta(null_x.cols());
+    null_beta(0) = m_null_start(0);
+    null_beta.tail(null_x.cols() - 1) =
+        m_null_start.tail(null_x.cols() - 1);
+    m_y = y;
+    m_null_eta = null_x * null_beta;
+    const Eigen::VectorXd mu = family.linkinv(m_null_eta);
+    m_score_resid = y - mu;
+    m_score_weight = family.variance(mu).array().sqrt();
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> PQR(
+        m_score_weight.asDiagonal() * null_x);
+    m_score_q = PQR.householderQ() * Eigen::MatrixXd::Identity(n, PQR.rank());
+    m_null_dev = family.dev_resids_sum(y, mu, weights);
+    m_intercept_dev = family.dev_resids_sum(
+        y, Eigen::VectorXd::Constant(n, y.mean()), weights);
+}
+
+bool WarmGlm::score(const Eigen::VectorXd& x, double& p_value, double& r2,
+                    double& coeff, double& standard_error) const
+{
+    if (empty())
+    { throw std::runtime_error("Error: Null model was not initialized"); }
+    const Eigen::Index n = m_score_q.rows();
+    if (n != x.rows()) { throw std::runtime_error("Error: Size mismatch"); }
+    // information of x after adjusting for the covariates, the null model
+    // residuals are already orthogonal to the covariates
+    const Eigen::VectorXd wx = m_score_weight.cwiseProduct(x);
+    const double info =
+        wx.squaredNorm() - (m_score_q.transpose() * wx).squaredNorm();
+    // also catches x containing NaN
+    if (!(info > 1e-10 * wx.squaredNorm())) return false;
+    const double u = x.dot(m_score_resid);
+    const double stat = u * u / info;
+    coeff = u / info;
+    standard_error = 1.0 / std::sqrt(info);
+    p_value = chiprob_p(stat, 1);
+    const double nobs = static_cast<double>(n);
+    r2 = (1.0 - std::exp((m_null_dev - stat - m_intercept_dev) / nobs))
+         / (1.0 - std::exp(-m_intercept_dev / nobs));
+    return true;
+}
+
+void WarmGlm::one_step_fit(const Eigen::VectorXd& x, double& p_value,
+                           double& r2, double& coeff, double& standard_error)
+{
+    if (score(x, p_value, r2, coeff, standard_error))
+    {
+        // the one step estimate only moves the linear predictor along the
+        // part of x orthogonal to the weighted covariates
+        Eigen::VectorXd wx = m_score_weight.cwiseProduct(x);
+        wx -= m_score_q * (m_score_q.transpose() * wx);
+        m_one_step_eta = m_null_eta;
+        m_one_step_eta += coeff * wx.cwiseQuotient(m_score_weight);
+        m_design.col(1) = x;
+        if (second_step_converged(m_design, m_y, m_one_step_eta, coeff,
+                                  standard_error))
+        {
+            const double z = coeff / standard_error;
+            p_value = chiprob_p(z * z, 1);
+            return;
+        }
+    }
+    fit(x, p_value, r2, coeff, standard_error);
+}
+
+void WarmGlm::null_stat(double& p_value, double& r2, double& coeff,
+                        double& standard_error) const
+{
+    if (!m_has_covariate)
+    { throw std::runtime_error("Error: Null model has no covariate"); }
+    p_value = m_null_p;
+    r2 = m_null_r2;
+    coeff = m_null_coeff;
+    standard_error = m_null_se;
+}
+
+bool WarmGlm::warm_solve(const Eigen::VectorXd& start)
+{
+    if (!m_glm->init_parms(start)) return false;
+    try
+    {
+        m_iter = m_glm->solve();
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+    return m_glm->has_converged();
+}
+
+void WarmGlm::fit(const Eigen::VectorXd& x, double& p_value, double& r2,
+                  double& coeff, double& standard_error)
+{
+    if (empty())
+    { throw std::runtime_error("Error: Null model was not initialized"); }
+    m_glm->set_column(1, x);
+    // use the previous fit when it explains the new x better than the null
+    // model, which is usually the case for the cumulative PRS
+    bool use_previous = false;
+    if (m_previous.size() != 0 && m_glm->init_parms(m_null_start))
+    {
+        const double null_dev = m_glm->deviance();
+        use_previous =
+            m_glm->init_parms(m_previous) && m_glm->deviance() < null_dev;
+    }
+    m_iter = 0;
+    if (!warm_solve(use_previous ? m_previous : m_null_start))
+    {
+        const int warm_iter = m_iter;
+        m_glm->init_parms();
+        m_iter = warm_iter + m_glm->solve();
+    }
+    // the weights of the last iteration can be those of the starting values
+    // when the start is close enough for the deviance to converge straight
+    // away, so always evaluate them at the fitted coefficients
+    m_glm->update_se();
+    m_previous = m_glm->get_beta();
+    r2 = m_glm->get_r2();
+    m_glm->get_stat(1, p_value, coeff, standard_error);
+}
+
 }
@@ -114,6 +114,48 @@ TEST_CASE("bgen read_genotype")
                      Catch::Equals<uintptr_t>(expected_target));
     }
 
+    SECTION("Read dosage")
+    {
+        if (allow_inter) return;
+        // expected dosages of the second SNP, with missing samples imputed
+        // by the mean
+        std::vector<double> expected(n_ref, 0.0);
+        std::vector<bool> missing(n_ref, false);
+        double total = 0.0;
+        size_t observed_ct = 0;
+        for (size_t i = 0; i < n_ref; ++i)
+        {
+            const double* p = &(second_prob[i * n_entries]);
+            double sum = 0.0;
+            for (size_t j = 0; j < n_entries; ++j) { sum += p[j]; }
+            if (misc::logically_equal(sum, 0.0))
+            {
+                missing[i] = true;
+                continue;
+            }
+            expected[i] = (n_entries == 3)
+                              ? p[1] + 2.0 * p[2]
+                              : p[0] * p[3] + p[1] * p[2] + 2.0 * p[1] * p[3];
+            total += expected[i];
+            ++observed_ct;
+        }
+        const double mean = total / static_cast<double>(observed_ct);
+        double expected_sum_sq = 0.0;
+        for (size_t i = 0; i < n_ref; ++i)
+        {
+            expected[i] = missing[i] ? 0.0 : expected[i] - mean;
+            expected_sum_sq += expected[i] * expected[i];
+        }
+        std::vector<uintptr_t> storage(Genotype::dosage_storage_size(n_ref));
+        auto target_snps = target_bgen.existed_snps();
+        ref_bgen.test_read_dosage(target_snps.back(), storage.data());
+        const float* observed = Genotype::dosage_vector(storage.data());
+        for (size_t i = 0; i < n_ref; ++i)
+        { REQUIRE(observed[i] == Approx(expected[i]).margin(1e-5)); }
+        REQUIRE(Genotype::dosage_sum_sq(storage.data())
+                == Approx(expected_sum_sq).epsilon(1e-5));
+    }
+
     SECTION("Read into memory")
     {
         target_bgen.load_genotype_to_memory();
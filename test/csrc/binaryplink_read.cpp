@@ -138,6 +138,56 @@ TEST_CASE("plink read_genotype")
         REQUIRE_THAT(observed, Catch::Equals<uintptr_t>(expected_memory));
     }
 }
+
+TEST_CASE("Sample subset compaction")
+{
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<uintptr_t> word_dist;
+    // cover dense and sparse subsets, and sizes that are not a multiple of
+    // the word size
+    auto n_sample = GENERATE(1u, 31u, 32u, 33u, 100u, 1025u);
+    auto keep_prob = GENERATE(0.05, 0.5, 0.95);
+    std::bernoulli_distribution keep(keep_prob);
+    const uintptr_t raw_ct = QUATERCT_TO_WORDCT(n_sample);
+    std::vector<uintptr_t> raw(raw_ct);
+    for (auto&& w : raw) { w = word_dist(mersenne_engine); }
+    std::vector<uintptr_t> mask(BITCT_TO_WORDCT(n_sample), 0);
+    std::vector<size_t> expected;
+    for (uint32_t i = 0; i < n_sample; ++i)
+    {
+        if (!keep(mersenne_engine)) continue;
+        SET_BIT(i, mask.data());
+        expected.push_back((raw[i / BITCT2] >> (2 * (i % BITCT2))) & 3);
+    }
+    if (expected.empty())
+    {
+        SET_BIT(0, mask.data());
+        expected.push_back(raw[0] & 3);
+    }
+    const uint32_t subset_size = static_cast<uint32_t>(expected.size());
+    std::vector<uintptr_t> scalar(QUATERCT_TO_WORDCT(subset_size), 0),
+        dispatched(QUATERCT_TO_WORDCT(subset_size), 0);
+    copy_quaterarr_nonempty_subset_scalar(raw.data(), mask.data(), n_sample,
+                                          subset_size, scalar.data());
+    copy_quaterarr_nonempty_subset(raw.data(), mask.data(), n_sample,
+                                   subset_size, dispatched.data());
+    for (uint32_t i = 0; i < subset_size; ++i)
+    {
+        REQUIRE(((scalar[i / BITCT2] >> (2 * (i % BITCT2))) & 3)
+                == expected[i]);
+    }
+    REQUIRE(scalar == dispatched);
+#ifdef PLINK_X86_DISPATCH
+    if (__builtin_cpu_supports("bmi2"))
+    {
+        std::vector<uintptr_t> bmi2(QUATERCT_TO_WORDCT(subset_size), 0);
+        copy_quaterarr_nonempty_subset_bmi2(raw.data(), mask.data(), n_sample,
+                                            subset_size, bmi2.data());
+        REQUIRE(scalar == bmi2);
+    }
+#endif
+}
 /*
 void generate_expected_prs(const std::vector<size_t>& genotype,
                            const std::vector<bool>& selected,
@@ -145,7 +195,7 @@ void generate_expected_prs(const std::vector<size_t>& genotype,
                            const MISSING_SCORE& missing_score,
                            const SCORING& scoring, const bool flipped,
                            const bool use_ref_maf, Genotype& geno,
-                           std::vector<PRS>& expected_prs,
+                           PRS& expected_prs,
                            misc::RunningStat& rs)
 {
 }
@@ -205,6 +205,45 @@ TEST_CASE("generate snp vector")
             // we are checking the last line only
             REQUIRE(token[0] == "SNP_4");
         }
+        SECTION("read all SNPs")
+        {
+            bim.open("load_snp2.bim");
+            bim << "chr1	SNP_5	0	742429	A	C" << std::endl;
+            bim << "chr2	SNP_6	0	742429	A	T" << std::endl;
+            bim.close();
+            bplink.gen_bed_head("load_snp2.bed", num_sample, 2, true, false);
+            // SNPs are not matched against anything when the file is read on
+            // its own, e.g. for the LD panel or the weight matrix
+            mock_binaryplink standalone(geno, pheno, " ", &reporter);
+            standalone.set_sample(num_sample);
+            standalone.keep_ambig(true).read_all_snps();
+            const bool is_ref = GENERATE(true, false);
+            if (is_ref) { standalone.reference(); }
+            const bool extract = GENERATE(false, true);
+            if (extract)
+            {
+                // the weight matrix is used as the extraction list
+                std::ofstream extract_file("load_snp.extract");
+                extract_file << "SNP A1 W1\nSNP_2 C 0.1\nSNP_6 A 0.2\n";
+                extract_file.close();
+                standalone.snp_extraction("load_snp.extract", "");
+            }
+            standalone.load_snps("load_snp",
+                                 std::vector<IITree<size_t, size_t>> {}, false,
+                                 is_ref ? &standalone : nullptr);
+            auto res = standalone.existed_snps();
+            std::vector<std::string> expected = {"SNP_1", "SNP_2", "SNP_4",
+                                                 "SNP_5", "SNP_6"};
+            if (extract) { expected = {"SNP_2", "SNP_6"}; }
+            REQUIRE(res.size() == expected.size());
+            for (size_t i = 0; i < res.size(); ++i)
+            {
+                REQUIRE(res[i].rs() == expected[i]);
+                const size_t file_idx =
+                    (res[i].rs() == "SNP_5" || res[i].rs() == "SNP_6");
+                REQUIRE(res[i].get_file_idx(is_ref) == file_idx);
+            }
+        }
     }
 
 
@@ -145,6 +145,12 @@ TEST_CASE("Commander set flag")
         REQUIRE(commander.parse_command_wrapper("--logit-perm"));
         REQUIRE(commander.get_perm().logit_perm);
     }
+    SECTION("perm-tail")
+    {
+        REQUIRE_FALSE(commander.get_perm().tail_approx);
+        REQUIRE(commander.parse_command_wrapper("--perm-tail"));
+        REQUIRE(commander.get_perm().tail_approx);
+    }
     SECTION("full-back")
     {
         REQUIRE_FALSE(commander.get_set().full_as_background);
@@ -908,6 +914,12 @@ TEST_CASE("Permutation parameter loading")
         REQUIRE(commander.get_perm().run_set_perm);
         REQUIRE_FALSE(commander.get_perm().run_perm);
     }
+    SECTION("adaptive perm")
+    {
+        REQUIRE(commander.parse_command_wrapper("--adaptive-perm 20"));
+        REQUIRE(commander.get_perm().adaptive_hit == 20);
+        REQUIRE_FALSE(commander.parse_command_wrapper("--adaptive-perm -1"));
+    }
     SECTION("overflow")
     {
         REQUIRE_FALSE(commander.parse_command_wrapper("--set-perm 1e200"));
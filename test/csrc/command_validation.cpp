@@ -75,7 +75,9 @@ TEST_CASE("Target validation")
         }
         SECTION("invalid type")
         {
-            REQUIRE(commander.parse_command_wrapper("--type vcf"));
+            auto i = GENERATE("vcf", "ldp");
+            REQUIRE(
+                commander.parse_command_wrapper("--type " + std::string(i)));
             REQUIRE_FALSE(commander.target_check_wrapper());
         }
         SECTION("autosome")
@@ -204,6 +206,98 @@ TEST_CASE("Clump")
             }
         }
     }
+    SECTION("LD cache")
+    {
+        REQUIRE(commander.parse_command_wrapper(
+            "--ld-cache ref.ld --clump-r2 0.2 --proxy 0.05"));
+        SECTION("default floor")
+        {
+            REQUIRE(commander.clump_check_wrapper());
+            REQUIRE(commander.get_clump_info().ld_cache_r2 == Approx(0.05));
+        }
+        SECTION("invalid floor")
+        {
+            REQUIRE(commander.parse_command_wrapper("--ld-cache-r2 1.5"));
+            REQUIRE_FALSE(commander.clump_check_wrapper());
+        }
+        SECTION("with intermediate")
+        {
+            REQUIRE(commander.parse_command_wrapper("--allow-inter"));
+            REQUIRE_FALSE(commander.clump_check_wrapper());
+        }
+    }
+    SECTION("memory limit")
+    {
+        REQUIRE(commander.clump_check_wrapper());
+        REQUIRE(commander.get_clump_info().memory == 0);
+        REQUIRE(commander.parse_command_wrapper("--memory 10mb"));
+        REQUIRE(commander.clump_check_wrapper());
+        REQUIRE(commander.get_clump_info().memory == 10485760);
+    }
+    SECTION("LD panel")
+    {
+        REQUIRE(commander.parse_command_wrapper("--make-ld-panel panel"));
+        // either the LD reference or the target is required
+        REQUIRE_FALSE(commander.clump_check_wrapper());
+        REQUIRE(commander.parse_command_wrapper("--target target --keep A"));
+        REQUIRE(commander.clump_check_wrapper());
+        REQUIRE(commander.get_clump_info().ld_panel == "panel");
+        // the panel doesn't depend on clumping
+        REQUIRE(commander.parse_command_wrapper("--no-clump"));
+        REQUIRE(commander.clump_check_wrapper());
+        // the target is used as the LD reference with its sample selection
+        REQUIRE(commander.ref_check_wrapper());
+        REQUIRE(commander.get_reference().file_name == "target");
+        REQUIRE(commander.get_reference().keep == "A");
+    }
+    SECTION("clumping sweep")
+    {
+        REQUIRE(commander.parse_command_wrapper(
+            "--clump-sweep 0.1:250,0.2:1mb,0.5:500bp"));
+        REQUIRE(commander.clump_check_wrapper());
+        auto&& sweep = commander.get_clump_info().sweep;
+        REQUIRE(sweep.size() == 3);
+        REQUIRE(sweep[0].r2 == Approx(0.1));
+        REQUIRE(sweep[0].distance == 250000);
+        REQUIRE(sweep[1].distance == 1000000);
+        REQUIRE(sweep[2].r2 == Approx(0.5));
+        REQUIRE(sweep[2].distance == 500);
+        // settings are reported in the unit they were provided in
+        REQUIRE(sweep[0].distance_string() == "250kb");
+        REQUIRE(sweep[1].distance_string() == "1mb");
+        REQUIRE(sweep[2].distance_string() == "500bp");
+        SECTION("incompatible options")
+        {
+            auto para = GENERATE("--ld-cache ref.ld", "--ld-dosage");
+            REQUIRE(commander.parse_command_wrapper(para));
+            REQUIRE_FALSE(commander.clump_check_wrapper());
+        }
+    }
+    SECTION("invalid clumping sweep")
+    {
+        auto para = GENERATE("0.1", "0.1:250:1", "a:250", "0.1:abc", "1.5:250");
+        mockCommander sweep_commander;
+        const bool parsed = sweep_commander.parse_command_wrapper(
+            "--clump-sweep " + std::string(para));
+        REQUIRE_FALSE((parsed && sweep_commander.clump_check_wrapper()));
+    }
+    SECTION("LD block")
+    {
+        REQUIRE(commander.parse_command_wrapper("--ld-block blocks.bed"));
+        REQUIRE(commander.clump_check_wrapper());
+        REQUIRE(commander.get_clump_info().ld_block == "blocks.bed");
+        REQUIRE(commander.parse_command_wrapper("--ld-cache ref.ld"));
+        REQUIRE_FALSE(commander.clump_check_wrapper());
+    }
+    SECTION("LD dosage")
+    {
+        REQUIRE(commander.parse_command_wrapper("--ld-dosage"));
+        REQUIRE(commander.clump_check_wrapper());
+        REQUIRE(commander.get_clump_info().ld_dosage);
+        auto para = GENERATE("--ld-cache ref.ld", "--allow-inter");
+        REQUIRE(commander.parse_command_wrapper(para));
+        REQUIRE_FALSE(commander.clump_check_wrapper());
+    }
 }
 
 TEST_CASE("Test automatic reference copy over")
@@ -319,11 +413,30 @@ TEST_CASE("Reference validation")
         }
         SECTION("Valid type")
         {
-            auto i = GENERATE("bgen", "bed", "ped");
+            auto i = GENERATE("bgen", "bed", "ped", "ldp");
             REQUIRE(
                 commander.parse_command_wrapper("--ld-type " + std::string(i)));
             REQUIRE(commander.ref_check_wrapper());
         }
+        SECTION("LD dosage")
+        {
+            auto i = GENERATE("bgen", "bed", "ldp");
+            REQUIRE(commander.parse_command_wrapper(
+                "--ld-dosage --ld-type " + std::string(i)));
+            if (std::string(i) == "bgen")
+            { REQUIRE(commander.ref_check_wrapper()); }
+            else
+            {
+                REQUIRE_FALSE(commander.ref_check_wrapper());
+            }
+        }
+        SECTION("LD panel with sample selection")
+        {
+            auto para = GENERATE("--ld-keep more", "--ld-remove no-more");
+            REQUIRE(commander.parse_command_wrapper("--ld-type ldp "
+                                                    + std::string(para)));
+            REQUIRE_FALSE(commander.ref_check_wrapper());
+        }
         SECTION("universial bound check")
         {
             auto para = GENERATE("--ld-geno ", "--ld-maf ");
@@ -373,6 +486,38 @@ TEST_CASE("Misc validation")
         // doesn't matter if we don't use perm, only add warning
         REQUIRE(commander.misc_check_wrapper());
     }
+    SECTION("adaptive-perm")
+    {
+        REQUIRE(commander.parse_command_wrapper("--adaptive-perm 10"));
+        SECTION("without set-perm")
+        {
+            // only add warning
+            REQUIRE(commander.misc_check_wrapper());
+            REQUIRE(commander.get_perm().adaptive_hit == 0);
+        }
+        SECTION("with set-perm")
+        {
+            REQUIRE(commander.parse_command_wrapper("--set-perm 100"));
+            REQUIRE(commander.misc_check_wrapper());
+            REQUIRE(commander.get_perm().adaptive_hit == 10);
+        }
+    }
+    SECTION("perm-tail")
+    {
+        REQUIRE(commander.parse_command_wrapper("--perm-tail"));
+        SECTION("without permutation")
+        {
+            // only add warning
+            REQUIRE(commander.misc_check_wrapper());
+            REQUIRE_FALSE(commander.get_perm().tail_approx);
+        }
+        SECTION("with perm")
+        {
+            REQUIRE(commander.parse_command_wrapper("--perm 1000"));
+            REQUIRE(commander.misc_check_wrapper());
+            REQUIRE(commander.get_perm().tail_approx);
+        }
+    }
     SECTION("use-ref-maf")
     {
         REQUIRE(commander.parse_command_wrapper("--use-ref-maf"));
@@ -449,6 +594,25 @@ TEST_CASE("Misc validation")
             REQUIRE_FALSE(commander.ultra_aggressive());
         }
     }
+    SECTION("weight matrix")
+    {
+        REQUIRE(commander.parse_command_wrapper("--weight-matrix weights"));
+        SECTION("with bed")
+        {
+            REQUIRE(commander.parse_command_wrapper("--type bed"));
+            REQUIRE(commander.misc_check_wrapper());
+        }
+        SECTION("with dosage bgen")
+        {
+            REQUIRE(commander.parse_command_wrapper("--type bgen"));
+            REQUIRE_FALSE(commander.misc_check_wrapper());
+        }
+        SECTION("with hard coded bgen")
+        {
+            REQUIRE(commander.parse_command_wrapper("--type bgen --hard"));
+            REQUIRE(commander.misc_check_wrapper());
+        }
+    }
     SECTION("snp selection")
     {
         SECTION("extract")
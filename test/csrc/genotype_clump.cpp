@@ -1,7 +1,10 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "catch.hpp"
 #include "genotype.hpp"
+#include "ldpanel.hpp"
 #include "mock_binaryplink.hpp"
 #include "mock_genotype.hpp"
+#include "pool_guard.hpp"
 
 
 TEST_CASE("Sort by p")
@@ -499,9 +502,10 @@ TEST_CASE("R2 calculation")
             REQUIRE_THAT(res,
                          Catch::Equals<range>({range {0, 25}, range {25, 50}}));
         }
-        SECTION("Threaded clumping")
-        {
-            size_t threads = GENERATE(1, 2);
+        // expected index SNPs of the greedy algorithm for SNPs that are at
+        // most window apart (and within the same partition, if provided)
+        auto greedy_clump = [&](size_t window,
+                                std::vector<size_t> partition = {}) {
             std::vector<std::string> expected_remain;
             auto snp = geno.existed_snps();
             auto idx = geno.sorted_p_index();
@@ -509,42 +513,271 @@ TEST_CASE("R2 calculation")
             for (auto i : idx)
             {
                 if (removed.find(i) != removed.end()) continue;
-                size_t cur_idx = 0, cur_start = 0, cur_end = dummy_input.size();
                 removed.insert(i);
-                if (i < dummy_input.size())
+                const size_t cur_start =
+                    i < dummy_input.size() ? 0 : dummy_input.size();
+                const size_t cur_idx = i - cur_start;
+                for (size_t j = cur_start; j < cur_start + dummy_input.size();
+                     ++j)
                 {
-                    cur_idx = i;
-                    cur_start = 0;
-                    cur_end = dummy_input.size();
+                    const size_t j_idx = j - cur_start;
+                    const size_t dist =
+                        j_idx < cur_idx ? cur_idx - j_idx : j_idx - cur_idx;
+                    if (dist > window || removed.find(j) != removed.end())
+                    { continue; }
+                    if (!partition.empty() && partition[i] != partition[j])
+                    { continue; }
+                    auto first_idx = j < i ? j_idx : cur_idx;
+                    auto second_idx = j < i ? cur_idx - first_idx - 1
+                                            : j_idx - first_idx - 1;
+                    auto r2 = expected_r2[first_idx][second_idx];
+                    if (r2 >= clump_info.r2) { removed.insert(j); }
                 }
+                expected_remain.push_back(snp[i].rs());
+            }
+            return expected_remain;
+        };
+        auto remaining_snps = [&geno]() {
+            std::vector<std::string> result;
+            for (auto&& snp : geno.existed_snps())
+            { result.push_back(snp.rs()); }
+            return result;
+        };
+        SECTION("Threaded clumping")
+        {
+            size_t threads = GENERATE(1, 2, 4);
+            auto expected_remain = greedy_clump(dummy_input.size());
+            Genotype* geno_ptr = &geno;
+            PoolGuard pool(threads);
+            geno.clumping(clump_info, *geno_ptr, threads);
+            REQUIRE_THAT(remaining_snps(),
+                         Catch::UnorderedEquals<std::string>(expected_remain));
+        }
+        SECTION("Block parallel clumping")
+        {
+            // use a small window so that each chromosome is split into
+            // multiple blocks
+            const size_t window = 5;
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            size_t threads = GENERATE(1, 3, 8);
+            auto expected_remain = greedy_clump(window);
+            Genotype* geno_ptr = &geno;
+            // same as main, where the pool is sized by --thread
+            PoolGuard pool(threads);
+            geno.clumping(clump_info, *geno_ptr, threads);
+            REQUIRE_THAT(remaining_snps(),
+                         Catch::UnorderedEquals<std::string>(expected_remain));
+        }
+        SECTION("Clumping error")
+        {
+            // plink reference can't provide dosages, so reading the window
+            // throws. The error must reach the caller instead of leaving the
+            // other tasks waiting for the failed block
+            const size_t window = 5;
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            clump_info.ld_dosage = true;
+            size_t threads = GENERATE(1, 3);
+            const size_t snp_size = GenotypePool::snp_size(
+                Genotype::ld_storage_size(clump_info, n_sample, n_sample));
+            clump_info.memory = GENERATE_COPY(0, 60 * snp_size);
+            Genotype* geno_ptr = &geno;
+            PoolGuard pool(threads);
+            REQUIRE_THROWS(geno.clumping(clump_info, *geno_ptr, threads));
+        }
+        SECTION("Memory budgeted clumping")
+        {
+            const size_t window = 5;
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            const size_t snp_size =
+                GenotypePool::snp_size(2 * BITCT_TO_WORDCT(n_sample));
+            Genotype* geno_ptr = &geno;
+            SECTION("insufficient memory")
+            {
+                clump_info.memory = 2 * snp_size;
+                REQUIRE_THROWS(geno.clumping(clump_info, *geno_ptr, 1));
+            }
+            SECTION("within budget")
+            {
+                // blocks contain 6 SNPs and an index SNP can touch its
+                // neighbouring blocks, so 20 genotypes is the smallest budget
+                // that always works. With 60 everything fits in memory. Each
+                // worker holds one more genotype, so the budget also limits
+                // the number of threads used
+                const size_t num_genotype = GENERATE(20, 21, 60);
+                clump_info.memory = num_genotype * snp_size;
+                auto expected_remain = greedy_clump(window);
+                size_t threads = GENERATE(1, 2, 4);
+                PoolGuard pool(threads);
+                geno.clumping(clump_info, *geno_ptr, threads);
+                REQUIRE_THAT(
+                    remaining_snps(),
+                    Catch::UnorderedEquals<std::string>(expected_remain));
+            }
+        }
+        SECTION("Clumping within LD blocks")
+        {
+            // chr1 is partitioned into [0, 9], [10, 17] and [18, 24], chr2
+            // into [0, 4], [5, 14] and [15, 24]
+            std::vector<IITree<size_t, size_t>> ld_blocks(3);
+            ld_blocks[1].add(0, 9, 0);
+            ld_blocks[1].add(10, 17, 0);
+            ld_blocks[2].add(5, 14, 0);
+            for (auto&& tree : ld_blocks) { tree.index(); }
+            geno.set_ld_blocks(std::move(ld_blocks));
+            geno.build_clump_windows(10000000);
+            geno.sort_by_p();
+            std::vector<size_t> partition;
+            for (size_t i = 0; i < 2 * dummy_input.size(); ++i)
+            {
+                const size_t loc = i % dummy_input.size();
+                if (i < dummy_input.size())
+                { partition.push_back(loc <= 9 ? 0 : (loc <= 17 ? 1 : 2)); }
                 else
                 {
-                    cur_idx = i - dummy_input.size();
-                    cur_start = dummy_input.size();
-                    cur_end = file_output.size();
-                }
-                for (size_t j = cur_start; j < cur_end; ++j)
-                {
-                    if (removed.find(j) == removed.end())
-                    {
-                        auto first_idx = j < i ? j - cur_start : cur_idx;
-                        auto second_idx = j < i ? cur_idx - first_idx - 1
-                                                : j - cur_start - first_idx - 1;
-                        auto r2 = expected_r2[first_idx][second_idx];
-                        if (r2 >= clump_info.r2) { removed.insert(j); }
-                    }
+                    partition.push_back(loc <= 4 ? 3 : (loc <= 14 ? 4 : 5));
                 }
-                expected_remain.push_back(snp[i].rs());
             }
+            auto expected_remain = greedy_clump(dummy_input.size(), partition);
+            size_t threads = GENERATE(1, 2, 4);
             Genotype* geno_ptr = &geno;
+            PoolGuard pool(threads);
             geno.clumping(clump_info, *geno_ptr, threads);
-            auto res_snp = geno.existed_snps();
-            std::vector<std::string> result;
-            result.reserve(res_snp.size());
-            for (auto&& snp : res_snp) { result.push_back(snp.rs()); }
-            REQUIRE_THAT(result,
+            REQUIRE_THAT(remaining_snps(),
+                         Catch::UnorderedEquals<std::string>(expected_remain));
+        }
+        SECTION("Clumping with LD cache")
+        {
+            const std::string cache_name = "clump_ld.cache";
+            std::remove(cache_name.c_str());
+            const size_t window = 10;
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            auto expected_remain = greedy_clump(window);
+            clump_info.ld_cache = cache_name;
+            clump_info.ld_cache_r2 = clump_info.r2;
+            clump_info.distance = window;
+            Genotype* geno_ptr = &geno;
+            // the cache is built by the workers of the pool
+            size_t threads = GENERATE(1, 2);
+            PoolGuard pool(threads);
+            // each worker needs the genotypes of a whole window
+            const size_t snp_size =
+                GenotypePool::snp_size(2 * BITCT_TO_WORDCT(n_sample));
+            clump_info.memory = window * snp_size;
+            REQUIRE_THROWS(geno.prepare_ld_cache(clump_info, *geno_ptr));
+            // a window spans at most 2 * window + 1 SNPs, plus one genotype
+            // for reading the file. The memory then only limits the number of
+            // workers
+            clump_info.memory = (2 * window + 3) * snp_size;
+            // first call generate the cache, the second will reuse it
+            REQUIRE_NOTHROW(geno.prepare_ld_cache(clump_info, *geno_ptr));
+            REQUIRE_NOTHROW(geno.prepare_ld_cache(clump_info, *geno_ptr));
+            // r2 from hard coded genotypes can't be reused for dosage LD
+            clump_info.ld_dosage = true;
+            REQUIRE_THROWS(geno.prepare_ld_cache(clump_info, *geno_ptr));
+            clump_info.ld_dosage = false;
+            // the cache is keyed by file location, and the distance is
+            // checked against the loc of the SNPs
+            LDCache cache;
+            cache.load(cache_name);
+            REQUIRE(cache.distance() == window);
+            REQUIRE(cache.floor() == Approx(clump_info.r2));
+            auto&& snps = geno.existed_snps();
+            for (size_t i = 0; i < snps.size(); ++i)
+            {
+                auto [file_idx, byte_pos] = snps[i].get_file_info(true);
+                auto variant = cache.find(
+                    snps[i].chr(), LDCache::variant_key(file_idx, byte_pos));
+                REQUIRE(variant.valid());
+            }
+            clump_info.memory = 0;
+            geno.clumping(clump_info, *geno_ptr, threads);
+            REQUIRE_THAT(remaining_snps(),
                          Catch::UnorderedEquals<std::string>(expected_remain));
         }
+        SECTION("Clumping with LD panel")
+        {
+            const std::string panel_name = "clump_ld_panel";
+            const size_t window = 5;
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            auto expected_remain = greedy_clump(window);
+            geno.write_ld_panel(panel_name + ".ldp");
+            GenoFile panel_file;
+            panel_file.file_name = panel_name;
+            panel_file.type = "ldp";
+            Phenotype pheno;
+            LDPanel panel(panel_file, pheno, " ", &reporter);
+            panel.reference();
+            panel.load_samples(false);
+            geno.update_snp_index();
+            panel.load_snps(panel_name, {}, false, &geno);
+            REQUIRE(geno.existed_snps().size() == file_output.size());
+            geno.build_clump_windows(window);
+            geno.sort_by_p();
+            size_t threads = GENERATE(1, 2);
+            PoolGuard pool(threads);
+            geno.clumping(clump_info, panel, threads);
+            REQUIRE_THAT(remaining_snps(),
+                         Catch::UnorderedEquals<std::string>(expected_remain));
+            // counts are taken from the panel instead of being recalculated
+            QCFiltering filter_info;
+            filter_info.geno = 0.99;
+            panel.calc_freqs_and_intermediate(filter_info, panel_name, false,
+                                              &geno);
+            for (auto&& snp : geno.existed_snps())
+            {
+                const size_t idx = std::stoul(snp.rs().substr(2));
+                uint32_t expected[4] = {0, 0, 0, 0};
+                for (size_t i = n_sample - 100; i < n_sample; ++i)
+                {
+                    ++expected[(file_output[idx][i / BITCT2]
+                                >> (2 * (i % BITCT2)))
+                               & 3];
+                }
+                uint32_t homcom, het, homrar, missing;
+                REQUIRE(snp.get_counts(homcom, het, homrar, missing, true));
+                REQUIRE(homcom == expected[0]);
+                REQUIRE(missing == expected[1]);
+                REQUIRE(het == expected[2]);
+                REQUIRE(homrar == expected[3]);
+            }
+        }
+        SECTION("Clumping sweep")
+        {
+            // the pair list is calculated at the widest window and the loosest
+            // r2, each setting should match the greedy algorithm on its own
+            std::vector<ClumpSetting> settings = {
+                {clump_info.r2, 5}, {0.01, 10}, {0.1, 25}, {clump_info.r2, 2}};
+            std::vector<std::vector<std::string>> expected;
+            const double r2 = clump_info.r2;
+            for (auto&& setting : settings)
+            {
+                clump_info.r2 = setting.r2;
+                expected.push_back(greedy_clump(setting.distance));
+            }
+            clump_info.r2 = r2;
+            clump_info.sweep = settings;
+            Genotype* geno_ptr = &geno;
+            // the LD is calculated by the workers of the pool, with or
+            // without a memory budget (enough for a single window of 25 SNPs
+            // on each side)
+            size_t threads = GENERATE(1, 2);
+            PoolGuard pool(threads);
+            const size_t snp_size =
+                GenotypePool::snp_size(2 * BITCT_TO_WORDCT(n_sample));
+            clump_info.memory = GENERATE_COPY(0, 53 * snp_size);
+            geno.prepare_clump_sweep(clump_info, *geno_ptr);
+            for (size_t i = 0; i < settings.size(); ++i)
+            {
+                geno.sweep_clumping(clump_info, settings[i]);
+                REQUIRE_THAT(remaining_snps(),
+                             Catch::UnorderedEquals<std::string>(expected[i]));
+            }
+        }
     }
     SECTION("Test R2 calculation")
     {
@@ -641,6 +874,327 @@ TEST_CASE("R2 calculation")
                                          index_tots)
                         == Approx(expected_r2[i][j - i - 1]));
             }
+            // the batched calculation must give the same r2 for the window
+            std::vector<uintptr_t*> window;
+            for (size_t j = i + 1; j < dummy_input.size(); ++j)
+            { window.push_back(dummy_input[j].data()); }
+            auto r2 = geno.test_get_r2_batch(founder_ctl2, founder_ctv2,
+                                             window, index_data, index_tots);
+            REQUIRE(r2.size() == window.size());
+            for (size_t j = 0; j < r2.size(); ++j)
+            { REQUIRE(r2[j] == Approx(expected_r2[i][j])); }
         }
     }
 }
+
+TEST_CASE("Two locus count kernels")
+{
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<uintptr_t> word_dist;
+    // cover the vector body and the remainder of each implementation
+    auto n_founder = GENERATE(1u, 31u, 32u, 250u, 257u, 1000u, 12345u);
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(n_founder);
+    const uintptr_t founder_ctv2 = QUATERCT_TO_ALIGNED_WORDCT(n_founder);
+    std::vector<uintptr_t> geno(founder_ctv2, 0), index(founder_ctv2, 0);
+    for (uintptr_t i = 0; i < founder_ctl2; ++i)
+    {
+        geno[i] = word_dist(mersenne_engine);
+        // index data only contains 01 and 00
+        index[i] = word_dist(mersenne_engine) & FIVEMASK;
+    }
+    if (n_founder % BITCT2)
+    {
+        index[founder_ctl2 - 1] &=
+            (ONELU << (2 * (n_founder % BITCT2))) - ONELU;
+    }
+    // naive count of each genotype within the index mask
+    uint32_t expected[3] = {0, 0, 0};
+    for (uint32_t i = 0; i < n_founder; ++i)
+    {
+        const uintptr_t shift = 2 * (i % BITCT2);
+        if (!((index[i / BITCT2] >> shift) & 1)) continue;
+        const uintptr_t code = (geno[i / BITCT2] >> shift) & 3;
+        if (code == 1) ++expected[0];
+        else if (code == 2)
+            ++expected[1];
+        else if (code == 3)
+            ++expected[2];
+    }
+    uint32_t observed[3];
+    genovec_3freq_generic(geno.data(), index.data(), founder_ctl2,
+                          &observed[0], &observed[1], &observed[2]);
+    REQUIRE(observed[0] == expected[0]);
+    REQUIRE(observed[1] == expected[1]);
+    REQUIRE(observed[2] == expected[2]);
+    genovec_3freq(geno.data(), index.data(), founder_ctl2, &observed[0],
+                  &observed[1], &observed[2]);
+    REQUIRE(observed[0] == expected[0]);
+    REQUIRE(observed[1] == expected[1]);
+    REQUIRE(observed[2] == expected[2]);
+#ifdef PLINK_X86_DISPATCH
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        genovec_3freq_avx2(geno.data(), index.data(), founder_ctl2,
+                           &observed[0], &observed[1], &observed[2]);
+        REQUIRE(observed[0] == expected[0]);
+        REQUIRE(observed[1] == expected[1]);
+        REQUIRE(observed[2] == expected[2]);
+    }
+    if (__builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512vpopcntdq"))
+    {
+        genovec_3freq_avx512(geno.data(), index.data(), founder_ctl2,
+                             &observed[0], &observed[1], &observed[2]);
+        REQUIRE(observed[0] == expected[0]);
+        REQUIRE(observed[1] == expected[1]);
+        REQUIRE(observed[2] == expected[2]);
+    }
+#endif
+}
+
+TEST_CASE("Batched two locus count kernels")
+{
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<uintptr_t> word_dist;
+    auto n_founder = GENERATE(1u, 31u, 257u, 12345u);
+    // odd number of SNPs so that the last tile is incomplete
+    auto n_snp = GENERATE(1u, 2u, 7u);
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(n_founder);
+    const uintptr_t founder_ctv2 = QUATERCT_TO_ALIGNED_WORDCT(n_founder);
+    std::vector<uintptr_t> index(3 * founder_ctv2, 0);
+    std::vector<std::vector<uintptr_t>> geno(
+        n_snp, std::vector<uintptr_t>(founder_ctv2, 0));
+    std::vector<uintptr_t*> geno_ptr;
+    for (auto&& g : geno)
+    {
+        for (uintptr_t i = 0; i < founder_ctl2; ++i)
+        { g[i] = word_dist(mersenne_engine); }
+        geno_ptr.push_back(g.data());
+    }
+    for (uintptr_t i = 0; i < 3 * founder_ctv2; ++i)
+    {
+        if (i % founder_ctv2 < founder_ctl2)
+        { index[i] = word_dist(mersenne_engine) & FIVEMASK; }
+    }
+    std::vector<uint32_t> expected(9 * n_snp);
+    for (uint32_t i_snp = 0; i_snp < n_snp; ++i_snp)
+    {
+        for (uint32_t mask = 0; mask < 3; ++mask)
+        {
+            uint32_t* cur = &(expected[9 * i_snp + 3 * mask]);
+            genovec_3freq_generic(geno_ptr[i_snp],
+                                  &(index[mask * founder_ctv2]), founder_ctl2,
+                                  &cur[0], &cur[1], &cur[2]);
+        }
+    }
+    std::vector<uint32_t> observed(9 * n_snp);
+    genovec_3freq_batch_generic(geno_ptr.data(), n_snp, index.data(),
+                                founder_ctv2, founder_ctl2, observed.data());
+    REQUIRE(observed == expected);
+    std::fill(observed.begin(), observed.end(), 0);
+    genovec_3freq_batch(geno_ptr.data(), n_snp, index.data(), founder_ctv2,
+                        founder_ctl2, observed.data());
+    REQUIRE(observed == expected);
+#ifdef PLINK_X86_DISPATCH
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        std::fill(observed.begin(), observed.end(), 0);
+        genovec_3freq_batch_avx2(geno_ptr.data(), n_snp, index.data(),
+                                 founder_ctv2, founder_ctl2, observed.data());
+        REQUIRE(observed == expected);
+    }
+    if (__builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512vpopcntdq"))
+    {
+        std::fill(observed.begin(), observed.end(), 0);
+        genovec_3freq_batch_avx512(geno_ptr.data(), n_snp, index.data(),
+                                   founder_ctv2, founder_ctl2, observed.data());
+        REQUIRE(observed == expected);
+    }
+#endif
+}
+
+TEST_CASE("Dosage dot product kernels")
+{
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_real_distribution<float> dosage_dist(-1.0f, 1.0f);
+    // cover the vector body, the remainder and multiple accumulation runs
+    auto n_founder = GENERATE(1u, 15u, 17u, 512u, 1000u, 12345u);
+    // odd number of SNPs so that the last tile is incomplete
+    auto n_snp = GENERATE(1u, 4u, 7u);
+    std::vector<float> index(n_founder);
+    std::vector<std::vector<float>> dosage(n_snp,
+                                           std::vector<float>(n_founder));
+    std::vector<const float*> dosage_ptr;
+    for (auto&& d : index) { d = dosage_dist(mersenne_engine); }
+    for (auto&& snp : dosage)
+    {
+        for (auto&& d : snp) { d = dosage_dist(mersenne_engine); }
+        dosage_ptr.push_back(snp.data());
+    }
+    std::vector<double> expected(n_snp, 0.0);
+    for (uint32_t i_snp = 0; i_snp < n_snp; ++i_snp)
+    {
+        for (uint32_t i = 0; i < n_founder; ++i)
+        {
+            expected[i_snp] += static_cast<double>(index[i])
+                               * static_cast<double>(dosage[i_snp][i]);
+        }
+    }
+    auto check = [&](const std::vector<double>& observed) {
+        for (uint32_t i_snp = 0; i_snp < n_snp; ++i_snp)
+        { REQUIRE(observed[i_snp] == Approx(expected[i_snp]).margin(1e-3)); }
+    };
+    std::vector<double> observed(n_snp, 0.0);
+    dosage_dot_batch_generic(index.data(), dosage_ptr.data(), n_snp, n_founder,
+                             observed.data());
+    check(observed);
+    std::fill(observed.begin(), observed.end(), 0.0);
+    dosage_dot_batch(index.data(), dosage_ptr.data(), n_snp, n_founder,
+                     observed.data());
+    check(observed);
+#ifdef PLINK_X86_DISPATCH
+    if (__builtin_cpu_supports("avx2"))
+    {
+        std::fill(observed.begin(), observed.end(), 0.0);
+        dosage_dot_batch_avx2(index.data(), dosage_ptr.data(), n_snp, n_founder,
+                              observed.data());
+        check(observed);
+    }
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        std::fill(observed.begin(), observed.end(), 0.0);
+        dosage_dot_batch_avx512(index.data(), dosage_ptr.data(), n_snp,
+                                n_founder, observed.data());
+        check(observed);
+    }
+#endif
+}
+
+TEST_CASE("Dosage r2")
+{
+    mockGenotype geno;
+    const uintptr_t n_founder = 5;
+    // store the mean centred dosages the same way as read_dosage
+    auto make_storage = [n_founder](const std::vector<double>& raw) {
+        std::vector<uintptr_t> storage(
+            Genotype::dosage_storage_size(n_founder), 0);
+        double mean = 0.0, sum_sq = 0.0;
+        for (auto&& d : raw) mean += d;
+        mean /= static_cast<double>(raw.size());
+        float* dosage = reinterpret_cast<float*>(storage.data() + 1);
+        for (size_t i = 0; i < raw.size(); ++i)
+        {
+            dosage[i] = static_cast<float>(raw[i] - mean);
+            sum_sq += (raw[i] - mean) * (raw[i] - mean);
+        }
+        std::memcpy(storage.data(), &sum_sq, sizeof(double));
+        return storage;
+    };
+    auto index = make_storage({0.1, 0.9, 1.2, 2.0, 1.8});
+    auto same = make_storage({0.1, 0.9, 1.2, 2.0, 1.8});
+    auto flipped = make_storage({1.9, 1.1, 0.8, 0.0, 0.2});
+    auto partial = make_storage({0.0, 1.0, 1.0, 2.0, 0.5});
+    auto mono = make_storage({1.0, 1.0, 1.0, 1.0, 1.0});
+    std::vector<uintptr_t*> window = {same.data(), flipped.data(),
+                                      partial.data(), mono.data()};
+    auto r2 = geno.test_get_dosage_r2_batch(n_founder, index.data(), window);
+    REQUIRE(r2.size() == 4);
+    REQUIRE(r2[0] == Approx(1.0));
+    REQUIRE(r2[1] == Approx(1.0));
+    // squared Pearson correlation of the two dosage vectors
+    REQUIRE(r2[2] == Approx(0.5059289).epsilon(1e-5));
+    REQUIRE(r2[3] == -1);
+}
+
+TEST_CASE("Two locus count kernel benchmark", "[.benchmark]")
+{
+    // hidden from the default test run, use ./tests [benchmark] to run it
+    std::mt19937 mersenne_engine {42};
+    std::uniform_int_distribution<uintptr_t> word_dist;
+    auto n_founder = GENERATE(500u, 5000u, 50000u, 500000u);
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(n_founder);
+    const uintptr_t founder_ctv2 = QUATERCT_TO_ALIGNED_WORDCT(n_founder);
+    std::vector<uintptr_t> geno(founder_ctv2, 0), index(founder_ctv2, 0);
+    for (uintptr_t i = 0; i < founder_ctl2; ++i)
+    {
+        geno[i] = word_dist(mersenne_engine);
+        index[i] = word_dist(mersenne_engine) & FIVEMASK;
+    }
+    uint32_t counts[3];
+    const std::string suffix = " (" + std::to_string(n_founder) + " founders)";
+    BENCHMARK("generic" + suffix)
+    {
+        genovec_3freq_generic(geno.data(), index.data(), founder_ctl2,
+                              &counts[0], &counts[1], &counts[2]);
+        return counts[0];
+    };
+#ifdef PLINK_X86_DISPATCH
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        BENCHMARK("avx2" + suffix)
+        {
+            genovec_3freq_avx2(geno.data(), index.data(), founder_ctl2,
+                               &counts[0], &counts[1], &counts[2]);
+            return counts[0];
+        };
+    }
+    if (__builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512vpopcntdq"))
+    {
+        BENCHMARK("avx512" + suffix)
+        {
+            genovec_3freq_avx512(geno.data(), index.data(), founder_ctl2,
+                                 &counts[0], &counts[1], &counts[2]);
+            return counts[0];
+        };
+    }
+#endif
+}
+
+TEST_CASE("Batched two locus count benchmark", "[.benchmark]")
+{
+    // one index SNP against a window of 64 SNPs, pair by pair or in a batch
+    std::mt19937 mersenne_engine {42};
+    std::uniform_int_distribution<uintptr_t> word_dist;
+    auto n_founder = GENERATE(500u, 5000u, 50000u);
+    const uint32_t n_snp = 64;
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(n_founder);
+    const uintptr_t founder_ctv2 = QUATERCT_TO_ALIGNED_WORDCT(n_founder);
+    std::vector<uintptr_t> index(3 * founder_ctv2, 0);
+    std::vector<std::vector<uintptr_t>> geno(
+        n_snp, std::vector<uintptr_t>(founder_ctv2, 0));
+    std::vector<uintptr_t*> geno_ptr;
+    for (auto&& g : geno)
+    {
+        for (uintptr_t i = 0; i < founder_ctl2; ++i)
+        { g[i] = word_dist(mersenne_engine); }
+        geno_ptr.push_back(g.data());
+    }
+    for (auto&& i : index) i = word_dist(mersenne_engine) & FIVEMASK;
+    std::vector<uint32_t> counts(9 * n_snp);
+    const std::string suffix = " (" + std::to_string(n_founder) + " founders)";
+    BENCHMARK("pairwise" + suffix)
+    {
+        uint32_t* cur = counts.data();
+        for (auto&& g : geno_ptr)
+        {
+            for (uint32_t mask = 0; mask < 3; ++mask)
+            {
+                genovec_3freq(g, &(index[mask * founder_ctv2]), founder_ctl2,
+                              &cur[0], &cur[1], &cur[2]);
+                cur += 3;
+            }
+        }
+        return counts[0];
+    };
+    BENCHMARK("batched" + suffix)
+    {
+        genovec_3freq_batch(geno_ptr.data(), n_snp, index.data(), founder_ctv2,
+                            founder_ctl2, counts.data());
+        return counts[0];
+    };
+}
@@ -0,0 +1,106 @@
+#include "catch.hpp"
+#include "genotype_pool.hpp"
+#include <set>
+#include <thread>
+
+TEST_CASE("Genotype pool")
+{
+    const size_t num_snps = 4;
+    const size_t memory_per_snp = 3;
+    const size_t snp_words = GenotypePool::snp_size(memory_per_snp)
+                             / sizeof(uintptr_t);
+    REQUIRE(snp_words == CACHELINE_WORD);
+    SECTION("allocation")
+    {
+        GenotypePool pool(num_snps, memory_per_snp);
+        std::vector<uintptr_t*> genotypes;
+        std::set<uintptr_t*> unique;
+        // beyond the first slab
+        for (size_t i = 0; i < 3 * num_snps + 1; ++i)
+        {
+            genotypes.push_back(pool.alloc());
+            REQUIRE(reinterpret_cast<uintptr_t>(genotypes.back()) % CACHELINE
+                    == 0);
+            std::fill_n(genotypes.back(), snp_words, i);
+            unique.insert(genotypes.back());
+        }
+        REQUIRE(unique.size() == genotypes.size());
+        for (size_t i = 0; i < genotypes.size(); ++i)
+        {
+            REQUIRE(std::all_of(genotypes[i], genotypes[i] + snp_words,
+                                [i](uintptr_t v) { return v == i; }));
+        }
+        auto stat = pool.stat();
+        REQUIRE(stat.in_use == genotypes.size());
+        REQUIRE(stat.peak == genotypes.size());
+        REQUIRE(stat.num_slab == 4);
+        REQUIRE(stat.capacity == 4 * num_snps);
+        for (size_t i = 0; i < 5; ++i) { pool.free(genotypes[i]); }
+        stat = pool.stat();
+        REQUIRE(stat.in_use == genotypes.size() - 5);
+        REQUIRE(stat.peak == genotypes.size());
+        // freed storage is reused before reserving another slab
+        auto reused = pool.alloc();
+        REQUIRE(std::find(genotypes.begin(), genotypes.begin() + 5, reused)
+                != genotypes.begin() + 5);
+        REQUIRE(pool.stat().num_slab == 4);
+        REQUIRE_THROWS(pool.free(nullptr));
+        uintptr_t foreign[CACHELINE_WORD];
+        REQUIRE_THROWS(pool.free(foreign));
+        REQUIRE_THROWS(pool.free(genotypes.back() + 1));
+    }
+    SECTION("limited pool")
+    {
+        GenotypePool pool(num_snps, memory_per_snp, num_snps + 2, true);
+        std::vector<uintptr_t*> genotypes;
+        for (size_t i = 0; i < num_snps + 2; ++i)
+        { genotypes.push_back(pool.alloc()); }
+        REQUIRE(pool.stat().capacity == num_snps + 2);
+        REQUIRE_THROWS(pool.alloc());
+        pool.free(genotypes.front());
+        REQUIRE(pool.alloc() == genotypes.front());
+    }
+    SECTION("concurrent pool")
+    {
+        const size_t num_thread = 4;
+        const size_t per_thread = 100;
+        ConcurrentGenotypePool pool(num_snps, memory_per_snp);
+        std::vector<std::vector<uintptr_t*>> allocated(num_thread);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_thread; ++t)
+        {
+            threads.emplace_back([&pool, &allocated, t, per_thread]() {
+                ConcurrentGenotypePool::Cache cache(pool);
+                for (size_t i = 0; i < per_thread; ++i)
+                {
+                    allocated[t].push_back(cache.alloc());
+                    // every third genotype is returned straight away
+                    if (i % 3 == 0)
+                    {
+                        cache.free(allocated[t].back());
+                        allocated[t].pop_back();
+                    }
+                }
+            });
+        }
+        for (auto&& thread : threads) thread.join();
+        std::set<uintptr_t*> unique;
+        size_t total = 0;
+        for (auto&& genotypes : allocated)
+        {
+            total += genotypes.size();
+            unique.insert(genotypes.begin(), genotypes.end());
+        }
+        REQUIRE(unique.size() == total);
+        auto stat = pool.stat();
+        REQUIRE(stat.in_use == total);
+        REQUIRE(stat.peak >= total);
+        // genotypes can be released by any thread
+        ConcurrentGenotypePool::Cache cache(pool);
+        for (auto&& genotypes : allocated)
+        {
+            for (auto&& geno : genotypes) { cache.free(geno); }
+        }
+        REQUIRE(pool.in_use() == 0);
+    }
+}
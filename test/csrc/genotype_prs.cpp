@@ -1,5 +1,7 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "catch.hpp"
 #include "mock_genotype.hpp"
+#include <numeric>
 
 TEST_CASE("Prepare PRSice")
 {
@@ -206,7 +208,7 @@ TEST_CASE("Read_PRS")
     }
     std::vector<double> observed_prs(num_selected);
     std::vector<size_t> observed_num(num_selected);
-    std::vector<PRS> observed(num_selected, PRS());
+    PRS observed(num_selected);
     const bool not_first = true;
 
     geno.test_read_prs(genotype_data.data(), observed, ploidy, stat, adj_score,
@@ -214,8 +216,8 @@ TEST_CASE("Read_PRS")
                        homrar_weight, !not_first);
     for (size_t i = 0; i < num_selected; ++i)
     {
-        observed_prs[i] = observed[i].prs;
-        observed_num[i] = observed[i].num_snp;
+        observed_prs[i] = observed.score(i);
+        observed_num[i] = observed.num_snp(i);
     }
 
     REQUIRE_THAT(observed_prs, Catch::Equals<double>(expected_prs));
@@ -227,8 +229,8 @@ TEST_CASE("Read_PRS")
                            het_weight, homrar_weight, !not_first);
         for (size_t i = 0; i < num_selected; ++i)
         {
-            observed_prs[i] = observed[i].prs;
-            observed_num[i] = observed[i].num_snp;
+            observed_prs[i] = observed.score(i);
+            observed_num[i] = observed.num_snp(i);
         }
         REQUIRE_THAT(observed_prs, Catch::Equals<double>(expected_prs));
         REQUIRE_THAT(observed_num, Catch::Equals<size_t>(expected_num));
@@ -241,8 +243,8 @@ TEST_CASE("Read_PRS")
                            het_weight, homrar_weight, not_first);
         for (size_t i = 0; i < num_selected; ++i)
         {
-            observed_prs[i] = observed[i].prs;
-            observed_num[i] = observed[i].num_snp;
+            observed_prs[i] = observed.score(i);
+            observed_num[i] = observed.num_snp(i);
             expected_prs[i] = 2 * expected_prs[i];
             expected_num[i] = 2 * expected_num[i];
         }
@@ -250,3 +252,292 @@ TEST_CASE("Read_PRS")
         REQUIRE_THAT(observed_num, Catch::Equals<size_t>(expected_num));
     }
 }
+
+TEST_CASE("Read sparse PRS")
+{
+    Reporter reporter("log", 60, true);
+    mockGenotype geno;
+    geno.set_reporter(&reporter);
+    auto model = GENERATE(MODEL::ADDITIVE, MODEL::DOMINANT, MODEL::RECESSIVE,
+                          MODEL::HETEROZYGOUS);
+    geno.set_weight(model);
+    // use a sample size that doesn't fill up the last word
+    const size_t num_sample = 2011;
+    std::vector<bool> selected_sample(num_sample, true);
+    geno.set_sample_vector(selected_sample);
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<size_t> rare_dist {1, 50}, geno_dist {1, 3};
+    const uintptr_t sample_ctl = BITCT_TO_WORDCT(num_sample);
+    std::vector<uintptr_t> genotype_data(2 * sample_ctl, 0);
+    for (size_t i = 0; i < num_sample; ++i)
+    {
+        // mostly homcom, which is 11 in the packed genotype
+        const size_t g = (rare_dist(mersenne_engine) == 1)
+                             ? geno_dist(mersenne_engine)
+                             : 0;
+        if (g == 0 || g == 1) SET_BIT(2 * i + 1, genotype_data.data());
+        if (g == 0 || g == 2) SET_BIT(2 * i, genotype_data.data());
+    }
+    const size_t ploidy = 2;
+    const double stat = 0.3, miss_score = 0.15;
+    auto adj_score = GENERATE(0.0, 0.2);
+    auto miss_count = GENERATE(0ul, 2ul);
+    const double homcom_weight = 0, het_weight = 1, homrar_weight = 2;
+    auto not_first = GENERATE(true, false);
+    auto compensated = GENERATE(true, false);
+    PRS dense(num_sample, compensated), sparse(num_sample, compensated);
+    dense.add_all(1.0, 3);
+    sparse.add_all(1.0, 3);
+    geno.test_read_prs(genotype_data.data(), dense, ploidy, stat, adj_score,
+                       miss_score, miss_count, homcom_weight, het_weight,
+                       homrar_weight, not_first);
+    geno.test_read_sparse_prs(genotype_data.data(), sparse, ploidy, stat,
+                              adj_score, miss_score, miss_count, homcom_weight,
+                              het_weight, homrar_weight, not_first);
+    for (size_t i = 0; i < num_sample; ++i)
+    {
+        REQUIRE(sparse.score(i) == Approx(dense.score(i)));
+        REQUIRE(sparse.num_snp(i) == dense.num_snp(i));
+    }
+}
+
+TEST_CASE("PRS storage")
+{
+    const size_t num_sample = 101;
+    auto compensated = GENERATE(true, false);
+    PRS prs(num_sample, compensated);
+    REQUIRE(prs.size() == num_sample);
+    REQUIRE(reinterpret_cast<uintptr_t>(prs.score_data()) % 64 == 0);
+    REQUIRE(reinterpret_cast<uintptr_t>(prs.num_snp_data()) % 64 == 0);
+    prs.assign(3, 1.5, 2);
+    prs.add(3, 0.5, 2);
+    REQUIRE(prs.score(3) == Approx(2.0));
+    REQUIRE(prs.num_snp(3) == 4);
+    prs.reset();
+    REQUIRE(prs.score(3) == 0.0);
+    REQUIRE(prs.num_snp(3) == 0);
+    SECTION("compensated summation")
+    {
+        // 1 + 1e-16 * 10000 cannot be accumulated with naive summation
+        prs.assign(0, 1.0, 0);
+        for (size_t i = 0; i < 10000; ++i) { prs.add(0, 1e-16, 2); }
+        REQUIRE(prs.num_snp(0) == 20000);
+        if (compensated)
+        { REQUIRE(prs.score(0) - 1.0 == Approx(1e-12).epsilon(0.001)); }
+        else
+        {
+            REQUIRE(prs.score(0) == 1.0);
+        }
+    }
+}
+
+TEST_CASE("Batched score calculation")
+{
+    mockGenotype geno;
+    Reporter reporter("log", 60, true);
+    geno.set_reporter(&reporter);
+    auto scoring = GENERATE(SCORING::AVERAGE, SCORING::STANDARDIZE,
+                            SCORING::CONTROL_STD, SCORING::SUM);
+    CalculatePRS prs_info;
+    prs_info.scoring_method = scoring;
+    geno.set_prs_instruction(prs_info);
+    geno.set_score_stat(0.1, 2.0);
+    const size_t num_sample = 500;
+    PRS prs(num_sample);
+    std::vector<size_t> index;
+    for (size_t i = 0; i < num_sample; ++i)
+    {
+        // leave some samples with no SNP
+        if (i % 7 != 0) prs.assign(i, static_cast<double>(i) * 0.01, 2);
+        if (i % 3 != 0) index.push_back(i);
+    }
+    Eigen::VectorXd batched(static_cast<Eigen::Index>(index.size()));
+    geno.calculate_score(prs, index, batched);
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        REQUIRE(batched(static_cast<Eigen::Index>(i))
+                == Approx(geno.calculate_score(prs, index[i])));
+    }
+}
+
+TEST_CASE("Scoring kernel benchmark", "[.benchmark]")
+{
+    // hidden from the default test run, use ./tests [benchmark] to run it
+    Reporter reporter("log", 60, true);
+    mockGenotype geno;
+    geno.set_reporter(&reporter);
+    auto scoring = GENERATE(SCORING::AVERAGE, SCORING::STANDARDIZE,
+                            SCORING::SUM);
+    auto model = GENERATE(MODEL::ADDITIVE, MODEL::DOMINANT, MODEL::RECESSIVE,
+                          MODEL::HETEROZYGOUS);
+    auto missing = GENERATE(MISSING_SCORE::MEAN_IMPUTE,
+                            MISSING_SCORE::SET_ZERO, MISSING_SCORE::CENTER);
+    CalculatePRS prs_info;
+    prs_info.scoring_method = scoring;
+    prs_info.genetic_model = model;
+    prs_info.missing_score = missing;
+    geno.set_prs_instruction(prs_info);
+    geno.set_weight(model);
+    geno.set_score_stat(0.1, 2.0);
+    const size_t num_sample = 100000;
+    geno.set_sample_vector(num_sample);
+    std::mt19937 mersenne_engine {42};
+    std::uniform_int_distribution<uintptr_t> geno_dist;
+    std::vector<uintptr_t> genotype(2 * BITCT_TO_WORDCT(num_sample));
+    for (auto&& g : genotype) { g = geno_dist(mersenne_engine); }
+    const size_t miss_count =
+        (missing != MISSING_SCORE::SET_ZERO) ? 2ul : 0ul;
+    const double adj_score = (missing == MISSING_SCORE::CENTER) ? 0.1 : 0.0;
+    const double miss_score =
+        (missing == MISSING_SCORE::MEAN_IMPUTE) ? 0.1 : 0.0;
+    double homcom_weight = 0, het_weight = 1, homrar_weight = 2;
+    switch (model)
+    {
+    case MODEL::HETEROZYGOUS: homrar_weight = 0; break;
+    case MODEL::DOMINANT: homrar_weight = 1; break;
+    case MODEL::RECESSIVE:
+        het_weight = 0;
+        homrar_weight = 1;
+        break;
+    default: break;
+    }
+    auto compensated = GENERATE(false, true);
+    PRS prs(num_sample, compensated);
+    std::vector<size_t> index(num_sample);
+    std::iota(index.begin(), index.end(), 0);
+    std::vector<double> out(num_sample);
+    // the legacy benchmarks are the runtime dispatched path that the
+    // templated kernels replaced, so both can be compared for every
+    // configuration
+    BENCHMARK("legacy read_prs")
+    {
+        geno.legacy_read_prs(genotype.data(), prs, 2, 0.3, adj_score,
+                             miss_score, miss_count, homcom_weight, het_weight,
+                             homrar_weight, true);
+        return prs.score(0);
+    };
+    BENCHMARK("read_prs")
+    {
+        geno.test_read_prs(genotype.data(), prs, 2, 0.3, adj_score,
+                           miss_score, miss_count, homcom_weight, het_weight,
+                           homrar_weight, true);
+        return prs.score(0);
+    };
+    BENCHMARK("legacy calculate_score")
+    {
+        for (size_t i = 0; i < num_sample; ++i)
+        { out[i] = geno.legacy_calculate_score(prs, i); }
+        return out[0];
+    };
+    BENCHMARK("per-sample calculate_score")
+    {
+        for (size_t i = 0; i < num_sample; ++i)
+        { out[i] = geno.calculate_score(prs, i); }
+        return out[0];
+    };
+    BENCHMARK("batched calculate_score")
+    {
+        geno.calculate_score(prs, index, out);
+        return out[0];
+    };
+}
+
+TEST_CASE("Matrix score")
+{
+    Reporter reporter("log", 60, true);
+    mockGenotype geno;
+    geno.set_reporter(&reporter);
+    auto model = GENERATE(MODEL::ADDITIVE, MODEL::DOMINANT);
+    auto missing = GENERATE(MISSING_SCORE::MEAN_IMPUTE,
+                            MISSING_SCORE::SET_ZERO, MISSING_SCORE::CENTER);
+    CalculatePRS prs_info;
+    prs_info.scoring_method = SCORING::SUM;
+    prs_info.genetic_model = model;
+    prs_info.missing_score = missing;
+    geno.set_prs_instruction(prs_info);
+    geno.set_weight(model);
+    const size_t num_sample = 1037, num_snp = 300;
+    const Eigen::Index num_weight = 3;
+    geno.set_sample_vector(num_sample);
+    std::mt19937 mersenne_engine {std::random_device {}()};
+    std::uniform_int_distribution<uintptr_t> geno_dist;
+    const uintptr_t sample_ctv2 = 2 * BITCT_TO_WORDCT(num_sample);
+    std::vector<uintptr_t> genotype(num_snp * sample_ctv2);
+    for (auto&& g : genotype) { g = geno_dist(mersenne_engine); }
+    std::vector<size_t> snp_index;
+    std::vector<bool> flipped;
+    for (size_t i = 0; i < num_snp; ++i)
+    {
+        SNP snp("rs" + std::to_string(i), 1, i, "A", "C", 0, 1, 0, 1);
+        // the counts don't have to match the genotype
+        snp.set_counts(static_cast<uint32_t>(i % 50 + 10), 20,
+                       static_cast<uint32_t>(i % 7 + 1), 3, false);
+        snp.set_genotype_storage(&genotype[i * sample_ctv2]);
+        geno.load_snp(snp);
+        snp_index.push_back(i);
+        flipped.push_back(i % 3 == 0);
+    }
+    Eigen::MatrixXd weights = Eigen::MatrixXd::Random(
+        static_cast<Eigen::Index>(num_snp), num_weight);
+    Eigen::MatrixXd scores;
+    std::vector<uint32_t> num_included;
+    geno.matrix_score(snp_index, flipped, weights, scores, num_included);
+    REQUIRE(scores.rows() == static_cast<Eigen::Index>(num_sample));
+    REQUIRE(scores.cols() == num_weight);
+    // compare against read_prs
+    double homcom_weight = 0, het_weight = 1, homrar_weight = 2;
+    if (model == MODEL::DOMINANT) homrar_weight = 1;
+    const size_t miss_count = (missing != MISSING_SCORE::SET_ZERO) ? 2 : 0;
+    auto&& snps = geno.modify_existed_snps();
+    for (Eigen::Index k = 0; k < num_weight; ++k)
+    {
+        PRS expected(num_sample);
+        for (size_t i = 0; i < num_snp; ++i)
+        {
+            uint32_t homcom_ct, het_ct, homrar_ct, missing_ct;
+            snps[i].get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                               false);
+            double homcom = homcom_weight, het = het_weight,
+                   homrar = homrar_weight;
+            if (flipped[i]) std::swap(homcom, homrar);
+            const double maf =
+                1.0
+                - (homcom * homcom_ct + het * het_ct + homrar * homrar_ct)
+                      / (static_cast<double>(homcom_ct + het_ct + homrar_ct)
+                         * 2);
+            const double stat = weights(static_cast<Eigen::Index>(i), k);
+            const double adj =
+                (missing == MISSING_SCORE::CENTER) ? 2 * stat * maf : 0;
+            const double miss_score =
+                (missing == MISSING_SCORE::MEAN_IMPUTE) ? 2 * stat * maf : 0;
+            geno.test_read_prs(&genotype[i * sample_ctv2], expected, 2, stat,
+                               adj, miss_score, miss_count, homcom, het,
+                               homrar, i != 0);
+        }
+        for (size_t s = 0; s < num_sample; ++s)
+        {
+            REQUIRE(scores(static_cast<Eigen::Index>(s), k)
+                    == Approx(expected.score(s)).margin(1e-9));
+            REQUIRE(num_included[s] == expected.num_snp(s));
+        }
+    }
+    SECTION("load weight matrix")
+    {
+        std::unique_ptr<std::istream> input =
+            std::make_unique<std::istringstream>(
+                "SNP A1 W1 W2\nrs1 A 0.1 0.2\nrs2 c 0.3 0.4\nrs3 G 1 1\n"
+                "rs_missing A 1 1\n");
+        std::vector<size_t> idx;
+        std::vector<bool> flip;
+        Eigen::MatrixXd loaded;
+        auto names =
+            geno.load_weight_matrix(std::move(input), idx, flip, loaded);
+        REQUIRE_THAT(names, Catch::Equals<std::string>({"W1", "W2"}));
+        REQUIRE_THAT(idx, Catch::Equals<size_t>({1, 2}));
+        REQUIRE(flip == std::vector<bool>({false, true}));
+        REQUIRE(loaded.rows() == 2);
+        REQUIRE(loaded(0, 1) == Approx(0.2));
+        REQUIRE(loaded(1, 0) == Approx(0.3));
+    }
+}
@@ -150,3 +150,71 @@ TEST_CASE("split")
         REQUIRE_THAT(alt, Catch::Equals<std::string>({"", "front", "empty"}));*/
     }
 }
+
+TEST_CASE("Generalized Pareto tail p-value")
+{
+    // the tail of an exponential distribution is exactly generalized Pareto
+    // (k = 0), with P(X > x) = exp(-x)
+    const size_t num_perm = 10000;
+    std::mt19937 rand_gen(1234);
+    std::exponential_distribution<double> exponential(1.0);
+    std::vector<double> null_stat(num_perm);
+    for (auto&& stat : null_stat) stat = exponential(rand_gen);
+    double p_value = -1, fit_p = -1;
+    SECTION("approximate the tail")
+    {
+        // extrapolation has a large variance, so check the median of
+        // replicates
+        const size_t num_rep = 21;
+        std::vector<double> beyond, within;
+        for (size_t rep = 0; rep < num_rep; ++rep)
+        {
+            for (auto&& stat : null_stat) stat = exponential(rand_gen);
+            // beyond the largest permuted statistic
+            REQUIRE(misc::gpd_tail_pvalue(null_stat, num_perm,
+                                          -std::log(1e-5), 42, p_value,
+                                          fit_p));
+            REQUIRE(fit_p > 0.05);
+            REQUIRE(fit_p <= 1.0);
+            beyond.push_back(p_value);
+            REQUIRE(misc::gpd_tail_pvalue(null_stat, num_perm,
+                                          -std::log(1e-3), 42, p_value,
+                                          fit_p));
+            within.push_back(p_value);
+        }
+        std::sort(beyond.begin(), beyond.end());
+        std::sort(within.begin(), within.end());
+        REQUIRE(beyond[num_rep / 2] > 1e-5 / 3);
+        REQUIRE(beyond[num_rep / 2] < 1e-5 * 3);
+        REQUIRE(within[num_rep / 2] == Approx(1e-3).epsilon(0.2));
+    }
+    SECTION("same seed, same answer")
+    {
+        double p_rep, fit_rep;
+        REQUIRE(misc::gpd_tail_pvalue(null_stat, num_perm, 12.0, 42, p_value,
+                                      fit_p));
+        REQUIRE(misc::gpd_tail_pvalue(null_stat, num_perm, 12.0, 42, p_rep,
+                                      fit_rep));
+        REQUIRE(p_value == p_rep);
+        REQUIRE(fit_p == fit_rep);
+    }
+    SECTION("observed statistic not in the tail")
+    {
+        REQUIRE_FALSE(misc::gpd_tail_pvalue(null_stat, num_perm, 0.5, 42,
+                                            p_value, fit_p));
+    }
+    SECTION("too few permutations")
+    {
+        null_stat.resize(100);
+        REQUIRE_FALSE(misc::gpd_tail_pvalue(null_stat, 100, 12.0, 42, p_value,
+                                            fit_p));
+    }
+    SECTION("bounded tail")
+    {
+        // uniform distribution has a finite upper bound (k = 1)
+        std::uniform_real_distribution<double> unif(0.0, 1.0);
+        for (auto&& stat : null_stat) stat = unif(rand_gen);
+        REQUIRE_FALSE(misc::gpd_tail_pvalue(null_stat, num_perm, 2.0, 42,
+                                            p_value, fit_p));
+    }
+}
@@ -1,5 +1,7 @@
 #include "catch.hpp"
+#include "mock_genotype.hpp"
 #include "mock_prsice.hpp"
+#include "pool_guard.hpp"
 #include "prsice.hpp"
 #include "storage.hpp"
 
@@ -57,3 +59,488 @@ TEST_CASE("Initialize progress bar")
     REQUIRE(ad == 0);
     REQUIRE(cd == 0);
 }
+
+TEST_CASE("Residualized linear regression")
+{
+    const Eigen::Index n = 200;
+    std::mt19937 rand_gen {std::random_device {}()};
+    std::normal_distribution<double> norm;
+    auto random_vector = [&]() {
+        Eigen::VectorXd v(n);
+        for (Eigen::Index i = 0; i < n; ++i) { v(i) = norm(rand_gen); }
+        return v;
+    };
+    // design matrix of intercept, PRS and covariates
+    auto num_cov = GENERATE(0, 1, 3);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, num_cov + 2);
+    for (Eigen::Index i = 0; i < num_cov; ++i) x.col(i + 2) = random_vector();
+    const bool rank_deficient = GENERATE(false, true);
+    if (rank_deficient && num_cov > 1)
+    { x.col(num_cov + 1) = (2 * x.col(2)).array() + 1; }
+    const Eigen::VectorXd y = random_vector() + 0.3 * x.rightCols(num_cov)
+                                                        .rowwise()
+                                                        .sum();
+    Eigen::MatrixXd covariates(n, num_cov + 1);
+    covariates.col(0) = x.col(0);
+    covariates.rightCols(num_cov) = x.rightCols(num_cov);
+    Regression::ResidualLm residual_lm(y, covariates);
+    double p, r2, r2_adjust, coeff, se;
+    double exp_p, exp_r2, exp_r2_adjust, exp_coeff, exp_se;
+    for (size_t i = 0; i < 5; ++i)
+    {
+        x.col(1) = random_vector() + 0.5 * y;
+        REQUIRE(residual_lm.fit(x.col(1), p, r2, r2_adjust, coeff, se));
+        Regression::fastLm(y, x, exp_p, exp_r2, exp_r2_adjust, exp_coeff,
+                           exp_se, true);
+        REQUIRE(coeff == Approx(exp_coeff));
+        REQUIRE(se == Approx(exp_se));
+        REQUIRE(r2 == Approx(exp_r2));
+        REQUIRE(r2_adjust == Approx(exp_r2_adjust));
+        REQUIRE(p == Approx(exp_p).margin(1e-300));
+    }
+    // PRS within the covariate space should be left to the QR
+    x.col(1) = x.rightCols(num_cov).rowwise().sum();
+    x.col(1).array() += 3;
+    REQUIRE_FALSE(residual_lm.fit(x.col(1), p, r2, r2_adjust, coeff, se));
+}
+
+TEST_CASE("Batched permutation linear regression")
+{
+    const Eigen::Index n = 200;
+    const Eigen::Index num_perm = 20;
+    std::mt19937 rand_gen {std::random_device {}()};
+    std::normal_distribution<double> norm;
+    auto random_vector = [&]() {
+        Eigen::VectorXd v(n);
+        for (Eigen::Index i = 0; i < n; ++i) { v(i) = norm(rand_gen); }
+        return v;
+    };
+    auto num_cov = GENERATE(0, 1, 3);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, num_cov + 2);
+    for (Eigen::Index i = 0; i < num_cov; ++i) x.col(i + 2) = random_vector();
+    const bool rank_deficient = GENERATE(false, true);
+    if (rank_deficient && num_cov > 1)
+    { x.col(num_cov + 1) = (2 * x.col(2)).array() + 1; }
+    const Eigen::VectorXd y = random_vector() + 0.3 * x.rightCols(num_cov)
+                                                        .rowwise()
+                                                        .sum();
+    Eigen::MatrixXd perm_y(n, num_perm);
+    for (Eigen::Index i = 0; i < num_perm; ++i)
+    {
+        perm_y.col(i) = y;
+        std::shuffle(perm_y.col(i).data(), perm_y.col(i).data() + n,
+                     rand_gen);
+    }
+    Eigen::MatrixXd covariates(n, num_cov + 1);
+    covariates.col(0) = x.col(0);
+    covariates.rightCols(num_cov) = x.rightCols(num_cov);
+    Regression::PermutedLm perm_lm(covariates);
+    perm_lm.load(perm_y);
+    REQUIRE(perm_lm.size() == num_perm);
+    Eigen::VectorXd t_value;
+    double p, r2, r2_adjust, coeff, se;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        x.col(1) = random_vector() + 0.5 * y;
+        REQUIRE(perm_lm.abs_t(x.col(1), t_value));
+        REQUIRE(t_value.rows() == num_perm);
+        for (Eigen::Index j = 0; j < num_perm; ++j)
+        {
+            Regression::fastLm(perm_y.col(j), x, p, r2, r2_adjust, coeff, se,
+                               true);
+            REQUIRE(t_value(j) == Approx(std::fabs(coeff / se)));
+        }
+    }
+    x.col(1) = x.rightCols(num_cov).rowwise().sum();
+    x.col(1).array() += 3;
+    REQUIRE_FALSE(perm_lm.abs_t(x.col(1), t_value));
+}
+
+TEST_CASE("Warm started logistic regression")
+{
+    const Eigen::Index n = 300;
+    // fixed seed so that the tolerances below are reproducible
+    std::mt19937 rand_gen {20191022};
+    std::normal_distribution<double> norm;
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    auto random_vector = [&]() {
+        Eigen::VectorXd v(n);
+        for (Eigen::Index i = 0; i < n; ++i) { v(i) = norm(rand_gen); }
+        return v;
+    };
+    auto num_cov = GENERATE(0, 2);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, num_cov + 2);
+    for (Eigen::Index i = 0; i < num_cov; ++i) x.col(i + 2) = random_vector();
+    const Eigen::VectorXd liability = random_vector();
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        double eta = 0.8 * liability(i);
+        for (Eigen::Index j = 0; j < num_cov; ++j) eta += 0.3 * x(i, j + 2);
+        y(i) = unif(rand_gen) < 1.0 / (1.0 + std::exp(-eta)) ? 1 : 0;
+    }
+    Regression::WarmGlm warm_glm(y, x);
+    double p, r2, coeff, se;
+    double exp_p, exp_r2, exp_coeff, exp_se;
+    if (num_cov > 0)
+    {
+        warm_glm.null_stat(p, r2, coeff, se);
+        Regression::glm(y, x.rightCols(num_cov + 1), exp_p, exp_r2, exp_coeff,
+                        exp_se);
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-6));
+        REQUIRE(se == Approx(exp_se).epsilon(1e-6));
+        REQUIRE(r2 == Approx(exp_r2).epsilon(1e-6));
+    }
+    else
+    {
+        REQUIRE_THROWS(warm_glm.null_stat(p, r2, coeff, se));
+    }
+    // mimic the cumulative PRS, where each threshold adds a little noise
+    Eigen::VectorXd prs = liability + random_vector();
+    for (size_t i = 0; i < 5; ++i)
+    {
+        prs += 0.05 * random_vector();
+        x.col(1) = prs;
+        warm_glm.fit(x.col(1), p, r2, coeff, se);
+        if (i != 0) { REQUIRE(warm_glm.iterations() <= 2); }
+        Regression::glm(y, x, exp_p, exp_r2, exp_coeff, exp_se);
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-6));
+        REQUIRE(r2 == Approx(exp_r2).epsilon(1e-6));
+        // glm derives the standard error from the weights of its last
+        // iteration, so compare against the reference evaluated at the
+        // fitted coefficients instead
+        GLM<Binomial> reference(x, y, Binomial());
+        reference.init_parms();
+        reference.solve();
+        reference.update_se();
+        REQUIRE(se == Approx(reference.get_se()(1)).epsilon(1e-6));
+        REQUIRE(p == Approx(exp_p).epsilon(1e-3).margin(1e-300));
+    }
+    // unrelated PRS still converges to the same model
+    x.col(1) = random_vector();
+    warm_glm.fit(x.col(1), p, r2, coeff, se);
+    Regression::glm(y, x, exp_p, exp_r2, exp_coeff, exp_se);
+    REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-6).margin(1e-8));
+    REQUIRE(r2 == Approx(exp_r2).epsilon(1e-6).margin(1e-8));
+}
+
+TEST_CASE("Score test of logistic regression")
+{
+    const Eigen::Index n = 500;
+    std::mt19937 rand_gen {std::random_device {}()};
+    std::normal_distribution<double> norm;
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    auto random_vector = [&]() {
+        Eigen::VectorXd v(n);
+        for (Eigen::Index i = 0; i < n; ++i) { v(i) = norm(rand_gen); }
+        return v;
+    };
+    auto num_cov = GENERATE(0, 2);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, num_cov + 2);
+    for (Eigen::Index i = 0; i < num_cov; ++i) x.col(i + 2) = random_vector();
+    const Eigen::VectorXd liability = random_vector();
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        double eta = 0.2 * liability(i);
+        for (Eigen::Index j = 0; j < num_cov; ++j) eta += 0.3 * x(i, j + 2);
+        y(i) = unif(rand_gen) < 1.0 / (1.0 + std::exp(-eta)) ? 1 : 0;
+    }
+    Regression::WarmGlm warm_glm(y, x);
+    Eigen::MatrixXd null_x(n, num_cov + 1);
+    null_x.col(0) = x.col(0);
+    null_x.rightCols(num_cov) = x.rightCols(num_cov);
+    Binomial family;
+    GLM<Binomial> null_glm(null_x, y, family);
+    null_glm.init_parms();
+    null_glm.solve();
+    const Eigen::VectorXd mu = family.linkinv(null_x * null_glm.get_beta());
+    const Eigen::VectorXd w = family.variance(mu);
+    const Eigen::MatrixXd info_null =
+        null_x.transpose() * w.asDiagonal() * null_x;
+    double p, r2, coeff, se;
+    double exp_p, exp_r2, exp_coeff, exp_se;
+    std::vector<double> score_r2, glm_r2;
+    for (size_t i = 0; i < 5; ++i)
+    {
+        x.col(1) = liability + (1.0 + i) * random_vector();
+        REQUIRE(warm_glm.score(x.col(1), p, r2, coeff, se));
+        // textbook efficient score statistic
+        const Eigen::VectorXd cross =
+            null_x.transpose() * w.asDiagonal() * x.col(1);
+        const double info =
+            x.col(1).dot(w.asDiagonal() * x.col(1))
+            - cross.dot(info_null.ldlt().solve(cross));
+        const double u = x.col(1).dot(y - mu);
+        REQUIRE(se == Approx(1.0 / std::sqrt(info)).epsilon(1e-6));
+        REQUIRE(coeff == Approx(u / info).epsilon(1e-4).margin(1e-8));
+        REQUIRE(p == Approx(chiprob_p(u * u / info, 1)).epsilon(1e-4));
+        // close to the logistic regression under a small effect
+        Regression::glm(y, x, exp_p, exp_r2, exp_coeff, exp_se);
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(0.1).margin(0.01));
+        REQUIRE(r2 == Approx(exp_r2).epsilon(0.1).margin(1e-3));
+        score_r2.push_back(r2);
+        glm_r2.push_back(exp_r2);
+    }
+    // thresholds are ranked the same way as the full regression
+    REQUIRE(std::max_element(score_r2.begin(), score_r2.end())
+                - score_r2.begin()
+            == std::max_element(glm_r2.begin(), glm_r2.end())
+                   - glm_r2.begin());
+    // PRS within the covariate space has to be fitted
+    Eigen::VectorXd in_span = 2.0 * x.col(0);
+    for (Eigen::Index i = 0; i < num_cov; ++i) in_span += x.col(i + 2);
+    x.col(1) = in_span;
+    REQUIRE_FALSE(warm_glm.score(x.col(1), p, r2, coeff, se));
+}
+
+TEST_CASE("Batched permutation logistic regression")
+{
+    const Eigen::Index n = 300;
+    const Eigen::Index num_perm = 20;
+    std::mt19937 rand_gen {std::random_device {}()};
+    std::normal_distribution<double> norm;
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    auto random_vector = [&]() {
+        Eigen::VectorXd v(n);
+        for (Eigen::Index i = 0; i < n; ++i) { v(i) = norm(rand_gen); }
+        return v;
+    };
+    auto num_cov = GENERATE(0, 2);
+    // the columns are fitted by the thread pool
+    auto thread = GENERATE(0, 3);
+    PoolGuard pool(static_cast<size_t>(thread));
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, num_cov + 2);
+    for (Eigen::Index i = 0; i < num_cov; ++i) x.col(i + 2) = random_vector();
+    const Eigen::VectorXd liability = random_vector();
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        double eta = 0.8 * liability(i);
+        for (Eigen::Index j = 0; j < num_cov; ++j) eta += 0.3 * x(i, j + 2);
+        y(i) = unif(rand_gen) < 1.0 / (1.0 + std::exp(-eta)) ? 1 : 0;
+    }
+    // keep the observed phenotype as the first column, such that at least
+    // one column has to be refitted
+    Eigen::MatrixXd perm_y(n, num_perm);
+    for (Eigen::Index i = 0; i < num_perm; ++i)
+    {
+        perm_y.col(i) = y;
+        if (i == 0) continue;
+        std::shuffle(perm_y.col(i).data(), perm_y.col(i).data() + n,
+                     rand_gen);
+    }
+    Eigen::MatrixXd covariates(n, num_cov + 1);
+    covariates.col(0) = x.col(0);
+    covariates.rightCols(num_cov) = x.rightCols(num_cov);
+    Regression::PermutedGlm perm_glm(covariates);
+    perm_glm.load(perm_y);
+    REQUIRE(perm_glm.size() == num_perm);
+    x.col(1) = liability + 0.5 * random_vector();
+    Eigen::VectorXd t_value;
+    REQUIRE(perm_glm.abs_t(x.col(1), t_value));
+    REQUIRE(t_value.rows() == num_perm);
+    REQUIRE(perm_glm.refitted() >= 1);
+    double p, r2, coeff, se;
+    for (Eigen::Index j = 0; j < num_perm; ++j)
+    {
+        // every statistic is within one_step_tol of the one of glm, whether
+        // or not it was refitted
+        Regression::glm(perm_y.col(j), x, p, r2, coeff, se);
+        const double expected = std::fabs(coeff / se);
+        REQUIRE(t_value(j)
+                == Approx(expected).epsilon(1e-4).margin(
+                    Regression::one_step_tol));
+        // the one step fit uses the same convergence check
+        Regression::WarmGlm warm_glm(perm_y.col(j), x);
+        warm_glm.one_step_fit(x.col(1), p, r2, coeff, se);
+        REQUIRE(std::fabs(coeff / se)
+                == Approx(expected).epsilon(1e-4).margin(
+                    Regression::one_step_tol));
+        REQUIRE(p == Approx(chiprob_p(coeff * coeff / (se * se), 1)));
+    }
+    // most permutations of the observed phenotype are accepted after the
+    // second step
+    REQUIRE(perm_glm.refitted() < static_cast<size_t>(num_perm) / 2);
+    // a PRS without any association with the second column converges
+    // straight away, so the statistic of that column is 0
+    GLM<Binomial> null_glm(covariates, perm_y.col(1), Binomial());
+    null_glm.init_parms();
+    null_glm.solve();
+    const Eigen::VectorXd null_resid =
+        perm_y.col(1) - Binomial().linkinv(covariates * null_glm.get_beta());
+    x.col(1) -= x.col(1).dot(null_resid) / null_resid.squaredNorm()
+                * null_resid;
+    REQUIRE(perm_glm.abs_t(x.col(1), t_value));
+    REQUIRE(t_value(1) == Approx(0).margin(1e-6));
+    REQUIRE(perm_glm.refitted() < static_cast<size_t>(num_perm));
+    // PRS within the covariate space has to be fitted
+    Eigen::VectorXd in_span = 2.0 * x.col(0);
+    for (Eigen::Index i = 0; i < num_cov; ++i) in_span += x.col(i + 2);
+    REQUIRE_FALSE(perm_glm.abs_t(in_span, t_value));
+}
+
+TEST_CASE("Counter based permutation")
+{
+    SECTION("known answer")
+    {
+        // Philox4x32-10 test vector of Random123 (zero counter and key)
+        Philox rand_gen(0, 0);
+        REQUIRE(rand_gen() == 0x6627e8d5u);
+        REQUIRE(rand_gen() == 0xe169c58du);
+        REQUIRE(rand_gen() == 0xbc57ac4cu);
+        REQUIRE(rand_gen() == 0x9b00dbd8u);
+    }
+    SECTION("streams are independent of the generation order")
+    {
+        const uint32_t seed = std::random_device {}();
+        std::vector<std::vector<uint32_t>> forward(10), backward(10);
+        for (size_t i = 0; i < 10; ++i)
+        {
+            Philox rand_gen(seed, i);
+            for (size_t j = 0; j < 9; ++j) forward[i].push_back(rand_gen());
+        }
+        for (size_t i = 10; i-- > 0;)
+        {
+            Philox rand_gen(seed, i);
+            for (size_t j = 0; j < 9; ++j) backward[i].push_back(rand_gen());
+        }
+        REQUIRE(forward == backward);
+        REQUIRE(forward[0] != forward[1]);
+        Philox other_seed(seed + 1, 0);
+        REQUIRE(other_seed() != forward[0][0]);
+    }
+    SECTION("background is restored after sampling")
+    {
+        Reporter reporter("log", 60, true);
+        mock_prsice prsice(false, &reporter);
+        std::vector<size_t> background(100);
+        std::iota(background.begin(), background.end(), 0);
+        const auto original = background;
+        std::vector<size_t> swapped;
+        std::vector<size_t> first_sample;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            Philox rand_gen(42, 7);
+            prsice.test_fisher_yates(background, rand_gen, 20, swapped);
+            REQUIRE(swapped.size() == 20);
+            std::vector<size_t> sample(background.begin(),
+                                       background.begin() + 20);
+            if (i == 0) first_sample = sample;
+            // same permutation index gives the same sample
+            REQUIRE(sample == first_sample);
+            std::sort(sample.begin(), sample.end());
+            REQUIRE(std::unique(sample.begin(), sample.end()) == sample.end());
+            prsice.test_undo_fisher_yates(background, swapped);
+            REQUIRE(background == original);
+        }
+    }
+}
+
+// genotype whose null score of a SNP is a fixed random value for each sample
+class null_score_genotype : public mockGenotype
+{
+public:
+    null_score_genotype(const size_t num_sample, const size_t num_snp,
+                        std::mt19937& rand_gen)
+    {
+        std::normal_distribution<double> norm;
+        for (size_t i = 0; i < num_sample; ++i) add_sample(Sample_ID());
+        for (size_t i = 0; i < num_snp; ++i)
+        {
+            load_snp("SNP" + std::to_string(i));
+            m_score.emplace_back();
+            for (size_t j = 0; j < num_sample; ++j)
+                m_score.back().push_back(norm(rand_gen));
+        }
+        m_prs_info = new_prs_storage();
+    }
+    void read_score(PRS& prs_list,
+                    const std::vector<size_t>::const_iterator& start,
+                    const std::vector<size_t>::const_iterator& end,
+                    bool reset_zero) override
+    {
+        if (reset_zero) prs_list.reset();
+        for (auto it = start; it != end; ++it)
+        {
+            for (size_t i = 0; i < prs_list.size(); ++i)
+                prs_list.add(i, m_score[*it][i], 1);
+        }
+    }
+
+private:
+    std::vector<std::vector<double>> m_score;
+};
+
+TEST_CASE("Adaptive competitive permutation")
+{
+    const size_t num_sample = 60;
+    const size_t num_snp = 40;
+    const size_t num_perm = 200;
+    const size_t hit_limit = 5;
+    std::mt19937 rand_gen {1234};
+    null_score_genotype target(num_sample, num_snp, rand_gen);
+    std::vector<size_t> background(num_snp);
+    std::iota(background.begin(), background.end(), 0);
+    std::normal_distribution<double> norm;
+    Eigen::VectorXd phenotype(num_sample);
+    for (size_t i = 0; i < num_sample; ++i)
+    { phenotype(static_cast<Eigen::Index>(i)) = norm(rand_gen); }
+    const Eigen::MatrixXd independent =
+        Eigen::MatrixXd::Ones(static_cast<Eigen::Index>(num_sample), 2);
+    auto run = [&](const size_t perm_ct, const size_t hit, const int thread) {
+        PoolGuard pool(static_cast<size_t>(thread));
+        CalculatePRS prs_info;
+        prs_info.thread = thread;
+        Permutations perm;
+        perm.num_permutation = perm_ct;
+        perm.seed = 42;
+        perm.adaptive_hit = hit;
+        perm.run_set_perm = true;
+        Reporter reporter("log", 60, true);
+        mock_prsice prsice(prs_info, PThresholding(), perm, "PRSice", false,
+                           &reporter);
+        prsice.set_regression(phenotype, independent);
+        // most null PRS exceed the weak set, none exceed the strong set. The
+        // weak set is the largest, so the draws of the strong set have to be
+        // the same once the weak set is stopped
+        prsice.add_set("Weak", 10, 0.5);
+        prsice.add_set("Strong", 5, 100);
+        prsice.run_competitive(target, background.cbegin(),
+                               background.cend());
+        // the progress ends at 100% even when the sets are stopped early
+        REQUIRE(std::get<1>(prsice.get_current_progress())
+                == std::get<1>(prsice.get_progress()));
+        return prsice.competitive_p();
+    };
+    const auto adaptive = run(num_perm, hit_limit, 1);
+    const auto full = run(num_perm, 0, 1);
+    REQUIRE(adaptive.size() == 2);
+    SECTION("stopped after the required exceedances")
+    {
+        // p = h / L, where L is the permutation of the h-th exceedance
+        const double hit = static_cast<double>(hit_limit);
+        const size_t stop =
+            static_cast<size_t>(std::lround(hit / adaptive[0]));
+        REQUIRE(stop >= hit_limit);
+        REQUIRE(stop < num_perm);
+        REQUIRE(adaptive[0] == Approx(hit / static_cast<double>(stop)));
+        // without early stopping, the first stop - 1 permutations only
+        // contain h - 1 exceedances, and the first stop contain h
+        REQUIRE(run(stop - 1, 0, 1)[0]
+                == Approx(hit / static_cast<double>(stop)));
+        REQUIRE(run(stop, 0, 1)[0]
+                == Approx((hit + 1.0) / static_cast<double>(stop + 1)));
+    }
+    SECTION("sets with fewer exceedances keep the full estimate")
+    {
+        REQUIRE(adaptive[1] == Approx(full[1]));
+        REQUIRE(adaptive[1]
+                == Approx(1.0 / static_cast<double>(num_perm + 1)));
+    }
+    SECTION("independent of the number of threads")
+    {
+        REQUIRE(run(num_perm, hit_limit, 3) == adaptive);
+        REQUIRE(run(num_perm, 0, 3) == full);
+    }
+}
@@ -0,0 +1,106 @@
+#include "catch.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Thread pool")
+{
+    const size_t num_worker = GENERATE(0, 1, 4);
+    ThreadPool pool(num_worker);
+    REQUIRE(pool.size() == num_worker);
+    REQUIRE_FALSE(ThreadPool::in_task());
+    SECTION("parallel for")
+    {
+        const size_t num_job = 1003;
+        std::vector<std::atomic<size_t>> visited(num_job);
+        for (auto&& v : visited) v = 0;
+        const size_t num_chunk = GENERATE(0, 1, 7, 5000);
+        pool.parallel_for(
+            0, num_job,
+            [&visited](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) ++visited[i];
+            },
+            num_chunk);
+        for (auto&& v : visited) REQUIRE(v == 1);
+        // empty range
+        pool.parallel_for(5, 5, [](size_t, size_t) { FAIL(); });
+    }
+    SECTION("nested parallel for runs inline")
+    {
+        std::atomic<size_t> num_moved {0}, total {0};
+        pool.parallel_for(0, 8, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const auto outer = std::this_thread::get_id();
+                pool.parallel_for(0, 100, [&](size_t b, size_t e) {
+                    if (std::this_thread::get_id() != outer) ++num_moved;
+                    total += e - b;
+                });
+            }
+        });
+        REQUIRE(num_moved == 0);
+        REQUIRE(total == 800);
+    }
+    SECTION("nested wait does not deadlock")
+    {
+        std::atomic<size_t> total {0};
+        ThreadPool::TaskGroup outer(pool);
+        for (size_t i = 0; i < 4; ++i)
+        {
+            outer.run([&]() {
+                // more tasks than workers, each waiting on its children
+                ThreadPool::TaskGroup inner(pool);
+                for (size_t j = 0; j < 10; ++j) inner.run([&]() { ++total; });
+                inner.wait();
+            });
+        }
+        outer.wait();
+        REQUIRE(total == 40);
+    }
+    SECTION("exception")
+    {
+        ThreadPool::TaskGroup group(pool);
+        std::atomic<size_t> total {0};
+        for (size_t i = 0; i < 10; ++i)
+        {
+            group.run([&, i]() {
+                if (i == 3) throw std::runtime_error("Error: Task failed");
+                ++total;
+            });
+        }
+        REQUIRE_THROWS_WITH(group.wait(), "Error: Task failed");
+        // other tasks are unaffected
+        REQUIRE(total == 9);
+        // the error is only reported once
+        group.wait();
+    }
+}
+
+TEST_CASE("Work stealing")
+{
+    ThreadPool pool(4);
+    std::mutex mutex;
+    std::set<std::thread::id> used;
+    ThreadPool::TaskGroup outer(pool);
+    outer.run([&]() {
+        // all tasks go to the deque of this worker, so the others have to
+        // steal them
+        ThreadPool::TaskGroup inner(pool);
+        for (size_t i = 0; i < 16; ++i)
+        {
+            inner.run([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                std::lock_guard<std::mutex> lock(mutex);
+                used.insert(std::this_thread::get_id());
+            });
+        }
+        inner.wait();
+    });
+    outer.wait();
+    REQUIRE(used.size() > 1);
+}
@@ -0,0 +1,226 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch.hpp"
+#include "thread_queue.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Thread queue")
+{
+    SECTION("items pushed before completion are drained")
+    {
+        Thread_Queue<size_t> queue(8);
+        REQUIRE(queue.capacity() == 8);
+        for (size_t i = 0; i < 5; ++i) queue.emplace(size_t(i));
+        queue.completed();
+        size_t item = 0, expected = 0;
+        while (!queue.pop(item))
+        {
+            REQUIRE(item == expected);
+            ++expected;
+        }
+        REQUIRE(expected == 5);
+        // stay completed
+        REQUIRE(queue.pop(item));
+    }
+    SECTION("capacity is rounded to a power of two")
+    {
+        Thread_Queue<size_t> queue(100);
+        REQUIRE(queue.capacity() == 128);
+    }
+    SECTION("batched push and pop")
+    {
+        Thread_Queue<std::string> queue(16);
+        std::vector<std::string> input {"a", "b", "c", "d", "e"};
+        queue.push_batch(input.begin(), input.end());
+        REQUIRE(queue.num_processing() == 5);
+        std::vector<std::string> output;
+        REQUIRE_FALSE(queue.pop_batch(output, 3));
+        REQUIRE(output == std::vector<std::string> {"a", "b", "c"});
+        queue.completed();
+        REQUIRE_FALSE(queue.pop_batch(output, 10));
+        REQUIRE(output == std::vector<std::string> {"d", "e"});
+        REQUIRE(queue.pop_batch(output, 10));
+        REQUIRE(output.empty());
+    }
+    SECTION("multiple producers and consumers")
+    {
+        const size_t num_producer = GENERATE(1, 3);
+        const size_t num_consumer = GENERATE(1, 4);
+        const size_t capacity = GENERATE(2, 64);
+        const size_t num_item = 20000;
+        Thread_Queue<size_t> queue(capacity);
+        std::vector<std::atomic<size_t>> seen(num_producer * num_item);
+        for (auto&& s : seen) s = 0;
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < num_producer; ++p)
+        {
+            threads.emplace_back([&, p]() {
+                std::vector<size_t> batch;
+                for (size_t i = 0; i < num_item; ++i)
+                {
+                    const size_t item = p * num_item + i;
+                    // mix single and batched pushes
+                    if (i % 3 == 0)
+                        queue.push(item, capacity);
+                    else
+                        batch.push_back(item);
+                    if (batch.size() == 5)
+                    {
+                        queue.push_batch(batch.begin(), batch.end());
+                        batch.clear();
+                    }
+                }
+                queue.push_batch(batch.begin(), batch.end());
+                queue.completed();
+            });
+        }
+        for (size_t c = 0; c < num_consumer; ++c)
+        {
+            threads.emplace_back([&, c]() {
+                if (c % 2 == 0)
+                {
+                    size_t item;
+                    while (!queue.pop(item, num_producer)) ++seen[item];
+                }
+                else
+                {
+                    std::vector<size_t> items;
+                    while (!queue.pop_batch(items, 7, num_producer))
+                    {
+                        for (auto&& item : items) ++seen[item];
+                    }
+                }
+            });
+        }
+        for (auto&& t : threads) t.join();
+        for (auto&& s : seen) REQUIRE(s == 1);
+    }
+    SECTION("back pressure")
+    {
+        Thread_Queue<size_t> queue(64);
+        const size_t max_process = 3;
+        std::atomic<bool> too_many {false};
+        std::thread producer([&]() {
+            for (size_t i = 0; i < 10000; ++i)
+            {
+                queue.push(i, max_process);
+                if (queue.num_processing() > max_process) too_many = true;
+            }
+            queue.completed();
+        });
+        size_t item, total = 0;
+        while (!queue.pop(item)) total += item;
+        producer.join();
+        REQUIRE_FALSE(too_many);
+        REQUIRE(total == 10000 * 9999 / 2);
+    }
+}
+
+namespace
+{
+// the mutex and condition variable based queue this queue replaced, kept
+// as the reference for the contention benchmark
+template <typename T>
+class Mutex_Queue
+{
+public:
+    bool pop(T& item, size_t num_thread)
+    {
+        std::unique_lock<std::mutex> mlock(m_mutex);
+        m_cond_not_empty.wait(mlock, [this, num_thread] {
+            return (m_storage_queue.size() || (m_num_completed == num_thread));
+        });
+        const bool done = m_storage_queue.empty();
+        if (!done)
+        {
+            item = std::move(m_storage_queue.front());
+            m_storage_queue.pop();
+        }
+        m_num_processing--;
+        mlock.unlock();
+        m_cond_not_full.notify_one();
+        return done;
+    }
+    void push(T&& item, size_t max_process)
+    {
+        std::unique_lock<std::mutex> mlock(m_mutex);
+        while (max_process <= m_num_processing) { m_cond_not_full.wait(mlock); }
+        m_storage_queue.push(std::move(item));
+        m_num_processing++;
+        mlock.unlock();
+        m_cond_not_empty.notify_one();
+    }
+    void completed()
+    {
+        std::unique_lock<std::mutex> mlock(m_mutex);
+        ++m_num_completed;
+        mlock.unlock();
+        m_cond_not_empty.notify_all();
+    }
+
+private:
+    std::queue<T> m_storage_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_not_empty;
+    std::condition_variable m_cond_not_full;
+    size_t m_num_processing = 0;
+    size_t m_num_completed = 0;
+};
+
+template <typename Queue>
+size_t run_contention(size_t num_producer, size_t num_consumer,
+                      size_t num_item, size_t max_process)
+{
+    Queue queue;
+    std::atomic<size_t> total {0};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < num_producer; ++p)
+    {
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < num_item; ++i)
+                queue.push(size_t(i), max_process);
+            queue.completed();
+        });
+    }
+    for (size_t c = 0; c < num_consumer; ++c)
+    {
+        threads.emplace_back([&]() {
+            size_t item, local = 0;
+            while (!queue.pop(item, num_producer)) local += item;
+            total += local;
+        });
+    }
+    for (auto&& t : threads) t.join();
+    return total;
+}
+} // namespace
+
+TEST_CASE("Thread queue contention benchmark", "[.benchmark]")
+{
+    // hidden from the default test run, use ./tests [benchmark] to run it
+    const size_t num_producer = GENERATE(1, 4);
+    const size_t num_consumer = GENERATE(1, 4, 8);
+    // the competitive permutation limits the queue to one item per consumer
+    const size_t max_process = GENERATE(0, 1024);
+    const size_t limit = max_process == 0 ? num_consumer : max_process;
+    const size_t num_item = 100000;
+    const std::string suffix =
+        " (" + std::to_string(num_producer) + " producer, "
+        + std::to_string(num_consumer) + " consumer, limit "
+        + std::to_string(limit) + ")";
+    BENCHMARK("mutex" + suffix)
+    {
+        return run_contention<Mutex_Queue<size_t>>(num_producer, num_consumer,
+                                                   num_item, limit);
+    };
+    BENCHMARK("lock free" + suffix)
+    {
+        return run_contention<Thread_Queue<size_t>>(
+            num_producer, num_consumer, num_item, limit);
+    };
+}
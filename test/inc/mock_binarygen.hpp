@@ -60,6 +60,10 @@ public:
         read_genotype(snp, sample_size, m_genotype_file, m_tmp_genotype.data(),
                       genotype, m_sample_for_ld.data(), is_ref);
     }
+    void test_read_dosage(const SNP& snp, uintptr_t* storage)
+    {
+        read_dosage(snp, m_genotype_file, storage, true);
+    }
     void set_hard_code(bool hard_coded) { m_hard_coded = hard_coded; }
     void test_read_genotype(uintptr_t* genotype, SNP& snp)
     {
@@ -135,8 +139,9 @@ public:
         // to do offset jump
         bgen_file->seekg(bytepos);
         // bgen_file->seekg(offset + 4);
+        auto [buffer1, buffer2] = decompress_buffer();
         genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
-            *bgen_file, m_context_map[cur_idx], setter, &m_buffer1, &m_buffer2);
+            *bgen_file, m_context_map[cur_idx], setter, buffer1, buffer2);
         AlleleCounts ct;
         setter.get_count(ct.homcom, ct.het, ct.homrar, ct.missing);
         double impute = setter.info_score(INFO::IMPUTE2);
@@ -273,6 +273,30 @@ public:
         return get_r2(founder_ctl2, founder_ctv2, window_data_ptr, index_data,
                       index_tots);
     }
+    std::vector<double>
+    test_get_r2_batch(const uintptr_t founder_ctl2,
+                      const uintptr_t founder_ctv2,
+                      const std::vector<uintptr_t*>& window_data,
+                      const std::vector<uintptr_t>& index_data,
+                      const std::vector<uintptr_t>& index_tots)
+    {
+        std::vector<uint32_t> counts;
+        std::vector<double> r2;
+        get_r2_batch(founder_ctl2, founder_ctv2, window_data, index_data,
+                     index_tots, counts, r2);
+        return r2;
+    }
+    std::vector<double>
+    test_get_dosage_r2_batch(const uintptr_t founder_ct,
+                             const uintptr_t* index_storage,
+                             const std::vector<uintptr_t*>& window_data)
+    {
+        std::vector<const float*> dosages;
+        std::vector<double> r2;
+        get_dosage_r2_batch(founder_ct, index_storage, window_data, dosages,
+                            r2);
+        return r2;
+    }
     void set_sample_vector(const std::vector<bool>& selected_samples)
     {
         m_unfiltered_sample_ct = selected_samples.size();
@@ -322,8 +346,13 @@ public:
         }
     }
     void set_very_small_thresholds() { m_very_small_thresholds = true; }
+    void set_score_stat(const double mean, const double sd)
+    {
+        m_mean_score = mean;
+        m_score_sd = sd;
+    }
     std::vector<uintptr_t>& std_exclusion_flag() { return m_exclude_from_std; }
-    void test_read_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
+    void test_read_prs(uintptr_t* genotype, PRS& prs_list,
                        const size_t ploidy, const double stat,
                        const double adj_score, const double miss_score,
                        const size_t miss_count, const double homcom_weight,
@@ -334,6 +363,98 @@ public:
                  miss_count, homcom_weight, het_weight, homrar_weight,
                  not_first);
     }
+    // the runtime dispatched scoring used before the kernels were templated,
+    // kept as the baseline of the scoring kernel benchmark
+    void legacy_update_prs(PRS& prs_list, const size_t sample_idx,
+                           const uint32_t geno,
+                           const std::vector<double>& scores,
+                           const std::vector<uint32_t>& counts)
+    {
+        prs_list.add(sample_idx, scores[geno], counts[geno]);
+    }
+    void legacy_initialize_prs(PRS& prs_list, const size_t sample_idx,
+                               const uint32_t geno,
+                               const std::vector<double>& scores,
+                               const std::vector<uint32_t>& counts)
+    {
+        prs_list.assign(sample_idx, scores[geno], counts[geno]);
+    }
+    void legacy_read_prs(uintptr_t* genotype, PRS& prs_list,
+                         const size_t ploidy, const double stat,
+                         const double adj_score, const double miss_score,
+                         const size_t miss_count, const double homcom_weight,
+                         const double het_weight, const double homrar_weight,
+                         const bool not_first)
+    {
+        std::vector<double> scores = {homcom_weight * stat - adj_score,
+                                      het_weight * stat - adj_score, miss_score,
+                                      homrar_weight * stat - adj_score};
+        const uint32_t ploidy_ct = static_cast<uint32_t>(ploidy);
+        std::vector<uint32_t> counts = {ploidy_ct, ploidy_ct,
+                                        static_cast<uint32_t>(miss_count),
+                                        ploidy_ct};
+        auto load_prs = not_first ? &mockGenotype::legacy_update_prs
+                                  : &mockGenotype::legacy_initialize_prs;
+        uintptr_t* lbptr = genotype;
+        uint32_t processed_samples = 0;
+        do
+        {
+            uintptr_t byte_block = ~(*lbptr++);
+            if (processed_samples + BITCT2 > m_unfiltered_sample_ct)
+            {
+                byte_block &=
+                    (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
+                    - ONELU;
+            }
+            uint32_t sample_idx = 0;
+            while (sample_idx < BITCT)
+            {
+                const uint32_t geno = (byte_block >> sample_idx) & 3;
+                if (processed_samples + (sample_idx / 2) >= m_sample_ct)
+                { break; }
+                (this->*load_prs)(prs_list,
+                                  processed_samples + (sample_idx / 2), geno,
+                                  scores, counts);
+                sample_idx += 2;
+            }
+            processed_samples += BITCT2;
+        } while (processed_samples < m_sample_ct);
+    }
+    double legacy_calculate_score(const PRS& prs_list, size_t i) const
+    {
+        if (i >= prs_list.size())
+            throw std::out_of_range("Sample name vector out of range");
+        const uint32_t num_snp = prs_list.num_snp(i);
+        double prs = prs_list.score(i);
+        double avg = prs;
+        if (num_snp == 0) { avg = 0.0; }
+        else
+        {
+            avg = prs / static_cast<double>(num_snp);
+        }
+        switch (m_prs_calculation.scoring_method)
+        {
+        case SCORING::SUM: return prs;
+        case SCORING::STANDARDIZE:
+        case SCORING::CONTROL_STD: return (avg - m_mean_score) / m_score_sd;
+        default: return avg;
+        }
+    }
+    void test_read_sparse_prs(uintptr_t* genotype, PRS& prs_list,
+                              const size_t ploidy, const double stat,
+                              const double adj_score, const double miss_score,
+                              const size_t miss_count,
+                              const double homcom_weight,
+                              const double het_weight,
+                              const double homrar_weight, const bool not_first)
+    {
+        double offset_score = 0;
+        size_t offset_count = 0;
+        read_sparse_prs(genotype, prs_list, ploidy, stat, adj_score,
+                        miss_score, miss_count, homcom_weight, het_weight,
+                        homrar_weight, not_first, offset_score, offset_count);
+        apply_prs_offset(prs_list, offset_score, offset_count);
+    }
     std::vector<int>& chr_id_col() { return m_chr_id_column; }
     std::vector<char>& chr_id_symbol() { return m_chr_id_symbol; }
     bool has_chr_formula() { return m_has_chr_id_formula; }
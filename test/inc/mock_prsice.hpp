@@ -2,6 +2,7 @@
 #define MOCK_PRSICE_HPP
 #include "catch.hpp"
 #include "prsice.hpp"
+#include <numeric>
 class mock_prsice : public PRSice
 {
 public:
@@ -53,6 +54,16 @@ public:
     {
         return load_pheno_map(delim, idx, ignore_fid, std::move(pheno_file));
     }
+    void test_fisher_yates(std::vector<size_t>& idx, Philox& g, size_t n,
+                           std::vector<size_t>& swapped)
+    {
+        fisher_yates(idx, g, n, swapped);
+    }
+    void test_undo_fisher_yates(std::vector<size_t>& idx,
+                                const std::vector<size_t>& swapped)
+    {
+        undo_fisher_yates(idx, swapped);
+    }
     void test_parse_pheno(const std::string& pheno,
                           std::vector<double>& pheno_store, int& max_pheno_code)
     {
@@ -160,6 +171,29 @@ public:
                                      std::move(cov_file));
     }
     Eigen::MatrixXd& get_independent() { return m_independent_variables; }
+    void set_regression(const Eigen::VectorXd& phenotype,
+                        const Eigen::MatrixXd& independent)
+    {
+        m_phenotype = phenotype;
+        m_independent_variables = independent;
+        m_matrix_index.resize(static_cast<size_t>(phenotype.rows()));
+        std::iota(m_matrix_index.begin(), m_matrix_index.end(), 0);
+    }
+    // add the observed result of a set, with an absolute t of obs_t
+    void add_set(const std::string& name, const size_t num_snp,
+                 const double obs_t)
+    {
+        m_prs_summary.emplace_back(
+            prsice_result(1.0, 0, 0, obs_t, 0.5, -1, 1.0, -1, num_snp), name,
+            false);
+    }
+    std::vector<double> competitive_p() const
+    {
+        std::vector<double> res;
+        for (auto&& summary : m_prs_summary)
+        { res.push_back(summary.result.competitive_p); }
+        return res;
+    }
     void init_independent(size_t sample, size_t col)
     {
         m_independent_variables = Eigen::MatrixXd::Zero(
@@ -0,0 +1,22 @@
+#ifndef POOL_GUARD_HPP
+#define POOL_GUARD_HPP
+#include "thread_pool.hpp"
+#include <cstddef>
+
+/*!
+ * \brief Size the global thread pool the same way main does for --thread,
+ * and restore it to no workers when the guard goes out of scope, even when a
+ * REQUIRE fails half way through a section
+ */
+class PoolGuard
+{
+public:
+    explicit PoolGuard(const size_t threads)
+    {
+        ThreadPool::global().resize(threads > 1 ? threads : 0);
+    }
+    PoolGuard(const PoolGuard&) = delete;
+    PoolGuard& operator=(const PoolGuard&) = delete;
+    ~PoolGuard() { ThreadPool::global().resize(0); }
+};
+#endif // POOL_GUARD_HPP